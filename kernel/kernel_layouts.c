@@ -0,0 +1,403 @@
+#include "kernel_layouts.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "platform.h"
+#include "platform_match.h"
+
+// ---- Layout descriptions -----------------------------------------------------------------------
+
+// Structs whose layout is the same on every supported build.
+static const char layouts__common[] =
+	"struct zone 0x140\n"
+	"	elem_size		0xf0	u64\n"
+	"	zone_name		0x120	str\n"
+	"struct zone_page_metadata 0x18\n"
+	"	zindex			0x14	u16\n"
+	"	page_count		0x16	u16\n"
+	"struct ipc_entry 0x18\n"
+	"	ie_object		0x0	ptr ipc_port\n"
+	"	ie_bits			0x8	u32\n"
+	"	ie_index		0xc	u32\n"
+	"struct ipc_space\n"
+	"	is_table_size		0x14	u32\n"
+	"	is_table		0x20	ptr ipc_entry\n"
+	"struct ipc_port\n"
+	"	io_bits			0x0	u32\n"
+	"	io_references		0x4	u32\n"
+	"	ip_kobject		0x68	ptr\n";
+
+static const char layouts__iphone10_1__16C101[] =
+	"struct proc\n"
+	"	p_list_next		0x0	ptr proc\n"
+	"	p_list_prev		0x8	ptr\n"
+	"	task			0x10	ptr task\n"
+	"	p_pid			0x60	i32\n"
+	"	p_ucred			0xf8	ptr\n"
+	"struct task\n"
+	"	itk_space		0x300	ptr ipc_space\n"
+	"	bsd_info		0x358	ptr proc\n";
+
+static const char layouts__iphone10_1__17B102[] =
+	"struct proc\n"
+	"	p_list_next		0x0	ptr proc\n"
+	"	p_list_prev		0x8	ptr\n"
+	"	task			0x10	ptr task\n"
+	"	p_pid			0x68	i32\n"
+	"	p_ucred			0x100	ptr\n"
+	"struct task\n"
+	"	itk_space		0x320	ptr ipc_space\n"
+	"	bsd_info		0x380	ptr proc\n";
+
+static const char layouts__iphone8_4__17G68[] =
+	"struct proc\n"
+	"	p_list_next		0x0	ptr proc\n"
+	"	p_list_prev		0x8	ptr\n"
+	"	task			0x10	ptr task\n"
+	"	p_pid			0x68	i32\n"
+	"	p_ucred			0x100	ptr\n"
+	"struct task\n"
+	"	itk_space		0x320	ptr ipc_space\n"
+	"	bsd_info		0x388	ptr proc\n";
+
+// The maximum number of descriptions that can apply to one platform.
+#define MAX_DESCRIPTIONS	4
+
+// The descriptions selected for this platform.
+static const char *descriptions[MAX_DESCRIPTIONS];
+static size_t description_count;
+
+static void
+add_description(const char *description) {
+	if (description_count < MAX_DESCRIPTIONS) {
+		descriptions[description_count++] = description;
+	}
+}
+
+static void
+layouts__all() {
+	add_description(layouts__common);
+}
+
+static void
+layouts__a11_16C101() {
+	add_description(layouts__iphone10_1__16C101);
+}
+
+static void
+layouts__a11_17B102() {
+	add_description(layouts__iphone10_1__17B102);
+}
+
+static void
+layouts__a9_17G68() {
+	add_description(layouts__iphone8_4__17G68);
+}
+
+static struct platform_initialization layout_descriptions[] = {
+	{ "*",                     NULL,           layouts__all        },
+	{ "iPhone10,1",            "16C101-16G77", layouts__a11_16C101 },
+	{ "iPhone10,6",            "16E227",       layouts__a11_16C101 },
+	{ "iPhone10,1|iPhone10,4", "17B102-17C54", layouts__a11_17B102 },
+	{ "iPhone8,4",             "17G68",        layouts__a9_17G68   },
+};
+
+// ---- Compilation -------------------------------------------------------------------------------
+
+// The maximum nesting of inline structs.
+#define MAX_LAYOUT_NESTING	8
+
+// The compiled layouts.
+static struct kernel_layout *layouts;
+static size_t layout_count;
+
+// The type names of the fields of each layout, in the same order as the fields, until they are
+// resolved.
+static char (**field_types)[32];
+
+/*
+ * layout_lookup
+ *
+ * Description:
+ * 	Find a layout by name among the layouts parsed so far.
+ */
+static struct kernel_layout *
+layout_lookup(const char *name) {
+	for (size_t i = 0; i < layout_count; i++) {
+		if (strcmp(layouts[i].name, name) == 0) {
+			return &layouts[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * parse_type
+ *
+ * Description:
+ * 	Parse the type of a field. Struct type names are stored to be resolved once all the
+ * 	descriptions have been parsed.
+ */
+static bool
+parse_type(const char *type, struct layout_field *field, char *type_name) {
+	static const struct {
+		const char *name;
+		uint8_t kind;
+		uint8_t width;
+	} scalars[] = {
+		{ "u8",  LAYOUT_UINT, 1 }, { "u16", LAYOUT_UINT, 2 },
+		{ "u32", LAYOUT_UINT, 4 }, { "u64", LAYOUT_UINT, 8 },
+		{ "i8",  LAYOUT_INT,  1 }, { "i16", LAYOUT_INT,  2 },
+		{ "i32", LAYOUT_INT,  4 }, { "i64", LAYOUT_INT,  8 },
+		{ "ptr", LAYOUT_PTR,  8 }, { "str", LAYOUT_STRING_PTR, 8 },
+	};
+	type_name[0] = 0;
+	field->count = 1;
+	field->type = NULL;
+	// A pointer to a struct.
+	if (strncmp(type, "ptr ", 4) == 0 && sscanf(type + 4, "%31s", type_name) == 1) {
+		field->kind = LAYOUT_STRUCT_PTR;
+		field->width = 8;
+		field->stride = 8;
+		return true;
+	}
+	// An optional array count.
+	char base[32];
+	unsigned count = 1;
+	char close = 0;
+	int matched = sscanf(type, "%31[^[ ][%u%c", base, &count, &close);
+	bool array = (strchr(type, '[') != NULL);
+	if (matched < 1 || (array && (matched != 3 || close != ']')) || count == 0) {
+		return false;
+	}
+	field->count = count;
+	if (strcmp(base, "char") == 0) {
+		field->kind = LAYOUT_CHARS;
+		field->width = 1;
+		field->stride = 1;
+		return true;
+	}
+	for (size_t i = 0; i < sizeof(scalars) / sizeof(scalars[0]); i++) {
+		if (strcmp(base, scalars[i].name) == 0) {
+			field->kind = scalars[i].kind;
+			field->width = scalars[i].width;
+			field->stride = scalars[i].width;
+			return true;
+		}
+	}
+	// An inline struct. The stride is set once the struct's size is known.
+	field->kind = LAYOUT_STRUCT;
+	field->width = 0;
+	field->stride = 0;
+	snprintf(type_name, 32, "%s", base);
+	return true;
+}
+
+/*
+ * parse_description
+ *
+ * Description:
+ * 	Parse one layout description, adding its structs to the layouts.
+ */
+static bool
+parse_description(const char *description) {
+	struct kernel_layout *layout = NULL;
+	size_t line_number = 0;
+	char text[128];
+	for (const char *line = description; *line != 0;) {
+		const char *line_end = strchr(line, '\n');
+		if (line_end == NULL) {
+			line_end = line + strlen(line);
+		}
+		snprintf(text, sizeof(text), "%.*s", (int) (line_end - line), line);
+		line = (*line_end == '\n' ? line_end + 1 : line_end);
+		line_number++;
+		const char *p = text;
+		while (isspace((unsigned char) *p)) {
+			p++;
+		}
+		if (*p == 0 || *p == '#') {
+			continue;
+		}
+		char name[32];
+		char type[64];
+		unsigned long long value = 0;
+		if (strncmp(p, "struct ", 7) == 0) {
+			int matched = sscanf(p, "struct %31s %lli", name, &value);
+			if (matched < 1) {
+				goto bad_line;
+			}
+			if (layout_lookup(name) != NULL) {
+				ERROR("struct %s is described twice", name);
+				return false;
+			}
+			struct kernel_layout *grown = realloc(layouts,
+					(layout_count + 1) * sizeof(*grown));
+			char (**grown_types)[32] = realloc(field_types,
+					(layout_count + 1) * sizeof(*grown_types));
+			if (grown == NULL || grown_types == NULL) {
+				layouts = (grown != NULL ? grown : layouts);
+				field_types = (grown_types != NULL ? grown_types : field_types);
+				ERROR("Could not allocate struct layouts");
+				return false;
+			}
+			layouts = grown;
+			field_types = grown_types;
+			layout = &layouts[layout_count];
+			field_types[layout_count] = NULL;
+			layout_count++;
+			memset(layout, 0, sizeof(*layout));
+			snprintf(layout->name, sizeof(layout->name), "%s", name);
+			layout->size = value;
+			continue;
+		}
+		if (layout == NULL) {
+			goto bad_line;
+		}
+		if (sscanf(p, "%31s %lli %63[^\n]", name, &value, type) != 3) {
+			goto bad_line;
+		}
+		struct layout_field field = {};
+		char type_name[32];
+		if (!parse_type(type, &field, type_name)) {
+			goto bad_line;
+		}
+		snprintf(field.name, sizeof(field.name), "%s", name);
+		field.offset = value;
+		size_t index = layout - layouts;
+		struct layout_field *fields = realloc(layout->fields,
+				(layout->field_count + 1) * sizeof(*fields));
+		char (*types)[32] = realloc(field_types[index],
+				(layout->field_count + 1) * sizeof(*types));
+		if (fields == NULL || types == NULL) {
+			layout->fields = (fields != NULL ? fields : layout->fields);
+			field_types[index] = (types != NULL ? types : field_types[index]);
+			ERROR("Could not allocate struct layouts");
+			return false;
+		}
+		layout->fields = fields;
+		field_types[index] = types;
+		fields[layout->field_count] = field;
+		snprintf(types[layout->field_count], sizeof(types[0]), "%s", type_name);
+		layout->field_count++;
+	}
+	return true;
+bad_line:
+	ERROR("Bad struct layout line %zu: %s", line_number, text);
+	return false;
+}
+
+/*
+ * resolve_layout
+ *
+ * Description:
+ * 	Resolve the struct types of a layout's fields and compute its size. Inline structs are
+ * 	resolved first, since their size sets the stride of the fields that contain them.
+ */
+static bool
+resolve_layout(size_t index, unsigned nesting) {
+	struct kernel_layout *layout = &layouts[index];
+	if (field_types[index] == NULL) {
+		return true;
+	}
+	if (nesting > MAX_LAYOUT_NESTING) {
+		ERROR("struct %s contains itself or nests too deeply", layout->name);
+		return false;
+	}
+	size_t end = 0;
+	for (size_t i = 0; i < layout->field_count; i++) {
+		struct layout_field *field = &layout->fields[i];
+		const char *type_name = field_types[index][i];
+		if (type_name[0] != 0) {
+			const struct kernel_layout *type = layout_lookup(type_name);
+			if (type == NULL) {
+				ERROR("struct %s field %s has unknown type %s", layout->name,
+						field->name, type_name);
+				return false;
+			}
+			field->type = type;
+			if (field->kind == LAYOUT_STRUCT) {
+				if (!resolve_layout(type - layouts, nesting + 1)) {
+					return false;
+				}
+				field->stride = type->size;
+			}
+		}
+		size_t field_end = field->offset + (size_t) field->count * field->stride;
+		end = (field_end > end ? field_end : end);
+	}
+	if (layout->size == 0) {
+		layout->size = end;
+	} else if (end > layout->size) {
+		ERROR("struct %s has fields past its size 0x%zx", layout->name, layout->size);
+		return false;
+	}
+	free(field_types[index]);
+	field_types[index] = NULL;
+	return true;
+}
+
+static int
+compare_fields(const void *a, const void *b) {
+	const struct layout_field *x = a;
+	const struct layout_field *y = b;
+	return (x->offset < y->offset ? -1 : x->offset > y->offset);
+}
+
+// ---- Public API --------------------------------------------------------------------------------
+
+#define ARRAY_COUNT(x)	(sizeof(x) / sizeof((x)[0]))
+
+bool
+kernel_layouts_init() {
+	// Only run once.
+	static bool initialized = false;
+	static bool failed = false;
+	if (initialized || failed) {
+		return initialized;
+	}
+	failed = true;
+	platform_init();
+	run_platform_initializations(layout_descriptions, ARRAY_COUNT(layout_descriptions));
+	for (size_t i = 0; i < description_count; i++) {
+		if (!parse_description(descriptions[i])) {
+			return false;
+		}
+	}
+	for (size_t i = 0; i < layout_count; i++) {
+		if (!resolve_layout(i, 0)) {
+			return false;
+		}
+	}
+	for (size_t i = 0; i < layout_count; i++) {
+		qsort(layouts[i].fields, layouts[i].field_count, sizeof(*layouts[i].fields),
+				compare_fields);
+	}
+	free(field_types);
+	field_types = NULL;
+	failed = false;
+	initialized = true;
+	return true;
+}
+
+const struct kernel_layout *
+kernel_layout_find(const char *name) {
+	if (!kernel_layouts_init()) {
+		return NULL;
+	}
+	return layout_lookup(name);
+}
+
+const struct layout_field *
+kernel_layout_field(const struct kernel_layout *layout, const char *name) {
+	for (size_t i = 0; i < layout->field_count; i++) {
+		if (strcmp(layout->fields[i].name, name) == 0) {
+			return &layout->fields[i];
+		}
+	}
+	return NULL;
+}
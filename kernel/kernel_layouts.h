@@ -0,0 +1,149 @@
+#ifndef KERNEL_LAYOUTS__H_
+#define KERNEL_LAYOUTS__H_
+/*
+ * Kernel struct layouts.
+ *
+ * Struct layouts are described in a small text format, one description per group of devices
+ * and builds, selected with platform_matches(). Each struct starts with a header line and is
+ * followed by one indented line per field:
+ *
+ * 	struct <name> [<size>]
+ * 		<field> <offset> <type>
+ *
+ * The size defaults to the end of the last field. A type is one of:
+ *
+ * 	u8, u16, u32, u64	Unsigned integers.
+ * 	i8, i16, i32, i64	Signed integers.
+ * 	ptr			A pointer.
+ * 	ptr <struct>		A pointer to a struct, which can be followed.
+ * 	str			A pointer to a NUL-terminated string.
+ * 	char[N]			An inline string.
+ * 	<struct>		An inline struct.
+ *
+ * Any type except ptr <struct> and str may be followed by [N] to make an inline array. Lines
+ * starting with # are comments.
+ *
+ * The descriptions are compiled into field tables once, when the layouts are first used, so
+ * that decoding a struct is a walk over an array of fields.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * enum layout_kind
+ *
+ * Description:
+ * 	How a field is decoded.
+ */
+enum layout_kind {
+	LAYOUT_UINT,
+	LAYOUT_INT,
+	LAYOUT_PTR,
+	LAYOUT_STRUCT_PTR,
+	LAYOUT_STRING_PTR,
+	LAYOUT_CHARS,
+	LAYOUT_STRUCT,
+};
+
+struct kernel_layout;
+
+/*
+ * struct layout_field
+ *
+ * Description:
+ * 	A compiled field. Arrays have count elements, each stride bytes apart. type is the
+ * 	struct of LAYOUT_STRUCT and LAYOUT_STRUCT_PTR fields.
+ */
+struct layout_field {
+	char name[32];
+	uint32_t offset;
+	uint32_t count;
+	uint32_t stride;
+	uint8_t kind;
+	uint8_t width;
+	const struct kernel_layout *type;
+};
+
+/*
+ * struct kernel_layout
+ *
+ * Description:
+ * 	A compiled struct layout. The fields are sorted by offset.
+ */
+struct kernel_layout {
+	char name[32];
+	size_t size;
+	struct layout_field *fields;
+	size_t field_count;
+};
+
+/*
+ * kernel_layouts_init
+ *
+ * Description:
+ * 	Compile the struct layouts for this platform. Only the first call does any work.
+ *
+ * Returns:
+ * 	True if the layout descriptions compiled.
+ */
+bool kernel_layouts_init(void);
+
+/*
+ * kernel_layout_find
+ *
+ * Description:
+ * 	Find a struct layout by name, compiling the layouts if needed.
+ *
+ * Returns:
+ * 	The layout, or NULL if there is no struct with that name for this platform.
+ */
+const struct kernel_layout *kernel_layout_find(const char *name);
+
+/*
+ * kernel_layout_field
+ *
+ * Description:
+ * 	Find a field of a struct by name.
+ *
+ * Returns:
+ * 	The field, or NULL if the struct has no field with that name.
+ */
+const struct layout_field *kernel_layout_field(const struct kernel_layout *layout,
+		const char *name);
+
+/*
+ * layout_field_value
+ *
+ * Description:
+ * 	Decode element index of an integer or pointer field of the struct at data. Signed
+ * 	integers are sign-extended.
+ */
+static inline uint64_t
+layout_field_value(const struct layout_field *field, const void *data, size_t index) {
+	const uint8_t *p = (const uint8_t *) data + field->offset + index * field->stride;
+	switch (field->width) {
+		case 1: {
+			uint8_t v = *p;
+			return (field->kind == LAYOUT_INT ? (uint64_t)(int8_t) v : v);
+		}
+		case 2: {
+			uint16_t v;
+			__builtin_memcpy(&v, p, sizeof(v));
+			return (field->kind == LAYOUT_INT ? (uint64_t)(int16_t) v : v);
+		}
+		case 4: {
+			uint32_t v;
+			__builtin_memcpy(&v, p, sizeof(v));
+			return (field->kind == LAYOUT_INT ? (uint64_t)(int32_t) v : v);
+		}
+		default: {
+			uint64_t v;
+			__builtin_memcpy(&v, p, sizeof(v));
+			return v;
+		}
+	}
+}
+
+#endif
@@ -93,8 +93,10 @@ kernel_read(uint64_t address, void *data, size_t size) {
 	kern_return_t kr = mach_vm_read_overwrite(kernel_task_port, address,
 			size, (mach_vm_address_t) data, &size_out);
 	if (kr != KERN_SUCCESS) {
-		ERROR("%s returned %d: %s", "mach_vm_read_overwrite", kr, mach_error_string(kr));
-		ERROR("could not %s address 0x%016llx", "read", address);
+		// Log one message per failure so that a scan across unmapped memory forms a single
+		// run for the logger to rate-limit.
+		ERROR("could not %s address 0x%016llx: %s returned %d: %s", "read", address,
+				"mach_vm_read_overwrite", kr, mach_error_string(kr));
 		return false;
 	}
 	if (size_out != size) {
@@ -116,8 +118,8 @@ kernel_write(uint64_t address, const void *data, size_t size) {
 		kern_return_t kr = mach_vm_write(kernel_task_port, address,
 				(mach_vm_address_t) write_data, (mach_msg_size_t) write_size);
 		if (kr != KERN_SUCCESS) {
-			ERROR("%s returned %d: %s", "mach_vm_write", kr, mach_error_string(kr));
-			ERROR("could not %s address 0x%016llx", "write", address);
+			ERROR("could not %s address 0x%016llx: %s returned %d: %s", "write",
+					address, "mach_vm_write", kr, mach_error_string(kr));
 			return false;
 		}
 		address += write_size;
@@ -158,6 +158,40 @@ bool kernel_write64(uint64_t address, uint64_t value);
 bool kernel_ipc_port_lookup(uint64_t task, mach_port_name_t port_name,
 		uint64_t *ipc_port, uint64_t *ipc_entry);
 
+/*
+ * struct kernel_ipc_entry
+ *
+ * Description:
+ * 	A decoded entry in an ipc_space's is_table. type holds the MACH_PORT_TYPE_* rights bits.
+ */
+struct kernel_ipc_entry {
+	uint64_t object;
+	mach_port_name_t name;
+	mach_port_type_t type;
+	uint32_t urefs;
+};
+
+/*
+ * kernel_ipc_space_entries
+ *
+ * Description:
+ * 	Read an ipc_space's whole is_table in page-sized chunks and decode the entries that are in
+ * 	use.
+ *
+ * Parameters:
+ * 		ipc_space		The address of the ipc_space.
+ * 		check			If not NULL, called on the ipc_space and on each chunk of
+ * 					the table before it is read. The read fails if it returns
+ * 					false.
+ * 	out	entries			On return, the entries. The caller frees the array.
+ * 	out	count			On return, the number of entries.
+ *
+ * Returns:
+ * 	True if the table was read.
+ */
+bool kernel_ipc_space_entries(uint64_t ipc_space, bool (*check)(uint64_t, size_t),
+		struct kernel_ipc_entry **entries, size_t *count);
+
 #undef extern
 
 #endif
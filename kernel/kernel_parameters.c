@@ -20,64 +20,71 @@
 #define KERNEL_PARAMETERS_EXTERN PARAMETER_SHARED
 #include "kernel_parameters.h"
 
+#include "kernel_layouts.h"
 #include "kernel_slide.h"
 #include "log.h"
 #include "platform_match.h"
 
 // ---- Offset initialization ---------------------------------------------------------------------
 
+// The struct offsets are not set here: they come from the layouts in kernel_layouts.c, so that
+// each offset is written down once.
 static void
-offsets__iphone10_1__16C101() {
+offsets__a9_a11() {
 	kernel_slide_step                       = 0x4000;
-	SIZE(ipc_entry)                         = 0x18;
-	OFFSET(ipc_entry, ie_object)            = 0;
-	OFFSET(ipc_space, is_table_size)        = 0x14;
-	OFFSET(ipc_space, is_table)             = 0x20;
-	OFFSET(proc, p_list_next)               = 0;
-	OFFSET(proc, task)                      = 0x10;
-	OFFSET(proc, p_pid)                     = 0x60;
-	OFFSET(task, itk_space)                 = 0x300;
-	OFFSET(task, bsd_info)                  = 0x358;
 	STATIC_ADDRESS(kernel_base)             = 0xFFFFFFF007004000;
 }
 
-static void
-offsets__iphone10_1__17B102() {
-	kernel_slide_step                       = 0x4000;
-	SIZE(ipc_entry)                         = 0x18;
-	OFFSET(ipc_entry, ie_object)            = 0;
-	OFFSET(ipc_space, is_table_size)        = 0x14;
-	OFFSET(ipc_space, is_table)             = 0x20;
-	OFFSET(proc, p_list_next)               = 0;
-	OFFSET(proc, task)                      = 0x10;
-	OFFSET(proc, p_pid)                     = 0x68;
-	OFFSET(task, itk_space)                 = 0x320;
-	OFFSET(task, bsd_info)                  = 0x380;
-	STATIC_ADDRESS(kernel_base)             = 0xFFFFFFF007004000;
-}
+static struct platform_initialization offsets[] = {
+	{ "iPhone10,1",            "16C101-16G77", offsets__a9_a11 },
+	{ "iPhone10,6",            "16E227",       offsets__a9_a11 },
+	{ "iPhone10,1|iPhone10,4", "17B102-17C54", offsets__a9_a11 },
+	{ "iPhone8,4",             "17G68",        offsets__a9_a11 },
+};
 
-static void 
-offsets__iphone8_4__17G68(){
-	kernel_slide_step                       = 0x4000;
-	SIZE(ipc_entry)                         = 0x18;
-	OFFSET(ipc_entry, ie_object)            = 0;
-	OFFSET(ipc_space, is_table_size)        = 0x14;
-	OFFSET(ipc_space, is_table)             = 0x20;
-	OFFSET(proc, p_list_next)               = 0;
-	OFFSET(proc, task)                      = 0x10;
-	OFFSET(proc, p_pid)                     = 0x68;
-	OFFSET(task, itk_space)                 = 0x320;
-	OFFSET(task, bsd_info)                  = 0x388; //0x380;
-	STATIC_ADDRESS(kernel_base)             = 0xFFFFFFF007004000;
-}
+// A struct size or field offset parameter and the layout it is taken from. A NULL field stands
+// for the size of the struct.
+struct layout_parameter {
+	const char *type;
+	const char *field;
+	size_t *value;
+};
 
-static struct platform_initialization offsets[] = {
-	{ "iPhone10,1",            "16C101-16G77", offsets__iphone10_1__16C101 },
-	{ "iPhone10,6",            "16E227",       offsets__iphone10_1__16C101 },
-	{ "iPhone10,1|iPhone10,4", "17B102-17C54", offsets__iphone10_1__17B102 },
-	{ "iPhone8,4",			   "17G68",		   offsets__iphone8_4__17G68   },
+static struct layout_parameter layout_parameters[] = {
+	{ "ipc_entry", NULL,            &SIZE(ipc_entry)                  },
+	{ "ipc_entry", "ie_object",     &OFFSET(ipc_entry, ie_object)     },
+	{ "ipc_entry", "ie_bits",       &OFFSET(ipc_entry, ie_bits)       },
+	{ "ipc_space", "is_table_size", &OFFSET(ipc_space, is_table_size) },
+	{ "ipc_space", "is_table",      &OFFSET(ipc_space, is_table)      },
+	{ "proc",      "p_list_next",   &OFFSET(proc, p_list_next)        },
+	{ "proc",      "task",          &OFFSET(proc, task)               },
+	{ "proc",      "p_pid",         &OFFSET(proc, p_pid)              },
+	{ "task",      "itk_space",     &OFFSET(task, itk_space)          },
+	{ "task",      "bsd_info",      &OFFSET(task, bsd_info)           },
 };
 
+// Set the struct sizes and field offsets from the kernel layouts.
+static bool
+init_layout_parameters(struct layout_parameter *parameters, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		const struct layout_parameter *parameter = &parameters[i];
+		const struct kernel_layout *layout = kernel_layout_find(parameter->type);
+		const struct layout_field *field = NULL;
+		if (layout != NULL && parameter->field != NULL) {
+			field = kernel_layout_field(layout, parameter->field);
+		}
+		if (layout == NULL || (parameter->field != NULL && field == NULL)) {
+			ERROR("No kernel layout for %s%s%s on %s %s", parameter->type,
+					(parameter->field != NULL ? "." : ""),
+					(parameter->field != NULL ? parameter->field : ""),
+					platform.machine, platform.osversion);
+			return false;
+		}
+		*parameter->value = (field != NULL ? field->offset : layout->size);
+	}
+	return true;
+}
+
 // ---- Address initialization --------------------------------------------------------------------
 
 static void
@@ -138,6 +145,9 @@ kernel_parameters_init() {
 		ERROR("No kernel %s for %s %s", "offsets", platform.machine, platform.osversion);
 		return false;
 	}
+	if (!init_layout_parameters(layout_parameters, ARRAY_COUNT(layout_parameters))) {
+		return false;
+	}
 	// Initialize addresses.
 	count = run_platform_initializations(addresses, ARRAY_COUNT(addresses));
 	if (count < 1) {
@@ -35,6 +35,7 @@ extern uint64_t kernel_slide_step;
 // Parameters for struct ipc_entry.
 extern size_t SIZE(ipc_entry);
 extern size_t OFFSET(ipc_entry, ie_object);
+extern size_t OFFSET(ipc_entry, ie_bits);
 
 // Parameters for struct ipc_port.
 extern size_t OFFSET(ipc_port, ip_kobject);
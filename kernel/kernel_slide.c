@@ -21,7 +21,15 @@
 #include "kernel_slide.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <mach-o/loader.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysctl.h>
+#include <unistd.h>
 
 #include "kernel_memory.h"
 #include "kernel_parameters.h"
@@ -51,10 +59,192 @@ is_kernel_base(uint64_t base) {
 	return true;
 }
 
+// The private directory holding the kernel slide cache, and the name of the file in which the
+// kernel slide found during this boot session is cached.
+#define SLIDE_CACHE_DIRECTORY	"/tmp/seokview"
+#define SLIDE_CACHE_NAME	"slide_cache"
+
+// The size of each read when scanning backwards for the kernel base.
+#define BASE_SCAN_CHUNK_SIZE	0x100000
+
+// Get a string identifying the current boot session: kern.bootsessionuuid if available, or else
+// kern.boottime.
+static bool
+boot_session_key(char *key, size_t size) {
+	size_t length = size;
+	if (sysctlbyname("kern.bootsessionuuid", key, &length, NULL, 0) == 0 && length > 1) {
+		key[size - 1] = 0;
+		return true;
+	}
+	struct timeval boottime;
+	length = sizeof(boottime);
+	if (sysctlbyname("kern.boottime", &boottime, &length, NULL, 0) != 0) {
+		return false;
+	}
+	snprintf(key, size, "%ld.%06d", (long) boottime.tv_sec, (int) boottime.tv_usec);
+	return true;
+}
+
+// Check that a cache file or directory belongs to this user and that no one else can write to
+// it. A directory must not be readable by others either.
+static bool
+slide_cache_is_private(int fd, bool directory) {
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		return false;
+	}
+	mode_t type = (directory ? S_IFDIR : S_IFREG);
+	mode_t others = (directory ? (S_IRWXG | S_IRWXO) : (S_IWGRP | S_IWOTH));
+	if ((st.st_mode & S_IFMT) != type || st.st_uid != geteuid()
+			|| (st.st_mode & others) != 0) {
+		WARNING("Ignoring the kernel slide cache in %s: it is not private",
+				SLIDE_CACHE_DIRECTORY);
+		return false;
+	}
+	return true;
+}
+
+// Open the slide cache directory, creating it with mode 0700 if asked. A symbolic link or a
+// directory that someone else could have planted is rejected.
+static int
+open_slide_cache_directory(bool create) {
+	if (create && mkdir(SLIDE_CACHE_DIRECTORY, 0700) != 0 && errno != EEXIST) {
+		return -1;
+	}
+	int fd = open(SLIDE_CACHE_DIRECTORY, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+	if (fd >= 0 && !slide_cache_is_private(fd, true)) {
+		close(fd);
+		fd = -1;
+	}
+	return fd;
+}
+
+// Read the kernel slide cached during this boot session for this kernel build. A cached slide is
+// only used if the cache is private and the kernel base it implies passes the Mach-O header
+// check.
+static bool
+load_cached_kernel_slide() {
+	char boot[64];
+	if (!boot_session_key(boot, sizeof(boot))) {
+		return false;
+	}
+	int directory = open_slide_cache_directory(false);
+	if (directory < 0) {
+		return false;
+	}
+	int fd = openat(directory, SLIDE_CACHE_NAME, O_RDONLY | O_NOFOLLOW);
+	close(directory);
+	if (fd < 0) {
+		return false;
+	}
+	FILE *file = NULL;
+	if (!slide_cache_is_private(fd, false) || (file = fdopen(fd, "r")) == NULL) {
+		close(fd);
+		return false;
+	}
+	char cached_boot[64] = {};
+	char cached_machine[32] = {};
+	char cached_build[32] = {};
+	unsigned long long slide = 0;
+	unsigned long long base = 0;
+	int fields = fscanf(file, "boot %63s\nmachine %31s\nbuild %31s\nslide %llx\nbase %llx\n",
+			cached_boot, cached_machine, cached_build, &slide, &base);
+	fclose(file);
+	if (fields != 5
+			|| strcmp(cached_boot, boot) != 0
+			|| strcmp(cached_machine, platform.machine) != 0
+			|| strcmp(cached_build, platform.osversion) != 0
+			|| base != STATIC_ADDRESS(kernel_base) + slide
+			|| !is_kernel_base(base)) {
+		return false;
+	}
+	kernel_slide = slide;
+	INFO("KASLR slide is 0x%llx (cached)", kernel_slide);
+	return true;
+}
+
+// Cache the kernel slide for later launches during this boot session. The file is written to a
+// new temporary file in the private cache directory and renamed over the cache, so that a
+// concurrent launch never reads a partial cache and no existing file is ever written through.
+static void
+store_cached_kernel_slide() {
+	char boot[64];
+	if (!boot_session_key(boot, sizeof(boot))) {
+		return;
+	}
+	int directory = open_slide_cache_directory(true);
+	if (directory < 0) {
+		return;
+	}
+	char temporary[32];
+	snprintf(temporary, sizeof(temporary), SLIDE_CACHE_NAME ".%d", (int) getpid());
+	int fd = openat(directory, temporary, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+	FILE *file = (fd >= 0 ? fdopen(fd, "w") : NULL);
+	if (file == NULL) {
+		if (fd >= 0) {
+			close(fd);
+			unlinkat(directory, temporary, 0);
+		}
+		goto out;
+	}
+	fprintf(file, "boot %s\nmachine %s\nbuild %s\nslide 0x%llx\nbase 0x%llx\n", boot,
+			platform.machine, platform.osversion, kernel_slide,
+			STATIC_ADDRESS(kernel_base) + kernel_slide);
+	bool ok = (fclose(file) == 0);
+	if (!ok || renameat(directory, temporary, directory, SLIDE_CACHE_NAME) != 0) {
+		unlinkat(directory, temporary, 0);
+	}
+out:
+	close(directory);
+}
+
 // Call this once the kernel slide has been set up.
 static void
 did_set_kernel_slide() {
 	INFO("KASLR slide is 0x%llx", kernel_slide);
+	store_cached_kernel_slide();
+}
+
+// Walk backwards from start to the static kernel base one step at a time until we find the
+// kernel base. The candidates are read in large chunks and only those that start with
+// MH_MAGIC_64 get the full header check. If a chunk cannot be read in one piece, its candidates
+// are checked one at a time.
+static bool
+find_kernel_base_backwards(uint64_t start, uint64_t step, uint64_t *base) {
+	const uint64_t end = STATIC_ADDRESS(kernel_base);
+	assert(step > 0 && step <= BASE_SCAN_CHUNK_SIZE && BASE_SCAN_CHUNK_SIZE % step == 0);
+	uint8_t *chunk = malloc(BASE_SCAN_CHUNK_SIZE);
+	bool found = false;
+	uint64_t high = start;
+	while (!found && high >= end) {
+		// The candidates in this chunk are high, high - step, ..., down to low.
+		uint64_t low = end;
+		if (high - end >= BASE_SCAN_CHUNK_SIZE - step) {
+			low = high - (BASE_SCAN_CHUNK_SIZE - step);
+		}
+		size_t size = (high - low) + sizeof(uint32_t);
+		bool bulk = (chunk != NULL && kernel_read(low, chunk, size));
+		for (uint64_t candidate = high;; candidate -= step) {
+			uint32_t magic = MH_MAGIC_64;
+			if (bulk) {
+				memcpy(&magic, chunk + (candidate - low), sizeof(magic));
+			}
+			if (magic == MH_MAGIC_64 && is_kernel_base(candidate)) {
+				*base = candidate;
+				found = true;
+				break;
+			}
+			if (candidate == low) {
+				break;
+			}
+		}
+		if (low == end) {
+			break;
+		}
+		high = low - step;
+	}
+	free(chunk);
+	return found;
 }
 
 // Some jailbreaks stash information about the kernel base in task_info(TASK_DYLD_INFO). Check to
@@ -96,16 +286,12 @@ init_with_kernel_image_address(uint64_t address) {
 	base = base + ((address - base) / kernel_slide_step) * kernel_slide_step;
 	// Now walk backwards from that kernel base one kernel slide at a time until we find the
 	// real kernel base.
-	while (base >= STATIC_ADDRESS(kernel_base)) {
-		bool found = is_kernel_base(base);
-		if (found) {
-			kernel_slide = base - STATIC_ADDRESS(kernel_base);
-			did_set_kernel_slide();
-			return true;
-		}
-		base -= kernel_slide_step;
+	if (!find_kernel_base_backwards(base, kernel_slide_step, &base)) {
+		return false;
 	}
-	return false;
+	kernel_slide = base - STATIC_ADDRESS(kernel_base);
+	did_set_kernel_slide();
+	return true;
 }
 
 // If we have current_task, then we can find the kernel slide easily by looking up the host port.
@@ -186,16 +372,13 @@ next:
 	// sections are empty and __TEXT is mapped first, and hence kernel_ptr lies after the
 	// Mach-O header. We'll program for the newer kernelcache format.
 	uint64_t page = kernel_ptr & ~0x3fff;
-	for (;;) {
-		bool found = is_kernel_base(page);
-		if (found) {
-			kernel_slide = page - STATIC_ADDRESS(kernel_base);
-			did_set_kernel_slide();
-			return true;
-		}
-		page -= 0x4000;
+	if (page < STATIC_ADDRESS(kernel_base)
+			|| !find_kernel_base_backwards(page, 0x4000, &page)) {
+		return false;
 	}
-	return false;
+	kernel_slide = page - STATIC_ADDRESS(kernel_base);
+	did_set_kernel_slide();
+	return true;
 }
 
 bool
@@ -208,6 +391,11 @@ kernel_slide_init() {
 	if (!ok) {
 		return false;
 	}
+	// Check if we already found the kernel slide during this boot session.
+	ok = load_cached_kernel_slide();
+	if (ok) {
+		return true;
+	}
 	// Check if the kernel base is stashed in task_info(TASK_DYLD_INFO).
 	ok = check_task_dyld_info();
 	if (ok) {
@@ -21,6 +21,8 @@
 #include "kernel_tasks.h"
 
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "kernel_memory.h"
@@ -55,40 +57,289 @@ kernel_ipc_port_lookup(uint64_t task, mach_port_name_t port_name,
 	return true;
 }
 
-// ---- Initialization ----------------------------------------------------------------------------
+// The largest is_table we are willing to read, in entries.
+#define MAX_IS_TABLE_SIZE	0x100000
+
+// The size of each read of an is_table.
+#define IS_TABLE_CHUNK_SIZE	0x4000
+
+// Fields of ipc_entry.ie_bits.
+#define IE_BITS_UREFS_MASK	0x0000ffff
+#define IE_BITS_TYPE_MASK	0x001f0000
+#define IE_BITS_GEN_SHIFT	24
+
+bool
+kernel_ipc_space_entries(uint64_t ipc_space, bool (*check)(uint64_t, size_t),
+		struct kernel_ipc_entry **entries, size_t *count) {
+	// Read is_table_size and is_table together.
+	size_t header_size = OFFSET(ipc_space, is_table_size) + sizeof(uint32_t);
+	if (OFFSET(ipc_space, is_table) + sizeof(uint64_t) > header_size) {
+		header_size = OFFSET(ipc_space, is_table) + sizeof(uint64_t);
+	}
+	uint8_t header[0x40];
+	assert(header_size <= sizeof(header));
+	if ((check != NULL && !check(ipc_space, header_size))
+			|| !kernel_read(ipc_space, header, header_size)) {
+		return false;
+	}
+	uint32_t is_table_size;
+	uint64_t is_table;
+	memcpy(&is_table_size, header + OFFSET(ipc_space, is_table_size), sizeof(is_table_size));
+	memcpy(&is_table, header + OFFSET(ipc_space, is_table), sizeof(is_table));
+	if (is_table_size > MAX_IS_TABLE_SIZE || (is_table_size > 0 && is_table == 0)) {
+		ERROR("ipc_space 0x%llx has a bad is_table", (unsigned long long) ipc_space);
+		return false;
+	}
+	if (is_table_size == 0) {
+		*entries = NULL;
+		*count = 0;
+		return true;
+	}
+	// Read the table one page at a time. The first read ends at a page boundary.
+	size_t table_size = is_table_size * SIZE(ipc_entry);
+	uint8_t *table = malloc(table_size);
+	struct kernel_ipc_entry *decoded = malloc(is_table_size * sizeof(*decoded));
+	if (table == NULL || decoded == NULL) {
+		ERROR("Could not allocate the is_table of ipc_space 0x%llx",
+				(unsigned long long) ipc_space);
+		goto fail;
+	}
+	for (size_t offset = 0; offset < table_size;) {
+		uint64_t address = is_table + offset;
+		size_t chunk = IS_TABLE_CHUNK_SIZE - (address & (IS_TABLE_CHUNK_SIZE - 1));
+		if (chunk > table_size - offset) {
+			chunk = table_size - offset;
+		}
+		if ((check != NULL && !check(address, chunk))
+				|| !kernel_read(address, table + offset, chunk)) {
+			goto fail;
+		}
+		offset += chunk;
+	}
+	// Decode the entries that hold a right. Entry 0 is never used.
+	size_t used = 0;
+	for (uint32_t index = 1; index < is_table_size; index++) {
+		const uint8_t *entry = table + index * SIZE(ipc_entry);
+		uint32_t ie_bits;
+		memcpy(&ie_bits, entry + OFFSET(ipc_entry, ie_bits), sizeof(ie_bits));
+		if ((ie_bits & IE_BITS_TYPE_MASK) == 0) {
+			continue;
+		}
+		struct kernel_ipc_entry *out = &decoded[used++];
+		memcpy(&out->object, entry + OFFSET(ipc_entry, ie_object), sizeof(out->object));
+		out->name  = (index << 8) | (ie_bits >> IE_BITS_GEN_SHIFT);
+		out->type  = ie_bits & IE_BITS_TYPE_MASK;
+		out->urefs = ie_bits & IE_BITS_UREFS_MASK;
+	}
+	free(table);
+	*entries = decoded;
+	*count = used;
+	return true;
+fail:
+	free(table);
+	free(decoded);
+	return false;
+}
+
+// ---- Process table ------------------------------------------------------------------------------
+
+// The maximum number of procs on allproc. This stops the walk if the list is corrupt.
+#define MAX_PROCS	16384
+
+// The processes found by the last allproc walk, in allproc order.
+static struct kernel_proc *proc_table;
+static size_t proc_count;
+
+// An open-addressing hash map from PID to proc_table index + 1, where 0 is an empty bucket. The
+// number of buckets is a power of 2.
+static uint32_t *proc_buckets;
+static size_t proc_bucket_count;
+
+// Whether proc_table reflects allproc.
+static bool proc_table_valid;
+
+// Whether the last allproc walk stopped early, so that proc_table holds only the procs before
+// the one that could not be read.
+static bool proc_table_partial;
 
-// Try to initialize kernel_task and current_task by walking the allproc list.
+static size_t
+proc_bucket(int pid) {
+	return ((uint32_t) pid * 2654435761u) & (proc_bucket_count - 1);
+}
+
+// Insert proc_table[index] into the hash map. If a PID appears twice on allproc, the first entry
+// wins.
+static void
+proc_bucket_insert(size_t index) {
+	int pid = proc_table[index].pid;
+	for (size_t b = proc_bucket(pid);; b = (b + 1) & (proc_bucket_count - 1)) {
+		if (proc_buckets[b] == 0) {
+			proc_buckets[b] = index + 1;
+			return;
+		}
+		if (proc_table[proc_buckets[b] - 1].pid == pid) {
+			return;
+		}
+	}
+}
+
+// Walk allproc and rebuild the process table. Each proc is read in a single chunk covering all
+// the fields we need. A proc that cannot be read ends the walk, and the procs before it are kept
+// as a partial table.
 static bool
-find_kernel_task_and_current_task() {
+proc_table_build() {
 	if (STATIC_ADDRESS(allproc) == 0) {
 		ERROR("Need allproc address to initialize tasks");
 		return false;
 	}
+	size_t fields[] = {
+		OFFSET(proc, p_list_next) + sizeof(uint64_t),
+		OFFSET(proc, task) + sizeof(uint64_t),
+		OFFSET(proc, p_pid) + sizeof(uint32_t),
+	};
+	size_t chunk_size = 0;
+	for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+		if (fields[i] > chunk_size) {
+			chunk_size = fields[i];
+		}
+	}
+	uint8_t chunk[0x100];
+	assert(chunk_size <= sizeof(chunk));
+	size_t capacity = 256;
+	struct kernel_proc *table = malloc(capacity * sizeof(*table));
+	if (table == NULL) {
+		ERROR("Could not allocate the process table");
+		return false;
+	}
+	size_t count = 0;
+	bool partial = false;
 	uint64_t allproc = kernel_read64(STATIC_ADDRESS(allproc) + kernel_slide);
-	uint64_t kernproc = 0;
-	uint64_t current_proc = 0;
-	int current_pid = getpid();
 	uint64_t proc = allproc;
-	for (;;) {
-		if (proc == 0 || proc == -1) {
+	while (proc != 0 && proc != -1) {
+		if (count == MAX_PROCS) {
+			WARNING("allproc has more than %d entries", MAX_PROCS);
+			partial = true;
 			break;
 		}
-		uint32_t pid = kernel_read32(proc + OFFSET(proc, p_pid));
-		if (pid == 0) {
-			kernproc = proc;
-		} else if (pid == current_pid) {
-			current_proc = proc;
+		// A proc can be freed while we walk the list.
+		if (!kernel_read(proc, chunk, chunk_size)) {
+			WARNING("Could not read proc 0x%llx on allproc, keeping the first %zu "
+					"processes", (unsigned long long) proc, count);
+			partial = true;
+			break;
 		}
-		proc = kernel_read64(proc + OFFSET(proc, p_list_next));
+		if (count == capacity) {
+			capacity *= 2;
+			struct kernel_proc *grown = realloc(table, capacity * sizeof(*table));
+			if (grown == NULL) {
+				ERROR("Could not allocate the process table");
+				goto fail;
+			}
+			table = grown;
+		}
+		struct kernel_proc *entry = &table[count++];
+		uint32_t pid;
+		memcpy(&pid, chunk + OFFSET(proc, p_pid), sizeof(pid));
+		memcpy(&entry->task, chunk + OFFSET(proc, task), sizeof(entry->task));
+		entry->proc = proc;
+		entry->pid = pid;
+		entry->ipc_space = 0;
+		memcpy(&proc, chunk + OFFSET(proc, p_list_next), sizeof(proc));
 		if (proc == allproc) {
 			break;
 		}
 	}
-	if (kernproc != 0) {
-		kernel_task = kernel_read64(kernproc + OFFSET(proc, task));
+	// The ipc_space pointers are read in a second pass, after the walk.
+	for (size_t i = 0; i < count; i++) {
+		if (table[i].task != 0) {
+			table[i].ipc_space = kernel_read64(table[i].task + OFFSET(task, itk_space));
+		}
+	}
+	size_t bucket_count = 16;
+	while (bucket_count < 2 * count) {
+		bucket_count *= 2;
+	}
+	uint32_t *buckets = calloc(bucket_count, sizeof(*buckets));
+	if (buckets == NULL) {
+		ERROR("Could not allocate the process table");
+		goto fail;
+	}
+	kernel_procs_invalidate();
+	proc_table = table;
+	proc_count = count;
+	proc_buckets = buckets;
+	proc_bucket_count = bucket_count;
+	for (size_t i = 0; i < count; i++) {
+		proc_bucket_insert(i);
+	}
+	proc_table_valid = true;
+	proc_table_partial = partial;
+	return true;
+fail:
+	free(table);
+	return false;
+}
+
+const struct kernel_proc *
+kernel_procs(size_t *count) {
+	if (!proc_table_valid && !proc_table_build()) {
+		return NULL;
+	}
+	*count = proc_count;
+	return proc_table;
+}
+
+bool
+kernel_procs_partial() {
+	return proc_table_partial;
+}
+
+const struct kernel_proc *
+kernel_proc_find(int pid) {
+	if (!proc_table_valid && !proc_table_build()) {
+		return NULL;
+	}
+	for (size_t b = proc_bucket(pid);; b = (b + 1) & (proc_bucket_count - 1)) {
+		if (proc_buckets[b] == 0) {
+			return NULL;
+		}
+		const struct kernel_proc *entry = &proc_table[proc_buckets[b] - 1];
+		if (entry->pid == pid) {
+			return entry;
+		}
+	}
+}
+
+void
+kernel_procs_invalidate() {
+	free(proc_table);
+	free(proc_buckets);
+	proc_table = NULL;
+	proc_count = 0;
+	proc_buckets = NULL;
+	proc_bucket_count = 0;
+	proc_table_valid = false;
+	proc_table_partial = false;
+}
+
+// ---- Initialization ----------------------------------------------------------------------------
+
+// Try to initialize kernel_task and current_task from the process table. kernproc is last on
+// allproc, so a partial table usually lacks it; allproc is walked once more in that case.
+static bool
+find_kernel_task_and_current_task() {
+	const struct kernel_proc *kernproc = kernel_proc_find(0);
+	const struct kernel_proc *current_proc = kernel_proc_find(getpid());
+	if ((kernproc == NULL || current_proc == NULL) && kernel_procs_partial()) {
+		kernel_procs_invalidate();
+		kernproc = kernel_proc_find(0);
+		current_proc = kernel_proc_find(getpid());
+	}
+	if (kernproc != NULL) {
+		kernel_task = kernproc->task;
 	}
-	if (current_proc != 0) {
-		current_task = kernel_read64(current_proc + OFFSET(proc, task));
+	if (current_proc != NULL) {
+		current_task = current_proc->task;
 	}
 	return (kernel_task != 0 && current_task != 0);
 }
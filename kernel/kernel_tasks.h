@@ -21,6 +21,7 @@
 #define KERNEL_TASKS__H_
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef KERNEL_TASKS_EXTERN
@@ -43,6 +44,65 @@ extern uint64_t kernel_task;
  */
 extern uint64_t current_task;
 
+/*
+ * struct kernel_proc
+ *
+ * Description:
+ * 	An entry in the process table: a proc on the allproc list and the kernel objects it owns.
+ */
+struct kernel_proc {
+	uint64_t proc;
+	uint64_t task;
+	uint64_t ipc_space;
+	int pid;
+};
+
+/*
+ * kernel_procs
+ *
+ * Description:
+ * 	Get the process table, walking allproc to build it if it has not been built since it was
+ * 	last invalidated.
+ *
+ * Parameters:
+ * 	out	count			On return, the number of processes.
+ *
+ * Returns:
+ * 	The processes in allproc order, or NULL if the table could not be built. The array is
+ * 	valid until the table is invalidated. If a proc could not be read, the table holds the
+ * 	processes before it; see kernel_procs_partial().
+ */
+const struct kernel_proc *kernel_procs(size_t *count);
+
+/*
+ * kernel_procs_partial
+ *
+ * Description:
+ * 	Whether the walk that built the process table stopped at a proc it could not read, so that
+ * 	later processes are missing.
+ */
+bool kernel_procs_partial(void);
+
+/*
+ * kernel_proc_find
+ *
+ * Description:
+ * 	Look up a process by PID in the process table, building the table if needed.
+ *
+ * Returns:
+ * 	The process, or NULL if there is no process with that PID or the table could not be
+ * 	built. The entry is valid until the table is invalidated.
+ */
+const struct kernel_proc *kernel_proc_find(int pid);
+
+/*
+ * kernel_procs_invalidate
+ *
+ * Description:
+ * 	Discard the process table so that the next lookup walks allproc again.
+ */
+void kernel_procs_invalidate(void);
+
 /*
  * kernel_tasks_init
  *
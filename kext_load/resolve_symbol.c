@@ -21,6 +21,8 @@
 
 #include <ctype.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -36,16 +38,35 @@
 static void *symbol_database = NULL;
 static size_t symbol_database_size = 0;
 
+// An index of the lines of the database sorted by symbol name, or NULL if it could not be built.
+static const char **symbol_index = NULL;
+static size_t symbol_index_count = 0;
+
 /*
- * lookup_symbol
+ * struct symbol_address
  *
  * Description:
- * 	Parses the memory-mapped database file line-by-line looking for the matching symbol.
+ * 	An entry in the index of the symbols by address.
+ */
+struct symbol_address {
+	uint64_t address;
+	const char *line;
+};
+
+// The symbols sorted by address, built on the first reverse lookup.
+static struct symbol_address *address_index = NULL;
+static size_t address_index_count = 0;
+
+/*
+ * lookup_symbol_from
+ *
+ * Description:
+ * 	Parses the memory-mapped database file line-by-line, starting at the given line, looking
+ * 	for the matching symbol.
  */
 static uint64_t
-lookup_symbol(const char *name) {
-	const char *str = symbol_database;
-	const char *const end = str + symbol_database_size;
+lookup_symbol_from(const char *name, const char *str) {
+	const char *const end = (const char *)symbol_database + symbol_database_size;
 	// Each iteration of this loop starts at the beginning of a line.
 	for (;;) {
 		char ch;
@@ -155,6 +176,194 @@ next_line:
 	}
 }
 
+/*
+ * compare_names
+ *
+ * Description:
+ * 	Compare the symbol names at the start of two lines. Names end at whitespace or at the end
+ * 	of the database.
+ */
+static int
+compare_names(const char *a, const char *b) {
+	const char *const end = (const char *)symbol_database + symbol_database_size;
+	for (;; a++, b++) {
+		int ca = (a >= end || isspace((unsigned char) *a) ? 0 : (unsigned char) *a);
+		int cb = (b >= end || isspace((unsigned char) *b) ? 0 : (unsigned char) *b);
+		if (ca != cb || ca == 0) {
+			return ca - cb;
+		}
+	}
+}
+
+// Compare the symbol name at the start of a line with a name.
+static int
+compare_line_name(const char *line, const char *name) {
+	const char *const end = (const char *)symbol_database + symbol_database_size;
+	for (;; line++, name++) {
+		bool at_end = (line >= end || isspace((unsigned char) *line));
+		int cl = (at_end ? 0 : (unsigned char) *line);
+		int cn = (unsigned char) *name;
+		if (cl != cn || cl == 0) {
+			return cl - cn;
+		}
+	}
+}
+
+// Order lines by name and then by position, so that the first definition of a name wins.
+static int
+compare_index_entries(const void *a, const void *b) {
+	const char *line_a = *(const char **)a;
+	const char *line_b = *(const char **)b;
+	int order = compare_names(line_a, line_b);
+	if (order != 0) {
+		return order;
+	}
+	return (line_a > line_b) - (line_a < line_b);
+}
+
+/*
+ * build_symbol_index
+ *
+ * Description:
+ * 	Sort the lines of the database by symbol name so that symbols can be found with a binary
+ * 	search rather than a scan of the whole file. If the index cannot be allocated, lookups
+ * 	fall back to scanning.
+ */
+static void
+build_symbol_index() {
+	const char *str = symbol_database;
+	const char *const end = str + symbol_database_size;
+	size_t lines = 1;
+	for (const char *p = str; p < end; p++) {
+		lines += (*p == '\n');
+	}
+	symbol_index = malloc(lines * sizeof(*symbol_index));
+	if (symbol_index == NULL) {
+		return;
+	}
+	size_t count = 0;
+	while (str < end) {
+		// Index the first non-blank character of each line that has one.
+		while (str < end && (*str == ' ' || *str == '\t')) {
+			str++;
+		}
+		if (str < end && *str != '\n') {
+			symbol_index[count++] = str;
+		}
+		str = memchr(str, '\n', end - str);
+		if (str == NULL) {
+			break;
+		}
+		str++;
+	}
+	qsort(symbol_index, count, sizeof(*symbol_index), compare_index_entries);
+	symbol_index_count = count;
+}
+
+/*
+ * parse_line_address
+ *
+ * Description:
+ * 	Parse the address that follows the symbol name on a line of the database.
+ */
+static bool
+parse_line_address(const char *line, uint64_t *address) {
+	const char *const end = (const char *)symbol_database + symbol_database_size;
+	while (line < end && !isspace((unsigned char) *line)) {
+		line++;
+	}
+	while (line < end && (*line == ' ' || *line == '\t')) {
+		line++;
+	}
+	if (end - line < 3 || line[0] != '0' || line[1] != 'x') {
+		return false;
+	}
+	uint64_t value = 0;
+	size_t digits = 0;
+	for (line += 2; line < end && isxdigit((unsigned char) *line) && digits < 16; line++) {
+		int ch = tolower((unsigned char) *line);
+		value = (value << 4) | (ch <= '9' ? ch - '0' : ch - 'a' + 0xa);
+		digits++;
+	}
+	*address = value;
+	return (digits > 0);
+}
+
+// Order address index entries by address.
+static int
+compare_address_entries(const void *a, const void *b) {
+	const struct symbol_address *x = a;
+	const struct symbol_address *y = b;
+	if (x->address != y->address) {
+		return (x->address < y->address ? -1 : 1);
+	}
+	return (x->line > y->line) - (x->line < y->line);
+}
+
+/*
+ * build_address_index
+ *
+ * Description:
+ * 	Sort the symbols by address for reverse lookups. This is done on the first reverse lookup
+ * 	since most sessions never need it.
+ */
+static bool
+build_address_index() {
+	if (address_index != NULL) {
+		return true;
+	}
+	if (symbol_index == NULL) {
+		return false;
+	}
+	address_index = malloc((symbol_index_count + 1) * sizeof(*address_index));
+	if (address_index == NULL) {
+		return false;
+	}
+	size_t count = 0;
+	for (size_t i = 0; i < symbol_index_count; i++) {
+		uint64_t address;
+		if (parse_line_address(symbol_index[i], &address) && address != 0) {
+			address_index[count].address = address;
+			address_index[count].line = symbol_index[i];
+			count++;
+		}
+	}
+	qsort(address_index, count, sizeof(*address_index), compare_address_entries);
+	address_index_count = count;
+	return true;
+}
+
+/*
+ * lookup_symbol
+ *
+ * Description:
+ * 	Find a symbol in the database, using the index if it was built.
+ */
+static uint64_t
+lookup_symbol(const char *name) {
+	if (symbol_database == NULL) {
+		return 0;
+	}
+	if (symbol_index == NULL) {
+		return lookup_symbol_from(name, symbol_database);
+	}
+	// Find the first line whose name is not less than the symbol.
+	size_t lo = 0;
+	size_t hi = symbol_index_count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (compare_line_name(symbol_index[mid], name) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo == symbol_index_count || compare_line_name(symbol_index[lo], name) != 0) {
+		return 0;
+	}
+	return lookup_symbol_from(name, symbol_index[lo]);
+}
+
 // ---- Public API --------------------------------------------------------------------------------
 
 bool
@@ -171,6 +380,7 @@ load_symbol_database(const char *database_path) {
 		WARNING("No kernel symbol database for %s %s", platform.machine, platform.osversion);
 		return false;
 	}
+	build_symbol_index();
 	return true;
 }
 
@@ -178,3 +388,33 @@ uint64_t
 resolve_symbol(const char *symbol) {
 	return lookup_symbol(symbol);
 }
+
+bool
+resolve_address(uint64_t address, char *name, size_t size, uint64_t *offset) {
+	if (symbol_database == NULL || !build_address_index()) {
+		return false;
+	}
+	// Find the last symbol at or before the address.
+	size_t lo = 0;
+	size_t hi = address_index_count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (address_index[mid].address <= address) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo == 0) {
+		return false;
+	}
+	const struct symbol_address *symbol = &address_index[lo - 1];
+	const char *const end = (const char *)symbol_database + symbol_database_size;
+	const char *name_end = symbol->line;
+	while (name_end < end && !isspace((unsigned char) *name_end)) {
+		name_end++;
+	}
+	snprintf(name, size, "%.*s", (int) (name_end - symbol->line), symbol->line);
+	*offset = address - symbol->address;
+	return true;
+}
@@ -21,6 +21,7 @@
 #define RESOLVE_SYMBOL__H_
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /*
@@ -41,4 +42,21 @@ bool load_symbol_database(const char *database_path);
  */
 uint64_t resolve_symbol(const char *symbol);
 
+/*
+ * resolve_address
+ *
+ * Description:
+ * 	Find the symbol at or before a static (unslid) address in the kernel image.
+ *
+ * Parameters:
+ * 		address			The static address.
+ * 	out	name			On return, the name of the symbol.
+ * 		size			The size of the name buffer.
+ * 	out	offset			On return, the offset of the address from the symbol.
+ *
+ * Returns:
+ * 	True if a symbol was found.
+ */
+bool resolve_address(uint64_t address, char *name, size_t size, uint64_t *offset);
+
 #endif
@@ -1,5 +1,8 @@
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "kernel_call.h"
 #include "kernel_memory.h"
@@ -12,6 +15,8 @@
 #include "memctl_overwrite/memctl/error.h"
 #include "memctl_overwrite/memctl/utility.h"
 #include "memctl_overwrite/memctl_modify/memCtlCommand.h"
+#include "memctl_overwrite/memctl_modify/memCtlPrefetch.h"
+#include "memctl_overwrite/memctl_modify/memCtlStartup.h"
 #include "memctl_overwrite/libmemctl/memctl_error.h"
 #include "memctl_overwrite/libmemctl/strparse.h"
 
@@ -934,6 +939,8 @@ bool memShow_cli(int argc, const char *argv[])
 			{
 				history(hist, &ev, H_ENTER, line);
 				command_run_argv(argc, argv);
+				// Print the command's log messages before the next prompt.
+				log_flush();
 			}
 			tok_reset(tok);
 			//print_errors();
@@ -947,59 +954,291 @@ bool memShow_cli(int argc, const char *argv[])
 }
 
 
-int initialize(){
-	int ret = 1;
-	// Load the kernel symbol database.
-	bool ok = kext_load_set_kernel_symbol_database("kernel_symbols");
-	if (!ok) {
-		ERROR("Could not load kernel symbol database");
-		goto done_0;
-	}
-	// Try to get the kernel task port using task_for_pid().
-	kernel_task_port = MACH_PORT_NULL;
-	task_for_pid(mach_task_self(), 0, &kernel_task_port);
-	if (kernel_task_port == MACH_PORT_NULL) {
-		ERROR("Could not get kernel task port");
-		goto done_0;
-	}
-	INFO("task_for_pid(0) = 0x%x", kernel_task_port);
-	// Initialize our kernel function calling capability.
-	ok = kernel_call_init();
-	if (!ok) {
-		ERROR("Could not initialize kernel_call subsystem");
-		goto done_0;
+// The number of upcoming script lines examined for reads to prefetch.
+#define BATCH_LOOKAHEAD	16
+
+/*
+ * struct batch_line
+ *
+ * Description:
+ * 	A tokenized line of a batch script.
+ */
+struct batch_line {
+	// The line number, for error messages.
+	size_t number;
+	// The line, split in place into words.
+	char *text;
+	int argc;
+	const char **argv;
+	// Whether the command only reads kernel memory. Any other command is a barrier: data
+	// prefetched for earlier lines is dropped before it runs.
+	bool read_only;
+};
+
+/*
+ * batch_tokenize
+ *
+ * Description:
+ * 	Split a line into words in place. Words are separated by whitespace; single quotes, double
+ * 	quotes, and backslashes group and escape characters as in the shell. A word starting with
+ * 	'#' begins a comment.
+ *
+ * Returns:
+ * 	True if the line was split. The argv array is allocated and NULL-terminated.
+ */
+static bool
+batch_tokenize(struct batch_line *line) {
+	char *in = line->text;
+	char *out = line->text;
+	int argc = 0;
+	const char **argv = NULL;
+	for (;;) {
+		while (isspace((unsigned char) *in)) {
+			in++;
+		}
+		if (*in == 0 || *in == '#') {
+			break;
+		}
+		char *word = out;
+		char quote = 0;
+		for (; *in != 0; in++) {
+			char ch = *in;
+			if (quote == 0 && isspace((unsigned char) ch)) {
+				break;
+			}
+			if (ch == quote) {
+				quote = 0;
+				continue;
+			}
+			if (quote == 0 && (ch == '\'' || ch == '"')) {
+				quote = ch;
+				continue;
+			}
+			if (ch == '\\' && quote != '\'' && in[1] != 0) {
+				ch = *++in;
+			}
+			*out++ = ch;
+		}
+		if (quote != 0) {
+			ERROR("line %zu: unterminated quote", line->number);
+			free(argv);
+			return false;
+		}
+		// The terminator may overwrite the separator, so step past it first.
+		if (*in != 0) {
+			in++;
+		}
+		*out++ = 0;
+		const char **new_argv = realloc(argv, (argc + 2) * sizeof(*argv));
+		if (new_argv == NULL) {
+			error_out_of_memory();
+			free(argv);
+			return false;
+		}
+		argv = new_argv;
+		argv[argc++] = word;
 	}
-	// TODO: Check if we've already bypassed KTRR.
-	// Ensure that we have a KTRR bypass.
-	ok = have_ktrr_bypass();
-	if (!ok) {
-		ERROR("No KTRR bypass is available for this platform");
-		goto done_1;
+	if (argv != NULL) {
+		argv[argc] = NULL;
 	}
-	// Bypass KTRR and remap the kernel as read/write.
-	ok = ktrr_bypass();
-	if (!ok) {
-		ERROR("NO KTRR bypass is available for this ktrr_bypass");
-		goto done_0;
+	line->argc = argc;
+	line->argv = argv;
+	return true;
+}
+
+/*
+ * batch_prefetch
+ *
+ * Description:
+ * 	Check whether a command only reads kernel virtual memory and, if so, queue the range it
+ * 	will read for prefetching.
+ *
+ * Returns:
+ * 	True if the command only reads memory.
+ *
+ * Notes:
+ * 	Only the plain forms "r <address> [length]", "rb <address> <length>", and
+ * 	"rs <address> [length]" are recognized. Commands with options, symbols, or other widths
+ * 	are treated as barriers, which is always safe.
+ */
+static bool
+batch_prefetch(int argc, const char **argv) {
+	if (argc < 2 || argc > 3) {
+		return false;
+	}
+	size_t length;
+	if (strcmp(argv[0], "r") == 0) {
+		length = sizeof(kword_t);
+	} else if (strcmp(argv[0], "rb") == 0 || strcmp(argv[0], "rs") == 0) {
+		length = 0;
+	} else {
+		return false;
+	}
+	char *end;
+	unsigned long long address = strtoull(argv[1], &end, 16);
+	if (argv[1][0] == '-' || *end != 0) {
+		return false;
+	}
+	if (argc == 3) {
+		unsigned long long value = strtoull(argv[2], &end, 0);
+		if (argv[2][0] == '-' || *end != 0) {
+			return false;
+		}
+		length = value;
+	}
+	if (length > 0) {
+		prefetch_range(address, length);
+	}
+	return true;
+}
+
+/*
+ * batch_run
+ *
+ * Description:
+ * 	Run the commands in a script, one per line, without the line editor. A path of "-" reads
+ * 	the script from stdin. A failed command does not stop the script.
+ *
+ * Parameters:
+ * 		path			The script file, or "-".
+ * 		lookahead		If true, the ranges read by upcoming read commands
+ * 					are prefetched on a background thread while earlier
+ * 					commands run.
+ *
+ * Returns:
+ * 	True if every command succeeded.
+ */
+static bool
+batch_run(const char *path, bool lookahead) {
+	bool from_stdin = (strcmp(path, "-") == 0);
+	FILE *file = (from_stdin ? stdin : fopen(path, "r"));
+	if (file == NULL) {
+		ERROR("could not open %s", path);
+		return false;
+	}
+	// Prefetching reads through the kernel task port and checks each page with safeacess(), so
+	// both must be set up first.
+	if (lookahead) {
+		lookahead = startup_require(FEATURE_KTRR) && prefetch_start();
+	}
+	const size_t window_size = (lookahead ? BATCH_LOOKAHEAD : 1);
+	struct batch_line window[BATCH_LOOKAHEAD];
+	size_t head = 0;
+	size_t pending = 0;
+	size_t number = 0;
+	bool eof = false;
+	bool barrier = false;
+	bool success = true;
+	interrupted = 0;
+	while (!interrupted) {
+		// Read ahead until the window is full or the next command is a barrier.
+		while (!eof && !barrier && pending < window_size) {
+			struct batch_line *line = &window[(head + pending) % BATCH_LOOKAHEAD];
+			size_t capacity = 0;
+			line->text = NULL;
+			line->number = ++number;
+			if (getline(&line->text, &capacity, file) < 0) {
+				free(line->text);
+				eof = true;
+				break;
+			}
+			if (!batch_tokenize(line)) {
+				free(line->text);
+				success = false;
+				continue;
+			}
+			if (line->argc == 0) {
+				free(line->text);
+				free(line->argv);
+				continue;
+			}
+			line->read_only = (lookahead && batch_prefetch(line->argc, line->argv));
+			barrier = !line->read_only;
+			pending++;
+		}
+		if (pending == 0) {
+			break;
+		}
+		// Run the oldest line.
+		struct batch_line *line = &window[head];
+		head = (head + 1) % BATCH_LOOKAHEAD;
+		pending--;
+		if (!line->read_only) {
+			if (lookahead) {
+				prefetch_clear();
+			}
+			barrier = false;
+		}
+		if (!command_run_argv(line->argc, line->argv)) {
+			success = false;
+		}
+		log_flush();
+		free(line->text);
+		free(line->argv);
+	}
+	if (interrupted) {
+		fprintf(stdout, "^C\n");
+		success = false;
+	}
+	// Free any lines read ahead but not run.
+	for (; pending > 0; pending--, head = (head + 1) % BATCH_LOOKAHEAD) {
+		free(window[head].text);
+		free(window[head].argv);
 	}
+	if (lookahead) {
+		prefetch_stop();
+	}
+	if (!from_stdin) {
+		fclose(file);
+	}
+	return success;
+}
+
 
+/*
+ * initialize
+ *
+ * Description:
+ * 	Start initializing seokView. Only the platform is detected here. Everything else,
+ * 	including the kernel task port, kernel_call and the KTRR bypass, is set up through
+ * 	startup_require() by the first command that needs it.
+ */
+int initialize(bool verbose){
+	startup_begin(verbose);
 	return true;
-	// Apply kernel patches.
-	// apply_kernel_patches();
-	// Load the kernel extension.
-done_1:
-	// De-initialize our kernel function calling primitive.
-	kernel_call_deinit();
-	return 0;
-done_0:
-	return ret;
 }
 
 int main(int argc, const char *argv[]) {
-	int init = initialize();
+	// Parse the options: -b runs a script instead of the REPL, -l enables look-ahead, and -v
+	// prints the startup trace.
+	const char *script = NULL;
+	bool lookahead = false;
+	bool verbose = false;
+	int ch;
+	while ((ch = getopt(argc, (char **) argv, "b:lv")) != -1) {
+		switch (ch) {
+			case 'b':
+				script = optarg;
+				break;
+			case 'l':
+				lookahead = true;
+				break;
+			case 'v':
+				verbose = true;
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-v] [-b script|- [-l]]\n", getprogname());
+				return 1;
+		}
+	}
+
+	int init = initialize(verbose);
 
-	if(init){
-		memShow_cli(argc - 1, argv + 1);
+	if(init && script != NULL){
+		return (batch_run(script, lookahead) ? 0 : 1);
+	}
+	else if(init){
+		memShow_cli(argc - optind, argv + optind);
 	}
 	else{
 		return 0;
@@ -1007,4 +1246,3 @@ int main(int argc, const char *argv[]) {
 
 	return true;
 }
-
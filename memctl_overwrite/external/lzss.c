@@ -38,58 +38,205 @@
  *  DRI: Josh de Cesare
  */
 
-#include <stdint.h>
+#include "lzss.h"
+
+#include <string.h>
 #define u_int8_t  uint8_t
 #define u_int16_t uint16_t
 #define u_int32_t uint32_t
 
-//#include <sl.h>
-
 #define N         4096  /* size of ring buffer - must be power of 2 */
 #define F         18    /* upper limit for match_length */
 #define THRESHOLD 2     /* encode string into position and length
                            if match_length is greater than this */
 #define NIL       N     /* index for root of binary search trees */
 
+/*
+ * The compressor starts with a window of N - F spaces, and the first byte of
+ * output is written at ring position N - F. Rather than copying every byte
+ * through a ring buffer, the decompressors below convert each ring position
+ * into a distance back from the current output position and copy matches
+ * straight out of the output. Only matches that reach back before the start
+ * of the output read the initial spaces.
+ */
+
+/*
+ * match_distance
+ *
+ * Convert the ring position i of a match into its distance, between 1 and N,
+ * back from the ring position r of the next output byte.
+ */
+static inline u_int32_t
+match_distance(u_int32_t r, int i)
+{
+    return ((r - i - 1) & (N - 1)) + 1;
+}
+
+/*
+ * copy_match
+ *
+ * Copy a match of length bytes from distance bytes back. The caller must
+ * ensure that there are at least distance bytes of output before dst and
+ * length bytes of space after it. Matches at least a word away are copied a
+ * word at a time: each word is read only after the words it depends on have
+ * been written, so this is exact even when the source and destination
+ * overlap. The last word may write past the end of the match, so this is only
+ * done when there is room for it.
+ */
+static inline u_int8_t *
+copy_match(u_int8_t *dst, u_int8_t *dstend, u_int32_t distance,
+           u_int32_t length)
+{
+    const u_int8_t *from = dst - distance;
+    u_int32_t k;
+
+    if (distance >= sizeof(uint64_t)
+        && (size_t)(dstend - dst) >= F + sizeof(uint64_t) - 1) {
+        for (k = 0; k < length; k += sizeof(uint64_t)) {
+            uint64_t word;
+            memcpy(&word, from + k, sizeof(word));
+            memcpy(dst + k, &word, sizeof(word));
+        }
+    } else if (distance >= length) {
+        memcpy(dst, from, length);
+    } else {
+        for (k = 0; k < length; k++)
+            dst[k] = from[k];
+    }
+    return dst + length;
+}
+
 int
-decompress_lzss(u_int8_t *dst, u_int8_t *src, u_int32_t srclen)
+decompress_lzss(u_int8_t *dst, u_int32_t dstlen, const u_int8_t *src,
+                u_int32_t srclen)
 {
-    /* ring buffer of size N, with extra F-1 bytes to aid string comparison */
-    u_int8_t text_buf[N + F - 1];
     u_int8_t *dststart = dst;
-    u_int8_t *srcend = src + srclen;
-    int  i, j, k, r, c;
+    u_int8_t *dstend = dst + dstlen;
+    const u_int8_t *srcend = src + srclen;
+    u_int32_t distance, length, pos, k;
     unsigned int flags;
-    
-    dst = dststart;
-    srcend = src + srclen;
-    for (i = 0; i < N - F; i++)
-        text_buf[i] = ' ';
-    r = N - F;
+    int i;
+
     flags = 0;
     for ( ; ; ) {
         if (((flags >>= 1) & 0x100) == 0) {
-            if (src < srcend) c = *src++; else break;
-            flags = c | 0xFF00;  /* uses higher byte cleverly */
+            if (src < srcend) flags = *src++; else break;
+            flags |= 0xFF00;  /* uses higher byte cleverly */
         }   /* to count eight */
         if (flags & 1) {
-            if (src < srcend) c = *src++; else break;
-            *dst++ = c;
-            text_buf[r++] = c;
-            r &= (N - 1);
+            if (src >= srcend || dst >= dstend) break;
+            *dst++ = *src++;
         } else {
-            if (src < srcend) i = *src++; else break;
-            if (src < srcend) j = *src++; else break;
-            i |= ((j & 0xF0) << 4);
-            j  =  (j & 0x0F) + THRESHOLD;
-            for (k = 0; k <= j; k++) {
-                c = text_buf[(i + k) & (N - 1)];
-                *dst++ = c;
-                text_buf[r++] = c;
-                r &= (N - 1);
+            if (srcend - src < 2) break;
+            i = src[0] | ((src[1] & 0xF0) << 4);
+            length = (src[1] & 0x0F) + THRESHOLD + 1;
+            src += 2;
+            pos = dst - dststart;
+            distance = match_distance(N - F + pos, i);
+            if (length > (u_int32_t)(dstend - dst))
+                length = dstend - dst;
+            if (distance <= pos) {
+                dst = copy_match(dst, dstend, distance, length);
+            } else {
+                /* The match starts in the initial window of spaces. */
+                for (k = 0; k < length; k++, dst++)
+                    *dst = (pos + k < distance) ? ' ' : *(dst - distance);
             }
+            if (dst == dstend) break;
         }
     }
-    
+
     return dst - dststart;
 }
+
+void
+lzss_stream_init(struct lzss_stream *stream, const u_int8_t *src,
+                 u_int32_t srclen)
+{
+    memset(stream->text_buf, ' ', sizeof(stream->text_buf));
+    stream->src = src;
+    stream->srcend = src + srclen;
+    stream->flags = 0;
+    stream->r = N - F;
+    stream->match_distance = 0;
+    stream->match_index = 0;
+    stream->match_length = 0;
+}
+
+/*
+ * stream_save_window
+ *
+ * Copy the tail of a chunk into the stream's ring buffer, so that matches in
+ * later chunks can reach back into it.
+ */
+static void
+stream_save_window(struct lzss_stream *stream, const u_int8_t *chunk,
+                   u_int32_t count)
+{
+    u_int32_t keep = count < N ? count : N;
+    u_int32_t r = (stream->r + count - keep) & (N - 1);
+    u_int32_t first = N - r < keep ? N - r : keep;
+
+    memcpy(&stream->text_buf[r], chunk + count - keep, first);
+    memcpy(&stream->text_buf[0], chunk + count - keep + first, keep - first);
+    stream->r = (stream->r + count) & (N - 1);
+}
+
+u_int32_t
+lzss_stream_read(struct lzss_stream *stream, u_int8_t *dst, u_int32_t dstlen)
+{
+    u_int8_t *chunk = dst;
+    u_int8_t *dstend = dst + dstlen;
+    const u_int8_t *src = stream->src;
+    const u_int8_t *srcend = stream->srcend;
+    unsigned int flags = stream->flags;
+    u_int32_t distance, length, pos;
+    int i;
+
+    for ( ; ; ) {
+        /* Finish a match one byte at a time, reaching back into the ring
+         * buffer for bytes produced before this chunk. */
+        while (stream->match_length > 0) {
+            if (dst == dstend) goto out;
+            pos = dst - chunk;
+            distance = stream->match_distance;
+            *dst = (pos >= distance)
+                ? *(dst - distance)
+                : stream->text_buf[stream->match_index & (N - 1)];
+            dst++;
+            stream->match_index++;
+            stream->match_length--;
+        }
+        if (dst == dstend) break;
+        if (((flags >>= 1) & 0x100) == 0) {
+            if (src < srcend) flags = *src++; else break;
+            flags |= 0xFF00;
+        }
+        if (flags & 1) {
+            if (src >= srcend) break;
+            *dst++ = *src++;
+        } else {
+            if (srcend - src < 2) {
+                src = srcend;
+                break;
+            }
+            i = src[0] | ((src[1] & 0xF0) << 4);
+            length = (src[1] & 0x0F) + THRESHOLD + 1;
+            src += 2;
+            pos = dst - chunk;
+            distance = match_distance(stream->r + pos, i);
+            if (distance <= pos && length <= (u_int32_t)(dstend - dst)) {
+                dst = copy_match(dst, dstend, distance, length);
+            } else {
+                stream->match_distance = distance;
+                stream->match_index = i;
+                stream->match_length = length;
+            }
+        }
+    }
+out:
+    stream->src = src;
+    stream->flags = flags;
+    stream_save_window(stream, chunk, dst - chunk);
+    return dst - chunk;
+}
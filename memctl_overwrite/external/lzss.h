@@ -0,0 +1,54 @@
+/*
+ *  lzss.h - Package for decompressing lzss compressed objects
+ */
+
+#ifndef LZSS_H_
+#define LZSS_H_
+
+#include <stdint.h>
+
+/*
+ * decompress_lzss
+ *
+ * Decompress srclen bytes of LZSS data from src into dst, writing at most
+ * dstlen bytes. Returns the number of bytes written.
+ */
+int decompress_lzss(uint8_t *dst, uint32_t dstlen, const uint8_t *src,
+                    uint32_t srclen);
+
+/*
+ * struct lzss_stream
+ *
+ * State for decompressing LZSS data in chunks. The last 4096 bytes of output
+ * are kept so that matches may refer back into earlier chunks.
+ */
+struct lzss_stream {
+    uint8_t text_buf[4096];
+    const uint8_t *src;
+    const uint8_t *srcend;
+    unsigned int flags;
+    uint32_t r;
+    uint32_t match_distance;
+    uint32_t match_index;
+    uint32_t match_length;
+};
+
+/*
+ * lzss_stream_init
+ *
+ * Start decompressing srclen bytes of LZSS data from src. The source buffer
+ * must remain valid until the stream is no longer used.
+ */
+void lzss_stream_init(struct lzss_stream *stream, const uint8_t *src,
+                      uint32_t srclen);
+
+/*
+ * lzss_stream_read
+ *
+ * Decompress up to dstlen more bytes into dst. Returns the number of bytes
+ * written, which is less than dstlen only once the input is exhausted.
+ */
+uint32_t lzss_stream_read(struct lzss_stream *stream, uint8_t *dst,
+                           uint32_t dstlen);
+
+#endif
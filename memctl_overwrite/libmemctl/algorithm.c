@@ -1,5 +1,6 @@
 #include "algorithm.h"
 
+#include <string.h>
 #include <unistd.h>
 
 const void *
@@ -70,3 +71,99 @@ void sorting_permutation(const void *array, size_t width, size_t count,
 	struct compare_sorting_permutation_context context = { array, width, compare };
 	qsort_r(permutation, count, sizeof(*permutation), &context, compare_sorting_permutation);
 }
+
+/*
+ * merge_sort_permutation
+ *
+ * Description:
+ * 	Recursively merge sort permutation[0..count) using scratch as temporary space.
+ */
+static void
+merge_sort_permutation(const struct compare_sorting_permutation_context *context,
+		size_t *permutation, size_t *scratch, size_t count) {
+	if (count < 2) {
+		return;
+	}
+	size_t half = count / 2;
+	merge_sort_permutation(context, permutation, scratch, half);
+	merge_sort_permutation(context, permutation + half, scratch, count - half);
+	// Skip the merge if the two halves are already in order.
+	if (compare_sorting_permutation((void *)context, &permutation[half - 1],
+				&permutation[half]) <= 0) {
+		return;
+	}
+	memcpy(scratch, permutation, half * sizeof(*permutation));
+	size_t *left  = scratch;
+	size_t *left_end = scratch + half;
+	size_t *right = permutation + half;
+	size_t *right_end = permutation + count;
+	size_t *out   = permutation;
+	while (left < left_end && right < right_end) {
+		// Take from the right only when strictly smaller, to keep the sort stable.
+		if (compare_sorting_permutation((void *)context, right, left) < 0) {
+			*out++ = *right++;
+		} else {
+			*out++ = *left++;
+		}
+	}
+	memcpy(out, left, (left_end - left) * sizeof(*left));
+}
+
+bool
+stable_sorting_permutation(const void *array, size_t width, size_t count,
+		int (*compare)(const void *, const void *), size_t *permutation) {
+	size_t *scratch = malloc((count / 2 + 1) * sizeof(*scratch));
+	if (scratch == NULL) {
+		return false;
+	}
+	struct compare_sorting_permutation_context context = { array, width, compare };
+	merge_sort_permutation(&context, permutation, scratch, count);
+	free(scratch);
+	return true;
+}
+
+bool
+radix_sorting_permutation(const uint64_t *keys, size_t count, size_t *permutation) {
+	size_t (*histogram)[256] = calloc(8, sizeof(*histogram));
+	size_t *scratch = malloc((count + 1) * sizeof(*scratch));
+	if (histogram == NULL || scratch == NULL) {
+		free(histogram);
+		free(scratch);
+		return false;
+	}
+	// Build the histograms for all 8 byte positions in one pass.
+	for (size_t i = 0; i < count; i++) {
+		permutation[i] = i;
+		for (unsigned byte = 0; byte < 8; byte++) {
+			histogram[byte][(keys[i] >> (8 * byte)) & 0xff]++;
+		}
+	}
+	size_t *from = permutation;
+	size_t *to   = scratch;
+	for (unsigned byte = 0; byte < 8 && count > 0; byte++) {
+		size_t *h = histogram[byte];
+		// Skip this pass if all keys share the same byte here.
+		if (h[(keys[0] >> (8 * byte)) & 0xff] == count) {
+			continue;
+		}
+		size_t offset = 0;
+		for (unsigned d = 0; d < 256; d++) {
+			size_t n = h[d];
+			h[d] = offset;
+			offset += n;
+		}
+		for (size_t i = 0; i < count; i++) {
+			size_t index = from[i];
+			to[h[(keys[index] >> (8 * byte)) & 0xff]++] = index;
+		}
+		size_t *tmp = from;
+		from = to;
+		to   = tmp;
+	}
+	if (from != permutation) {
+		memcpy(permutation, from, count * sizeof(*permutation));
+	}
+	free(histogram);
+	free(scratch);
+	return true;
+}
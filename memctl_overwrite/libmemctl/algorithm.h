@@ -1,6 +1,8 @@
 #ifndef MEMCTL__ALGORITHM_H_
 #define MEMCTL__ALGORITHM_H_
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 /*
@@ -62,4 +64,46 @@ const void *binary_search(const void *array, size_t width, size_t count,
 void sorting_permutation(const void *array, size_t width, size_t count,
 		int (*compare)(const void *, const void *), size_t *permutation);
 
+/*
+ * stable_sorting_permutation
+ *
+ * Description:
+ * 	Refine a sorting permutation with a stable merge sort. Unlike sorting_permutation, the
+ * 	permutation is not reset first: elements of the permutation that compare equal keep their
+ * 	relative order.
+ *
+ * Parameters:
+ * 		array			The array of values.
+ * 		width			The width of each element of the array in bytes.
+ * 		count			The number of elements in the permutation.
+ * 		compare			A comparison function for values in the array, as in
+ * 					sorting_permutation.
+ * 	inout	permutation		On entry, the indices into array to sort. On return, the
+ * 					same indices in stable sorted order.
+ *
+ * Returns:
+ * 	True on success, false if temporary memory could not be allocated.
+ */
+bool stable_sorting_permutation(const void *array, size_t width, size_t count,
+		int (*compare)(const void *, const void *), size_t *permutation);
+
+/*
+ * radix_sorting_permutation
+ *
+ * Description:
+ * 	Get the ascending sort order of an array of 64-bit keys using an LSD radix sort. The sort
+ * 	is stable, and byte positions at which all keys agree are skipped, so sorting kernel
+ * 	addresses typically takes only a few linear passes.
+ *
+ * Parameters:
+ * 		keys			The array of keys.
+ * 		count			The number of keys.
+ * 	out	permutation		On return, the permutation of { 0, 1, ..., count-1 } that
+ * 					sorts keys.
+ *
+ * Returns:
+ * 	True on success, false if temporary memory could not be allocated.
+ */
+bool radix_sorting_permutation(const uint64_t *keys, size_t count, size_t *permutation);
+
 #endif
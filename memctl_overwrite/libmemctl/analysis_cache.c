@@ -0,0 +1,384 @@
+#include "analysis_cache.h"
+
+#include "cache_file.h"
+
+#include <assert.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// The version of the file layout. Bump this whenever the layout or the symbol table image format
+// changes.
+#define ANALYSIS_FILE_FORMAT	1
+
+// The magic number at the start of a saved analysis.
+static const char analysis_file_magic[8] = "memanly1";
+
+/*
+ * struct analysis_file_header
+ *
+ * Description:
+ * 	The header of a saved analysis. It is followed by entry_count entries, and then by the
+ * 	bundle IDs and symbol table images they refer to, each aligned to 8 bytes.
+ */
+struct analysis_file_header {
+	char     magic[8];
+	uint32_t format;
+	uint32_t entry_count;
+	uint64_t finder_version;
+	uint64_t content_hash;
+	uint8_t  uuid[16];
+	uint64_t size;
+};
+
+/*
+ * struct analysis_file_entry
+ *
+ * Description:
+ * 	The saved analysis of one kext.
+ */
+struct analysis_file_entry {
+	// The kext's LC_UUID.
+	uint8_t  uuid[16];
+	// The file offset of the kext's bundle ID, which is NUL-terminated.
+	uint64_t bundle_id;
+	// The file offset and size of the kext's symbol table image.
+	uint64_t image;
+	uint64_t image_size;
+};
+
+/*
+ * struct analysis_record
+ *
+ * Description:
+ * 	A new analysis recorded by analysis_cache_add, waiting to be saved.
+ */
+struct analysis_record {
+	struct analysis_record *next;
+	uint8_t  uuid[16];
+	char *   bundle_id;
+	void *   image;
+	size_t   image_size;
+};
+
+// Whether the cache is open. The cache is not opened if the kernel has no UUID.
+static bool cache_open;
+
+// The header of the current kernel's analysis file.
+static struct analysis_file_header cache_header;
+
+// The mapped analysis file, if it matched the current kernel.
+static const void *cache_mapping;
+static size_t cache_mapping_size;
+
+// Protects cache_records.
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// The new analyses to save.
+static struct analysis_record *cache_records;
+
+/*
+ * analysis_file_map
+ *
+ * Description:
+ * 	Map the analysis file if its header matches cache_header.
+ */
+static void
+analysis_file_map(const char *name) {
+	size_t size = 0;
+	const void *data = cache_file_map(name, &size);
+	if (data == NULL) {
+		return;
+	}
+	const struct analysis_file_header *header = data;
+	size_t entries_size = 0;
+	if (size >= sizeof(*header)) {
+		entries_size = (size - sizeof(*header)) / sizeof(struct analysis_file_entry);
+	}
+	if (size < sizeof(*header)
+			|| memcmp(header->magic, cache_header.magic, sizeof(header->magic)) != 0
+			|| header->format != cache_header.format
+			|| header->finder_version != cache_header.finder_version
+			|| header->content_hash != cache_header.content_hash
+			|| memcmp(header->uuid, cache_header.uuid, sizeof(header->uuid)) != 0
+			|| header->size != size
+			|| header->entry_count > entries_size) {
+		munmap((void *) data, size);
+		return;
+	}
+	cache_mapping      = data;
+	cache_mapping_size = size;
+}
+
+void
+analysis_cache_open(const struct macho *kernel, uint64_t finder_version) {
+	assert(!cache_open);
+	memset(&cache_header, 0, sizeof(cache_header));
+	if (macho_find_uuid(kernel, cache_header.uuid) != MACHO_SUCCESS) {
+		return;
+	}
+	memcpy(cache_header.magic, analysis_file_magic, sizeof(cache_header.magic));
+	cache_header.format         = ANALYSIS_FILE_FORMAT;
+	cache_header.finder_version = finder_version;
+	cache_header.content_hash   = cache_file_hash(kernel->mh, kernel->size);
+	char name[CACHE_FILE_NAME_SIZE];
+	cache_file_name(name, "analysis-", cache_header.uuid, sizeof(cache_header.uuid));
+	analysis_file_map(name);
+	cache_open = true;
+}
+
+/*
+ * mapped_entries
+ *
+ * Description:
+ * 	Get the entries of the mapped analysis file.
+ */
+static const struct analysis_file_entry *
+mapped_entries(size_t *count) {
+	if (cache_mapping == NULL) {
+		*count = 0;
+		return NULL;
+	}
+	const struct analysis_file_header *header = cache_mapping;
+	*count = header->entry_count;
+	return (const struct analysis_file_entry *) (header + 1);
+}
+
+/*
+ * mapped_bundle_id
+ *
+ * Description:
+ * 	Get the bundle ID of an entry in the mapped analysis file, or NULL if it is malformed.
+ */
+static const char *
+mapped_bundle_id(const struct analysis_file_entry *entry) {
+	if (entry->bundle_id >= cache_mapping_size) {
+		return NULL;
+	}
+	const char *bundle_id = (const char *) cache_mapping + entry->bundle_id;
+	if (memchr(bundle_id, 0, cache_mapping_size - entry->bundle_id) == NULL) {
+		return NULL;
+	}
+	return bundle_id;
+}
+
+/*
+ * mapped_image
+ *
+ * Description:
+ * 	Get the symbol table image of an entry in the mapped analysis file, or NULL if it is
+ * 	malformed.
+ */
+static const void *
+mapped_image(const struct analysis_file_entry *entry) {
+	if (entry->image > cache_mapping_size
+			|| entry->image_size > cache_mapping_size - entry->image) {
+		return NULL;
+	}
+	return (const uint8_t *) cache_mapping + entry->image;
+}
+
+bool
+analysis_cache_find(const char *bundle_id, const struct macho *macho,
+		struct symbol_table *st) {
+	uint8_t uuid[16];
+	if (cache_mapping == NULL || macho_find_uuid(macho, uuid) != MACHO_SUCCESS) {
+		return false;
+	}
+	size_t count;
+	const struct analysis_file_entry *entry = mapped_entries(&count);
+	for (size_t i = 0; i < count; i++, entry++) {
+		const char *entry_bundle_id = mapped_bundle_id(entry);
+		if (memcmp(entry->uuid, uuid, sizeof(uuid)) != 0
+				|| entry_bundle_id == NULL
+				|| strcmp(entry_bundle_id, bundle_id) != 0) {
+			continue;
+		}
+		const void *image = mapped_image(entry);
+		return (image != NULL
+				&& symbol_table_init_with_image(st, image, entry->image_size));
+	}
+	return false;
+}
+
+void
+analysis_cache_add(const char *bundle_id, const struct macho *macho,
+		const struct symbol_table *st) {
+	if (!cache_open) {
+		return;
+	}
+	struct analysis_record *record = calloc(1, sizeof(*record));
+	if (record == NULL) {
+		return;
+	}
+	record->bundle_id  = strdup(bundle_id);
+	record->image_size = symbol_table_image_size(st);
+	record->image      = malloc(record->image_size);
+	if (macho_find_uuid(macho, record->uuid) != MACHO_SUCCESS || record->bundle_id == NULL
+			|| record->image == NULL) {
+		free(record->bundle_id);
+		free(record->image);
+		free(record);
+		return;
+	}
+	symbol_table_write_image(st, record->image);
+	pthread_mutex_lock(&cache_lock);
+	record->next  = cache_records;
+	cache_records = record;
+	pthread_mutex_unlock(&cache_lock);
+}
+
+/*
+ * is_superseded
+ *
+ * Description:
+ * 	Returns true if a mapped entry is replaced by a new record or is malformed, and so should
+ * 	not be saved again.
+ */
+static bool
+is_superseded(const struct analysis_file_entry *entry) {
+	const char *bundle_id = mapped_bundle_id(entry);
+	if (bundle_id == NULL || mapped_image(entry) == NULL) {
+		return true;
+	}
+	for (struct analysis_record *r = cache_records; r != NULL; r = r->next) {
+		if (memcmp(r->uuid, entry->uuid, sizeof(r->uuid)) == 0
+				&& strcmp(r->bundle_id, bundle_id) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * align8
+ *
+ * Description:
+ * 	Round a file offset up to a multiple of 8.
+ */
+static uint64_t
+align8(uint64_t offset) {
+	return (offset + 7) & ~(uint64_t) 7;
+}
+
+/*
+ * write_padded
+ *
+ * Description:
+ * 	Write data to the file followed by zeros up to the next multiple of 8 bytes.
+ */
+static bool
+write_padded(FILE *file, const void *data, size_t size) {
+	static const uint8_t zero[8];
+	size_t padding = align8(size) - size;
+	return (fwrite(data, 1, size, file) == size
+			&& fwrite(zero, 1, padding, file) == padding);
+}
+
+/*
+ * add_entry
+ *
+ * Description:
+ * 	Fill in a file entry for a kext and advance the data offset past its bundle ID and image.
+ */
+static void
+add_entry(struct analysis_file_entry *entry, const uint8_t uuid[16], const char *bundle_id,
+		size_t image_size, uint64_t *offset) {
+	memcpy(entry->uuid, uuid, sizeof(entry->uuid));
+	entry->bundle_id  = *offset;
+	*offset          += align8(strlen(bundle_id) + 1);
+	entry->image      = *offset;
+	entry->image_size = image_size;
+	*offset          += align8(image_size);
+}
+
+/*
+ * analysis_file_save
+ *
+ * Description:
+ * 	Write the still-valid mapped entries and the new records to a new analysis file. Failure is
+ * 	not an error.
+ */
+static void
+analysis_file_save(const char *name) {
+	// Lay out the file.
+	size_t mapped_count;
+	const struct analysis_file_entry *mapped = mapped_entries(&mapped_count);
+	size_t count = 0;
+	for (size_t i = 0; i < mapped_count; i++) {
+		count += !is_superseded(&mapped[i]);
+	}
+	for (struct analysis_record *r = cache_records; r != NULL; r = r->next) {
+		count++;
+	}
+	struct analysis_file_entry *entries = calloc(count + 1, sizeof(*entries));
+	if (entries == NULL) {
+		return;
+	}
+	uint64_t offset = sizeof(cache_header) + count * sizeof(*entries);
+	size_t e = 0;
+	for (size_t i = 0; i < mapped_count; i++) {
+		if (!is_superseded(&mapped[i])) {
+			add_entry(&entries[e++], mapped[i].uuid, mapped_bundle_id(&mapped[i]),
+					mapped[i].image_size, &offset);
+		}
+	}
+	for (struct analysis_record *r = cache_records; r != NULL; r = r->next) {
+		add_entry(&entries[e++], r->uuid, r->bundle_id, r->image_size, &offset);
+	}
+	struct analysis_file_header header = cache_header;
+	header.entry_count = count;
+	header.size        = offset;
+	// Write the file.
+	struct cache_file cf;
+	if (!cache_file_create(&cf, name)) {
+		goto out;
+	}
+	FILE *file = cf.file;
+	bool written = (fwrite(&header, sizeof(header), 1, file) == 1
+			&& fwrite(entries, sizeof(*entries), count, file) == count);
+	e = 0;
+	for (size_t i = 0; written && i < mapped_count; i++) {
+		if (!is_superseded(&mapped[i])) {
+			const char *bundle_id = mapped_bundle_id(&mapped[i]);
+			const void *image = mapped_image(&mapped[i]);
+			written = (write_padded(file, bundle_id, strlen(bundle_id) + 1)
+					&& write_padded(file, image, mapped[i].image_size));
+		}
+	}
+	for (struct analysis_record *r = cache_records; written && r != NULL; r = r->next) {
+		written = (write_padded(file, r->bundle_id, strlen(r->bundle_id) + 1)
+				&& write_padded(file, r->image, r->image_size));
+	}
+	cache_file_commit(&cf, written);
+out:
+	free(entries);
+}
+
+void
+analysis_cache_close() {
+	if (!cache_open) {
+		return;
+	}
+	if (cache_records != NULL) {
+		char name[CACHE_FILE_NAME_SIZE];
+		cache_file_name(name, "analysis-", cache_header.uuid, sizeof(cache_header.uuid));
+		analysis_file_save(name);
+	}
+	while (cache_records != NULL) {
+		struct analysis_record *record = cache_records;
+		cache_records = record->next;
+		free(record->bundle_id);
+		free(record->image);
+		free(record);
+	}
+	if (cache_mapping != NULL) {
+		munmap((void *) cache_mapping, cache_mapping_size);
+		cache_mapping      = NULL;
+		cache_mapping_size = 0;
+	}
+	cache_open = false;
+}
@@ -0,0 +1,87 @@
+#ifndef MEMCTL__ANALYSIS_CACHE_H_
+#define MEMCTL__ANALYSIS_CACHE_H_
+/*
+ * Persistent analysis cache.
+ *
+ * The symbol tables of the kernel and its kexts, including every symbol added by the symbol
+ * finders, are saved to a file in CACHE_FILE_DIR named after the kernel's LC_UUID. On later
+ * runs the file is mapped and the symbol tables are used in place, without running the finders
+ * or parsing the Mach-O symbol tables again.
+ *
+ * The file records the kernel's UUID, a hash of the kernel's contents, and the version of the
+ * symbol finders. If any of these differ, the file is ignored and rewritten. Each saved symbol
+ * table is additionally keyed by the bundle ID and LC_UUID of its kext.
+ */
+
+#include "macho.h"
+#include "symbol_table.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * analysis_cache_open
+ *
+ * Description:
+ * 	Map the saved analysis for the given kernel, if there is one, and prepare to record new
+ * 	analyses.
+ *
+ * Parameters:
+ * 		kernel			The kernel Mach-O.
+ * 		finder_version		The version of the symbol finders that will be run.
+ *
+ * Notes:
+ * 	Failure to map the saved analysis is not an error.
+ */
+void analysis_cache_open(const struct macho *kernel, uint64_t finder_version);
+
+/*
+ * analysis_cache_close
+ *
+ * Description:
+ * 	Save any analyses recorded with analysis_cache_add and unmap the saved analysis. All symbol
+ * 	tables initialized by analysis_cache_find must have been deinitialized.
+ */
+void analysis_cache_close(void);
+
+/*
+ * analysis_cache_find
+ *
+ * Description:
+ * 	Initialize a kext's symbol table from the saved analysis.
+ *
+ * Parameters:
+ * 		bundle_id		The bundle ID of the kext.
+ * 		macho			The kext's Mach-O.
+ * 	out	st			On return, the symbol table. The table refers to the mapped
+ * 					file until it is modified.
+ *
+ * Returns:
+ * 	True if the kext's analysis was found.
+ *
+ * Notes:
+ * 	This function may be called from any thread.
+ */
+bool analysis_cache_find(const char *bundle_id, const struct macho *macho,
+		struct symbol_table *st);
+
+/*
+ * analysis_cache_add
+ *
+ * Description:
+ * 	Record a kext's symbol table to be saved by analysis_cache_close.
+ *
+ * Parameters:
+ * 		bundle_id		The bundle ID of the kext.
+ * 		macho			The kext's Mach-O.
+ * 		st			The symbol table, including the symbols added by the symbol
+ * 					finders.
+ *
+ * Notes:
+ * 	This function may be called from any thread. Failure is not an error: the kext will simply
+ * 	be analyzed again next time.
+ */
+void analysis_cache_add(const char *bundle_id, const struct macho *macho,
+		const struct symbol_table *st);
+
+#endif
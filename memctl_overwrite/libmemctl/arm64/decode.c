@@ -0,0 +1,145 @@
+#include "arm64/decode.h"
+
+#include <assert.h>
+#include <pthread.h>
+
+// The number of high bits of the instruction used to classify it.
+#define CLASS_BITS	11
+#define CLASS_SHIFT	(32 - CLASS_BITS)
+
+/*
+ * struct class_pattern
+ *
+ * Description:
+ * 	The fixed bits of an instruction class that lie in the top CLASS_BITS bits of the
+ * 	instruction. The remaining fixed bits are checked by the class's decoder.
+ */
+struct class_pattern {
+	uint32_t mask;
+	uint32_t bits;
+	enum aarch64_decoded_kind kind;
+};
+
+/*
+ * class_patterns
+ *
+ * Description:
+ * 	The instruction classes supported by aarch64_decode. The patterns are disjoint.
+ */
+static const struct class_pattern class_patterns[] = {
+	{ 0x1fe00000, 0x1a000000, AARCH64_DECODED_ADC     }, // x x x 1 1 0 1 0 0 0 0
+	{ 0x1fe00000, 0x0b200000, AARCH64_DECODED_ADD_XR  }, // x x x 0 1 0 1 1 0 0 1
+	{ 0x1f000000, 0x11000000, AARCH64_DECODED_ADD_IM  }, // x x x 1 0 0 0 1 x x x
+	{ 0x1f200000, 0x0b000000, AARCH64_DECODED_ADD_SR  }, // x x x 0 1 0 1 1 x x 0
+	{ 0x1f000000, 0x10000000, AARCH64_DECODED_ADR     }, // x x x 1 0 0 0 0 x x x
+	{ 0x1f800000, 0x12000000, AARCH64_DECODED_AND_IM  }, // x x x 1 0 0 1 0 0 x x
+	{ 0x1f000000, 0x0a000000, AARCH64_DECODED_AND_SR  }, // x x x 0 1 0 1 0 x x x
+	{ 0x7c000000, 0x14000000, AARCH64_DECODED_B       }, // x 0 0 1 0 1 x x x x x
+	{ 0xfe000000, 0xd6000000, AARCH64_DECODED_BR      }, // 1 1 0 1 0 1 1 x x x x
+	{ 0x7e000000, 0x34000000, AARCH64_DECODED_CBZ     }, // x 0 1 1 0 1 0 x x x x
+	{ 0x3e000000, 0x28000000, AARCH64_DECODED_LDP     }, // x x 1 0 1 0 0 x x x x
+	{ 0x3f200000, 0x38000000, AARCH64_DECODED_LDR_IX  }, // x x 1 1 1 0 0 0 x x 0
+	{ 0x3f000000, 0x39000000, AARCH64_DECODED_LDR_UI  }, // x x 1 1 1 0 0 1 x x x
+	{ 0x3f000000, 0x18000000, AARCH64_DECODED_LDR_LIT }, // x x 0 1 1 0 0 0 x x x
+	{ 0x3f200000, 0x38200000, AARCH64_DECODED_LDR_R   }, // x x 1 1 1 0 0 0 x x 1
+	{ 0x1f800000, 0x12800000, AARCH64_DECODED_MOV     }, // x x x 1 0 0 1 0 1 x x
+	{ 0xffe00000, 0xd5000000, AARCH64_DECODED_NOP     }, // 1 1 0 1 0 1 0 1 0 0 0
+};
+
+/*
+ * class_table
+ *
+ * Description:
+ * 	The instruction class for each value of the top CLASS_BITS bits of an instruction.
+ */
+static uint8_t class_table[1 << CLASS_BITS];
+
+// Guards the one-time initialization of class_table. aarch64_decode is called from many
+// threads at once.
+static pthread_once_t class_table_once = PTHREAD_ONCE_INIT;
+
+/*
+ * init_class_table
+ *
+ * Description:
+ * 	Build class_table from class_patterns. Run once, through class_table_once.
+ */
+static void
+init_class_table() {
+	for (uint32_t index = 0; index < (1 << CLASS_BITS); index++) {
+		uint32_t ins = index << CLASS_SHIFT;
+		uint8_t kind = AARCH64_DECODED_UNKNOWN;
+		for (size_t i = 0; i < sizeof(class_patterns) / sizeof(class_patterns[0]); i++) {
+			if ((ins & class_patterns[i].mask) == class_patterns[i].bits) {
+				assert(kind == AARCH64_DECODED_UNKNOWN);
+				kind = class_patterns[i].kind;
+			}
+		}
+		class_table[index] = kind;
+	}
+}
+
+bool
+aarch64_decode(uint32_t ins, uint64_t pc, struct aarch64_decoded *decoded) {
+	pthread_once(&class_table_once, init_class_table);
+	bool success;
+	enum aarch64_decoded_kind kind = class_table[ins >> CLASS_SHIFT];
+	switch (kind) {
+		case AARCH64_DECODED_ADC:
+			success = aarch64_decode_adc(ins, &decoded->adc);
+			break;
+		case AARCH64_DECODED_ADD_XR:
+			success = aarch64_decode_add_xr(ins, &decoded->add_xr);
+			break;
+		case AARCH64_DECODED_ADD_IM:
+			success = aarch64_decode_add_im(ins, &decoded->add_im);
+			break;
+		case AARCH64_DECODED_ADD_SR:
+			success = aarch64_decode_add_sr(ins, &decoded->add_sr);
+			break;
+		case AARCH64_DECODED_ADR:
+			success = aarch64_decode_adr(ins, pc, &decoded->adr);
+			break;
+		case AARCH64_DECODED_AND_IM:
+			success = aarch64_decode_and_im(ins, &decoded->and_im);
+			break;
+		case AARCH64_DECODED_AND_SR:
+			success = aarch64_decode_and_sr(ins, &decoded->and_sr);
+			break;
+		case AARCH64_DECODED_B:
+			success = aarch64_decode_b(ins, pc, &decoded->b);
+			break;
+		case AARCH64_DECODED_BR:
+			success = aarch64_decode_br(ins, &decoded->br);
+			break;
+		case AARCH64_DECODED_CBZ:
+			success = aarch64_decode_cbz(ins, pc, &decoded->cbz);
+			break;
+		case AARCH64_DECODED_LDP:
+			success = aarch64_decode_ldp(ins, &decoded->ldp);
+			break;
+		case AARCH64_DECODED_LDR_IX:
+			success = aarch64_decode_ldr_ix(ins, &decoded->ldr_im);
+			break;
+		case AARCH64_DECODED_LDR_UI:
+			success = aarch64_decode_ldr_ui(ins, &decoded->ldr_im);
+			break;
+		case AARCH64_DECODED_LDR_LIT:
+			success = aarch64_decode_ldr_lit(ins, pc, &decoded->ldr_lit);
+			break;
+		case AARCH64_DECODED_LDR_R:
+			success = aarch64_decode_ldr_r(ins, &decoded->ldr_r);
+			break;
+		case AARCH64_DECODED_MOV:
+			success = aarch64_decode_mov(ins, &decoded->mov);
+			break;
+		case AARCH64_DECODED_NOP:
+			success = aarch64_decode_nop(ins);
+			break;
+		default:
+			success = false;
+			break;
+	}
+	decoded->kind = (success ? kind : AARCH64_DECODED_UNKNOWN);
+	return success;
+}
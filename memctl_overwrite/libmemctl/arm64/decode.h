@@ -0,0 +1,85 @@
+#ifndef MEMCTL__ARM64__DECODE_H_
+#define MEMCTL__ARM64__DECODE_H_
+
+#include "memctl/arm64/disasm.h"
+
+/*
+ * enum aarch64_decoded_kind
+ *
+ * Description:
+ * 	The kind of instruction decoded by aarch64_decode.
+ */
+enum aarch64_decoded_kind {
+	AARCH64_DECODED_UNKNOWN,
+	AARCH64_DECODED_ADC,
+	AARCH64_DECODED_ADD_XR,
+	AARCH64_DECODED_ADD_IM,
+	AARCH64_DECODED_ADD_SR,
+	AARCH64_DECODED_ADR,
+	AARCH64_DECODED_AND_IM,
+	AARCH64_DECODED_AND_SR,
+	AARCH64_DECODED_B,
+	AARCH64_DECODED_BR,
+	AARCH64_DECODED_CBZ,
+	AARCH64_DECODED_LDP,
+	AARCH64_DECODED_LDR_IX,
+	AARCH64_DECODED_LDR_UI,
+	AARCH64_DECODED_LDR_LIT,
+	AARCH64_DECODED_LDR_R,
+	AARCH64_DECODED_MOV,
+	AARCH64_DECODED_NOP,
+	AARCH64_DECODED_KIND_COUNT,
+};
+
+/*
+ * struct aarch64_decoded
+ *
+ * Description:
+ * 	A decoded instruction. The kind field selects which member of the union is valid. Both
+ * 	AARCH64_DECODED_LDR_IX and AARCH64_DECODED_LDR_UI use ldr_im.
+ */
+struct aarch64_decoded {
+	enum aarch64_decoded_kind kind;
+	union {
+		struct aarch64_ins_adc     adc;
+		struct aarch64_ins_add_xr  add_xr;
+		struct aarch64_ins_add_im  add_im;
+		struct aarch64_ins_add_sr  add_sr;
+		struct aarch64_ins_adr     adr;
+		struct aarch64_ins_and_im  and_im;
+		struct aarch64_ins_and_sr  and_sr;
+		struct aarch64_ins_b       b;
+		struct aarch64_ins_br      br;
+		struct aarch64_ins_cbz     cbz;
+		struct aarch64_ins_ldp     ldp;
+		struct aarch64_ins_ldr_im  ldr_im;
+		struct aarch64_ins_ldr_lit ldr_lit;
+		struct aarch64_ins_ldr_r   ldr_r;
+		struct aarch64_ins_mov     mov;
+	};
+};
+
+/*
+ * aarch64_decode
+ *
+ * Description:
+ * 	Decode an instruction supported by the simulator.
+ *
+ * Parameters:
+ * 		ins			The instruction.
+ * 		pc			The address of the instruction, used for PC-relative
+ * 					instructions.
+ * 	out	decoded			On return, the decoded instruction. If the instruction
+ * 					is not recognized, kind is AARCH64_DECODED_UNKNOWN.
+ *
+ * Returns:
+ * 	True if the instruction was recognized.
+ *
+ * Notes:
+ * 	The instruction class is looked up in a table indexed by the top 11 bits of the
+ * 	instruction, so exactly one of the aarch64_decode_* routines is run. This is equivalent
+ * 	to trying each of them in turn.
+ */
+bool aarch64_decode(uint32_t ins, uint64_t pc, struct aarch64_decoded *decoded);
+
+#endif
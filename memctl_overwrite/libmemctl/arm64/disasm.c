@@ -3,6 +3,7 @@
 #include "memctl/utility.h"
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <strings.h>
 
@@ -136,6 +137,51 @@ decode_bit_masks(unsigned sf, uint8_t N, uint8_t imms, uint8_t immr, uint8_t imm
 	return true;
 }
 
+/*
+ * logical_immediates
+ *
+ * Description:
+ * 	The 64-bit logical immediate for each N:immr:imms encoding, or 0 if the encoding is
+ * 	reserved. 0 is never a valid logical immediate, and the 32-bit immediate for an encoding
+ * 	with N clear is the low 32 bits of the 64-bit one, since the element size is at most 32.
+ */
+static uint64_t logical_immediates[1 << 13];
+
+// Guards the one-time initialization of logical_immediates. Instructions are decoded on
+// many threads at once.
+static pthread_once_t logical_immediates_once = PTHREAD_ONCE_INIT;
+
+/*
+ * init_logical_immediates
+ *
+ * Description:
+ * 	Build logical_immediates. Run once, through logical_immediates_once.
+ */
+static void
+init_logical_immediates() {
+	for (unsigned n = 0; n < 2; n++) {
+		for (unsigned r = 0; r < 64; r++) {
+			for (unsigned s = 0; s < 64; s++) {
+				uint64_t wmask = 0, tmask;
+				decode_bit_masks(1, n, s, r, 1, &wmask, &tmask);
+				logical_immediates[(n << 12) | (r << 6) | s] = wmask;
+			}
+		}
+	}
+}
+
+/*
+ * logical_immediate
+ *
+ * Description:
+ * 	Look up the logical immediate for the given encoding, building the table on first use.
+ */
+static uint64_t
+logical_immediate(uint8_t N, uint8_t immr, uint8_t imms) {
+	pthread_once(&logical_immediates_once, init_logical_immediates);
+	return logical_immediates[(N << 12) | (immr << 6) | imms];
+}
+
 // Generalized decoders
 
 bool
@@ -247,8 +293,8 @@ aarch64_decode_and_im(uint32_t ins, struct aarch64_ins_and_im *and_im) {
 	}
 	uint8_t immr = extract(ins, 0, 21, 16, 0);
 	uint8_t imms = extract(ins, 0, 15, 10, 0);
-	uint64_t wmask, tmask;
-	if (!decode_bit_masks(sf, N, imms, immr, 1, &wmask, &tmask)) {
+	uint64_t wmask = logical_immediate(N, immr, imms);
+	if (wmask == 0) {
 		return false;
 	}
 	and_im->and      = (opc == 0 || S);
@@ -36,7 +36,9 @@
  *  	2. Once we have collected all possible OSMetaClass instances, scan the __DATA_CONST segment
  *  	   of the kext looking for possible vtables.
  *  	3. For each vtable candidate, simulate the entry corresponding to getMetaClass and check
- *  	   whether it returns an OSMetaClass instance discovered earlier.
+ *  	   whether it returns an OSMetaClass instance discovered earlier. Each distinct
+ *  	   getMetaClass method is simulated only once, and the simulations are spread across
+ *  	   several threads.
  *  	4. If it does, then add the vtable and metaclass symbols. (We could also add the metaclass
  *  	   vtable as a symbol, but right now we don't.)
  */
@@ -44,7 +46,9 @@
 #include "memctl/arm64/ksim.h"
 #include "memctl/class.h"
 
+#include "algorithm.h"
 #include "mangle.h"
+#include "parallel.h"
 
 /*
  * struct state
@@ -273,27 +277,28 @@ collect_metaclasses(struct state *state) {
  * 	Add symbols for the OSMetaClass instance and virtual method table for the given class name.
  */
 static void
-add_symbols(struct symbol_table *symtab, const char *class_name, kaddr_t metaclass,
+add_symbols(struct symbol_table_builder *builder, const char *class_name, kaddr_t metaclass,
 		kaddr_t vtable) {
 	// Skip the symbols if the vtable address is already known.
 	size_t offset;
-	if (symbol_table_resolve_address(symtab, vtable, NULL, NULL, &offset) && offset == 0) {
+	if (symbol_table_resolve_address(builder->st, vtable, NULL, NULL, &offset) && offset == 0) {
 		return;
 	}
-	// Add the vtable symbol.
+	// Stage the vtable symbol. If the class name repeats, symbol_table_builder_finish keeps
+	// only the first vtable and metaclass symbols, since both names derive from class_name.
 	size_t vtable_symbol_size = mangle_class_vtable(NULL, 0, &class_name, 1) + 1;
 	char vtable_symbol[vtable_symbol_size];
 	mangle_class_vtable(vtable_symbol, vtable_symbol_size, &class_name, 1);
-	bool success = symbol_table_add_symbol(symtab, vtable_symbol, vtable);
+	bool success = symbol_table_builder_add(builder, vtable_symbol, vtable);
 	if (!success) {
 		return;
 	}
-	// Add the metaclass symbol.
+	// Stage the metaclass symbol.
 	const char *metaclass_name[2] = { class_name, METACLASS_INSTANCE_NAME };
 	size_t metaclass_symbol_size = mangle_class_name(NULL, 0, metaclass_name, 2) + 1;
 	char metaclass_symbol[metaclass_symbol_size];
 	mangle_class_name(metaclass_symbol, metaclass_symbol_size, metaclass_name, 2);
-	symbol_table_add_symbol(symtab, metaclass_symbol, metaclass);
+	symbol_table_builder_add(builder, metaclass_symbol, metaclass);
 }
 
 #define MIN_GETMETACLASS_INSTRUCTION_COUNT      2
@@ -333,50 +338,244 @@ looks_like_kernel_text_address(kaddr_t address) {
 #define NMETHODS           12
 #define GETMETACLASS_INDEX 7
 
+// The minimum number of getMetaClass methods worth starting a thread for.
+#define MIN_GETMETACLASS_SHARD		64
+
+/*
+ * find_vtable_candidates
+ *
+ * Description:
+ * 	Find the possible vtables in the __DATA_CONST.__const section: VTABLE_OFFSET zero words
+ * 	followed by NMETHODS words that look like kernel text addresses. The candidates are
+ * 	returned as word indices into the section, in increasing order.
+ *
+ * Notes:
+ * 	Rather than re-checking all VTABLE_OFFSET + NMETHODS words at every position, this makes
+ * 	one pass over the section tracking the current runs of zero and text words. Since text
+ * 	addresses are nonzero, a run of NMETHODS text words that starts right after at least
+ * 	VTABLE_OFFSET zero words identifies exactly one candidate.
+ */
+static bool
+find_vtable_candidates(struct state *state, size_t **candidates, size_t *count) {
+	const kaddr_t *v = state->data_const_const.data;
+	size_t n = state->data_const_const.size / sizeof(*v);
+	size_t *found = NULL;
+	size_t found_count = 0;
+	size_t capacity = 0;
+	size_t zero_run = 0;
+	size_t text_run = 0;
+	size_t zeros_before_text = 0;
+	for (size_t i = 0; i < n; i++) {
+		kaddr_t word = v[i];
+		if (word == 0) {
+			zero_run++;
+			text_run = 0;
+			continue;
+		}
+		if (!looks_like_kernel_text_address(word)) {
+			zero_run = 0;
+			text_run = 0;
+			continue;
+		}
+		if (text_run == 0) {
+			zeros_before_text = zero_run;
+		}
+		zero_run = 0;
+		text_run++;
+		if (text_run != NMETHODS || zeros_before_text < VTABLE_OFFSET) {
+			continue;
+		}
+		if (found_count == capacity) {
+			capacity = max(2 * capacity, (size_t) 64);
+			size_t *new_found = realloc(found, capacity * sizeof(*found));
+			if (new_found == NULL) {
+				free(found);
+				return false;
+			}
+			found = new_found;
+		}
+		found[found_count++] = i + 1 - NMETHODS - VTABLE_OFFSET;
+	}
+	*candidates = found;
+	*count      = found_count;
+	return true;
+}
+
+/*
+ * struct getMetaClass_memo
+ *
+ * Description:
+ * 	The result of simulating each distinct getMetaClass method. Many vtables share the same
+ * 	inherited getMetaClass implementation, so each method is simulated only once.
+ */
+struct getMetaClass_memo {
+	// The getMetaClass methods, sorted and unique.
+	kaddr_t *methods;
+	// The OSMetaClass instance returned by each method, or 0.
+	kaddr_t *metaclasses;
+	size_t   count;
+};
+
+/*
+ * struct getMetaClass_shard
+ *
+ * Description:
+ * 	A range of getMetaClass methods to simulate on one thread.
+ */
+struct getMetaClass_shard {
+	struct state             *state;
+	struct getMetaClass_memo *memo;
+	size_t                    start;
+	size_t                    end;
+};
+
+/*
+ * simulate_getMetaClass_shard
+ *
+ * Description:
+ * 	Simulate the getMetaClass methods in a shard, storing the results in the memo. This is
+ * 	the start routine for parallel_run.
+ */
+static void *
+simulate_getMetaClass_shard(void *context) {
+	struct getMetaClass_shard *shard = context;
+	struct getMetaClass_memo *memo = shard->memo;
+	for (size_t i = shard->start; i < shard->end; i++) {
+		memo->metaclasses[i] = simulate_getMetaClass(shard->state, memo->methods[i]);
+	}
+	return NULL;
+}
+
+/*
+ * compare_kaddr
+ *
+ * Description:
+ * 	Compare two kernel addresses, for qsort and binary_search.
+ */
+static int
+compare_kaddr(const void *a, const void *b) {
+	kaddr_t x = *(const kaddr_t *)a;
+	kaddr_t y = *(const kaddr_t *)b;
+	return (x < y ? -1 : x > y);
+}
+
+/*
+ * getMetaClass_memo_init
+ *
+ * Description:
+ * 	Collect the distinct getMetaClass methods of the vtable candidates and simulate each one,
+ * 	sharding the methods across threads. While kexts are being analyzed, the shards run on the
+ * 	same worker pool as the analyses.
+ */
+static bool
+getMetaClass_memo_init(struct getMetaClass_memo *memo, struct state *state,
+		const size_t *candidates, size_t candidate_count) {
+	const kaddr_t *v = state->data_const_const.data;
+	memo->methods     = malloc((candidate_count + 1) * sizeof(*memo->methods));
+	memo->metaclasses = malloc((candidate_count + 1) * sizeof(*memo->metaclasses));
+	memo->count       = 0;
+	if (memo->methods == NULL || memo->metaclasses == NULL) {
+		return false;
+	}
+	// Collect the distinct methods.
+	for (size_t i = 0; i < candidate_count; i++) {
+		memo->methods[i] = v[candidates[i] + VTABLE_OFFSET + GETMETACLASS_INDEX];
+	}
+	qsort(memo->methods, candidate_count, sizeof(*memo->methods), compare_kaddr);
+	size_t count = 0;
+	for (size_t i = 0; i < candidate_count; i++) {
+		if (count == 0 || memo->methods[count - 1] != memo->methods[i]) {
+			memo->methods[count++] = memo->methods[i];
+		}
+	}
+	memo->count = count;
+	// Simulate the methods.
+	size_t thread_count = parallel_thread_count(count, MIN_GETMETACLASS_SHARD);
+	struct getMetaClass_shard shards[PARALLEL_MAX_THREADS];
+	for (size_t t = 0; t < thread_count; t++) {
+		shards[t].state = state;
+		shards[t].memo  = memo;
+		shards[t].start = count * t / thread_count;
+		shards[t].end   = count * (t + 1) / thread_count;
+	}
+	parallel_run(simulate_getMetaClass_shard, shards, sizeof(*shards), thread_count);
+	return true;
+}
+
+/*
+ * getMetaClass_memo_deinit
+ *
+ * Description:
+ * 	Free the memo.
+ */
+static void
+getMetaClass_memo_deinit(struct getMetaClass_memo *memo) {
+	free(memo->methods);
+	free(memo->metaclasses);
+}
+
+/*
+ * getMetaClass_memo_lookup
+ *
+ * Description:
+ * 	Get the OSMetaClass instance returned by a getMetaClass method, or 0.
+ */
+static kaddr_t
+getMetaClass_memo_lookup(const struct getMetaClass_memo *memo, kaddr_t method) {
+	const kaddr_t *found = binary_search(memo->methods, sizeof(*memo->methods), memo->count,
+			compare_kaddr, &method, NULL);
+	if (found == NULL) {
+		return 0;
+	}
+	return memo->metaclasses[found - memo->methods];
+}
+
 /*
  * search_for_vtables
  *
  * Description:
  * 	Search through the __DATA_CONST.__const section for possible virtual method tables. For
  * 	each possible vtable, disassemble the getMetaClass method to see if it returns an
- * 	OSMetaClass instance found earlier. If it does, add symbols for the vtable and the
+ * 	OSMetaClass instance found earlier. If it does, stage symbols for the vtable and the
  * 	OSMetaClass instance.
+ *
+ * 	The simulations run in parallel, but the symbols are staged on this thread afterwards in
+ * 	section order, so the result does not depend on the number of threads.
  */
 static void
-search_for_vtables(struct state *state, struct kext *kext) {
-	// Look for a vtable whose 7th method returns a metaclass pointer.
+search_for_vtables(struct state *state, struct symbol_table_builder *builder) {
 	const kaddr_t *v = state->data_const_const.data;
-	const kaddr_t *end = v + state->data_const_const.size / sizeof(*v);
-	for (; v + VTABLE_OFFSET + NMETHODS <= end; v++) {
-		// Make sure all entries prior to VTABLE_OFFSET are empty.
-		for (size_t i = 0; i < VTABLE_OFFSET; i++) {
-			if (v[i] != 0) {
-				goto next;
-			}
-		}
-		// Make sure that the NMETHODS entries after VTABLE_OFFSET are nonempty.
-		for (size_t i = VTABLE_OFFSET; i < VTABLE_OFFSET + NMETHODS; i++) {
-			if (!looks_like_kernel_text_address(v[i])) {
-				goto next;
-			}
-		}
-		// Simulate the getMetaClass method.
-		kaddr_t getMetaClass = v[VTABLE_OFFSET + GETMETACLASS_INDEX];
-		kaddr_t metaclass = simulate_getMetaClass(state, getMetaClass);
+	size_t *candidates;
+	size_t candidate_count;
+	if (!find_vtable_candidates(state, &candidates, &candidate_count)) {
+		return;
+	}
+	// Simulate every distinct getMetaClass method up front.
+	struct getMetaClass_memo memo;
+	if (!getMetaClass_memo_init(&memo, state, candidates, candidate_count)) {
+		goto end;
+	}
+	// Look for a vtable whose 7th method returns a metaclass pointer.
+	for (size_t i = 0; i < candidate_count; i++) {
+		const kaddr_t *candidate = v + candidates[i];
+		kaddr_t getMetaClass = candidate[VTABLE_OFFSET + GETMETACLASS_INDEX];
+		kaddr_t metaclass = getMetaClass_memo_lookup(&memo, getMetaClass);
 		if (metaclass == 0) {
-			goto next;
+			continue;
 		}
 		// Check if this OSMetaClass instance has an associated class name.
 		const char *class_name = get_class_name_for_metaclass(state, metaclass);
 		if (class_name == NULL) {
-			goto next;
+			continue;
 		}
 		// So, we now think that this OSMetaClass instance is valid. Get the vtable address
 		// and try to add the symbols.
-		kaddr_t vtable = mapped_region_address(&state->data_const_const, v);
-		add_symbols(&kext->symtab, class_name, metaclass, vtable);
-next:;
+		kaddr_t vtable = mapped_region_address(&state->data_const_const, candidate);
+		add_symbols(builder, class_name, metaclass, vtable);
 	}
+end:
+	getMetaClass_memo_deinit(&memo);
+	free(candidates);
 }
 
 void
@@ -388,7 +587,11 @@ kext_find_vtables(struct kext *kext) {
 	if (!collect_metaclasses(&state)) {
 		goto end;
 	}
-	search_for_vtables(&state, kext);
+	// Stage the symbols and sort them into the symbol table in one pass at the end.
+	struct symbol_table_builder builder;
+	symbol_table_builder_init(&builder, &kext->symtab);
+	search_for_vtables(&state, &builder);
+	symbol_table_builder_finish(&builder);
 end:
 	deinit_state(&state);
 }
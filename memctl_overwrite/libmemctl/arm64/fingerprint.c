@@ -0,0 +1,1090 @@
+#include "arm64/fingerprint.h"
+
+#include "arm64/decode.h"
+#include "algorithm.h"
+#include "memctl/memctl_error.h"
+#include "memctl/utility.h"
+#include "parallel.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// The minimum number of functions fingerprinted by one thread.
+#define MIN_FINGERPRINT_SHARD	256
+
+// The minimum capacity of a references array.
+#define MIN_CAPACITY		64
+
+// The minimum and maximum length of a referenced string that is hashed.
+#define MIN_STRING_LENGTH	4
+#define MAX_STRING_LENGTH	256
+
+// The maximum number of rounds of hash joins and call propagation.
+#define MAX_MATCH_ROUNDS	8
+
+// The FNV-1a offset basis and prime.
+#define FNV_OFFSET		0xcbf29ce484222325
+#define FNV_PRIME		0x100000001b3
+
+/*
+ * struct segment_data
+ *
+ * Description:
+ * 	The contents of a segment of the Mach-O.
+ */
+struct segment_data {
+	const uint8_t *data;
+	kaddr_t addr;
+	size_t size;
+	bool code;
+};
+
+/*
+ * struct fingerprint_segments
+ *
+ * Description:
+ * 	The segments of the Mach-O, sorted by address.
+ */
+struct fingerprint_segments {
+	size_t count;
+	struct segment_data segment[];
+};
+
+/*
+ * enum reference_kind
+ *
+ * Description:
+ * 	The kind of a reference made by a function.
+ */
+enum reference_kind {
+	// An address formed by ADR, ADRP+ADD, ADRP+LDR, or LDR (literal).
+	REFERENCE_DATA,
+	// The target of a BL.
+	REFERENCE_CALL,
+};
+
+/*
+ * struct reference
+ *
+ * Description:
+ * 	A reference made by a function.
+ */
+struct reference {
+	enum reference_kind kind;
+	kaddr_t source;
+	kaddr_t target;
+};
+
+/*
+ * struct reference_array
+ *
+ * Description:
+ * 	A growable array of references.
+ */
+struct reference_array {
+	struct reference *references;
+	size_t count;
+	size_t capacity;
+};
+
+/*
+ * reference_fn
+ *
+ * Description:
+ * 	A callback for each reference made by a function. Returns false to stop.
+ */
+typedef bool (*reference_fn)(void *context, enum reference_kind kind, kaddr_t source,
+		kaddr_t target);
+
+/*
+ * struct page_tracker
+ *
+ * Description:
+ * 	The page addresses loaded into registers by ADRP instructions.
+ */
+struct page_tracker {
+	kaddr_t page[32];
+	// A bitmask of the registers holding a page address.
+	uint32_t valid;
+};
+
+/*
+ * struct fingerprint_shard
+ *
+ * Description:
+ * 	A run of functions to fingerprint.
+ */
+struct fingerprint_shard {
+	const struct aarch64_fingerprints *fp;
+	size_t first;
+	size_t last;
+};
+
+/*
+ * struct fingerprint_context
+ *
+ * Description:
+ * 	The fingerprint being computed by fingerprint_reference.
+ */
+struct fingerprint_context {
+	const struct aarch64_fingerprints *fp;
+	struct aarch64_fingerprint *fingerprint;
+};
+
+/*
+ * struct fingerprint_job
+ *
+ * Description:
+ * 	A Mach-O to fingerprint, possibly on another thread.
+ */
+struct fingerprint_job {
+	struct aarch64_fingerprints *fp;
+	const struct macho *macho;
+	bool success;
+};
+
+/*
+ * struct keyed_function
+ *
+ * Description:
+ * 	A function and its key in a hash join.
+ */
+struct keyed_function {
+	uint64_t key;
+	uint32_t index;
+};
+
+/*
+ * match_key_fn
+ *
+ * Description:
+ * 	Compute the key on which a hash join matches functions. Functions with a key of 0 do not
+ * 	take part in the join.
+ */
+typedef uint64_t (*match_key_fn)(const struct aarch64_fingerprint *fingerprint);
+
+/*
+ * struct join_side
+ *
+ * Description:
+ * 	The unmatched functions of one side of a hash join, sorted by key.
+ */
+struct join_side {
+	const struct aarch64_fingerprints *fp;
+	// The side's matches, used to skip functions that have already been matched.
+	const uint32_t *match;
+	match_key_fn key;
+	struct keyed_function *keyed;
+	size_t count;
+};
+
+/*
+ * struct match_state
+ *
+ * Description:
+ * 	The state of matching two sets of fingerprints.
+ */
+struct match_state {
+	const struct aarch64_fingerprints *from;
+	const struct aarch64_fingerprints *to;
+	// The match of each function in from and each function in to.
+	uint32_t *match;
+	uint32_t *reverse;
+	// The key each function in from was matched on.
+	uint8_t *keys;
+	size_t matched;
+	// The two sides of a hash join.
+	struct join_side sides[2];
+	// Scratch space for call propagation.
+	struct reference_array calls[2];
+};
+
+/*
+ * mix
+ *
+ * Description:
+ * 	Add a value to an FNV-1a style hash.
+ */
+static uint64_t
+mix(uint64_t hash, uint64_t value) {
+	return (hash ^ value) * FNV_PRIME;
+}
+
+/*
+ * normalize
+ *
+ * Description:
+ * 	Mask the registers and immediates of an instruction, keeping the opcode and the fields
+ * 	that select what the instruction does, such as the condition of a B.cond or the system
+ * 	register of an MRS.
+ */
+static uint32_t
+normalize(uint32_t ins) {
+	// Loads and stores.
+	if ((ins & 0x0a000000) == 0x08000000) {
+		// LDR (literal).
+		if ((ins & 0x3b000000) == 0x18000000) {
+			return ins & 0xff000000;
+		}
+		// Register pairs and unsigned offsets.
+		if ((ins & 0x38000000) == 0x28000000 || (ins & 0x3b000000) == 0x39000000) {
+			return ins & 0xffc00000;
+		}
+		return ins & 0xffe00c00;
+	}
+	// Data processing (register).
+	if ((ins & 0x0e000000) == 0x0a000000) {
+		// Conditional select and data processing (1 and 2 source).
+		if ((ins & 0x1f800000) == 0x1a800000) {
+			return ins & 0xffe0fc00;
+		}
+		return ins & 0xffe00000;
+	}
+	// SIMD and floating point.
+	if ((ins & 0x0e000000) == 0x0e000000) {
+		return ins & 0xffe0fc00;
+	}
+	// Data processing (immediate).
+	if ((ins & 0x1c000000) == 0x10000000) {
+		// ADR, ADRP
+		if ((ins & 0x1f000000) == 0x10000000) {
+			return ins & 0x9f000000;
+		}
+		return ins & 0xff800000;
+	}
+	// Branches, exceptions, and system instructions.
+	if ((ins & 0x1c000000) == 0x14000000) {
+		// B.cond
+		if ((ins & 0xff000010) == 0x54000000) {
+			return ins & 0xff00000f;
+		}
+		// System instructions.
+		if ((ins & 0xffc00000) == 0xd5000000) {
+			return ins & 0xffffffe0;
+		}
+		// Exception generation.
+		if ((ins & 0xff000000) == 0xd4000000) {
+			return ins & 0xffe0001f;
+		}
+		// Unconditional branch (register).
+		if ((ins & 0xfe000000) == 0xd6000000) {
+			return ins & 0xfffffc1f;
+		}
+		// B, BL, CBZ, CBNZ, TBZ, TBNZ
+		return ins & 0xfc000000;
+	}
+	return ins & 0xff000000;
+}
+
+/*
+ * compare_segment
+ *
+ * Description:
+ * 	Compare two segments by address for qsort.
+ */
+static int
+compare_segment(const void *a, const void *b) {
+	kaddr_t x = ((const struct segment_data *)a)->addr;
+	kaddr_t y = ((const struct segment_data *)b)->addr;
+	return (x < y ? -1 : x > y);
+}
+
+/*
+ * collect_segments
+ *
+ * Description:
+ * 	Collect the segments of the Mach-O that have data, sorted by address.
+ */
+static bool
+collect_segments(struct aarch64_fingerprints *fp) {
+	size_t count = 0;
+	const struct load_command *lc = NULL;
+	while ((lc = macho_next_segment(fp->macho, lc)) != NULL) {
+		count++;
+	}
+	struct fingerprint_segments *segments = calloc(1,
+			sizeof(*segments) + (count + 1) * sizeof(segments->segment[0]));
+	if (segments == NULL) {
+		return false;
+	}
+	while ((lc = macho_next_segment(fp->macho, lc)) != NULL) {
+		const struct segment_command_64 *sc = (const struct segment_command_64 *)lc;
+		struct segment_data *segment = &segments->segment[segments->count];
+		const void *data;
+		macho_segment_data(fp->macho, lc, &data, &segment->addr, &segment->size);
+		if (data == NULL || segment->size == 0) {
+			continue;
+		}
+		segment->data = data;
+		segment->code = ((sc->initprot & VM_PROT_EXECUTE) != 0);
+		segments->count++;
+	}
+	qsort(segments->segment, segments->count, sizeof(segments->segment[0]), compare_segment);
+	fp->segments = segments;
+	return true;
+}
+
+/*
+ * segment_containing
+ *
+ * Description:
+ * 	Find the segment containing an address.
+ */
+static const struct segment_data *
+segment_containing(const struct fingerprint_segments *segments, kaddr_t address) {
+	size_t lo = 0, hi = segments->count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		const struct segment_data *segment = &segments->segment[mid];
+		if (address < segment->addr) {
+			hi = mid;
+		} else if (address - segment->addr >= segment->size) {
+			lo = mid + 1;
+		} else {
+			return segment;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * function_code
+ *
+ * Description:
+ * 	Get the instructions of a function, or NULL if they are not in an executable segment.
+ * 	All of a function's blocks lie in the segment containing its start.
+ */
+static const uint32_t *
+function_code(const struct aarch64_fingerprints *fp, const struct aarch64_function *function) {
+	kaddr_t start = fp->functions.base + function->start;
+	const struct segment_data *segment = segment_containing(fp->segments, start);
+	if (segment == NULL || !segment->code) {
+		return NULL;
+	}
+	size_t available = segment->size - (start - segment->addr);
+	if (function->end - function->start > available) {
+		return NULL;
+	}
+	return (const uint32_t *)(segment->data + (start - segment->addr));
+}
+
+/*
+ * string_hash
+ *
+ * Description:
+ * 	Hash the string at an address, if there is a printable, NUL-terminated string of
+ * 	reasonable length there.
+ */
+static bool
+string_hash(const struct aarch64_fingerprints *fp, kaddr_t address, uint64_t *hash) {
+	const struct segment_data *segment = segment_containing(fp->segments, address);
+	if (segment == NULL || segment->code) {
+		return false;
+	}
+	const uint8_t *string = segment->data + (address - segment->addr);
+	size_t available = min(segment->size - (address - segment->addr),
+			(size_t) MAX_STRING_LENGTH + 1);
+	uint64_t h = FNV_OFFSET;
+	for (size_t i = 0; i < available; i++) {
+		uint8_t ch = string[i];
+		if (ch == 0) {
+			*hash = h;
+			return (i >= MIN_STRING_LENGTH);
+		}
+		if ((ch < 0x20 || ch > 0x7e) && ch != '\t' && ch != '\n') {
+			return false;
+		}
+		h = mix(h, ch);
+	}
+	return false;
+}
+
+/*
+ * tracker_set
+ *
+ * Description:
+ * 	Record the page address loaded into a register by an ADRP.
+ */
+static void
+tracker_set(struct page_tracker *tracker, aarch64_gpreg reg, kaddr_t page) {
+	unsigned n = AARCH64_GPREGID(reg);
+	if (n < 31) {
+		tracker->page[n] = page;
+		tracker->valid  |= 1u << n;
+	}
+}
+
+/*
+ * tracker_clear
+ *
+ * Description:
+ * 	Forget the page address in a register that has been overwritten.
+ */
+static void
+tracker_clear(struct page_tracker *tracker, aarch64_gpreg reg) {
+	unsigned n = AARCH64_GPREGID(reg);
+	if (n < 31) {
+		tracker->valid &= ~(1u << n);
+	}
+}
+
+/*
+ * tracker_get
+ *
+ * Description:
+ * 	Get the page address in a register, if it is known.
+ */
+static bool
+tracker_get(const struct page_tracker *tracker, aarch64_gpreg reg, kaddr_t *page) {
+	unsigned n = AARCH64_GPREGID(reg);
+	if (n >= 31 || (tracker->valid & (1u << n)) == 0) {
+		return false;
+	}
+	*page = tracker->page[n];
+	return true;
+}
+
+/*
+ * walk_instruction
+ *
+ * Description:
+ * 	Call a function for the reference made by an instruction, if any, and track the page
+ * 	addresses loaded by ADRP.
+ */
+static bool
+walk_instruction(struct page_tracker *tracker, uint32_t ins, kaddr_t pc,
+		reference_fn callback, void *context) {
+	struct aarch64_decoded d;
+	if (!aarch64_decode(ins, pc, &d)) {
+		return true;
+	}
+	kaddr_t page;
+	bool known;
+	switch (d.kind) {
+		case AARCH64_DECODED_ADR:
+			if (!d.adr.adrp) {
+				return callback(context, REFERENCE_DATA, pc, d.adr.label);
+			}
+			tracker_set(tracker, d.adr.Xd, d.adr.label);
+			return true;
+		case AARCH64_DECODED_ADD_IM:
+			known = tracker_get(tracker, d.add_im.Rn, &page);
+			tracker_clear(tracker, d.add_im.Rd);
+			if (known && d.add_im.add && !d.add_im.setflags
+					&& AARCH64_GPREGSIZE(d.add_im.Rd) == 64) {
+				kaddr_t offset = (kaddr_t) d.add_im.imm << d.add_im.shift;
+				return callback(context, REFERENCE_DATA, pc, page + offset);
+			}
+			return true;
+		case AARCH64_DECODED_LDR_UI:
+			known = tracker_get(tracker, d.ldr_im.Xn, &page);
+			if (d.ldr_im.load) {
+				tracker_clear(tracker, d.ldr_im.Rt);
+			}
+			if (known) {
+				return callback(context, REFERENCE_DATA, pc, page + d.ldr_im.imm);
+			}
+			return true;
+		case AARCH64_DECODED_LDR_LIT:
+			return callback(context, REFERENCE_DATA, pc, d.ldr_lit.label);
+		case AARCH64_DECODED_B:
+			if (d.b.link) {
+				return callback(context, REFERENCE_CALL, pc, d.b.label);
+			}
+			return true;
+		default:
+			return true;
+	}
+}
+
+/*
+ * walk_references
+ *
+ * Description:
+ * 	Call a function for each reference made by the reachable instructions of a function, in
+ * 	order of address. ADRP results are tracked from the start of the function.
+ */
+static bool
+walk_references(const struct aarch64_fingerprints *fp, const struct aarch64_function *function,
+		reference_fn callback, void *context) {
+	const uint32_t *code = function_code(fp, function);
+	if (code == NULL) {
+		return true;
+	}
+	const struct aarch64_basic_block *blocks = &fp->functions.blocks[function->first_block];
+	struct page_tracker tracker = {};
+	for (uint32_t b = 0; b < function->block_count; b++) {
+		for (uint32_t offset = blocks[b].start; offset < blocks[b].end;
+				offset += AARCH64_INSTRUCTION_SIZE) {
+			uint32_t ins = code[(offset - function->start) / AARCH64_INSTRUCTION_SIZE];
+			if (!walk_instruction(&tracker, ins, fp->functions.base + offset, callback,
+						context)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/*
+ * fingerprint_reference
+ *
+ * Description:
+ * 	A reference_fn that adds a reference to a fingerprint.
+ */
+static bool
+fingerprint_reference(void *context, enum reference_kind kind, kaddr_t source,
+		kaddr_t target) {
+	struct fingerprint_context *fc = context;
+	uint64_t hash;
+	if (kind == REFERENCE_CALL) {
+		fc->fingerprint->calls++;
+	} else if (string_hash(fc->fp, target, &hash)) {
+		// Summing keeps the hash independent of the order of the references.
+		fc->fingerprint->strings += hash;
+	}
+	return true;
+}
+
+/*
+ * fingerprint_function
+ *
+ * Description:
+ * 	Compute the fingerprint of a function.
+ */
+static void
+fingerprint_function(const struct aarch64_fingerprints *fp, size_t index) {
+	const struct aarch64_function *function = &fp->functions.functions[index];
+	struct aarch64_fingerprint *fingerprint = &fp->fingerprints[index];
+	const uint32_t *code = function_code(fp, function);
+	const struct aarch64_basic_block *blocks = &fp->functions.blocks[function->first_block];
+	uint64_t code_hash = FNV_OFFSET;
+	uint64_t shape = mix(FNV_OFFSET, function->block_count);
+	for (uint32_t b = 0; code != NULL && b < function->block_count; b++) {
+		uint32_t count = (blocks[b].end - blocks[b].start) / AARCH64_INSTRUCTION_SIZE;
+		shape = mix(mix(shape, count), blocks[b].edge_count);
+		const uint32_t *ins = code + (blocks[b].start - function->start)
+			/ AARCH64_INSTRUCTION_SIZE;
+		for (uint32_t i = 0; i < count; i++) {
+			code_hash = mix(code_hash, normalize(ins[i]));
+		}
+	}
+	*fingerprint = (struct aarch64_fingerprint) { code_hash, shape, 0, 0 };
+	struct fingerprint_context context = { fp, fingerprint };
+	walk_references(fp, function, fingerprint_reference, &context);
+}
+
+/*
+ * fingerprint_shard
+ *
+ * Description:
+ * 	Fingerprint a run of functions. This is a pthread start routine.
+ *
+ * Notes:
+ * 	This does not push errors, so it may be run on any thread.
+ */
+static void *
+fingerprint_shard(void *arg) {
+	struct fingerprint_shard *shard = arg;
+	for (size_t i = shard->first; i < shard->last; i++) {
+		fingerprint_function(shard->fp, i);
+	}
+	return NULL;
+}
+
+bool
+aarch64_fingerprints_init(struct aarch64_fingerprints *fp, const struct macho *macho) {
+	assert(macho_is_64(macho));
+	*fp = (struct aarch64_fingerprints) { macho };
+	if (!aarch64_function_index_init(&fp->functions, macho, true)) {
+		goto fail;
+	}
+	if (!aarch64_xref_index_init(&fp->xrefs, macho, true)) {
+		goto fail;
+	}
+	size_t count = fp->functions.function_count;
+	fp->fingerprints = calloc(count + 1, sizeof(*fp->fingerprints));
+	if (fp->fingerprints == NULL || !collect_segments(fp)) {
+		error_out_of_memory();
+		goto fail;
+	}
+	struct fingerprint_shard shards[PARALLEL_MAX_THREADS];
+	size_t threads = parallel_thread_count(count, MIN_FINGERPRINT_SHARD);
+	for (size_t t = 0; t < threads; t++) {
+		shards[t].fp    = fp;
+		shards[t].first = count * t / threads;
+		shards[t].last  = count * (t + 1) / threads;
+	}
+	parallel_run(fingerprint_shard, shards, sizeof(*shards), threads);
+	return true;
+fail:
+	aarch64_fingerprints_deinit(fp);
+	return false;
+}
+
+/*
+ * fingerprint_job
+ *
+ * Description:
+ * 	Fingerprint a Mach-O. This is a pthread start routine.
+ */
+static void *
+fingerprint_job(void *arg) {
+	struct fingerprint_job *job = arg;
+	job->success = aarch64_fingerprints_init(job->fp, job->macho);
+	return NULL;
+}
+
+bool
+aarch64_fingerprints_init_pair(struct aarch64_fingerprints *fp1, const struct macho *macho1,
+		struct aarch64_fingerprints *fp2, const struct macho *macho2) {
+	struct fingerprint_job jobs[2] = { { fp1, macho1 }, { fp2, macho2 } };
+	parallel_run(fingerprint_job, jobs, sizeof(*jobs), 2);
+	if (jobs[0].success && jobs[1].success) {
+		return true;
+	}
+	if (jobs[0].success) {
+		// Errors pushed on another thread are not visible on this one.
+		error_out_of_memory();
+		aarch64_fingerprints_deinit(fp1);
+	}
+	if (jobs[1].success) {
+		aarch64_fingerprints_deinit(fp2);
+	}
+	return false;
+}
+
+void
+aarch64_fingerprints_deinit(struct aarch64_fingerprints *fp) {
+	aarch64_function_index_deinit(&fp->functions);
+	aarch64_xref_index_deinit(&fp->xrefs);
+	free(fp->fingerprints);
+	free(fp->segments);
+	fp->fingerprints = NULL;
+	fp->segments     = NULL;
+}
+
+// ---- Matching ----------------------------------------------------------------------------------
+
+/*
+ * key_exact
+ *
+ * Description:
+ * 	Join on the whole fingerprint.
+ */
+static uint64_t
+key_exact(const struct aarch64_fingerprint *fingerprint) {
+	return mix(mix(mix(FNV_OFFSET, fingerprint->code), fingerprint->shape),
+			fingerprint->strings);
+}
+
+/*
+ * key_code
+ *
+ * Description:
+ * 	Join on the instructions and control flow graph, for functions whose strings changed.
+ */
+static uint64_t
+key_code(const struct aarch64_fingerprint *fingerprint) {
+	return mix(mix(FNV_OFFSET, fingerprint->code), fingerprint->shape);
+}
+
+/*
+ * key_strings_shape
+ *
+ * Description:
+ * 	Join on the strings and control flow graph, for functions whose instructions changed.
+ */
+static uint64_t
+key_strings_shape(const struct aarch64_fingerprint *fingerprint) {
+	if (fingerprint->strings == 0) {
+		return 0;
+	}
+	return mix(mix(FNV_OFFSET, fingerprint->strings), fingerprint->shape);
+}
+
+/*
+ * key_strings
+ *
+ * Description:
+ * 	Join on the strings alone.
+ */
+static uint64_t
+key_strings(const struct aarch64_fingerprint *fingerprint) {
+	return fingerprint->strings;
+}
+
+/*
+ * compare_keyed_function
+ *
+ * Description:
+ * 	Compare two keyed functions by key for qsort.
+ */
+static int
+compare_keyed_function(const void *a, const void *b) {
+	const struct keyed_function *x = a;
+	const struct keyed_function *y = b;
+	if (x->key != y->key) {
+		return (x->key < y->key ? -1 : 1);
+	}
+	return (x->index < y->index ? -1 : x->index > y->index);
+}
+
+/*
+ * join_side_prepare
+ *
+ * Description:
+ * 	Key and sort the unmatched functions of one side of a join. This is a pthread start
+ * 	routine.
+ */
+static void *
+join_side_prepare(void *arg) {
+	struct join_side *side = arg;
+	const struct aarch64_fingerprints *fp = side->fp;
+	side->count = 0;
+	for (size_t i = 0; i < fp->functions.function_count; i++) {
+		if (side->match[i] != AARCH64_NO_MATCH) {
+			continue;
+		}
+		uint64_t key = side->key(&fp->fingerprints[i]);
+		if (key != 0) {
+			side->keyed[side->count++] = (struct keyed_function) { key, i };
+		}
+	}
+	qsort(side->keyed, side->count, sizeof(*side->keyed), compare_keyed_function);
+	return NULL;
+}
+
+/*
+ * run_length
+ *
+ * Description:
+ * 	Count the functions with the same key starting at the given position of a join side.
+ */
+static size_t
+run_length(const struct join_side *side, size_t i) {
+	size_t end = i + 1;
+	while (end < side->count && side->keyed[end].key == side->keyed[i].key) {
+		end++;
+	}
+	return end - i;
+}
+
+/*
+ * add_match
+ *
+ * Description:
+ * 	Record that two functions match.
+ */
+static void
+add_match(struct match_state *state, uint32_t from, uint32_t to, enum aarch64_match_key key) {
+	state->match[from] = to;
+	state->reverse[to] = from;
+	state->keys[from]  = key;
+	state->matched++;
+}
+
+/*
+ * hash_join
+ *
+ * Description:
+ * 	Match the unmatched functions whose key is unique on both sides. The sides are keyed and
+ * 	sorted in parallel.
+ */
+static void
+hash_join(struct match_state *state, match_key_fn key, enum aarch64_match_key match_key) {
+	struct join_side *a = &state->sides[0];
+	struct join_side *b = &state->sides[1];
+	a->key = key;
+	b->key = key;
+	parallel_run(join_side_prepare, state->sides, sizeof(state->sides[0]), 2);
+	size_t i = 0, j = 0;
+	while (i < a->count && j < b->count) {
+		uint64_t ka = a->keyed[i].key;
+		uint64_t kb = b->keyed[j].key;
+		size_t ni = run_length(a, i);
+		size_t nj = run_length(b, j);
+		if (ka == kb && ni == 1 && nj == 1) {
+			add_match(state, a->keyed[i].index, b->keyed[j].index, match_key);
+		}
+		i += (ka <= kb ? ni : 0);
+		j += (kb <= ka ? nj : 0);
+	}
+}
+
+/*
+ * collect_reference
+ *
+ * Description:
+ * 	A reference_fn that appends a reference to a reference_array.
+ */
+static bool
+collect_reference(void *context, enum reference_kind kind, kaddr_t source, kaddr_t target) {
+	struct reference_array *array = context;
+	if (array->count == array->capacity) {
+		size_t capacity = max(2 * array->capacity, (size_t) MIN_CAPACITY);
+		struct reference *references = realloc(array->references,
+				capacity * sizeof(*references));
+		if (references == NULL) {
+			return false;
+		}
+		array->references = references;
+		array->capacity   = capacity;
+	}
+	array->references[array->count++] = (struct reference) { kind, source, target };
+	return true;
+}
+
+/*
+ * collect_references
+ *
+ * Description:
+ * 	Collect the references made by a function, in order of address.
+ */
+static bool
+collect_references(const struct aarch64_fingerprints *fp, uint32_t index,
+		struct reference_array *array) {
+	array->count = 0;
+	return walk_references(fp, &fp->functions.functions[index], collect_reference, array);
+}
+
+/*
+ * function_starting_at
+ *
+ * Description:
+ * 	Find the index of the function starting at an address, or AARCH64_NO_MATCH.
+ */
+static uint32_t
+function_starting_at(const struct aarch64_fingerprints *fp, kaddr_t address) {
+	const struct aarch64_function *function = aarch64_function_containing(&fp->functions,
+			address);
+	if (function == NULL || fp->functions.base + function->start != address) {
+		return AARCH64_NO_MATCH;
+	}
+	return function - fp->functions.functions;
+}
+
+/*
+ * next_call
+ *
+ * Description:
+ * 	Find the first call in a references array at or after the given position.
+ */
+static size_t
+next_call(const struct reference_array *array, size_t i) {
+	while (i < array->count && array->references[i].kind != REFERENCE_CALL) {
+		i++;
+	}
+	return i;
+}
+
+/*
+ * propagate_calls
+ *
+ * Description:
+ * 	For each matched pair of functions making the same number of calls, match the unmatched
+ * 	functions they call in the same order.
+ */
+static bool
+propagate_calls(struct match_state *state) {
+	const struct aarch64_fingerprints *from = state->from;
+	const struct aarch64_fingerprints *to   = state->to;
+	struct reference_array *calls = state->calls;
+	for (size_t f = 0; f < from->functions.function_count; f++) {
+		uint32_t t = state->match[f];
+		if (t == AARCH64_NO_MATCH || from->fingerprints[f].calls == 0
+				|| from->fingerprints[f].calls != to->fingerprints[t].calls) {
+			continue;
+		}
+		if (!collect_references(from, f, &calls[0])
+				|| !collect_references(to, t, &calls[1])) {
+			return false;
+		}
+		size_t i = next_call(&calls[0], 0);
+		size_t j = next_call(&calls[1], 0);
+		for (; i < calls[0].count && j < calls[1].count;
+				i = next_call(&calls[0], i + 1), j = next_call(&calls[1], j + 1)) {
+			uint32_t a = function_starting_at(from, calls[0].references[i].target);
+			uint32_t b = function_starting_at(to, calls[1].references[j].target);
+			if (a != AARCH64_NO_MATCH && b != AARCH64_NO_MATCH
+					&& state->match[a] == AARCH64_NO_MATCH
+					&& state->reverse[b] == AARCH64_NO_MATCH) {
+				add_match(state, a, b, AARCH64_MATCH_CALL);
+			}
+		}
+	}
+	return true;
+}
+
+bool
+aarch64_fingerprints_match(const struct aarch64_fingerprints *from,
+		const struct aarch64_fingerprints *to, uint32_t **match, uint8_t **keys,
+		size_t *matched) {
+	static const struct {
+		match_key_fn key;
+		enum aarch64_match_key match_key;
+	} joins[] = {
+		{ key_exact,         AARCH64_MATCH_EXACT         },
+		{ key_code,          AARCH64_MATCH_CODE          },
+		{ key_strings_shape, AARCH64_MATCH_STRINGS_SHAPE },
+		{ key_strings,       AARCH64_MATCH_STRINGS       },
+	};
+	size_t from_count = from->functions.function_count;
+	size_t to_count   = to->functions.function_count;
+	struct match_state state = { from, to };
+	bool success = false;
+	state.match    = malloc((from_count + 1) * sizeof(*state.match));
+	state.reverse  = malloc((to_count + 1) * sizeof(*state.reverse));
+	state.keys     = malloc((from_count + 1) * sizeof(*state.keys));
+	state.sides[0] = (struct join_side) { from, state.match };
+	state.sides[1] = (struct join_side) { to, state.reverse };
+	state.sides[0].keyed = malloc((from_count + 1) * sizeof(*state.sides[0].keyed));
+	state.sides[1].keyed = malloc((to_count + 1) * sizeof(*state.sides[1].keyed));
+	if (state.match == NULL || state.reverse == NULL || state.keys == NULL
+			|| state.sides[0].keyed == NULL || state.sides[1].keyed == NULL) {
+		goto out;
+	}
+	memset(state.match, 0xff, from_count * sizeof(*state.match));
+	memset(state.reverse, 0xff, to_count * sizeof(*state.reverse));
+	// Each round matches what it can with the joins and then extends the matches to callees,
+	// which can make more keys unique among the remaining functions.
+	for (size_t round = 0; round < MAX_MATCH_ROUNDS; round++) {
+		size_t before = state.matched;
+		for (size_t k = 0; k < sizeof(joins) / sizeof(joins[0]); k++) {
+			hash_join(&state, joins[k].key, joins[k].match_key);
+		}
+		if (!propagate_calls(&state)) {
+			goto out;
+		}
+		if (state.matched == before) {
+			break;
+		}
+	}
+	*match   = state.match;
+	*keys    = state.keys;
+	*matched = state.matched;
+	state.match = NULL;
+	state.keys  = NULL;
+	success = true;
+out:
+	if (!success) {
+		error_out_of_memory();
+	}
+	free(state.match);
+	free(state.keys);
+	free(state.reverse);
+	free(state.sides[0].keyed);
+	free(state.sides[1].keyed);
+	free(state.calls[0].references);
+	free(state.calls[1].references);
+	return success;
+}
+
+const char *
+aarch64_match_key_name(enum aarch64_match_key key) {
+	static const char *const names[AARCH64_MATCH_KEY_COUNT] = {
+		[AARCH64_MATCH_EXACT]         = "exact",
+		[AARCH64_MATCH_CODE]          = "code",
+		[AARCH64_MATCH_STRINGS_SHAPE] = "strings+shape",
+		[AARCH64_MATCH_STRINGS]       = "strings",
+		[AARCH64_MATCH_CALL]          = "call",
+	};
+	return (key < AARCH64_MATCH_KEY_COUNT ? names[key] : "unknown");
+}
+
+// ---- Porting -----------------------------------------------------------------------------------
+
+/*
+ * port_code_address
+ *
+ * Description:
+ * 	Port an address in a function through the function's match.
+ */
+static bool
+port_code_address(const struct aarch64_fingerprints *from,
+		const struct aarch64_fingerprints *to, const uint32_t *match, const uint8_t *keys,
+		const struct aarch64_function *function, kaddr_t address, kaddr_t *ported,
+		enum aarch64_match_key *key) {
+	uint32_t f = function - from->functions.functions;
+	uint32_t t = match[f];
+	if (t == AARCH64_NO_MATCH) {
+		return false;
+	}
+	kaddr_t offset = address - (from->functions.base + function->start);
+	// Only a function start can be ported if the instructions differ.
+	if (offset != 0 && key_code(&from->fingerprints[f]) != key_code(&to->fingerprints[t])) {
+		return false;
+	}
+	*ported = to->functions.base + to->functions.functions[t].start + offset;
+	*key    = keys[f];
+	return true;
+}
+
+/*
+ * port_data_address
+ *
+ * Description:
+ * 	Port a data address through the most reliably matched function that references it. The
+ * 	references of the two functions are paired in order, so they must make the same number of
+ * 	references.
+ */
+static bool
+port_data_address(const struct aarch64_fingerprints *from,
+		const struct aarch64_fingerprints *to, const uint32_t *match, const uint8_t *keys,
+		kaddr_t address, kaddr_t *ported, enum aarch64_match_key *key) {
+	struct reference_array references[2] = {};
+	bool found = false;
+	size_t first;
+	size_t count = aarch64_xref_find(&from->xrefs, address, &first);
+	for (size_t x = 0; x < count && !(found && *key == AARCH64_MATCH_EXACT); x++) {
+		kaddr_t source = aarch64_xref_source(&from->xrefs, first + x);
+		const struct aarch64_function *function = aarch64_function_containing(
+				&from->functions, source);
+		if (function == NULL) {
+			continue;
+		}
+		uint32_t f = function - from->functions.functions;
+		uint32_t t = match[f];
+		if (t == AARCH64_NO_MATCH || (found && keys[f] >= *key)) {
+			continue;
+		}
+		if (!collect_references(from, f, &references[0])
+				|| !collect_references(to, t, &references[1])) {
+			error_out_of_memory();
+			break;
+		}
+		if (references[0].count != references[1].count) {
+			continue;
+		}
+		for (size_t i = 0; i < references[0].count; i++) {
+			const struct reference *ref = &references[0].references[i];
+			const struct reference *ported_ref = &references[1].references[i];
+			if (ref->source == source && ref->target == address
+					&& ported_ref->kind == ref->kind) {
+				*ported = ported_ref->target;
+				*key    = keys[f];
+				found   = true;
+				break;
+			}
+		}
+	}
+	free(references[0].references);
+	free(references[1].references);
+	return found;
+}
+
+bool
+aarch64_fingerprints_port(const struct aarch64_fingerprints *from,
+		const struct aarch64_fingerprints *to, const uint32_t *match, const uint8_t *keys,
+		kaddr_t address, kaddr_t *ported, enum aarch64_match_key *key) {
+	enum aarch64_match_key unused;
+	if (key == NULL) {
+		key = &unused;
+	}
+	const struct aarch64_function *function = aarch64_function_containing(&from->functions,
+			address);
+	if (function != NULL) {
+		return port_code_address(from, to, match, keys, function, address, ported, key);
+	}
+	return port_data_address(from, to, match, keys, address, ported, key);
+}
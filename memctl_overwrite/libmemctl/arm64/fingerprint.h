@@ -0,0 +1,189 @@
+#ifndef MEMCTL__ARM64__FINGERPRINT_H_
+#define MEMCTL__ARM64__FINGERPRINT_H_
+/*
+ * Function fingerprinting and build-to-build matching.
+ *
+ * A fingerprint summarizes a function from the function index in a form that survives
+ * recompilation: a hash of its instructions with registers and immediates masked, a hash of the
+ * shape of its control flow graph, and a hash of the strings it references. Two kernelcaches
+ * are matched by a series of hash joins on these keys, from the most to the least specific,
+ * where a key that is unique among the unmatched functions on both sides is taken as a match.
+ * Each match is then extended to the functions the matched pair calls. Every match records the
+ * key it was made on, since only a match on the exact fingerprint is reliable.
+ *
+ * Once the functions are matched, addresses in the reference kernelcache can be ported to the
+ * new kernelcache: addresses in code by their offset in the matched function, and data
+ * addresses through the references made to them by matched functions.
+ */
+
+#include "arm64/functions.h"
+#include "arm64/xref.h"
+
+/*
+ * AARCH64_NO_MATCH
+ *
+ * Description:
+ * 	The value in a match array for a function that has no match.
+ */
+#define AARCH64_NO_MATCH	UINT32_MAX
+
+/*
+ * enum aarch64_match_key
+ *
+ * Description:
+ * 	The key on which two functions were matched, from the most to the least reliable.
+ */
+enum aarch64_match_key {
+	// The whole fingerprint.
+	AARCH64_MATCH_EXACT,
+	// The instructions and control flow graph, for functions whose strings changed.
+	AARCH64_MATCH_CODE,
+	// The strings and control flow graph, for functions whose instructions changed.
+	AARCH64_MATCH_STRINGS_SHAPE,
+	// The strings alone.
+	AARCH64_MATCH_STRINGS,
+	// The position of a call made by a matched function.
+	AARCH64_MATCH_CALL,
+	AARCH64_MATCH_KEY_COUNT,
+};
+
+/*
+ * struct aarch64_fingerprint
+ *
+ * Description:
+ * 	The fingerprint of a function.
+ */
+struct aarch64_fingerprint {
+	// The hash of the function's reachable instructions, with registers and immediates masked.
+	uint64_t code;
+	// The hash of the function's control flow graph: the number of instructions and
+	// successors of each basic block.
+	uint64_t shape;
+	// An order-independent hash of the strings the function references, or 0 if it references
+	// none.
+	uint64_t strings;
+	// The number of direct calls the function makes.
+	uint32_t calls;
+};
+
+/*
+ * struct aarch64_fingerprints
+ *
+ * Description:
+ * 	The fingerprints of every function in a Mach-O.
+ */
+struct aarch64_fingerprints {
+	// The Mach-O. It must stay mapped while the fingerprints are in use.
+	const struct macho *macho;
+	// The functions and the references made by the code.
+	struct aarch64_function_index functions;
+	struct aarch64_xref_index xrefs;
+	// The fingerprint of each function in the function index.
+	struct aarch64_fingerprint *fingerprints;
+	// The segments of the Mach-O, used to read code and strings.
+	struct fingerprint_segments *segments;
+};
+
+/*
+ * aarch64_fingerprints_init
+ *
+ * Description:
+ * 	Fingerprint every function in a Mach-O. The function and cross-reference indexes are
+ * 	loaded from or saved to CACHE_FILE_DIR, and the functions are fingerprinted in parallel.
+ *
+ * Parameters:
+ * 	out	fp			The fingerprints to initialize.
+ * 		macho			The Mach-O file.
+ *
+ * Returns:
+ * 	True if no errors were encountered.
+ */
+bool aarch64_fingerprints_init(struct aarch64_fingerprints *fp, const struct macho *macho);
+
+/*
+ * aarch64_fingerprints_init_pair
+ *
+ * Description:
+ * 	Fingerprint two Mach-O files at the same time. The second is processed on its own thread.
+ *
+ * Returns:
+ * 	True if no errors were encountered. On failure neither set of fingerprints is
+ * 	initialized.
+ */
+bool aarch64_fingerprints_init_pair(struct aarch64_fingerprints *fp1, const struct macho *macho1,
+		struct aarch64_fingerprints *fp2, const struct macho *macho2);
+
+/*
+ * aarch64_fingerprints_deinit
+ *
+ * Description:
+ * 	Free the resources used by a set of fingerprints.
+ */
+void aarch64_fingerprints_deinit(struct aarch64_fingerprints *fp);
+
+/*
+ * aarch64_fingerprints_match
+ *
+ * Description:
+ * 	Match the functions of a reference Mach-O with the functions of another build.
+ *
+ * Parameters:
+ * 		from			The fingerprints of the reference Mach-O.
+ * 		to			The fingerprints of the Mach-O to match against.
+ * 	out	match			On return, an allocated array giving, for each function in
+ * 					from, the index of the matching function in to, or
+ * 					AARCH64_NO_MATCH. The caller must free the array.
+ * 	out	keys			On return, an allocated array giving, for each matched
+ * 					function in from, the enum aarch64_match_key it was matched
+ * 					on. The caller must free the array.
+ * 	out	matched			On return, the number of functions matched.
+ *
+ * Returns:
+ * 	True if no errors were encountered.
+ */
+bool aarch64_fingerprints_match(const struct aarch64_fingerprints *from,
+		const struct aarch64_fingerprints *to, uint32_t **match, uint8_t **keys,
+		size_t *matched);
+
+/*
+ * aarch64_match_key_name
+ *
+ * Description:
+ * 	A short name for a match key, such as "exact" or "strings".
+ */
+const char *aarch64_match_key_name(enum aarch64_match_key key);
+
+/*
+ * aarch64_fingerprints_port
+ *
+ * Description:
+ * 	Find the address in the matched Mach-O corresponding to an address in the reference
+ * 	Mach-O.
+ *
+ * Parameters:
+ * 		from			The fingerprints of the reference Mach-O.
+ * 		to			The fingerprints of the matched Mach-O.
+ * 		match			The match array from aarch64_fingerprints_match.
+ * 		keys			The keys array from aarch64_fingerprints_match.
+ * 		address			The static address in the reference Mach-O.
+ * 	out	ported			On return, the corresponding static address.
+ * 	out	key			On return, the key of the match the address was ported
+ * 					through. May be NULL.
+ *
+ * Returns:
+ * 	True if the address was ported.
+ *
+ * Notes:
+ * 	A function start is ported if its function was matched. Any other address in code is
+ * 	ported only if the matched functions have the same normalized instructions. A data address
+ * 	is ported through the most reliably matched function that references it with a reference
+ * 	that can be paired with one in the matching function.
+ *
+ * 	Only an address ported through an AARCH64_MATCH_EXACT match should be trusted without
+ * 	checking it.
+ */
+bool aarch64_fingerprints_port(const struct aarch64_fingerprints *from,
+		const struct aarch64_fingerprints *to, const uint32_t *match, const uint8_t *keys,
+		kaddr_t address, kaddr_t *ported, enum aarch64_match_key *key);
+
+#endif
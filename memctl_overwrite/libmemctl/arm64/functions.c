@@ -0,0 +1,1088 @@
+#include "arm64/functions.h"
+
+#include "algorithm.h"
+#include "cache_file.h"
+#include "memctl/arm64/disasm.h"
+#include "memctl/memctl_error.h"
+#include "memctl/utility.h"
+#include "parallel.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The minimum number of instructions scanned for function starts by one thread.
+#define MIN_SCAN_SHARD		0x10000
+
+// The minimum number of functions analyzed by one thread.
+#define MIN_CFG_SHARD		256
+
+// The minimum capacity of a growable array.
+#define MIN_CAPACITY		1024
+
+// Instruction marks used while analyzing a function.
+#define MARK_VISITED		0x1
+#define MARK_LEADER		0x2
+#define MARK_BRANCH		0x4
+
+// The version of the saved index format. Bump this whenever the format or the functions found
+// by the analysis change.
+#define FUNCTION_FILE_VERSION	1
+
+// The magic number at the start of a saved index.
+static const char function_file_magic[8] = "memfunc1";
+
+/*
+ * struct function_file_header
+ *
+ * Description:
+ * 	The header of a saved function index. The functions, blocks, and edges follow the header.
+ */
+struct function_file_header {
+	char     magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint8_t  uuid[16];
+	uint64_t base;
+	uint64_t function_count;
+	uint64_t block_count;
+	uint64_t edge_count;
+};
+
+/*
+ * enum flow
+ *
+ * Description:
+ * 	How an instruction affects control flow.
+ */
+enum flow {
+	// Execution continues with the next instruction.
+	FLOW_NONE,
+	// A direct call (BL). Execution continues with the next instruction after the call.
+	FLOW_CALL,
+	// A conditional branch (B.cond, CBZ, CBNZ, TBZ, or TBNZ).
+	FLOW_CONDITIONAL,
+	// An unconditional branch (B).
+	FLOW_JUMP,
+	// An instruction after which execution does not continue in this function: an indirect
+	// branch or return, or a trap.
+	FLOW_STOP,
+};
+
+/*
+ * struct code_range
+ *
+ * Description:
+ * 	An executable segment of the Mach-O.
+ */
+struct code_range {
+	const uint32_t *code;
+	kaddr_t addr;
+	size_t count;
+};
+
+/*
+ * struct function_build
+ *
+ * Description:
+ * 	The state shared by the threads building an index.
+ */
+struct function_build {
+	// The base address of the index.
+	kaddr_t base;
+	// The executable segments, sorted by address.
+	struct code_range *ranges;
+	size_t range_count;
+	// The function starts, as sorted offsets from base.
+	uint32_t *starts;
+	size_t start_count;
+};
+
+/*
+ * struct offset_array
+ *
+ * Description:
+ * 	A growable array of 32-bit offsets.
+ */
+struct offset_array {
+	uint32_t *offsets;
+	size_t count;
+	size_t capacity;
+};
+
+/*
+ * struct scan_shard
+ *
+ * Description:
+ * 	A run of instructions to scan for function starts.
+ */
+struct scan_shard {
+	const struct function_build *build;
+	const uint32_t *code;
+	kaddr_t addr;
+	size_t count;
+	// Whether the instruction before the shard ends a function.
+	bool after_stop;
+	// The function starts found.
+	struct offset_array starts;
+	bool success;
+};
+
+/*
+ * struct cfg_shard
+ *
+ * Description:
+ * 	A run of functions to analyze. Block and edge indexes are local to the shard until the
+ * 	shards are merged.
+ */
+struct cfg_shard {
+	const struct function_build *build;
+	// The indexes of the shard's function starts.
+	size_t first;
+	size_t last;
+	// The shard's functions.
+	struct aarch64_function *functions;
+	// The blocks found.
+	struct aarch64_basic_block *blocks;
+	size_t block_count;
+	size_t block_capacity;
+	// The edges found.
+	struct offset_array edges;
+	// Scratch space for analyzing a function.
+	uint8_t *marks;
+	uint32_t *worklist;
+	size_t scratch_capacity;
+	bool success;
+};
+
+/*
+ * offset_array_add
+ *
+ * Description:
+ * 	Append an offset to an array.
+ */
+static bool
+offset_array_add(struct offset_array *array, uint32_t offset) {
+	if (array->count == array->capacity) {
+		size_t capacity = max(2 * array->capacity, (size_t) MIN_CAPACITY);
+		uint32_t *offsets = realloc(array->offsets, capacity * sizeof(*offsets));
+		if (offsets == NULL) {
+			return false;
+		}
+		array->offsets  = offsets;
+		array->capacity = capacity;
+	}
+	array->offsets[array->count++] = offset;
+	return true;
+}
+
+/*
+ * branch_label
+ *
+ * Description:
+ * 	Compute the target of a PC-relative branch whose signed word offset is in the given bits of
+ * 	the instruction.
+ */
+static kaddr_t
+branch_label(uint32_t ins, kaddr_t pc, unsigned hi, unsigned lo) {
+	unsigned bits = hi - lo + 1;
+	int64_t imm = (ins >> lo) & ((1u << bits) - 1);
+	imm = (imm ^ (1ll << (bits - 1))) - (1ll << (bits - 1));
+	return pc + imm * AARCH64_INSTRUCTION_SIZE;
+}
+
+/*
+ * classify
+ *
+ * Description:
+ * 	Determine how an instruction affects control flow and, for direct branches, its target.
+ * 	The disassembler does not decode B.cond, TBZ, or the authenticated branches, so they are
+ * 	matched here directly.
+ */
+static enum flow
+classify(uint32_t ins, kaddr_t pc, kaddr_t *target) {
+	struct aarch64_ins_b b;
+	struct aarch64_ins_cbz cbz;
+	if (aarch64_decode_b(ins, pc, &b)) {
+		*target = b.label;
+		return (b.link ? FLOW_CALL : FLOW_JUMP);
+	}
+	if (aarch64_decode_cbz(ins, pc, &cbz)) {
+		*target = cbz.label;
+		return FLOW_CONDITIONAL;
+	}
+	// B.cond
+	if ((ins & 0xff000010) == 0x54000000) {
+		*target = branch_label(ins, pc, 23, 5);
+		return FLOW_CONDITIONAL;
+	}
+	// TBZ, TBNZ
+	if ((ins & 0x7e000000) == 0x36000000) {
+		*target = branch_label(ins, pc, 18, 5);
+		return FLOW_CONDITIONAL;
+	}
+	// Unconditional branch (register): BR, BLR, RET, ERET, and their authenticated forms.
+	// Only the BLR forms return to the next instruction.
+	if ((ins & 0xfe000000) == 0xd6000000) {
+		return ((((ins >> 21) & 0x7) == 1) ? FLOW_NONE : FLOW_STOP);
+	}
+	// BRK, UDF
+	if ((ins & 0xffe0001f) == 0xd4200000 || (ins & 0xffff0000) == 0) {
+		return FLOW_STOP;
+	}
+	return FLOW_NONE;
+}
+
+/*
+ * is_prologue
+ *
+ * Description:
+ * 	Returns true if the instruction usually begins a function. If after_stop is false, only
+ * 	instructions that never appear elsewhere in a function are accepted.
+ */
+static bool
+is_prologue(uint32_t ins, bool after_stop) {
+	// PACIASP, PACIBSP
+	if (ins == 0xd503233f || ins == 0xd503237f) {
+		return true;
+	}
+	if (!after_stop) {
+		return false;
+	}
+	// STP Xt1, Xt2, [SP, #-imm]!
+	if ((ins & 0xffe003e0) == 0xa9a003e0) {
+		return true;
+	}
+	// SUB SP, SP, #imm
+	return ((ins & 0xff8003ff) == 0xd10003ff);
+}
+
+/*
+ * code_range_containing
+ *
+ * Description:
+ * 	Find the executable segment containing an address.
+ */
+static const struct code_range *
+code_range_containing(const struct function_build *build, kaddr_t address) {
+	size_t lo = 0, hi = build->range_count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		const struct code_range *range = &build->ranges[mid];
+		if (address < range->addr) {
+			hi = mid;
+		} else if (address >= range->addr + range->count * AARCH64_INSTRUCTION_SIZE) {
+			lo = mid + 1;
+		} else {
+			return range;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * scan_shard
+ *
+ * Description:
+ * 	Find the call targets and prologues in a run of instructions. This is a pthread start
+ * 	routine.
+ *
+ * Notes:
+ * 	This does not push errors, so it may be run on any thread.
+ */
+static void *
+scan_shard(void *arg) {
+	struct scan_shard *shard = arg;
+	const struct function_build *build = shard->build;
+	bool after_stop = shard->after_stop;
+	shard->success = false;
+	for (size_t i = 0; i < shard->count; i++) {
+		kaddr_t pc = shard->addr + i * AARCH64_INSTRUCTION_SIZE;
+		uint32_t ins = shard->code[i];
+		kaddr_t target;
+		enum flow flow = classify(ins, pc, &target);
+		if (is_prologue(ins, after_stop)) {
+			if (!offset_array_add(&shard->starts, pc - build->base)) {
+				return NULL;
+			}
+		}
+		if (flow == FLOW_CALL && (target & (AARCH64_INSTRUCTION_SIZE - 1)) == 0
+				&& code_range_containing(build, target) != NULL) {
+			if (!offset_array_add(&shard->starts, target - build->base)) {
+				return NULL;
+			}
+		}
+		after_stop = (flow == FLOW_JUMP || flow == FLOW_STOP);
+	}
+	shard->success = true;
+	return NULL;
+}
+
+/*
+ * compare_offset
+ *
+ * Description:
+ * 	Compare two offsets for qsort.
+ */
+static int
+compare_offset(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	return (x < y ? -1 : x > y);
+}
+
+/*
+ * compare_code_range
+ *
+ * Description:
+ * 	Compare two code ranges by address for qsort.
+ */
+static int
+compare_code_range(const void *a, const void *b) {
+	kaddr_t x = ((const struct code_range *)a)->addr;
+	kaddr_t y = ((const struct code_range *)b)->addr;
+	return (x < y ? -1 : x > y);
+}
+
+/*
+ * add_initializers
+ *
+ * Description:
+ * 	Add the functions in __mod_init_func to the function starts.
+ */
+static bool
+add_initializers(struct offset_array *starts, const struct function_build *build,
+		const struct macho *macho) {
+	const struct load_command *lc = NULL;
+	while ((lc = macho_next_segment(macho, lc)) != NULL) {
+		const struct section_64 *sect = macho_find_section(macho, lc, "__mod_init_func");
+		if (sect == NULL) {
+			continue;
+		}
+		const void *data;
+		kaddr_t addr;
+		size_t size;
+		macho_section_data(macho, lc, sect, &data, &addr, &size);
+		const kaddr_t *init = data;
+		for (size_t i = 0; data != NULL && i < size / sizeof(*init); i++) {
+			if (code_range_containing(build, init[i]) != NULL
+					&& !offset_array_add(starts, init[i] - build->base)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/*
+ * collect_starts
+ *
+ * Description:
+ * 	Find the function starts in all the executable segments, sort them, and remove duplicates.
+ * 	Each segment also starts a function.
+ */
+static bool
+collect_starts(struct function_build *build, const struct macho *macho) {
+	struct offset_array starts = {};
+	struct scan_shard shards[PARALLEL_MAX_THREADS];
+	bool success = false;
+	for (size_t r = 0; r < build->range_count; r++) {
+		const struct code_range *range = &build->ranges[r];
+		if (range->count == 0) {
+			continue;
+		}
+		if (!offset_array_add(&starts, range->addr - build->base)) {
+			goto out;
+		}
+		// Split the segment into shards, each of which starts scanning after the
+		// instruction ending the previous shard.
+		size_t count = parallel_thread_count(range->count, MIN_SCAN_SHARD);
+		for (size_t t = 0; t < count; t++) {
+			size_t first = range->count * t / count;
+			size_t last  = range->count * (t + 1) / count;
+			kaddr_t target;
+			shards[t] = (struct scan_shard) { build };
+			shards[t].code  = range->code + first;
+			shards[t].addr  = range->addr + first * AARCH64_INSTRUCTION_SIZE;
+			shards[t].count = last - first;
+			if (first == 0) {
+				shards[t].after_stop = true;
+			} else {
+				enum flow flow = classify(range->code[first - 1],
+						shards[t].addr - AARCH64_INSTRUCTION_SIZE, &target);
+				shards[t].after_stop = (flow == FLOW_JUMP || flow == FLOW_STOP);
+			}
+		}
+		parallel_run(scan_shard, shards, sizeof(*shards), count);
+		bool scanned = true;
+		for (size_t t = 0; t < count; t++) {
+			struct offset_array *found = &shards[t].starts;
+			scanned &= shards[t].success;
+			for (size_t i = 0; scanned && i < found->count; i++) {
+				scanned = offset_array_add(&starts, found->offsets[i]);
+			}
+			free(found->offsets);
+		}
+		if (!scanned) {
+			goto out;
+		}
+	}
+	if (!add_initializers(&starts, build, macho)) {
+		goto out;
+	}
+	qsort(starts.offsets, starts.count, sizeof(*starts.offsets), compare_offset);
+	size_t count = 0;
+	for (size_t i = 0; i < starts.count; i++) {
+		if (count == 0 || starts.offsets[count - 1] != starts.offsets[i]) {
+			starts.offsets[count++] = starts.offsets[i];
+		}
+	}
+	build->starts      = starts.offsets;
+	build->start_count = count;
+	starts.offsets     = NULL;
+	success = true;
+out:
+	free(starts.offsets);
+	return success;
+}
+
+/*
+ * add_block
+ *
+ * Description:
+ * 	Append a basic block to a shard.
+ */
+static bool
+add_block(struct cfg_shard *shard, uint32_t start) {
+	if (shard->block_count == shard->block_capacity) {
+		size_t capacity = max(2 * shard->block_capacity, (size_t) MIN_CAPACITY);
+		struct aarch64_basic_block *blocks = realloc(shard->blocks,
+				capacity * sizeof(*blocks));
+		if (blocks == NULL) {
+			return false;
+		}
+		shard->blocks         = blocks;
+		shard->block_capacity = capacity;
+	}
+	shard->blocks[shard->block_count++] = (struct aarch64_basic_block) {
+		start, start + AARCH64_INSTRUCTION_SIZE, 0, 0
+	};
+	return true;
+}
+
+/*
+ * add_edge
+ *
+ * Description:
+ * 	Add an edge from the most recent block of a function to the block starting at the given
+ * 	offset, if the function has one.
+ */
+static bool
+add_edge(struct cfg_shard *shard, const struct aarch64_function *function, uint32_t target) {
+	const struct aarch64_basic_block *blocks = &shard->blocks[function->first_block];
+	size_t lo = 0, hi = function->block_count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (blocks[mid].start < target) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo == function->block_count || blocks[lo].start != target) {
+		return true;
+	}
+	return offset_array_add(&shard->edges, function->first_block + lo);
+}
+
+/*
+ * reserve_scratch
+ *
+ * Description:
+ * 	Make sure the shard's scratch space can hold a function of the given number of
+ * 	instructions.
+ */
+static bool
+reserve_scratch(struct cfg_shard *shard, size_t count) {
+	if (count <= shard->scratch_capacity) {
+		return true;
+	}
+	size_t capacity = max(count, 2 * shard->scratch_capacity);
+	uint8_t *marks = realloc(shard->marks, capacity * sizeof(*marks));
+	if (marks == NULL) {
+		return false;
+	}
+	shard->marks = marks;
+	uint32_t *worklist = realloc(shard->worklist, (capacity + 1) * sizeof(*worklist));
+	if (worklist == NULL) {
+		return false;
+	}
+	shard->worklist         = worklist;
+	shard->scratch_capacity = capacity;
+	return true;
+}
+
+/*
+ * mark_reachable
+ *
+ * Description:
+ * 	Mark the instructions reachable from the start of a function without leaving it, the
+ * 	instructions that begin basic blocks, and the branches that end them.
+ */
+static void
+mark_reachable(struct cfg_shard *shard, const uint32_t *code, kaddr_t start, size_t count) {
+	uint8_t *marks = shard->marks;
+	uint32_t *worklist = shard->worklist;
+	size_t pending = 0;
+	memset(marks, 0, count * sizeof(*marks));
+	marks[0] = MARK_LEADER;
+	worklist[pending++] = 0;
+	while (pending > 0) {
+		size_t i = worklist[--pending];
+		for (; i < count; i++) {
+			if (marks[i] & MARK_VISITED) {
+				// Execution joins code that has already been visited.
+				marks[i] |= MARK_LEADER;
+				break;
+			}
+			marks[i] |= MARK_VISITED;
+			kaddr_t target;
+			enum flow flow = classify(code[i], start + i * AARCH64_INSTRUCTION_SIZE,
+					&target);
+			if (flow == FLOW_CONDITIONAL || flow == FLOW_JUMP) {
+				marks[i] |= MARK_BRANCH;
+				size_t t = (target - start) / AARCH64_INSTRUCTION_SIZE;
+				if (target >= start && t < count
+						&& (target & (AARCH64_INSTRUCTION_SIZE - 1)) == 0) {
+					marks[t] |= MARK_LEADER;
+					worklist[pending++] = t;
+				}
+			}
+			if (flow == FLOW_JUMP) {
+				break;
+			}
+			if (flow == FLOW_STOP) {
+				marks[i] |= MARK_BRANCH;
+				break;
+			}
+			if (flow == FLOW_CONDITIONAL && i + 1 < count) {
+				marks[i + 1] |= MARK_LEADER;
+			}
+		}
+	}
+}
+
+/*
+ * analyze_function
+ *
+ * Description:
+ * 	Build the control flow graph of the function at the given start index, which ends no later
+ * 	than the next function start or the end of its segment.
+ */
+static bool
+analyze_function(struct cfg_shard *shard, size_t index) {
+	const struct function_build *build = shard->build;
+	struct aarch64_function *function = &shard->functions[index - shard->first];
+	uint32_t offset = build->starts[index];
+	kaddr_t start = build->base + offset;
+	const struct code_range *range = code_range_containing(build, start);
+	assert(range != NULL);
+	kaddr_t limit = range->addr + range->count * AARCH64_INSTRUCTION_SIZE;
+	if (index + 1 < build->start_count) {
+		limit = min(limit, build->base + build->starts[index + 1]);
+	}
+	size_t count = (limit - start) / AARCH64_INSTRUCTION_SIZE;
+	const uint32_t *code = range->code + (start - range->addr) / AARCH64_INSTRUCTION_SIZE;
+	if (!reserve_scratch(shard, count)) {
+		return false;
+	}
+	mark_reachable(shard, code, start, count);
+	// Split the reachable instructions into basic blocks.
+	const uint8_t *marks = shard->marks;
+	function->start       = offset;
+	function->first_block = shard->block_count;
+	for (size_t i = 0; i < count; i++) {
+		if ((marks[i] & MARK_VISITED) == 0) {
+			continue;
+		}
+		uint32_t pc = offset + i * AARCH64_INSTRUCTION_SIZE;
+		if (i == 0 || (marks[i] & MARK_LEADER) || (marks[i - 1] & MARK_VISITED) == 0
+				|| (marks[i - 1] & MARK_BRANCH)) {
+			if (!add_block(shard, pc)) {
+				return false;
+			}
+		}
+		shard->blocks[shard->block_count - 1].end = pc + AARCH64_INSTRUCTION_SIZE;
+		function->end = pc + AARCH64_INSTRUCTION_SIZE;
+	}
+	function->block_count = shard->block_count - function->first_block;
+	// Connect the blocks.
+	for (size_t b = function->first_block; b < shard->block_count; b++) {
+		struct aarch64_basic_block *block = &shard->blocks[b];
+		kaddr_t pc = build->base + block->end - AARCH64_INSTRUCTION_SIZE;
+		block->first_edge = shard->edges.count;
+		kaddr_t target;
+		enum flow flow = classify(code[(pc - start) / AARCH64_INSTRUCTION_SIZE], pc,
+				&target);
+		bool ok = true;
+		if (flow == FLOW_CONDITIONAL || flow == FLOW_JUMP) {
+			if (start <= target && target < limit) {
+				ok = add_edge(shard, function, target - build->base);
+			}
+		}
+		if (ok && flow != FLOW_JUMP && flow != FLOW_STOP) {
+			ok = add_edge(shard, function, block->end);
+		}
+		if (!ok) {
+			return false;
+		}
+		block->edge_count = shard->edges.count - block->first_edge;
+	}
+	return true;
+}
+
+/*
+ * analyze_shard
+ *
+ * Description:
+ * 	Analyze each function in a shard. This is a pthread start routine.
+ *
+ * Notes:
+ * 	This does not push errors, so it may be run on any thread.
+ */
+static void *
+analyze_shard(void *arg) {
+	struct cfg_shard *shard = arg;
+	shard->success = false;
+	for (size_t i = shard->first; i < shard->last; i++) {
+		if (!analyze_function(shard, i)) {
+			return NULL;
+		}
+	}
+	shard->success = true;
+	return NULL;
+}
+
+/*
+ * build_cfgs
+ *
+ * Description:
+ * 	Analyze every function in parallel and merge the results into the index.
+ */
+static bool
+build_cfgs(struct aarch64_function_index *index, const struct function_build *build) {
+	struct cfg_shard shards[PARALLEL_MAX_THREADS] = {};
+	size_t count = parallel_thread_count(build->start_count, MIN_CFG_SHARD);
+	struct aarch64_function *functions = calloc(build->start_count + 1, sizeof(*functions));
+	struct aarch64_basic_block *blocks = NULL;
+	uint32_t *edges = NULL;
+	bool success = false;
+	if (functions == NULL) {
+		goto out;
+	}
+	for (size_t t = 0; t < count; t++) {
+		shards[t].build     = build;
+		shards[t].first     = build->start_count * t / count;
+		shards[t].last      = build->start_count * (t + 1) / count;
+		shards[t].functions = functions + shards[t].first;
+	}
+	parallel_run(analyze_shard, shards, sizeof(*shards), count);
+	// Merge the shards, rebasing their block and edge indexes.
+	size_t block_count = 0, edge_count = 0;
+	for (size_t t = 0; t < count; t++) {
+		if (!shards[t].success) {
+			goto out;
+		}
+		block_count += shards[t].block_count;
+		edge_count  += shards[t].edges.count;
+	}
+	blocks = malloc((block_count + 1) * sizeof(*blocks));
+	edges  = malloc((edge_count + 1) * sizeof(*edges));
+	if (blocks == NULL || edges == NULL) {
+		goto out;
+	}
+	size_t block_base = 0, edge_base = 0;
+	for (size_t t = 0; t < count; t++) {
+		struct cfg_shard *shard = &shards[t];
+		for (size_t f = shard->first; f < shard->last; f++) {
+			functions[f].first_block += block_base;
+		}
+		for (size_t b = 0; b < shard->block_count; b++) {
+			blocks[block_base + b] = shard->blocks[b];
+			blocks[block_base + b].first_edge += edge_base;
+		}
+		for (size_t e = 0; e < shard->edges.count; e++) {
+			edges[edge_base + e] = shard->edges.offsets[e] + block_base;
+		}
+		block_base += shard->block_count;
+		edge_base  += shard->edges.count;
+	}
+	index->base           = build->base;
+	index->functions      = functions;
+	index->function_count = build->start_count;
+	index->blocks         = blocks;
+	index->block_count    = block_count;
+	index->edges          = edges;
+	index->edge_count     = edge_count;
+	functions = NULL;
+	blocks    = NULL;
+	edges     = NULL;
+	success = true;
+out:
+	for (size_t t = 0; t < count; t++) {
+		free(shards[t].blocks);
+		free(shards[t].edges.offsets);
+		free(shards[t].marks);
+		free(shards[t].worklist);
+	}
+	free(functions);
+	free(blocks);
+	free(edges);
+	return success;
+}
+
+/*
+ * collect_code_ranges
+ *
+ * Description:
+ * 	Collect the executable segments that can be represented relative to the base, sorted by
+ * 	address.
+ */
+static bool
+collect_code_ranges(struct function_build *build, const struct macho *macho) {
+	size_t count = 0;
+	const struct load_command *lc = NULL;
+	while ((lc = macho_next_segment(macho, lc)) != NULL) {
+		count++;
+	}
+	build->ranges = calloc(count + 1, sizeof(*build->ranges));
+	if (build->ranges == NULL) {
+		return false;
+	}
+	while ((lc = macho_next_segment(macho, lc)) != NULL) {
+		const struct segment_command_64 *sc = (const struct segment_command_64 *)lc;
+		if ((sc->initprot & VM_PROT_EXECUTE) == 0) {
+			continue;
+		}
+		struct code_range *range = &build->ranges[build->range_count];
+		const void *data;
+		size_t size;
+		macho_segment_data(macho, lc, &data, &range->addr, &size);
+		if (data == NULL || range->addr < build->base
+				|| range->addr + size - build->base > UINT32_MAX) {
+			continue;
+		}
+		range->code  = data;
+		range->count = size / AARCH64_INSTRUCTION_SIZE;
+		build->range_count++;
+	}
+	qsort(build->ranges, build->range_count, sizeof(*build->ranges), compare_code_range);
+	return true;
+}
+
+/*
+ * function_index_build
+ *
+ * Description:
+ * 	Find the functions in the Mach-O and build their control flow graphs.
+ */
+static bool
+function_index_build(struct aarch64_function_index *index, const struct macho *macho) {
+	assert(macho_is_64(macho));
+	struct function_build build = {};
+	build.base = macho_lowest_address(macho);
+	bool success = (collect_code_ranges(&build, macho)
+			&& collect_starts(&build, macho)
+			&& build_cfgs(index, &build));
+	if (!success) {
+		error_out_of_memory();
+	}
+	free(build.ranges);
+	free(build.starts);
+	return success;
+}
+
+/*
+ * read_array
+ *
+ * Description:
+ * 	Allocate an array and read it from a file.
+ */
+static void *
+read_array(FILE *file, size_t width, uint64_t count) {
+	if (count > SIZE_MAX / width - 1) {
+		return NULL;
+	}
+	void *array = malloc((count + 1) * width);
+	if (array != NULL && fread(array, width, count, file) != count) {
+		free(array);
+		return NULL;
+	}
+	return array;
+}
+
+/*
+ * function_index_valid
+ *
+ * Description:
+ * 	Check that the functions of a loaded index are sorted and that every block and edge index
+ * 	lies within its array.
+ */
+static bool
+function_index_valid(const struct aarch64_function_index *index) {
+	for (size_t i = 0; i < index->function_count; i++) {
+		const struct aarch64_function *function = &index->functions[i];
+		if (function->start > function->end
+				|| (i > 0 && function->start < index->functions[i - 1].end)
+				|| (uint64_t) function->first_block + function->block_count
+				> index->block_count) {
+			return false;
+		}
+	}
+	for (size_t i = 0; i < index->block_count; i++) {
+		const struct aarch64_basic_block *block = &index->blocks[i];
+		if ((uint64_t) block->first_edge + block->edge_count > index->edge_count) {
+			return false;
+		}
+	}
+	for (size_t i = 0; i < index->edge_count; i++) {
+		if (index->edges[i] >= index->block_count) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * function_index_load
+ *
+ * Description:
+ * 	Load a saved index, if it exists and matches the Mach-O. Failure is not an error.
+ */
+static bool
+function_index_load(struct aarch64_function_index *index, const char *name,
+		const uint8_t uuid[16], kaddr_t base) {
+	FILE *file = cache_file_open(name);
+	if (file == NULL) {
+		return false;
+	}
+	struct function_file_header header;
+	struct aarch64_function_index loaded = {};
+	if (fread(&header, sizeof(header), 1, file) != 1
+			|| memcmp(header.magic, function_file_magic, sizeof(header.magic)) != 0
+			|| header.version != FUNCTION_FILE_VERSION
+			|| memcmp(header.uuid, uuid, sizeof(header.uuid)) != 0
+			|| header.base != base) {
+		goto fail;
+	}
+	loaded.functions = read_array(file, sizeof(*loaded.functions), header.function_count);
+	if (loaded.functions == NULL) {
+		goto fail;
+	}
+	loaded.blocks = read_array(file, sizeof(*loaded.blocks), header.block_count);
+	if (loaded.blocks == NULL) {
+		goto fail;
+	}
+	loaded.edges = read_array(file, sizeof(*loaded.edges), header.edge_count);
+	if (loaded.edges == NULL) {
+		goto fail;
+	}
+	fclose(file);
+	file = NULL;
+	loaded.base           = base;
+	loaded.function_count = header.function_count;
+	loaded.block_count    = header.block_count;
+	loaded.edge_count     = header.edge_count;
+	if (!function_index_valid(&loaded)) {
+		goto fail;
+	}
+	*index = loaded;
+	return true;
+fail:
+	aarch64_function_index_deinit(&loaded);
+	if (file != NULL) {
+		fclose(file);
+	}
+	return false;
+}
+
+/*
+ * function_index_save
+ *
+ * Description:
+ * 	Save an index for later runs. Failure is not an error.
+ */
+static void
+function_index_save(const struct aarch64_function_index *index, const char *name,
+		const uint8_t uuid[16]) {
+	struct cache_file cf;
+	if (!cache_file_create(&cf, name)) {
+		return;
+	}
+	FILE *file = cf.file;
+	struct function_file_header header = {};
+	memcpy(header.magic, function_file_magic, sizeof(header.magic));
+	header.version = FUNCTION_FILE_VERSION;
+	memcpy(header.uuid, uuid, sizeof(header.uuid));
+	header.base           = index->base;
+	header.function_count = index->function_count;
+	header.block_count    = index->block_count;
+	header.edge_count     = index->edge_count;
+	bool written = (fwrite(&header, sizeof(header), 1, file) == 1
+			&& fwrite(index->functions, sizeof(*index->functions),
+				index->function_count, file) == index->function_count
+			&& fwrite(index->blocks, sizeof(*index->blocks),
+				index->block_count, file) == index->block_count
+			&& fwrite(index->edges, sizeof(*index->edges),
+				index->edge_count, file) == index->edge_count);
+	cache_file_commit(&cf, written);
+}
+
+bool
+aarch64_function_index_init(struct aarch64_function_index *index, const struct macho *macho,
+		bool persist) {
+	uint8_t uuid[16];
+	char name[CACHE_FILE_NAME_SIZE];
+	persist = persist && macho_find_uuid(macho, uuid) == MACHO_SUCCESS;
+	if (persist) {
+		cache_file_name(name, "functions-", uuid, sizeof(uuid));
+		if (function_index_load(index, name, uuid, macho_lowest_address(macho))) {
+			return true;
+		}
+	}
+	if (!function_index_build(index, macho)) {
+		return false;
+	}
+	if (persist) {
+		function_index_save(index, name, uuid);
+	}
+	return true;
+}
+
+void
+aarch64_function_index_deinit(struct aarch64_function_index *index) {
+	free(index->functions);
+	free(index->blocks);
+	free(index->edges);
+	index->functions      = NULL;
+	index->function_count = 0;
+	index->blocks         = NULL;
+	index->block_count    = 0;
+	index->edges          = NULL;
+	index->edge_count     = 0;
+}
+
+const struct aarch64_function *
+aarch64_function_containing(const struct aarch64_function_index *index, kaddr_t address) {
+	if (address < index->base || address - index->base > UINT32_MAX) {
+		return NULL;
+	}
+	uint32_t offset = address - index->base;
+	// Find the last function starting at or before the address.
+	size_t lo = 0, hi = index->function_count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (index->functions[mid].start <= offset) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo == 0 || offset >= index->functions[lo - 1].end) {
+		return NULL;
+	}
+	return &index->functions[lo - 1];
+}
+
+// ---- Shared indexes ----------------------------------------------------------------------------
+
+/*
+ * struct shared_function_index
+ *
+ * Description:
+ * 	A function index shared through aarch64_function_index_get.
+ */
+struct shared_function_index {
+	struct shared_function_index *next;
+	// The Mach-O the index describes.
+	const void *mh;
+	size_t size;
+	// Held while the index is built, so that other threads wait for it.
+	pthread_mutex_t lock;
+	bool built;
+	bool success;
+	// Set once the index has been built successfully, for aarch64_function_index_find.
+	atomic_bool ready;
+	struct aarch64_function_index index;
+};
+
+// Protects shared_function_indexes.
+static pthread_mutex_t shared_function_indexes_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// The shared function indexes.
+static struct shared_function_index *shared_function_indexes;
+
+const struct aarch64_function_index *
+aarch64_function_index_get(const struct macho *macho) {
+	pthread_mutex_lock(&shared_function_indexes_lock);
+	struct shared_function_index *shared = shared_function_indexes;
+	while (shared != NULL && (shared->mh != macho->mh || shared->size != macho->size)) {
+		shared = shared->next;
+	}
+	if (shared == NULL) {
+		shared = calloc(1, sizeof(*shared));
+		if (shared == NULL) {
+			pthread_mutex_unlock(&shared_function_indexes_lock);
+			error_out_of_memory();
+			return NULL;
+		}
+		shared->mh   = macho->mh;
+		shared->size = macho->size;
+		pthread_mutex_init(&shared->lock, NULL);
+		shared->next = shared_function_indexes;
+		shared_function_indexes = shared;
+	}
+	pthread_mutex_unlock(&shared_function_indexes_lock);
+	// Build the index without holding the list lock, so that indexes for other Mach-O files
+	// can be built at the same time.
+	pthread_mutex_lock(&shared->lock);
+	if (!shared->built) {
+		shared->success = aarch64_function_index_init(&shared->index, macho, true);
+		shared->built   = true;
+		atomic_store_explicit(&shared->ready, shared->success, memory_order_release);
+	}
+	pthread_mutex_unlock(&shared->lock);
+	return (shared->success ? &shared->index : NULL);
+}
+
+const struct aarch64_function_index *
+aarch64_function_index_find(const struct macho *macho) {
+	const struct aarch64_function_index *index = NULL;
+	pthread_mutex_lock(&shared_function_indexes_lock);
+	struct shared_function_index *shared = shared_function_indexes;
+	while (shared != NULL && (shared->mh != macho->mh || shared->size != macho->size)) {
+		shared = shared->next;
+	}
+	// An index that is still being built is not waited for.
+	if (shared != NULL && atomic_load_explicit(&shared->ready, memory_order_acquire)) {
+		index = &shared->index;
+	}
+	pthread_mutex_unlock(&shared_function_indexes_lock);
+	return index;
+}
+
+void
+aarch64_function_index_cache_clear() {
+	pthread_mutex_lock(&shared_function_indexes_lock);
+	while (shared_function_indexes != NULL) {
+		struct shared_function_index *shared = shared_function_indexes;
+		shared_function_indexes = shared->next;
+		aarch64_function_index_deinit(&shared->index);
+		pthread_mutex_destroy(&shared->lock);
+		free(shared);
+	}
+	pthread_mutex_unlock(&shared_function_indexes_lock);
+}
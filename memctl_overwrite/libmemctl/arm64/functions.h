@@ -0,0 +1,151 @@
+#ifndef MEMCTL__ARM64__FUNCTIONS_H_
+#define MEMCTL__ARM64__FUNCTIONS_H_
+/*
+ * Function boundary and control flow graph discovery.
+ *
+ * The function index records where each function in the executable segments of a Mach-O starts
+ * and ends, and the control flow graph of each function as basic blocks and edges. Function
+ * starts are found from BL targets, prologues following the end of a previous function, and the
+ * entries of __mod_init_func, so the index works on stripped kernelcaches. A function ends after
+ * the last instruction reachable from its start before the next function begins.
+ *
+ * All addresses are stored as 32-bit offsets from the lowest address in the Mach-O, and the
+ * functions, blocks, and edges are each kept in a single array.
+ */
+
+#include "memctl/macho.h"
+#include "memctl/memctl_types.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * struct aarch64_function
+ *
+ * Description:
+ * 	A function in the function index.
+ */
+struct aarch64_function {
+	// The offsets of the start of the function and of the end of its last instruction.
+	uint32_t start;
+	uint32_t end;
+	// The function's basic blocks, sorted by address. The first block is the entry block.
+	uint32_t first_block;
+	uint32_t block_count;
+};
+
+/*
+ * struct aarch64_basic_block
+ *
+ * Description:
+ * 	A basic block in the function index.
+ */
+struct aarch64_basic_block {
+	// The offsets of the first instruction and of the end of the last instruction.
+	uint32_t start;
+	uint32_t end;
+	// The block's successors in the edges array.
+	uint32_t first_edge;
+	uint32_t edge_count;
+};
+
+/*
+ * struct aarch64_function_index
+ *
+ * Description:
+ * 	The functions in a Mach-O, sorted by address.
+ */
+struct aarch64_function_index {
+	// The lowest address in the Mach-O. All offsets are relative to base.
+	kaddr_t base;
+	// The functions.
+	struct aarch64_function *functions;
+	size_t function_count;
+	// The basic blocks of all the functions.
+	struct aarch64_basic_block *blocks;
+	size_t block_count;
+	// The index in blocks of the successor at the end of each edge. Calls are not edges.
+	uint32_t *edges;
+	size_t edge_count;
+};
+
+/*
+ * aarch64_function_index_init
+ *
+ * Description:
+ * 	Discover the functions in a Mach-O file and build their control flow graphs. The code is
+ * 	scanned and the functions are analyzed in parallel.
+ *
+ * Parameters:
+ * 	out	index			The index to initialize.
+ * 		macho			The Mach-O file.
+ * 		persist			If true, load the index from CACHE_FILE_DIR if a previous
+ * 					run saved it there, and otherwise save it there once it is
+ * 					built. Saved indexes are keyed by the Mach-O's UUID.
+ *
+ * Returns:
+ * 	True if no errors were encountered.
+ */
+bool aarch64_function_index_init(struct aarch64_function_index *index, const struct macho *macho,
+		bool persist);
+
+/*
+ * aarch64_function_index_deinit
+ *
+ * Description:
+ * 	Free the resources used by a function index.
+ */
+void aarch64_function_index_deinit(struct aarch64_function_index *index);
+
+/*
+ * aarch64_function_containing
+ *
+ * Description:
+ * 	Find the function containing an address.
+ *
+ * Returns:
+ * 	The function, or NULL if the address is not part of any function.
+ */
+const struct aarch64_function *aarch64_function_containing(
+		const struct aarch64_function_index *index, kaddr_t address);
+
+/*
+ * aarch64_function_index_get
+ *
+ * Description:
+ * 	Get a shared function index for a Mach-O file, building it with persistence on first use.
+ *
+ * Returns:
+ * 	The function index, or NULL if it could not be built. An error is pushed only by the call
+ * 	that tried to build the index.
+ *
+ * Notes:
+ * 	This function may be called from any thread. The index is valid until
+ * 	aarch64_function_index_cache_clear is called.
+ */
+const struct aarch64_function_index *aarch64_function_index_get(const struct macho *macho);
+
+/*
+ * aarch64_function_index_find
+ *
+ * Description:
+ * 	Get the shared function index for a Mach-O file if aarch64_function_index_get has already
+ * 	built it. The index is never built by this function.
+ *
+ * Returns:
+ * 	The function index, or NULL if it has not been built or could not be built.
+ */
+const struct aarch64_function_index *aarch64_function_index_find(const struct macho *macho);
+
+/*
+ * aarch64_function_index_cache_clear
+ *
+ * Description:
+ * 	Free the shared function indexes returned by aarch64_function_index_get. Shared indexes
+ * 	are looked up by the address of the Mach-O header, so this must be called when the Mach-O
+ * 	files they describe are unmapped.
+ */
+void aarch64_function_index_cache_clear(void);
+
+#endif
@@ -0,0 +1,287 @@
+#include "arm64/ir_cache.h"
+
+#include "memctl/mapped_region.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+/*
+ * struct ir_cache
+ *
+ * Description:
+ * 	One thread's IR cache. The cache is direct-mapped on the page number: code is mostly
+ * 	contiguous, so consecutive pages never collide, and a lookup is a single comparison.
+ */
+struct ir_cache {
+	// The decoded pages.
+	struct aarch64_ir_page *pages[AARCH64_IR_CACHE_PAGES];
+	// The running counters reported by aarch64_ir_cache_stats.
+	struct aarch64_ir_cache_stats statistics;
+};
+
+/*
+ * ir_cache
+ *
+ * Description:
+ * 	The calling thread's IR cache, or NULL if the thread has not decoded any pages. Each
+ * 	thread has its own cache, so threads can simulate code concurrently without locking.
+ */
+_Thread_local static struct ir_cache *ir_cache;
+
+/*
+ * allocated_pages
+ *
+ * Description:
+ * 	The number of decoded pages allocated by all threads, limited by
+ * 	AARCH64_IR_CACHE_TOTAL_PAGES.
+ */
+static atomic_size_t allocated_pages;
+
+/*
+ * ir_cache_key
+ *
+ * Description:
+ * 	A key holding each thread's IR cache, used to free the cache when the thread exits.
+ */
+static pthread_key_t ir_cache_key;
+static pthread_once_t ir_cache_key_once = PTHREAD_ONCE_INIT;
+
+/*
+ * ir_cache_free_pages
+ *
+ * Description:
+ * 	Free all decoded pages in an IR cache.
+ */
+static void
+ir_cache_free_pages(struct ir_cache *cache) {
+	for (size_t i = 0; i < AARCH64_IR_CACHE_PAGES; i++) {
+		free(cache->pages[i]);
+		cache->pages[i] = NULL;
+	}
+	atomic_fetch_sub_explicit(&allocated_pages, cache->statistics.pages,
+			memory_order_relaxed);
+	cache->statistics.pages = 0;
+}
+
+/*
+ * ir_cache_destroy
+ *
+ * Description:
+ * 	The ir_cache_key destructor. This is passed the cache rather than using the thread-local
+ * 	variable, which may already have been torn down.
+ */
+static void
+ir_cache_destroy(void *cache) {
+	ir_cache_free_pages(cache);
+	free(cache);
+}
+
+/*
+ * ir_cache_key_create
+ *
+ * Description:
+ * 	Create ir_cache_key.
+ */
+static void
+ir_cache_key_create() {
+	pthread_key_create(&ir_cache_key, ir_cache_destroy);
+}
+
+/*
+ * ir_cache_get
+ *
+ * Description:
+ * 	Get the calling thread's IR cache, creating it if necessary.
+ */
+static struct ir_cache *
+ir_cache_get() {
+	if (ir_cache == NULL) {
+		struct ir_cache *cache = calloc(1, sizeof(*cache));
+		if (cache == NULL) {
+			return NULL;
+		}
+		pthread_once(&ir_cache_key_once, ir_cache_key_create);
+		pthread_setspecific(ir_cache_key, cache);
+		ir_cache = cache;
+	}
+	return ir_cache;
+}
+
+/*
+ * page_slot
+ *
+ * Description:
+ * 	Get the cache slot for the page containing the given address.
+ */
+static struct aarch64_ir_page **
+page_slot(struct ir_cache *cache, kaddr_t pc) {
+	return &cache->pages[(pc / AARCH64_IR_PAGE_SIZE) & (AARCH64_IR_CACHE_PAGES - 1)];
+}
+
+/*
+ * page_alloc
+ *
+ * Description:
+ * 	Get a page to decode into an empty slot. A new page is allocated while the global limit
+ * 	allows, and otherwise the thread's page in another slot is moved to this one.
+ */
+static struct aarch64_ir_page *
+page_alloc(struct ir_cache *cache, struct aarch64_ir_page **slot) {
+	size_t allocated = atomic_fetch_add_explicit(&allocated_pages, 1, memory_order_relaxed);
+	size_t index = slot - cache->pages;
+	for (size_t i = 1; allocated >= AARCH64_IR_CACHE_TOTAL_PAGES && i < AARCH64_IR_CACHE_PAGES;
+			i++) {
+		struct aarch64_ir_page **victim =
+			&cache->pages[(index + i) & (AARCH64_IR_CACHE_PAGES - 1)];
+		if (*victim != NULL) {
+			atomic_fetch_sub_explicit(&allocated_pages, 1, memory_order_relaxed);
+			struct aarch64_ir_page *page = *victim;
+			*victim = NULL;
+			cache->statistics.evictions++;
+			return page;
+		}
+	}
+	struct aarch64_ir_page *page = malloc(sizeof(*page));
+	if (page == NULL) {
+		atomic_fetch_sub_explicit(&allocated_pages, 1, memory_order_relaxed);
+		return NULL;
+	}
+	cache->statistics.pages++;
+	return page;
+}
+
+/*
+ * decoded_target
+ *
+ * Description:
+ * 	Get the PC-relative target of a decoded instruction, or 0 if it has none.
+ */
+static kaddr_t
+decoded_target(const struct aarch64_decoded *decoded) {
+	switch (decoded->kind) {
+		case AARCH64_DECODED_ADR:	return decoded->adr.label;
+		case AARCH64_DECODED_B:		return decoded->b.label;
+		case AARCH64_DECODED_CBZ:	return decoded->cbz.label;
+		case AARCH64_DECODED_LDR_LIT:	return decoded->ldr_lit.label;
+		default:			return 0;
+	}
+}
+
+/*
+ * ends_block
+ *
+ * Description:
+ * 	Returns true if the instruction class is a branch, which ends a basic block.
+ */
+static bool
+ends_block(enum aarch64_decoded_kind kind) {
+	return (kind == AARCH64_DECODED_B
+			|| kind == AARCH64_DECODED_BR
+			|| kind == AARCH64_DECODED_CBZ);
+}
+
+/*
+ * page_fill
+ *
+ * Description:
+ * 	Decode the part of the page at the given address that lies within the code region.
+ */
+static void
+page_fill(struct ir_cache *cache, struct aarch64_ir_page *page, const struct mapped_region *code,
+		kaddr_t address) {
+	kaddr_t start = (code->addr > address ? code->addr : address);
+	kaddr_t end = address + AARCH64_IR_PAGE_SIZE;
+	kaddr_t code_end = code->addr + code->size;
+	if (code_end < end) {
+		end = code_end;
+	}
+	page->address = address;
+	page->start   = (start - address) / AARCH64_INSTRUCTION_SIZE;
+	page->end     = (end - address) / AARCH64_INSTRUCTION_SIZE;
+	const uint32_t *ins = mapped_region_get(code, start, NULL);
+	for (unsigned i = page->start; i < page->end; i++, ins++) {
+		kaddr_t pc = address + i * AARCH64_INSTRUCTION_SIZE;
+		struct aarch64_decoded *decoded = &page->decoded[i];
+		aarch64_decode(*ins, pc, decoded);
+		page->ins[i]    = *ins;
+		page->kind[i]   = decoded->kind;
+		page->target[i] = decoded_target(decoded);
+	}
+	// Split the page into basic blocks.
+	uint16_t block_end = page->end;
+	for (unsigned i = page->end; i > page->start; i--) {
+		if (ends_block(page->kind[i - 1])) {
+			block_end = i;
+		}
+		page->block_end[i - 1] = block_end;
+	}
+	cache->statistics.fills++;
+}
+
+const struct aarch64_ir_page *
+aarch64_ir_page(const struct mapped_region *code, kaddr_t pc) {
+	if (!mapped_region_contains(code, pc, AARCH64_INSTRUCTION_SIZE)) {
+		return NULL;
+	}
+	struct ir_cache *cache = ir_cache_get();
+	if (cache == NULL) {
+		return NULL;
+	}
+	kaddr_t address = pc & ~(kaddr_t)(AARCH64_IR_PAGE_SIZE - 1);
+	unsigned index = AARCH64_IR_PAGE_INDEX(pc);
+	struct aarch64_ir_page **slot = page_slot(cache, pc);
+	struct aarch64_ir_page *page = *slot;
+	if (page == NULL) {
+		page = page_alloc(cache, slot);
+		if (page == NULL) {
+			return NULL;
+		}
+		*slot = page;
+	} else if (page->address == address && page->start <= index && index < page->end) {
+		// The page may have been decoded from a previous kernel mapped at the same address.
+		const uint32_t *ins = mapped_region_get(code, pc, NULL);
+		if (page->ins[index] == *ins) {
+			cache->statistics.hits++;
+			return page;
+		}
+	} else {
+		cache->statistics.evictions++;
+	}
+	page_fill(cache, page, code, address);
+	return page;
+}
+
+bool
+aarch64_ir_decode(uint32_t ins, kaddr_t pc, struct aarch64_decoded *decoded) {
+	if (ir_cache != NULL) {
+		const struct aarch64_ir_page *page = *page_slot(ir_cache, pc);
+		if (page != NULL
+		    && page->address == (pc & ~(kaddr_t)(AARCH64_IR_PAGE_SIZE - 1))) {
+			unsigned index = AARCH64_IR_PAGE_INDEX(pc);
+			if (page->start <= index && index < page->end && page->ins[index] == ins) {
+				*decoded = page->decoded[index];
+				return (decoded->kind != AARCH64_DECODED_UNKNOWN);
+			}
+		}
+	}
+	return aarch64_decode(ins, pc, decoded);
+}
+
+void
+aarch64_ir_cache_clear() {
+	if (ir_cache != NULL) {
+		ir_cache_free_pages(ir_cache);
+	}
+}
+
+void
+aarch64_ir_cache_stats(struct aarch64_ir_cache_stats *stats) {
+	if (ir_cache == NULL) {
+		*stats = (struct aarch64_ir_cache_stats) {};
+		return;
+	}
+	*stats = ir_cache->statistics;
+	stats->memory = ir_cache->statistics.pages * sizeof(struct aarch64_ir_page)
+		+ sizeof(*ir_cache);
+}
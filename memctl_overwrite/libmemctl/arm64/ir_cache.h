@@ -0,0 +1,168 @@
+#ifndef MEMCTL__ARM64__IR_CACHE_H_
+#define MEMCTL__ARM64__IR_CACHE_H_
+/*
+ * Pre-decoded instruction cache.
+ *
+ * The finders simulate the same kernel code many times: every vtable candidate runs
+ * getMetaClass() through ksim, and every ksim_exec_until_* call steps through the same
+ * functions. The IR cache decodes code one page at a time, the first time the page is touched,
+ * and keeps the result in a structure-of-arrays layout so that both the simulator and the
+ * scanners can use it.
+ *
+ * Pages are keyed by address. aarch64_ir_decode checks each entry against the instruction word
+ * before using it, so the simulator never sees a decoding left over from a previous kernel.
+ *
+ * The cache is per-thread, and a thread's pages are freed when it exits. The number of pages
+ * allocated across all threads is limited, so that a pool of simulating threads does not each
+ * hold a full cache.
+ */
+
+#include "arm64/decode.h"
+#include "memctl/memctl_types.h"
+
+#include <stddef.h>
+
+struct mapped_region;
+
+/*
+ * AARCH64_IR_PAGE_SIZE
+ *
+ * Description:
+ * 	The number of bytes of code decoded together.
+ */
+#define AARCH64_IR_PAGE_SIZE		0x1000
+#define AARCH64_IR_PAGE_INSTRUCTIONS	(AARCH64_IR_PAGE_SIZE / AARCH64_INSTRUCTION_SIZE)
+
+/*
+ * AARCH64_IR_CACHE_PAGES
+ *
+ * Description:
+ * 	The maximum number of decoded pages kept in memory by one thread. Must be a power of 2.
+ */
+#ifndef AARCH64_IR_CACHE_PAGES
+# define AARCH64_IR_CACHE_PAGES		128
+#endif
+
+/*
+ * AARCH64_IR_CACHE_TOTAL_PAGES
+ *
+ * Description:
+ * 	The number of decoded pages that all threads together may keep in memory. A thread that
+ * 	needs a page once this many are allocated reuses one of its own pages instead, although
+ * 	every thread may have at least one page.
+ */
+#ifndef AARCH64_IR_CACHE_TOTAL_PAGES
+# define AARCH64_IR_CACHE_TOTAL_PAGES	256
+#endif
+
+/*
+ * AARCH64_IR_PAGE_INDEX
+ *
+ * Description:
+ * 	The index of the instruction at the given address within its page.
+ */
+#define AARCH64_IR_PAGE_INDEX(pc)	\
+	(((pc) & (AARCH64_IR_PAGE_SIZE - 1)) / AARCH64_INSTRUCTION_SIZE)
+
+/*
+ * struct aarch64_ir_page
+ *
+ * Description:
+ * 	The decoded instructions of one page of code. Only the instructions with indices in the
+ * 	range [start, end) are valid; the rest of the page lies outside the code region.
+ */
+struct aarch64_ir_page {
+	// The address of the start of the page.
+	kaddr_t address;
+	// The first valid instruction index.
+	uint16_t start;
+	// One past the last valid instruction index.
+	uint16_t end;
+	// The raw instruction words.
+	uint32_t ins[AARCH64_IR_PAGE_INSTRUCTIONS];
+	// The instruction classes, as enum aarch64_decoded_kind.
+	uint8_t kind[AARCH64_IR_PAGE_INSTRUCTIONS];
+	// The PC-relative target of each ADR, ADRP, B, BL, CBZ, CBNZ and LDR (literal)
+	// instruction, or 0.
+	kaddr_t target[AARCH64_IR_PAGE_INSTRUCTIONS];
+	// The decoded operands: registers, immediates, shifts and extends.
+	struct aarch64_decoded decoded[AARCH64_IR_PAGE_INSTRUCTIONS];
+	// The end of the basic block starting at each instruction: one past the index of the next
+	// branch, or end if there is no branch before the end of the page.
+	uint16_t block_end[AARCH64_IR_PAGE_INSTRUCTIONS];
+};
+
+/*
+ * struct aarch64_ir_cache_stats
+ *
+ * Description:
+ * 	Usage statistics for the IR cache.
+ */
+struct aarch64_ir_cache_stats {
+	// The number of pages currently allocated.
+	size_t pages;
+	// The number of page lookups that found a decoded page.
+	size_t hits;
+	// The number of pages decoded.
+	size_t fills;
+	// The number of decoded pages discarded to make room for another page, either because
+	// the pages mapped to the same slot or because the global page limit was reached.
+	size_t evictions;
+	// The total number of bytes allocated by the cache.
+	size_t memory;
+};
+
+/*
+ * aarch64_ir_page
+ *
+ * Description:
+ * 	Get the decoded page containing the given address, decoding it if necessary.
+ *
+ * Parameters:
+ * 		code			The code region containing pc.
+ * 		pc			The address of an instruction in the code region.
+ *
+ * Returns:
+ * 	The decoded page, or NULL if pc is not in the code region or memory could not be
+ * 	allocated. The page is valid until the next call to aarch64_ir_page or
+ * 	aarch64_ir_cache_clear.
+ */
+const struct aarch64_ir_page *aarch64_ir_page(const struct mapped_region *code, kaddr_t pc);
+
+/*
+ * aarch64_ir_decode
+ *
+ * Description:
+ * 	Decode an instruction, using the IR cache if the instruction's page has already been
+ * 	decoded. This never fills the cache.
+ *
+ * Parameters:
+ * 		ins			The instruction.
+ * 		pc			The address of the instruction.
+ * 	out	decoded			On return, the decoded instruction.
+ *
+ * Returns:
+ * 	True if the instruction was recognized.
+ */
+bool aarch64_ir_decode(uint32_t ins, kaddr_t pc, struct aarch64_decoded *decoded);
+
+/*
+ * aarch64_ir_cache_clear
+ *
+ * Description:
+ * 	Free all decoded pages belonging to the calling thread.
+ */
+void aarch64_ir_cache_clear(void);
+
+/*
+ * aarch64_ir_cache_stats
+ *
+ * Description:
+ * 	Report the memory used by the calling thread's IR cache.
+ *
+ * Parameters:
+ * 	out	stats			On return, the IR cache statistics.
+ */
+void aarch64_ir_cache_stats(struct aarch64_ir_cache_stats *stats);
+
+#endif
@@ -1,9 +1,18 @@
 #include "memctl/arm64/ksim.h"
 
+#include "arm64/functions.h"
+#include "arm64/ir_cache.h"
+#include "arm64/scan.h"
+#include "arm64/sim_block.h"
+#include "arm64/xref.h"
+
 #include "memctl/kernelcache.h"
 #include "memctl/macho.h"
+#include "memctl/memctl_error.h"
 #include "memctl/utility.h"
 
+#include <pthread.h>
+
 
 // AArch64 temporary registers.
 #define TEMPREGS_START 0
@@ -115,8 +124,14 @@ sim_get_instruction(struct aarch64_sim *sim, const struct mapped_region *code) {
 	if (!mapped_region_contains(code, pc, AARCH64_INSTRUCTION_SIZE)) {
 		return false;
 	}
-	const uint32_t *ins = mapped_region_get(code, pc, NULL);
-	sim->instruction.value = *ins;
+	// Go through the IR cache so that aarch64_sim_step finds the instruction pre-decoded.
+	const struct aarch64_ir_page *page = aarch64_ir_page(code, pc);
+	if (page != NULL) {
+		sim->instruction.value = page->ins[AARCH64_IR_PAGE_INDEX(pc)];
+	} else {
+		const uint32_t *ins = mapped_region_get(code, pc, NULL);
+		sim->instruction.value = *ins;
+	}
 	return true;
 }
 
@@ -246,13 +261,72 @@ ksim_exec_find_reference(struct macho *kext, kword_t value) {
 	}
 }
 
+/*
+ * ksim_xref_find_reference
+ *
+ * Description:
+ * 	Look up the first instruction in the kext's __TEXT_EXEC segment that references the
+ * 	specified value using the cross-reference index. The index for the most recently used kext
+ * 	is kept, so repeated lookups in the same kext only pay for building it once.
+ *
+ * Parameters:
+ * 		kext			The kext.
+ * 		value			The referenced value.
+ * 	out	reference		On return, the address of the referencing instruction,
+ * 					or 0 if the index has no reference to value.
+ *
+ * Returns:
+ * 	True if no errors were encountered.
+ */
+static bool
+ksim_xref_find_reference(const struct macho *kext, kaddr_t value, kaddr_t *reference) {
+	static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	static struct aarch64_xref_index index;
+	static const void *index_mh;
+	static size_t index_size;
+	bool success = false;
+	*reference = 0;
+	// Symbol finders may run on several threads at once.
+	pthread_mutex_lock(&lock);
+	if (index_mh != kext->mh || index_size != kext->size) {
+		aarch64_xref_index_deinit(&index);
+		index_mh = NULL;
+		if (!aarch64_xref_index_init(&index, kext, true)) {
+			goto out;
+		}
+		index_mh   = kext->mh;
+		index_size = kext->size;
+	}
+	success = true;
+	const struct load_command *sc = macho_find_segment(kext, "__TEXT_EXEC");
+	if (sc == NULL) {
+		goto out;
+	}
+	const void *data;
+	kaddr_t text_start;
+	size_t text_size;
+	macho_segment_data(kext, sc, &data, &text_start, &text_size);
+	size_t first;
+	size_t count = aarch64_xref_find(&index, value, &first);
+	for (size_t i = first; i < first + count; i++) {
+		kaddr_t source = aarch64_xref_source(&index, i);
+		if (text_start <= source && source < text_start + text_size) {
+			*reference = source;
+			break;
+		}
+	}
+out:
+	pthread_mutex_unlock(&lock);
+	return success;
+}
+
 kaddr_t
 ksim_string_reference(const char *kext_id, const char *reference) {
 	if (kext_id == NULL) {
 		kext_id = KERNEL_ID;
 	}
 	// Open the Mach-O file for the bundle ID.
-	struct macho kext;
+	struct macho kext = {};
 	kext_result kr = kernelcache_kext_init_macho(&kernelcache, &kext, kext_id);
 	if (kr != KEXT_SUCCESS) {
 		assert(kr == KEXT_NO_KEXT);
@@ -263,7 +337,15 @@ ksim_string_reference(const char *kext_id, const char *reference) {
 	if (cstring == 0) {
 		return 0;
 	}
-	// Do the search.
+	// Try the cross-reference index first, and fall back to simulating the whole segment if
+	// the index has no reference or cannot be built.
+	kaddr_t xref;
+	error_stop();
+	bool indexed = ksim_xref_find_reference(&kext, cstring, &xref);
+	error_start();
+	if (indexed && xref != 0) {
+		return xref;
+	}
 	return ksim_exec_find_reference(&kext, cstring);
 }
 
@@ -302,7 +384,7 @@ find_code_segment(const struct macho *macho, uint64_t pc) {
 
 void
 ksim_set_pc(struct ksim *ksim, kaddr_t pc) {
-	struct macho kext;
+	struct macho kext = {};
 	kext_result kr = kernelcache_find_containing_address(&kernelcache, pc, NULL, NULL, &kext);
 	assert(kr == KEXT_SUCCESS);
 	const struct load_command *sc = find_code_segment(&kext, pc);
@@ -312,31 +394,111 @@ ksim_set_pc(struct ksim *ksim, kaddr_t pc) {
 	sim_set_pc(&ksim->sim, pc);
 }
 
-bool
-ksim_scan_for(struct ksim *ksim, int direction, uint32_t ins, uint32_t mask, unsigned index,
-		kaddr_t *pc, unsigned count) {
-	size_t step = (direction < 0 ? -1 : 1) * AARCH64_INSTRUCTION_SIZE;
-	ins &= mask;
-	for (unsigned i = 0; i < count; i++) {
-		// Advance. We don't use the aarch64_sim API because that one only moves forward.
-		ksim->sim.PC.value += step;
-		if (!sim_get_instruction(&ksim->sim, &ksim->code)) {
-			// Undo that last step before returning.
-			ksim->sim.PC.value -= step;
-			break;
-		}
-		// If we have a match, decrement the index or succeed.
-		if ((ksim->sim.instruction.value & mask) == ins) {
-			if (index == 0) {
-				if (pc != NULL) {
-					*pc = ksim->sim.PC.value;
-				}
-				return true;
+/*
+ * ksim_function_end
+ *
+ * Description:
+ * 	Find the end of the function containing the given address using the function index of
+ * 	its kext. Returns 0 if the function is not known.
+ */
+static kaddr_t
+ksim_function_end(kaddr_t pc) {
+	struct macho kext = {};
+	kext_result kr = kernelcache_find_containing_address(&kernelcache, pc, NULL, NULL, &kext);
+	if (kr != KEXT_SUCCESS) {
+		return 0;
+	}
+	// The bound only narrows the scan, so failing to build the index is not an error.
+	error_stop();
+	const struct aarch64_function_index *index = aarch64_function_index_get(&kext);
+	error_start();
+	if (index == NULL) {
+		return 0;
+	}
+	const struct aarch64_function *function = aarch64_function_containing(index, pc);
+	return (function == NULL ? 0 : index->base + function->end);
+}
+
+/*
+ * scan_for
+ *
+ * Description:
+ * 	Scan for an instruction as ksim_scan_for does. If in_function is true, a forward scan does
+ * 	not run past the end of the function containing PC.
+ */
+static bool
+scan_for(struct ksim *ksim, int direction, uint32_t ins, uint32_t mask, unsigned index,
+		kaddr_t *pc, unsigned count, bool in_function) {
+	// We don't use the aarch64_sim API because that one only moves forward.
+	struct aarch64_sim *sim = &ksim->sim;
+	const struct mapped_region *code = &ksim->code;
+	if (taint_unknown(sim->PC.taint)) {
+		return false;
+	}
+	// Find the run of instructions we can scan without leaving the code region. The scan
+	// starts with the instruction after (or before) PC.
+	kaddr_t start = sim->PC.value;
+	kaddr_t first = start + (direction < 0 ? -1 : 1) * AARCH64_INSTRUCTION_SIZE;
+	size_t available = 0;
+	if (mapped_region_contains(code, first, AARCH64_INSTRUCTION_SIZE)) {
+		if (direction < 0) {
+			available = (first - code->addr) / AARCH64_INSTRUCTION_SIZE + 1;
+		} else {
+			available = (code->addr + code->size - first) / AARCH64_INSTRUCTION_SIZE;
+			kaddr_t end = (in_function ? ksim_function_end(start) : 0);
+			if (end != 0) {
+				size_t left = (end > first ? end - first : 0);
+				available = min(available, left / AARCH64_INSTRUCTION_SIZE);
 			}
-			index--;
 		}
 	}
-	return false;
+	size_t n = min(available, (size_t) count);
+	if (n == 0) {
+		return false;
+	}
+	kaddr_t low = (direction < 0 ? start - n * AARCH64_INSTRUCTION_SIZE : first);
+	const uint32_t *words = mapped_region_get(code, low, NULL);
+	size_t position;
+	bool found;
+	if (direction < 0) {
+		found = aarch64_scan_backward(words, n, ins & mask, mask, index, &position);
+		if (!found) {
+			position = 0;
+		}
+	} else {
+		found = aarch64_scan_forward(words, n, ins & mask, mask, index, &position);
+		if (!found) {
+			position = n - 1;
+		}
+	}
+	// Leave PC at the match, or at the last instruction scanned.
+	sim->PC.value = low + position * AARCH64_INSTRUCTION_SIZE;
+	sim->instruction.value = words[position];
+	if (found && pc != NULL) {
+		*pc = sim->PC.value;
+	}
+	return found;
+}
+
+bool
+ksim_scan_for(struct ksim *ksim, int direction, uint32_t ins, uint32_t mask, unsigned index,
+		kaddr_t *pc, unsigned count) {
+	return scan_for(ksim, direction, ins, mask, index, pc, count, false);
+}
+
+/*
+ * ksim_scan_for_in_function
+ *
+ * Description:
+ * 	Scan for an instruction like ksim_scan_for, except that a forward scan stops at the end of
+ * 	the function containing PC rather than running into the next function. The end comes from
+ * 	the function index of the kext, which is built on first use. If there is no index, the
+ * 	scan is not limited.
+ */
+bool
+ksim_scan_for_in_function(struct ksim *ksim, int direction, uint32_t ins, uint32_t mask,
+		unsigned index, kaddr_t *pc, unsigned count) {
+	return scan_for(ksim, direction, ins, mask, index, pc, count, true);
 }
 
 bool
@@ -347,10 +509,11 @@ ksim_scan_for_jump(struct ksim *ksim, int direction, unsigned index, kaddr_t *pc
 	if (!found) {
 		return false;
 	}
-	struct aarch64_ins_b b;
-	bool success = aarch64_decode_b(ksim->sim.instruction.value, ksim->sim.PC.value, &b);
-	assert(success);
-	*target = b.label;
+	struct aarch64_decoded decoded;
+	bool success = aarch64_ir_decode(ksim->sim.instruction.value, ksim->sim.PC.value,
+			&decoded);
+	assert(success && decoded.kind == AARCH64_DECODED_B);
+	*target = decoded.b.label;
 	return true;
 }
 
@@ -362,10 +525,11 @@ ksim_scan_for_call(struct ksim *ksim, int direction, unsigned index, kaddr_t *pc
 	if (!found) {
 		return false;
 	}
-	struct aarch64_ins_b b;
-	bool success = aarch64_decode_b(ksim->sim.instruction.value, ksim->sim.PC.value, &b);
-	assert(success);
-	*target = b.label;
+	struct aarch64_decoded decoded;
+	bool success = aarch64_ir_decode(ksim->sim.instruction.value, ksim->sim.PC.value,
+			&decoded);
+	assert(success && decoded.kind == AARCH64_DECODED_B);
+	*target = decoded.b.label;
 	return true;
 }
 
@@ -416,6 +580,9 @@ struct ksim_exec_context {
 	ksim_branch *            branches;
 	unsigned                 instructions_left;
 	bool                     found;
+	// True if until can only stop at a branch instruction, so that the instructions before
+	// the branch ending each basic block can be run without checking until.
+	bool                     until_branch;
 };
 
 /*
@@ -523,22 +690,82 @@ ksim_init_sim(struct ksim *ksim, kaddr_t pc) {
 	ksim->did_stop          = false;
 }
 
-bool
-ksim_exec_until(struct ksim *ksim, ksim_exec_until_callback until, void *context,
-		ksim_branch *branches, unsigned count) {
+/*
+ * ksim_exec_block
+ *
+ * Description:
+ * 	Run the basic block starting at PC from the IR cache, up to but not including its final
+ * 	instruction. This performs the same per-instruction work as ksim_exec_instruction_fetch,
+ * 	except that until is not called, so it may only be used if until can only stop at a
+ * 	branch. The final instruction is left for aarch64_sim_step, which calls until as usual.
+ *
+ * 	Returns false if the simulator stopped.
+ */
+static bool
+ksim_exec_block(struct ksim_exec_context *context) {
+	struct ksim *ksim = context->ksim;
+	struct aarch64_sim *sim = &ksim->sim;
+	// If PC is unknown, let aarch64_sim_step fail.
+	if (taint_unknown(sim->PC.taint)) {
+		return true;
+	}
+	kaddr_t pc = sim->PC.value;
+	const struct aarch64_ir_page *page = aarch64_ir_page(&ksim->code, pc);
+	if (page == NULL) {
+		return true;
+	}
+	unsigned index = AARCH64_IR_PAGE_INDEX(pc);
+	size_t count = page->block_end[index] - index - 1;
+	count = min(count, (size_t) context->instructions_left);
+	if (count == 0) {
+		return true;
+	}
+	if (ksim->clear_temporaries) {
+		sim_clear_temps(sim);
+		ksim->clear_temporaries = false;
+	}
+	ksim->did_stop = false;
+	size_t executed;
+	bool run = aarch64_sim_run_block(sim, &page->ins[index], &page->decoded[index], count,
+			&executed);
+	context->instructions_left -= executed;
+	return run;
+}
+
+/*
+ * ksim_exec_until_
+ *
+ * Description:
+ * 	Implementation of ksim_exec_until. If until_branch is true, until must only return true
+ * 	for branch instructions; the simulator then runs a basic block at a time.
+ */
+static bool
+ksim_exec_until_(struct ksim *ksim, ksim_exec_until_callback until, void *context,
+		ksim_branch *branches, unsigned count, bool until_branch) {
 	ksim_branch dummy_branch = KSIM_BRANCH_ALL_FALSE;
 	if (branches == NULL) {
 		branches = &dummy_branch;
 	}
-	struct ksim_exec_context exec_context = { ksim, until, context, branches, count };
+	struct ksim_exec_context exec_context = {
+		ksim, until, context, branches, count, false, until_branch
+	};
 	ksim->sim.context = &exec_context;
 	for (;;) {
+		if (until_branch && !ksim_exec_block(&exec_context)) {
+			return exec_context.found;
+		}
 		if (!aarch64_sim_step(&ksim->sim)) {
 			return exec_context.found;
 		}
 	}
 }
 
+bool
+ksim_exec_until(struct ksim *ksim, ksim_exec_until_callback until, void *context,
+		ksim_branch *branches, unsigned count) {
+	return ksim_exec_until_(ksim, until, context, branches, count, false);
+}
+
 /*
  * ksim_exec_until_call_callback
  *
@@ -561,7 +788,8 @@ ksim_exec_until_call_callback(void *context, struct ksim *ksim, kaddr_t pc, uint
 
 bool
 ksim_exec_until_call(struct ksim *ksim, ksim_branch *branches, kaddr_t *target, unsigned count) {
-	return ksim_exec_until(ksim, ksim_exec_until_call_callback, target, branches, count);
+	return ksim_exec_until_(ksim, ksim_exec_until_call_callback, target, branches, count,
+			true);
 }
 
 /*
@@ -577,7 +805,8 @@ ksim_exec_until_return_callback(void *context, struct ksim *ksim, kaddr_t pc, ui
 
 bool
 ksim_exec_until_return(struct ksim *ksim, ksim_branch *branches, unsigned count) {
-	return ksim_exec_until(ksim, ksim_exec_until_return_callback, NULL, branches, count);
+	return ksim_exec_until_(ksim, ksim_exec_until_return_callback, NULL, branches, count,
+			true);
 }
 
 /*
@@ -0,0 +1,189 @@
+#include "arm64/scan.h"
+
+#include "memctl/mapped_region.h"
+#include "memctl/memctl_error.h"
+#include "memctl/utility.h"
+
+#include <stdlib.h>
+
+#if __arm64__
+# include <arm_neon.h>
+#elif __x86_64__
+# include <emmintrin.h>
+#endif
+
+// The number of instructions compared in each step.
+#define SCAN_BLOCK	8
+
+// The minimum capacity of the aarch64_scan_region matches array.
+#define MIN_MATCHES_CAPACITY	64
+
+/*
+ * match_block
+ *
+ * Description:
+ * 	Compare SCAN_BLOCK instructions against the pattern. Bit i of the result is set if ins[i]
+ * 	matches.
+ */
+static inline unsigned
+match_block(const uint32_t *ins, uint32_t bits, uint32_t mask) {
+#if __arm64__
+	static const uint32_t weights[4] = { 1, 2, 4, 8 };
+	uint32x4_t w  = vld1q_u32(weights);
+	uint32x4_t m  = vdupq_n_u32(mask);
+	uint32x4_t b  = vdupq_n_u32(bits);
+	uint32x4_t lo = vceqq_u32(vandq_u32(vld1q_u32(ins), m), b);
+	uint32x4_t hi = vceqq_u32(vandq_u32(vld1q_u32(ins + 4), m), b);
+	return vaddvq_u32(vandq_u32(lo, w)) | (vaddvq_u32(vandq_u32(hi, w)) << 4);
+#elif __x86_64__
+	__m128i m  = _mm_set1_epi32(mask);
+	__m128i b  = _mm_set1_epi32(bits);
+	__m128i lo = _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128((const __m128i *)ins), m), b);
+	__m128i hi = _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128((const __m128i *)(ins + 4)), m),
+			b);
+	return _mm_movemask_ps(_mm_castsi128_ps(lo))
+		| (_mm_movemask_ps(_mm_castsi128_ps(hi)) << 4);
+#else
+	unsigned matches = 0;
+	for (unsigned i = 0; i < SCAN_BLOCK; i++) {
+		matches |= ((ins[i] & mask) == bits) << i;
+	}
+	return matches;
+#endif
+}
+
+/*
+ * nth_lowest_bit
+ *
+ * Description:
+ * 	Return the position of the n-th lowest set bit.
+ */
+static unsigned
+nth_lowest_bit(unsigned bits, unsigned n) {
+	for (; n > 0; n--) {
+		bits &= bits - 1;
+	}
+	return __builtin_ctz(bits);
+}
+
+/*
+ * nth_highest_bit
+ *
+ * Description:
+ * 	Return the position of the n-th highest set bit.
+ */
+static unsigned
+nth_highest_bit(unsigned bits, unsigned n) {
+	for (; n > 0; n--) {
+		bits &= ~(1u << (31 - __builtin_clz(bits)));
+	}
+	return 31 - __builtin_clz(bits);
+}
+
+bool
+aarch64_scan_forward(const uint32_t *ins, size_t count, uint32_t bits, uint32_t mask,
+		unsigned index, size_t *position) {
+	size_t i = 0;
+	for (; i + SCAN_BLOCK <= count; i += SCAN_BLOCK) {
+		unsigned matches = match_block(ins + i, bits, mask);
+		unsigned n = __builtin_popcount(matches);
+		if (index < n) {
+			*position = i + nth_lowest_bit(matches, index);
+			return true;
+		}
+		index -= n;
+	}
+	for (; i < count; i++) {
+		if ((ins[i] & mask) == bits) {
+			if (index == 0) {
+				*position = i;
+				return true;
+			}
+			index--;
+		}
+	}
+	return false;
+}
+
+bool
+aarch64_scan_backward(const uint32_t *ins, size_t count, uint32_t bits, uint32_t mask,
+		unsigned index, size_t *position) {
+	size_t i = count;
+	for (; i >= SCAN_BLOCK; i -= SCAN_BLOCK) {
+		unsigned matches = match_block(ins + i - SCAN_BLOCK, bits, mask);
+		unsigned n = __builtin_popcount(matches);
+		if (index < n) {
+			*position = i - SCAN_BLOCK + nth_highest_bit(matches, index);
+			return true;
+		}
+		index -= n;
+	}
+	while (i > 0) {
+		i--;
+		if ((ins[i] & mask) == bits) {
+			if (index == 0) {
+				*position = i;
+				return true;
+			}
+			index--;
+		}
+	}
+	return false;
+}
+
+/*
+ * add_match
+ *
+ * Description:
+ * 	Append an address to the aarch64_scan_region matches array.
+ */
+static bool
+add_match(kaddr_t **matches, size_t *count, size_t *capacity, kaddr_t address) {
+	if (*count == *capacity) {
+		size_t new_capacity = max(2 * *capacity, (size_t) MIN_MATCHES_CAPACITY);
+		kaddr_t *new_matches = realloc(*matches, new_capacity * sizeof(**matches));
+		if (new_matches == NULL) {
+			return false;
+		}
+		*matches  = new_matches;
+		*capacity = new_capacity;
+	}
+	(*matches)[*count] = address;
+	(*count)++;
+	return true;
+}
+
+bool
+aarch64_scan_region(const struct mapped_region *code, uint32_t bits, uint32_t mask,
+		kaddr_t **matches, size_t *count) {
+	const uint32_t *ins = code->data;
+	size_t ins_count = code->size / sizeof(*ins);
+	kaddr_t *found = NULL;
+	size_t found_count = 0;
+	size_t capacity = 0;
+	size_t i = 0;
+	for (; i + SCAN_BLOCK <= ins_count; i += SCAN_BLOCK) {
+		unsigned block = match_block(ins + i, bits, mask);
+		for (; block != 0; block &= block - 1) {
+			kaddr_t address = code->addr + (i + __builtin_ctz(block)) * sizeof(*ins);
+			if (!add_match(&found, &found_count, &capacity, address)) {
+				goto out_of_memory;
+			}
+		}
+	}
+	for (; i < ins_count; i++) {
+		if ((ins[i] & mask) == bits) {
+			kaddr_t address = code->addr + i * sizeof(*ins);
+			if (!add_match(&found, &found_count, &capacity, address)) {
+				goto out_of_memory;
+			}
+		}
+	}
+	*matches = found;
+	*count   = found_count;
+	return true;
+out_of_memory:
+	free(found);
+	error_out_of_memory();
+	return false;
+}
@@ -0,0 +1,81 @@
+#ifndef MEMCTL__ARM64__SCAN_H_
+#define MEMCTL__ARM64__SCAN_H_
+/*
+ * Instruction pattern scanning.
+ *
+ * These routines look for instructions ins satisfying (ins & mask) == bits in an array of
+ * instruction words. The mask and compare is applied to 8 instructions at a time with vector
+ * instructions where they are available.
+ */
+
+#include "memctl/memctl_types.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct mapped_region;
+
+/*
+ * aarch64_scan_forward
+ *
+ * Description:
+ * 	Find the index-th instruction matching a pattern, scanning forward from the start of the
+ * 	array.
+ *
+ * Parameters:
+ * 		ins			The instruction words.
+ * 		count			The number of instruction words.
+ * 		bits			The bits that must be set in a matching instruction.
+ * 		mask			The mask of instruction bits to compare.
+ * 		index			The number of matches to skip.
+ * 	out	position		On return, the array index of the match.
+ *
+ * Returns:
+ * 	True if a match was found.
+ */
+bool aarch64_scan_forward(const uint32_t *ins, size_t count, uint32_t bits, uint32_t mask,
+		unsigned index, size_t *position);
+
+/*
+ * aarch64_scan_backward
+ *
+ * Description:
+ * 	Find the index-th instruction matching a pattern, scanning backward from the end of the
+ * 	array.
+ *
+ * Parameters:
+ * 		ins			The instruction words.
+ * 		count			The number of instruction words.
+ * 		bits			The bits that must be set in a matching instruction.
+ * 		mask			The mask of instruction bits to compare.
+ * 		index			The number of matches to skip.
+ * 	out	position		On return, the array index of the match.
+ *
+ * Returns:
+ * 	True if a match was found.
+ */
+bool aarch64_scan_backward(const uint32_t *ins, size_t count, uint32_t bits, uint32_t mask,
+		unsigned index, size_t *position);
+
+/*
+ * aarch64_scan_region
+ *
+ * Description:
+ * 	Find all instructions in a code region matching a pattern.
+ *
+ * Parameters:
+ * 		code			The code region.
+ * 		bits			The bits that must be set in a matching instruction.
+ * 		mask			The mask of instruction bits to compare.
+ * 	out	matches			On return, an array of the addresses of all the matching
+ * 					instructions, in increasing order. The caller must free
+ * 					the array.
+ * 	out	count			On return, the number of matches.
+ *
+ * Returns:
+ * 	True if no errors were encountered.
+ */
+bool aarch64_scan_region(const struct mapped_region *code, uint32_t bits, uint32_t mask,
+		kaddr_t **matches, size_t *count);
+
+#endif
@@ -1,5 +1,8 @@
 #include "memctl/arm64/sim.h"
 
+#include "arm64/ir_cache.h"
+#include "arm64/sim_block.h"
+
 #include "memctl/utility.h"
 
 // Bit manipulations
@@ -224,18 +227,16 @@ aarch64_sim_pc_advance(struct aarch64_sim *sim) {
 	aarch64_sim_taint_meet_with(&sim->PC.taint, sim->taint_default[AARCH64_SIM_TAINT_CONSTANT]);
 }
 
-bool
-aarch64_sim_step(struct aarch64_sim *sim) {
+/*
+ * sim_execute
+ *
+ * Description:
+ * 	Execute the current instruction, which has already been fetched and decoded.
+ */
+static bool
+sim_execute(struct aarch64_sim *sim, const struct aarch64_decoded *decoded) {
 	bool keep_running = true;
-	// Fetch the next instruction.
-	bool run = sim->instruction_fetch(sim);
-	if (!run) {
-		return false;
-	}
-
-	// The instruction and program counter.
-	uint32_t ins = (uint32_t) sim->instruction.value;
-	uint64_t pc = sim->PC.value;
+	bool run;
 	// The taint for all sources.
 	aarch64_sim_taint taint = sim->instruction.taint;
 	// Branching state.
@@ -249,265 +250,274 @@ aarch64_sim_step(struct aarch64_sim *sim) {
 	uint8_t carry = 0;
 	aarch64_pstate nzcv;
 
-	struct aarch64_ins_adc     adc;
-	struct aarch64_ins_add_xr  add_xr;
-	struct aarch64_ins_add_im  add_im;
-	struct aarch64_ins_add_sr  add_sr;
-	struct aarch64_ins_adr     adr;
-	struct aarch64_ins_and_im  and_im;
-	struct aarch64_ins_and_sr  and_sr;
-	struct aarch64_ins_b       b;
-	struct aarch64_ins_br      br;
-	struct aarch64_ins_cbz     cbz;
-	struct aarch64_ins_ldp     ldp;
-	struct aarch64_ins_ldr_im  ldr_im;
-	struct aarch64_ins_ldr_lit ldr_lit;
-	struct aarch64_ins_ldr_r   ldr_r;
-	struct aarch64_ins_mov     mov;
-
-	if (aarch64_decode_adc(ins, &adc)) {
-		op1 = gpreg_get_(sim, adc.Rn, &taint);
-		op2 = gpreg_get_(sim, adc.Rm, &taint);
-		carry = pstate_get_(sim, C, nzcv, &taint);
-		if (!adc.adc) {
-			op2 = ~op2;
-		}
-		add_with_carry(&result, &nzcv, op1, op2, carry);
-		if (adc.setflags) {
-			pstate_set_(sim, NZCV, nzcv, nzcv, taint);
-		}
-		gpreg_set_(sim, adc.Rd, result, taint);
-	} else if (aarch64_decode_add_xr(ins, &add_xr)) {
-		op1 = gpreg_get_(sim, add_xr.Rn, &taint);
-		op2 = gpreg_get_extend_(sim, add_xr.Rn, add_xr.extend, add_xr.amount,
-				&taint);
-		if (!add_xr.add) {
-			op2 = ~op2;
-			carry = 1;
-		}
-		add_with_carry(&result, &nzcv, op1, op2, carry);
-		if (add_xr.setflags) {
-			pstate_set_(sim, NZCV, nzcv, nzcv, taint);
-		}
-		gpreg_set_(sim, add_xr.Rd, result, taint);
-	} else if (aarch64_decode_add_im(ins, &add_im)) {
-		op1 = gpreg_get_(sim, add_im.Rn, &taint);
-		op2 = (uint64_t)add_im.imm << add_im.shift;
-		if (!add_im.add) {
-			op2 = ~op2;
-			carry = 1;
-		}
-		add_with_carry(&result, &nzcv, op1, op2, carry);
-		if (add_im.setflags) {
-			pstate_set_(sim, NZCV, nzcv, nzcv, taint);
-		}
-		gpreg_set_(sim, add_im.Rd, result, taint);
-	} else if (aarch64_decode_add_sr(ins, &add_sr)) {
-		op1 = gpreg_get_(sim, add_sr.Rn, &taint);
-		op2 = gpreg_get_shift_(sim, add_sr.Rm, add_sr.shift, add_sr.amount, &taint);
-		if (!add_sr.add) {
-			op2 = ~op2;
-			carry = 1;
-		}
-		add_with_carry(&result, &nzcv, op1, op2, carry);
-		if (add_sr.setflags) {
-			pstate_set_(sim, NZCV, nzcv, nzcv, taint);
-		}
-		gpreg_set_(sim, add_sr.Rd, result, taint);
-	} else if (aarch64_decode_adr(ins, pc, &adr)) {
-		aarch64_sim_taint_meet_with(&taint, sim->PC.taint);
-		gpreg_set_(sim, adr.Xd, adr.label, taint);
-	} else if (aarch64_decode_and_im(ins, &and_im)) {
-		op1 = gpreg_get_(sim, and_im.Rn, &taint);
-		op2 = and_im.imm;
-		if (and_im.and) {
-			result = op1 & op2;
-		} else if (and_im.or) {
-			result = op1 | op2;
-		} else {
-			assert(and_im.xor);
-			result = op1 ^ op2;
-		}
-		if (and_im.setflags) {
-			pstate_set_(sim, NZCV, make_nzcv(result), nzcv, taint);
-		}
-		gpreg_set_(sim, and_im.Rd, result, taint);
-	} else if (aarch64_decode_and_sr(ins, &and_sr)) {
-		op1 = gpreg_get_(sim, and_sr.Rn, &taint);
-		op2 = gpreg_get_shift_(sim, and_sr.Rm, and_sr.shift, and_sr.amount, &taint);
-		if (and_sr.not) {
-			op2 = ~op2;
-		}
-		if (and_sr.and) {
-			result = op1 & op2;
-		} else if (and_sr.or) {
-			result = op1 | op2;
-		} else {
-			assert(and_sr.xor);
-			result = op1 ^ op2;
-		}
-		if (and_sr.setflags) {
-			pstate_set_(sim, NZCV, make_nzcv(result), nzcv, taint);
-		}
-		gpreg_set_(sim, and_sr.Rd, result, taint);
-	} else if (aarch64_decode_b(ins, pc, &b)) {
-		do_branch = true;
-		if (b.link) {
-			branch_type = AARCH64_SIM_BRANCH_TYPE_BRANCH_AND_LINK;
-		}
-		branch_address.value = b.label;
-		aarch64_sim_taint_meet_with(&branch_address.taint, sim->PC.taint);
-	} else if (aarch64_decode_br(ins, &br)) {
-		do_branch = true;
-		if (br.ret) {
-			branch_type = AARCH64_SIM_BRANCH_TYPE_RETURN;
-		} else if (br.link) {
-			branch_type = AARCH64_SIM_BRANCH_TYPE_BRANCH_AND_LINK;
-		}
-		branch_address.value = gpreg_get_(sim, br.Xn, &taint);
-		branch_address.taint = taint;
-	} else if (aarch64_decode_cbz(ins, pc, &cbz)) {
-		do_branch = true;
-		branch_type = AARCH64_SIM_BRANCH_TYPE_CONDITIONAL;
-		op1 = gpreg_get_(sim, cbz.Rt, &taint);
-		branch_condition.value = ((cbz.n && op1 != 0) || (!cbz.n && op1 == 0));
-		branch_condition.taint = taint;
-		branch_address.value = pc + cbz.label;
-		aarch64_sim_taint_meet_with(&branch_address.taint, sim->PC.taint);
-	} else if (aarch64_decode_ldp(ins, &ldp)) {
-		uint64_t address = gpreg_get_(sim, ldp.Xn, &taint);
-		if (!ldp.post) {
-			address += ldp.imm;
-		}
-		struct aarch64_sim_word address_taint = { address, taint };
-		size_t size = 1 << ldp.size;
-		if (ldp.load) {
-			struct aarch64_sim_word mem1 = { 0, taint }, mem2 = { 0, taint };
-			run = sim->memory_load(sim, &mem1, &address_taint, size);
-			if (!run) {
-				keep_running = false;
+	switch (decoded->kind) {
+		case AARCH64_DECODED_ADC:
+			op1 = gpreg_get_(sim, decoded->adc.Rn, &taint);
+			op2 = gpreg_get_(sim, decoded->adc.Rm, &taint);
+			carry = pstate_get_(sim, C, nzcv, &taint);
+			if (!decoded->adc.adc) {
+				op2 = ~op2;
 			}
-			address_taint.value += size;
-			run = sim->memory_load(sim, &mem2, &address_taint, size);
-			if (!run) {
-				keep_running = false;
+			add_with_carry(&result, &nzcv, op1, op2, carry);
+			if (decoded->adc.setflags) {
+				pstate_set_(sim, NZCV, nzcv, nzcv, taint);
 			}
-			if (ldp.sign) {
-				mem1.value = sign_extend(mem1.value, 8 * size - 1);
-				mem2.value = sign_extend(mem2.value, 8 * size - 1);
+			gpreg_set_(sim, decoded->adc.Rd, result, taint);
+			break;
+		case AARCH64_DECODED_ADD_XR:
+			op1 = gpreg_get_(sim, decoded->add_xr.Rn, &taint);
+			op2 = gpreg_get_extend_(sim, decoded->add_xr.Rm, decoded->add_xr.extend,
+					decoded->add_xr.amount, &taint);
+			if (!decoded->add_xr.add) {
+				op2 = ~op2;
+				carry = 1;
 			}
-			gpreg_set_(sim, ldp.Rt1, mem1.value, mem1.taint);
-			gpreg_set_(sim, ldp.Rt2, mem2.value, mem2.taint);
-		} else {
-			struct aarch64_sim_word reg1 = { 0, sim->instruction.taint };
-			struct aarch64_sim_word reg2 = { 0, sim->instruction.taint };
-			reg1.value = gpreg_get_(sim, ldp.Rt1, &reg1.taint);
-			reg2.value = gpreg_get_(sim, ldp.Rt2, &reg2.taint);
-			run = sim->memory_store(sim, &reg1, &address_taint, size);
-			if (!run) {
-				keep_running = false;
+			add_with_carry(&result, &nzcv, op1, op2, carry);
+			if (decoded->add_xr.setflags) {
+				pstate_set_(sim, NZCV, nzcv, nzcv, taint);
 			}
-			address_taint.value += size;
-			run = sim->memory_store(sim, &reg2, &address_taint, size);
-			if (!run) {
-				keep_running = false;
+			gpreg_set_(sim, decoded->add_xr.Rd, result, taint);
+			break;
+		case AARCH64_DECODED_ADD_IM:
+			op1 = gpreg_get_(sim, decoded->add_im.Rn, &taint);
+			op2 = (uint64_t)decoded->add_im.imm << decoded->add_im.shift;
+			if (!decoded->add_im.add) {
+				op2 = ~op2;
+				carry = 1;
 			}
-		}
-		if (ldp.wb) {
-			if (ldp.post) {
-				address += ldp.imm;
+			add_with_carry(&result, &nzcv, op1, op2, carry);
+			if (decoded->add_im.setflags) {
+				pstate_set_(sim, NZCV, nzcv, nzcv, taint);
+			}
+			gpreg_set_(sim, decoded->add_im.Rd, result, taint);
+			break;
+		case AARCH64_DECODED_ADD_SR:
+			op1 = gpreg_get_(sim, decoded->add_sr.Rn, &taint);
+			op2 = gpreg_get_shift_(sim, decoded->add_sr.Rm, decoded->add_sr.shift,
+					decoded->add_sr.amount, &taint);
+			if (!decoded->add_sr.add) {
+				op2 = ~op2;
+				carry = 1;
 			}
-			gpreg_set_(sim, ldp.Xn, address, taint);
+			add_with_carry(&result, &nzcv, op1, op2, carry);
+			if (decoded->add_sr.setflags) {
+				pstate_set_(sim, NZCV, nzcv, nzcv, taint);
+			}
+			gpreg_set_(sim, decoded->add_sr.Rd, result, taint);
+			break;
+		case AARCH64_DECODED_ADR:
+			aarch64_sim_taint_meet_with(&taint, sim->PC.taint);
+			gpreg_set_(sim, decoded->adr.Xd, decoded->adr.label, taint);
+			break;
+		case AARCH64_DECODED_AND_IM:
+			op1 = gpreg_get_(sim, decoded->and_im.Rn, &taint);
+			op2 = decoded->and_im.imm;
+			if (decoded->and_im.and) {
+				result = op1 & op2;
+			} else if (decoded->and_im.or) {
+				result = op1 | op2;
+			} else {
+				assert(decoded->and_im.xor);
+				result = op1 ^ op2;
+			}
+			if (decoded->and_im.setflags) {
+				pstate_set_(sim, NZCV, make_nzcv(result), nzcv, taint);
+			}
+			gpreg_set_(sim, decoded->and_im.Rd, result, taint);
+			break;
+		case AARCH64_DECODED_AND_SR:
+			op1 = gpreg_get_(sim, decoded->and_sr.Rn, &taint);
+			op2 = gpreg_get_shift_(sim, decoded->and_sr.Rm, decoded->and_sr.shift,
+					decoded->and_sr.amount, &taint);
+			if (decoded->and_sr.not) {
+				op2 = ~op2;
+			}
+			if (decoded->and_sr.and) {
+				result = op1 & op2;
+			} else if (decoded->and_sr.or) {
+				result = op1 | op2;
+			} else {
+				assert(decoded->and_sr.xor);
+				result = op1 ^ op2;
+			}
+			if (decoded->and_sr.setflags) {
+				pstate_set_(sim, NZCV, make_nzcv(result), nzcv, taint);
+			}
+			gpreg_set_(sim, decoded->and_sr.Rd, result, taint);
+			break;
+		case AARCH64_DECODED_B:
+			do_branch = true;
+			if (decoded->b.link) {
+				branch_type = AARCH64_SIM_BRANCH_TYPE_BRANCH_AND_LINK;
+			}
+			branch_address.value = decoded->b.label;
+			aarch64_sim_taint_meet_with(&branch_address.taint, sim->PC.taint);
+			break;
+		case AARCH64_DECODED_BR:
+			do_branch = true;
+			if (decoded->br.ret) {
+				branch_type = AARCH64_SIM_BRANCH_TYPE_RETURN;
+			} else if (decoded->br.link) {
+				branch_type = AARCH64_SIM_BRANCH_TYPE_BRANCH_AND_LINK;
+			}
+			branch_address.value = gpreg_get_(sim, decoded->br.Xn, &taint);
+			branch_address.taint = taint;
+			break;
+		case AARCH64_DECODED_CBZ:
+			do_branch = true;
+			branch_type = AARCH64_SIM_BRANCH_TYPE_CONDITIONAL;
+			op1 = gpreg_get_(sim, decoded->cbz.Rt, &taint);
+			branch_condition.value = ((decoded->cbz.n && op1 != 0)
+					|| (!decoded->cbz.n && op1 == 0));
+			branch_condition.taint = taint;
+			branch_address.value = decoded->cbz.label;
+			aarch64_sim_taint_meet_with(&branch_address.taint, sim->PC.taint);
+			break;
+		case AARCH64_DECODED_LDP: {
+			uint64_t address = gpreg_get_(sim, decoded->ldp.Xn, &taint);
+			if (!decoded->ldp.post) {
+				address += decoded->ldp.imm;
+			}
+			struct aarch64_sim_word address_taint = { address, taint };
+			size_t size = 1 << decoded->ldp.size;
+			if (decoded->ldp.load) {
+				struct aarch64_sim_word mem1 = { 0, taint }, mem2 = { 0, taint };
+				run = sim->memory_load(sim, &mem1, &address_taint, size);
+				if (!run) {
+					keep_running = false;
+				}
+				address_taint.value += size;
+				run = sim->memory_load(sim, &mem2, &address_taint, size);
+				if (!run) {
+					keep_running = false;
+				}
+				if (decoded->ldp.sign) {
+					mem1.value = sign_extend(mem1.value, 8 * size - 1);
+					mem2.value = sign_extend(mem2.value, 8 * size - 1);
+				}
+				gpreg_set_(sim, decoded->ldp.Rt1, mem1.value, mem1.taint);
+				gpreg_set_(sim, decoded->ldp.Rt2, mem2.value, mem2.taint);
+			} else {
+				struct aarch64_sim_word reg1 = { 0, sim->instruction.taint };
+				struct aarch64_sim_word reg2 = { 0, sim->instruction.taint };
+				reg1.value = gpreg_get_(sim, decoded->ldp.Rt1, &reg1.taint);
+				reg2.value = gpreg_get_(sim, decoded->ldp.Rt2, &reg2.taint);
+				run = sim->memory_store(sim, &reg1, &address_taint, size);
+				if (!run) {
+					keep_running = false;
+				}
+				address_taint.value += size;
+				run = sim->memory_store(sim, &reg2, &address_taint, size);
+				if (!run) {
+					keep_running = false;
+				}
+			}
+			if (decoded->ldp.wb) {
+				if (decoded->ldp.post) {
+					address += decoded->ldp.imm;
+				}
+				gpreg_set_(sim, decoded->ldp.Xn, address, taint);
+			}
+			break;
 		}
-	} else if (aarch64_decode_ldr_ix(ins, &ldr_im)
-			|| aarch64_decode_ldr_ui(ins, &ldr_im)) {
-		uint64_t address = gpreg_get_(sim, ldr_im.Xn, &taint);
-		if (!ldr_im.post) {
-			address += ldr_im.imm;
+		case AARCH64_DECODED_LDR_IX:
+		case AARCH64_DECODED_LDR_UI: {
+			uint64_t address = gpreg_get_(sim, decoded->ldr_im.Xn, &taint);
+			if (!decoded->ldr_im.post) {
+				address += decoded->ldr_im.imm;
+			}
+			struct aarch64_sim_word address_taint = { address, taint };
+			size_t size = 1 << decoded->ldr_im.size;
+			if (decoded->ldr_im.load) {
+				struct aarch64_sim_word mem = { 0, taint };
+				run = sim->memory_load(sim, &mem, &address_taint, size);
+				if (!run) {
+					keep_running = false;
+				}
+				if (decoded->ldr_im.sign) {
+					mem.value = sign_extend(mem.value, 8 * size - 1);
+				}
+				gpreg_set_(sim, decoded->ldr_im.Rt, mem.value, mem.taint);
+			} else {
+				struct aarch64_sim_word reg = { 0, sim->instruction.taint };
+				reg.value = gpreg_get_(sim, decoded->ldr_im.Rt, &reg.taint);
+				run = sim->memory_store(sim, &reg, &address_taint, size);
+				if (!run) {
+					keep_running = false;
+				}
+			}
+			if (decoded->ldr_im.wb) {
+				if (decoded->ldr_im.post) {
+					address += decoded->ldr_im.imm;
+				}
+				gpreg_set_(sim, decoded->ldr_im.Xn, address, taint);
+			}
+			break;
 		}
-		struct aarch64_sim_word address_taint = { address, taint };
-		size_t size = 1 << ldr_im.size;
-		if (ldr_im.load) {
+		case AARCH64_DECODED_LDR_LIT: {
+			struct aarch64_sim_word address_taint = { decoded->ldr_lit.label, taint };
+			aarch64_sim_taint_meet_with(&address_taint.taint, sim->PC.taint);
+			size_t size = 1 << decoded->ldr_lit.size;
+			assert(decoded->ldr_lit.load);
 			struct aarch64_sim_word mem = { 0, taint };
 			run = sim->memory_load(sim, &mem, &address_taint, size);
 			if (!run) {
 				keep_running = false;
 			}
-			if (ldr_im.sign) {
+			if (decoded->ldr_lit.sign) {
 				mem.value = sign_extend(mem.value, 8 * size - 1);
 			}
-			gpreg_set_(sim, ldr_im.Rt, mem.value, mem.taint);
-		} else {
-			struct aarch64_sim_word reg = { 0, sim->instruction.taint };
-			reg.value = gpreg_get_(sim, ldr_im.Rt, &reg.taint);
-			run = sim->memory_store(sim, &reg, &address_taint, size);
-			if (!run) {
-				keep_running = false;
-			}
+			gpreg_set_(sim, decoded->ldr_lit.Rt, mem.value, mem.taint);
+			break;
 		}
-		if (ldr_im.wb) {
-			if (ldr_im.post) {
-				address += ldr_im.imm;
+		case AARCH64_DECODED_LDR_R: {
+			uint64_t address = gpreg_get_(sim, decoded->ldr_r.Xn, &taint);
+			uint64_t offset  = gpreg_get_extend_(sim, decoded->ldr_r.Rm,
+					decoded->ldr_r.extend, decoded->ldr_r.amount, &taint);
+			address += offset;
+			struct aarch64_sim_word address_taint = { address, taint };
+			size_t size = 1 << decoded->ldr_r.size;
+			if (decoded->ldr_r.load) {
+				struct aarch64_sim_word mem = { 0, taint };
+				run = sim->memory_load(sim, &mem, &address_taint, size);
+				if (!run) {
+					keep_running = false;
+				}
+				if (decoded->ldr_r.sign) {
+					mem.value = sign_extend(mem.value, 8 * size - 1);
+				}
+				gpreg_set_(sim, decoded->ldr_r.Rt, mem.value, mem.taint);
+			} else {
+				struct aarch64_sim_word reg = { 0, sim->instruction.taint };
+				reg.value = gpreg_get_(sim, decoded->ldr_r.Rt, &reg.taint);
+				run = sim->memory_store(sim, &reg, &address_taint, size);
+				if (!run) {
+					keep_running = false;
+				}
 			}
-			gpreg_set_(sim, ldr_im.Xn, address, taint);
+			break;
 		}
-	} else if (aarch64_decode_ldr_lit(ins, pc, &ldr_lit)) {
-		struct aarch64_sim_word address_taint = { ldr_lit.label, taint };
-		aarch64_sim_taint_meet_with(&address_taint.taint, sim->PC.taint);
-		size_t size = 1 << ldr_lit.size;
-		assert(ldr_lit.load);
-		struct aarch64_sim_word mem = { 0, taint };
-		run = sim->memory_load(sim, &mem, &address_taint, size);
-		if (!run) {
-			keep_running = false;
-		}
-		if (ldr_lit.sign) {
-			mem.value = sign_extend(mem.value, 8 * size - 1);
-		}
-		gpreg_set_(sim, ldr_im.Rt, mem.value, mem.taint);
-	} else if (aarch64_decode_ldr_r(ins, &ldr_r)) {
-		uint64_t address = gpreg_get_(sim, ldr_r.Xn, &taint);
-		uint64_t offset  = gpreg_get_extend_(sim, ldr_r.Rm, ldr_r.extend, ldr_r.amount,
-				&taint);
-		address += offset;
-		struct aarch64_sim_word address_taint = { address, taint };
-		size_t size = 1 << ldr_r.size;
-		if (ldr_r.load) {
-			struct aarch64_sim_word mem = { 0, taint };
-			run = sim->memory_load(sim, &mem, &address_taint, size);
-			if (!run) {
-				keep_running = false;
+		case AARCH64_DECODED_MOV:
+			op1 = 0;
+			if (decoded->mov.k) {
+				op1 = gpreg_get_(sim, decoded->mov.Rd, &taint);
+				op1 &= ~(ones(16) << decoded->mov.shift);
 			}
-			if (ldr_r.sign) {
-				mem.value = sign_extend(mem.value, 8 * size - 1);
+			op1 |= (uint64_t)decoded->mov.imm << decoded->mov.shift;
+			if (decoded->mov.n) {
+				op1 = ~op1;
 			}
-			gpreg_set_(sim, ldr_r.Rt, mem.value, mem.taint);
-		} else {
-			struct aarch64_sim_word reg = { 0, sim->instruction.taint };
-			reg.value = gpreg_get_(sim, ldr_r.Rt, &reg.taint);
-			run = sim->memory_store(sim, &reg, &address_taint, size);
+			gpreg_set_(sim, decoded->mov.Rd, op1, taint);
+			break;
+		case AARCH64_DECODED_NOP:
+			// Do nothing.
+			break;
+		default:
+			run = sim->illegal_instruction(sim);
 			if (!run) {
 				keep_running = false;
 			}
-		}
-	} else if (aarch64_decode_mov(ins, &mov)) {
-		op1 = 0;
-		if (mov.k) {
-			op1 = gpreg_get_(sim, mov.Rd, &taint);
-			op1 &= ~(ones(16) << mov.shift);
-		}
-		op1 |= (uint64_t)mov.imm << mov.shift;
-		if (mov.n) {
-			op1 = ~op1;
-		}
-		gpreg_set_(sim, mov.Rd, op1, taint);
-	} else if (aarch64_decode_nop(ins)) {
-		// Do nothing.
-	} else {
-		run = sim->illegal_instruction(sim);
-		if (!run) {
-			keep_running = false;
-		}
+			break;
 	}
 
 	// Handle any branching. Note that because branch_hit may abort before executing the
@@ -541,6 +551,34 @@ aarch64_sim_step(struct aarch64_sim *sim) {
 	return keep_running;
 }
 
+bool
+aarch64_sim_step(struct aarch64_sim *sim) {
+	// Fetch the next instruction.
+	bool run = sim->instruction_fetch(sim);
+	if (!run) {
+		return false;
+	}
+	// Decode and execute it.
+	uint32_t ins = (uint32_t) sim->instruction.value;
+	struct aarch64_decoded decoded;
+	aarch64_ir_decode(ins, sim->PC.value, &decoded);
+	return sim_execute(sim, &decoded);
+}
+
+bool
+aarch64_sim_run_block(struct aarch64_sim *sim, const uint32_t *ins,
+		const struct aarch64_decoded *decoded, size_t count, size_t *executed) {
+	bool run = true;
+	size_t i = 0;
+	while (run && i < count) {
+		sim->instruction.value = ins[i];
+		run = sim_execute(sim, &decoded[i]);
+		i++;
+	}
+	*executed = i;
+	return run;
+}
+
 void
 aarch64_sim_run(struct aarch64_sim *sim) {
 	bool run;
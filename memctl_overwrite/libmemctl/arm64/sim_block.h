@@ -0,0 +1,38 @@
+#ifndef MEMCTL__ARM64__SIM_BLOCK_H_
+#define MEMCTL__ARM64__SIM_BLOCK_H_
+
+#include "memctl/arm64/sim.h"
+
+#include "arm64/decode.h"
+
+#include <stddef.h>
+
+/*
+ * aarch64_sim_run_block
+ *
+ * Description:
+ * 	Execute a run of pre-decoded instructions starting at PC, without calling the
+ * 	instruction_fetch callback. The memory_load, memory_store, branch_hit, and
+ * 	illegal_instruction callbacks are called exactly as they would be by aarch64_sim_step.
+ *
+ * Parameters:
+ * 		sim			The simulator.
+ * 		ins			The instruction words, the first of which is at PC.
+ * 		decoded			The decoded instructions.
+ * 		count			The number of instructions to execute.
+ * 	out	executed		On return, the number of instructions that were executed.
+ *
+ * Returns:
+ * 	True if all count instructions were executed and the simulator should keep running.
+ *
+ * Notes:
+ * 	The instructions are executed in order regardless of where PC ends up, so only the last
+ * 	instruction may be a branch. The IR cache's basic blocks satisfy this.
+ *
+ * 	Since instruction_fetch is skipped, the client must perform any checks it would have made
+ * 	there for every instruction in the run before calling this function.
+ */
+bool aarch64_sim_run_block(struct aarch64_sim *sim, const uint32_t *ins,
+		const struct aarch64_decoded *decoded, size_t count, size_t *executed);
+
+#endif
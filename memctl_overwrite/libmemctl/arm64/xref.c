@@ -0,0 +1,537 @@
+#include "arm64/xref.h"
+
+#include "arm64/decode.h"
+#include "algorithm.h"
+#include "cache_file.h"
+#include "memctl/memctl_error.h"
+#include "memctl/utility.h"
+#include "parallel.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The number of instructions for which an ADRP result is remembered.
+#define XREF_WINDOW		16
+
+// The minimum capacity of a segment's references array.
+#define MIN_XREF_CAPACITY	1024
+
+// The registers clobbered by a function call: X0 through X18.
+#define CALL_CLOBBERED		0x7ffff
+
+// The version of the saved index format. Bump this whenever the format or the references
+// found by the scan change.
+#define XREF_FILE_VERSION	1
+
+// The magic number at the start of a saved index.
+static const char xref_file_magic[8] = "memxref1";
+
+/*
+ * struct xref_file_header
+ *
+ * Description:
+ * 	The header of a saved cross-reference index. The references follow the header.
+ */
+struct xref_file_header {
+	char     magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint8_t  uuid[16];
+	uint64_t base;
+	uint64_t count;
+};
+
+/*
+ * struct xref_tracker
+ *
+ * Description:
+ * 	The page addresses loaded into registers by recent ADRP instructions.
+ */
+struct xref_tracker {
+	// The page address in each register.
+	kaddr_t page[32];
+	// The instruction index after which each register's page is forgotten.
+	size_t expires[32];
+	// A bitmask of the registers holding a page address.
+	uint32_t valid;
+};
+
+/*
+ * struct xref_segment
+ *
+ * Description:
+ * 	The state for scanning one executable segment.
+ */
+struct xref_segment {
+	// The code in the segment.
+	const uint32_t *code;
+	kaddr_t addr;
+	size_t count;
+	// The base address of the index.
+	kaddr_t base;
+	// The references found so far.
+	uint64_t *xref;
+	size_t xref_count;
+	size_t capacity;
+	// Whether the scan succeeded.
+	bool success;
+};
+
+/*
+ * tracker_forget
+ *
+ * Description:
+ * 	Forget the page address in the register with the given number.
+ */
+static void
+tracker_forget(struct xref_tracker *tracker, unsigned n) {
+	if (n < 31) {
+		tracker->valid &= ~(1u << n);
+	}
+}
+
+/*
+ * tracker_clear
+ *
+ * Description:
+ * 	Forget the page address in a register that has been overwritten.
+ */
+static void
+tracker_clear(struct xref_tracker *tracker, aarch64_gpreg reg) {
+	tracker_forget(tracker, AARCH64_GPREGID(reg));
+}
+
+/*
+ * tracker_set
+ *
+ * Description:
+ * 	Record the page address loaded into a register by the ADRP at instruction index i.
+ */
+static void
+tracker_set(struct xref_tracker *tracker, aarch64_gpreg reg, size_t i, kaddr_t page) {
+	unsigned n = AARCH64_GPREGID(reg);
+	if (n < 31) {
+		tracker->page[n]    = page;
+		tracker->expires[n] = i + XREF_WINDOW;
+		tracker->valid     |= 1u << n;
+	}
+}
+
+/*
+ * tracker_get
+ *
+ * Description:
+ * 	Get the page address in a register at instruction index i, if it is known.
+ */
+static bool
+tracker_get(const struct xref_tracker *tracker, aarch64_gpreg reg, size_t i, kaddr_t *page) {
+	unsigned n = AARCH64_GPREGID(reg);
+	if (n >= 31 || (tracker->valid & (1u << n)) == 0 || tracker->expires[n] < i) {
+		return false;
+	}
+	*page = tracker->page[n];
+	return true;
+}
+
+/*
+ * emit
+ *
+ * Description:
+ * 	Record a reference. References that cannot be represented relative to the base are
+ * 	dropped.
+ */
+static bool
+emit(struct xref_segment *segment, kaddr_t target, kaddr_t source) {
+	if (target < segment->base || target - segment->base > UINT32_MAX
+			|| source - segment->base > UINT32_MAX) {
+		return true;
+	}
+	if (segment->xref_count == segment->capacity) {
+		size_t capacity = max(2 * segment->capacity, (size_t) MIN_XREF_CAPACITY);
+		uint64_t *xref = realloc(segment->xref, capacity * sizeof(*xref));
+		if (xref == NULL) {
+			return false;
+		}
+		segment->xref     = xref;
+		segment->capacity = capacity;
+	}
+	segment->xref[segment->xref_count] = ((target - segment->base) << 32)
+		| (source - segment->base);
+	segment->xref_count++;
+	return true;
+}
+
+/*
+ * scan_segment
+ *
+ * Description:
+ * 	Find all the references made by the code in a segment. This is a pthread start routine.
+ *
+ * Notes:
+ * 	This does not push errors, so it may be run on any thread.
+ */
+static void *
+scan_segment(void *arg) {
+	struct xref_segment *segment = arg;
+	struct xref_tracker tracker = {};
+	segment->success = false;
+	for (size_t i = 0; i < segment->count; i++) {
+		kaddr_t pc = segment->addr + i * AARCH64_INSTRUCTION_SIZE;
+		uint32_t ins = segment->code[i];
+		struct aarch64_decoded d;
+		aarch64_decode(ins, pc, &d);
+		kaddr_t page;
+		bool ok = true;
+		switch (d.kind) {
+			case AARCH64_DECODED_ADR:
+				if (d.adr.adrp) {
+					tracker_set(&tracker, d.adr.Xd, i, d.adr.label);
+				} else {
+					ok = emit(segment, d.adr.label, pc);
+					tracker_clear(&tracker, d.adr.Xd);
+				}
+				break;
+			case AARCH64_DECODED_ADD_IM:
+				if (d.add_im.add && !d.add_im.setflags
+						&& AARCH64_GPREGSIZE(d.add_im.Rd) == 64
+						&& tracker_get(&tracker, d.add_im.Rn, i, &page)) {
+					kaddr_t offset = (kaddr_t) d.add_im.imm << d.add_im.shift;
+					ok = emit(segment, page + offset, pc);
+				}
+				tracker_clear(&tracker, d.add_im.Rd);
+				break;
+			case AARCH64_DECODED_LDR_UI:
+				if (tracker_get(&tracker, d.ldr_im.Xn, i, &page)) {
+					ok = emit(segment, page + d.ldr_im.imm, pc);
+				}
+				if (d.ldr_im.load) {
+					tracker_clear(&tracker, d.ldr_im.Rt);
+				}
+				break;
+			case AARCH64_DECODED_LDR_IX:
+				if (d.ldr_im.load) {
+					tracker_clear(&tracker, d.ldr_im.Rt);
+				}
+				tracker_clear(&tracker, d.ldr_im.Xn);
+				break;
+			case AARCH64_DECODED_LDR_R:
+				if (d.ldr_r.load) {
+					tracker_clear(&tracker, d.ldr_r.Rt);
+				}
+				break;
+			case AARCH64_DECODED_LDR_LIT:
+				ok = emit(segment, d.ldr_lit.label, pc);
+				tracker_clear(&tracker, d.ldr_lit.Rt);
+				break;
+			case AARCH64_DECODED_LDP:
+				if (d.ldp.load) {
+					tracker_clear(&tracker, d.ldp.Rt1);
+					tracker_clear(&tracker, d.ldp.Rt2);
+				}
+				if (d.ldp.wb) {
+					tracker_clear(&tracker, d.ldp.Xn);
+				}
+				break;
+			case AARCH64_DECODED_B:
+				ok = emit(segment, d.b.label, pc);
+				tracker.valid &= (d.b.link ? ~CALL_CLOBBERED : 0);
+				break;
+			case AARCH64_DECODED_BR:
+				tracker.valid = 0;
+				break;
+			case AARCH64_DECODED_ADC:
+				tracker_clear(&tracker, d.adc.Rd);
+				break;
+			case AARCH64_DECODED_ADD_XR:
+				tracker_clear(&tracker, d.add_xr.Rd);
+				break;
+			case AARCH64_DECODED_ADD_SR:
+				tracker_clear(&tracker, d.add_sr.Rd);
+				break;
+			case AARCH64_DECODED_AND_IM:
+				tracker_clear(&tracker, d.and_im.Rd);
+				break;
+			case AARCH64_DECODED_AND_SR:
+				tracker_clear(&tracker, d.and_sr.Rd);
+				break;
+			case AARCH64_DECODED_MOV:
+				tracker_clear(&tracker, d.mov.Rd);
+				break;
+			case AARCH64_DECODED_CBZ:
+			case AARCH64_DECODED_NOP:
+				break;
+			default:
+				// Nearly every instruction that writes a general-purpose
+				// register keeps the destination in the low 5 bits.
+				tracker_forget(&tracker, ins & 0x1f);
+				break;
+		}
+		if (!ok) {
+			return NULL;
+		}
+	}
+	segment->success = true;
+	return NULL;
+}
+
+/*
+ * is_code_segment
+ *
+ * Description:
+ * 	Returns true if the segment is executable.
+ */
+static bool
+is_code_segment(const struct load_command *lc) {
+	const struct segment_command_64 *sc = (const struct segment_command_64 *)lc;
+	return (sc->initprot & VM_PROT_EXECUTE) != 0;
+}
+
+/*
+ * xref_index_build
+ *
+ * Description:
+ * 	Scan every executable segment of the Mach-O and build the sorted index.
+ */
+static bool
+xref_index_build(struct aarch64_xref_index *index, const struct macho *macho) {
+	assert(macho_is_64(macho));
+	kaddr_t base = macho_lowest_address(macho);
+	// Set up the segments.
+	size_t segment_count = 0;
+	const struct load_command *lc = NULL;
+	while ((lc = macho_next_segment(macho, lc)) != NULL) {
+		segment_count += is_code_segment(lc);
+	}
+	struct xref_segment *segments = calloc(segment_count + 1, sizeof(*segments));
+	uint64_t *keys = NULL;
+	size_t *permutation = NULL;
+	bool success = false;
+	size_t s = 0;
+	if (segments == NULL) {
+		goto out_of_memory;
+	}
+	while ((lc = macho_next_segment(macho, lc)) != NULL) {
+		if (!is_code_segment(lc)) {
+			continue;
+		}
+		struct xref_segment *segment = &segments[s++];
+		const void *data;
+		size_t size;
+		macho_segment_data(macho, lc, &data, &segment->addr, &size);
+		segment->code  = data;
+		segment->count = (data == NULL ? 0 : size / AARCH64_INSTRUCTION_SIZE);
+		segment->base  = base;
+	}
+	// Scan each segment on its own thread.
+	parallel_run(scan_segment, segments, sizeof(*segments), segment_count);
+	size_t count = 0;
+	bool scanned = true;
+	for (s = 0; s < segment_count; s++) {
+		scanned &= segments[s].success;
+		count += segments[s].xref_count;
+	}
+	if (!scanned) {
+		goto out_of_memory;
+	}
+	// Merge and sort the references.
+	keys = malloc((count + 1) * sizeof(*keys));
+	permutation = malloc((count + 1) * sizeof(*permutation));
+	if (keys == NULL || permutation == NULL) {
+		goto out_of_memory;
+	}
+	size_t k = 0;
+	for (s = 0; s < segment_count; s++) {
+		memcpy(keys + k, segments[s].xref, segments[s].xref_count * sizeof(*keys));
+		k += segments[s].xref_count;
+	}
+	if (!radix_sorting_permutation(keys, count, permutation)) {
+		goto out_of_memory;
+	}
+	uint64_t *xref = malloc((count + 1) * sizeof(*xref));
+	if (xref == NULL) {
+		goto out_of_memory;
+	}
+	for (k = 0; k < count; k++) {
+		xref[k] = keys[permutation[k]];
+	}
+	index->base  = base;
+	index->xref  = xref;
+	index->count = count;
+	success = true;
+	goto out;
+out_of_memory:
+	error_out_of_memory();
+out:
+	if (segments != NULL) {
+		for (s = 0; s < segment_count; s++) {
+			free(segments[s].xref);
+		}
+	}
+	free(segments);
+	free(keys);
+	free(permutation);
+	return success;
+}
+
+/*
+ * code_end_offset
+ *
+ * Description:
+ * 	Get the offset from the base of the end of the last executable segment. Every reference
+ * 	comes from an instruction below this offset.
+ */
+static uint64_t
+code_end_offset(const struct macho *macho, kaddr_t base) {
+	uint64_t end = 0;
+	const struct load_command *lc = NULL;
+	while ((lc = macho_next_segment(macho, lc)) != NULL) {
+		const struct segment_command_64 *sc = (const struct segment_command_64 *)lc;
+		if (is_code_segment(lc) && sc->vmaddr + sc->vmsize - base > end) {
+			end = sc->vmaddr + sc->vmsize - base;
+		}
+	}
+	return end;
+}
+
+/*
+ * xref_index_valid
+ *
+ * Description:
+ * 	Check that loaded references are sorted and that every source lies in the code.
+ */
+static bool
+xref_index_valid(const uint64_t *xref, size_t count, uint64_t code_end) {
+	for (size_t i = 0; i < count; i++) {
+		if ((i > 0 && xref[i] < xref[i - 1]) || (uint32_t) xref[i] >= code_end) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * xref_index_load
+ *
+ * Description:
+ * 	Load a saved index, if it exists and matches the Mach-O. Failure is not an error.
+ */
+static bool
+xref_index_load(struct aarch64_xref_index *index, const char *name, const uint8_t uuid[16],
+		const struct macho *macho) {
+	FILE *file = cache_file_open(name);
+	if (file == NULL) {
+		return false;
+	}
+	kaddr_t base = macho_lowest_address(macho);
+	struct xref_file_header header;
+	uint64_t *xref = NULL;
+	if (fread(&header, sizeof(header), 1, file) != 1
+			|| memcmp(header.magic, xref_file_magic, sizeof(header.magic)) != 0
+			|| header.version != XREF_FILE_VERSION
+			|| memcmp(header.uuid, uuid, sizeof(header.uuid)) != 0
+			|| header.base != base
+			|| header.count > SIZE_MAX / sizeof(*xref) - 1) {
+		goto fail;
+	}
+	xref = malloc((header.count + 1) * sizeof(*xref));
+	if (xref == NULL
+			|| fread(xref, sizeof(*xref), header.count, file) != header.count
+			|| !xref_index_valid(xref, header.count, code_end_offset(macho, base))) {
+		goto fail;
+	}
+	fclose(file);
+	index->base  = base;
+	index->xref  = xref;
+	index->count = header.count;
+	return true;
+fail:
+	free(xref);
+	fclose(file);
+	return false;
+}
+
+/*
+ * xref_index_save
+ *
+ * Description:
+ * 	Save an index for later runs. Failure is not an error.
+ */
+static void
+xref_index_save(const struct aarch64_xref_index *index, const char *name,
+		const uint8_t uuid[16]) {
+	struct cache_file cf;
+	if (!cache_file_create(&cf, name)) {
+		return;
+	}
+	struct xref_file_header header = {};
+	memcpy(header.magic, xref_file_magic, sizeof(header.magic));
+	header.version = XREF_FILE_VERSION;
+	memcpy(header.uuid, uuid, sizeof(header.uuid));
+	header.base  = index->base;
+	header.count = index->count;
+	bool written = (fwrite(&header, sizeof(header), 1, cf.file) == 1
+			&& fwrite(index->xref, sizeof(*index->xref), index->count, cf.file)
+			== index->count);
+	cache_file_commit(&cf, written);
+}
+
+bool
+aarch64_xref_index_init(struct aarch64_xref_index *index, const struct macho *macho,
+		bool persist) {
+	uint8_t uuid[16];
+	char name[CACHE_FILE_NAME_SIZE];
+	persist = persist && macho_find_uuid(macho, uuid) == MACHO_SUCCESS;
+	if (persist) {
+		cache_file_name(name, "xref-", uuid, sizeof(uuid));
+		if (xref_index_load(index, name, uuid, macho)) {
+			return true;
+		}
+	}
+	if (!xref_index_build(index, macho)) {
+		return false;
+	}
+	if (persist) {
+		xref_index_save(index, name, uuid);
+	}
+	return true;
+}
+
+void
+aarch64_xref_index_deinit(struct aarch64_xref_index *index) {
+	free(index->xref);
+	index->xref  = NULL;
+	index->count = 0;
+}
+
+size_t
+aarch64_xref_find(const struct aarch64_xref_index *index, kaddr_t target, size_t *first) {
+	*first = 0;
+	if (target < index->base || target - index->base > UINT32_MAX) {
+		return 0;
+	}
+	uint64_t key = (target - index->base) << 32;
+	// Find the first reference whose key is at least key.
+	size_t lo = 0, hi = index->count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (index->xref[mid] < key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	*first = lo;
+	size_t end = lo;
+	while (end < index->count && (index->xref[end] >> 32) == (key >> 32)) {
+		end++;
+	}
+	return end - lo;
+}
+
+kaddr_t
+aarch64_xref_source(const struct aarch64_xref_index *index, size_t i) {
+	assert(i < index->count);
+	return index->base + (uint32_t) index->xref[i];
+}
@@ -0,0 +1,87 @@
+#ifndef MEMCTL__ARM64__XREF_H_
+#define MEMCTL__ARM64__XREF_H_
+/*
+ * Cross-reference index.
+ *
+ * The xref index records, for every executable segment of a Mach-O, which instructions refer to
+ * which addresses: ADRP+ADD and ADRP+LDR/STR pairs, ADR, LDR (literal), and B/BL. It is built in
+ * one linear pass over the code, after which finding the references to a string or function is
+ * a binary search.
+ */
+
+#include "memctl/macho.h"
+#include "memctl/memctl_types.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * struct aarch64_xref_index
+ *
+ * Description:
+ * 	A sorted table of cross-references.
+ */
+struct aarch64_xref_index {
+	// The lowest address in the Mach-O. Addresses are stored as 32-bit offsets from base.
+	kaddr_t base;
+	// The references, sorted. Each entry is (target offset << 32) | (source offset), so all
+	// the references to a target are adjacent and in increasing order of source address.
+	uint64_t *xref;
+	// The number of references.
+	size_t count;
+};
+
+/*
+ * aarch64_xref_index_init
+ *
+ * Description:
+ * 	Build the cross-reference index for a Mach-O file. Each executable segment is scanned on
+ * 	its own thread.
+ *
+ * Parameters:
+ * 	out	index			The index to initialize.
+ * 		macho			The Mach-O file.
+ * 		persist			If true, load the index from CACHE_FILE_DIR if a previous
+ * 					run saved it there, and otherwise save it there once it is
+ * 					built. Saved indexes are keyed by the Mach-O's UUID.
+ *
+ * Returns:
+ * 	True if no errors were encountered.
+ */
+bool aarch64_xref_index_init(struct aarch64_xref_index *index, const struct macho *macho,
+		bool persist);
+
+/*
+ * aarch64_xref_index_deinit
+ *
+ * Description:
+ * 	Free the resources used by a cross-reference index.
+ */
+void aarch64_xref_index_deinit(struct aarch64_xref_index *index);
+
+/*
+ * aarch64_xref_find
+ *
+ * Description:
+ * 	Find the references to an address.
+ *
+ * Parameters:
+ * 		index			The cross-reference index.
+ * 		target			The referenced address.
+ * 	out	first			On return, the index of the first reference to target. Use
+ * 					aarch64_xref_source to get the referencing address.
+ *
+ * Returns:
+ * 	The number of references to target.
+ */
+size_t aarch64_xref_find(const struct aarch64_xref_index *index, kaddr_t target, size_t *first);
+
+/*
+ * aarch64_xref_source
+ *
+ * Description:
+ * 	Get the address of the instruction making the given reference.
+ */
+kaddr_t aarch64_xref_source(const struct aarch64_xref_index *index, size_t i);
+
+#endif
@@ -0,0 +1,183 @@
+#include "cache_file.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Distinguishes the temporary files of threads saving the same cache file.
+static atomic_uint temporary_counter;
+
+uint64_t
+cache_file_hash(const void *data, size_t size) {
+	// Four independent FNV-1a lanes over 64-bit words keep the multiplies from serializing.
+	const uint64_t prime = 0x100000001b3;
+	uint64_t lane[4] = {
+		0xcbf29ce484222325, 0x84222325cbf29ce4, 0x9ce484222325cbf2, 0x2325cbf29ce48422,
+	};
+	const uint8_t *p = data;
+	size_t i = 0;
+	for (; i + 32 <= size; i += 32) {
+		for (unsigned l = 0; l < 4; l++) {
+			uint64_t word;
+			memcpy(&word, p + i + 8 * l, sizeof(word));
+			lane[l] = (lane[l] ^ word) * prime;
+		}
+	}
+	uint64_t hash = size;
+	for (unsigned l = 0; l < 4; l++) {
+		hash = (hash ^ lane[l]) * prime;
+	}
+	for (; i < size; i++) {
+		hash = (hash ^ p[i]) * prime;
+	}
+	return hash;
+}
+
+void
+cache_file_name(char name[CACHE_FILE_NAME_SIZE], const char *prefix, const void *key,
+		size_t key_size) {
+	size_t n = strlen(prefix);
+	assert(n + 2 * key_size < CACHE_FILE_NAME_SIZE);
+	memcpy(name, prefix, n);
+	const uint8_t *k = key;
+	for (size_t i = 0; i < key_size; i++) {
+		name[n++] = "0123456789abcdef"[k[i] >> 4];
+		name[n++] = "0123456789abcdef"[k[i] & 0xf];
+	}
+	name[n] = 0;
+}
+
+/*
+ * is_private
+ *
+ * Description:
+ * 	Check that a cache file or directory belongs to this user and that no one else can write to
+ * 	it. The directory must not be accessible to anyone else at all.
+ */
+static bool
+is_private(int fd, bool directory) {
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		return false;
+	}
+	mode_t type = (directory ? S_IFDIR : S_IFREG);
+	mode_t others = (directory ? (S_IRWXG | S_IRWXO) : (S_IWGRP | S_IWOTH));
+	return ((st.st_mode & S_IFMT) == type && st.st_uid == geteuid()
+			&& (st.st_mode & others) == 0);
+}
+
+/*
+ * open_directory
+ *
+ * Description:
+ * 	Open the cache directory, creating it with mode 0700 if asked. A symbolic link or a
+ * 	directory that someone else could have planted is rejected.
+ */
+static int
+open_directory(bool create) {
+	if (create && mkdir(CACHE_FILE_DIR, 0700) != 0 && errno != EEXIST) {
+		return -1;
+	}
+	int fd = open(CACHE_FILE_DIR, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+	if (fd >= 0 && !is_private(fd, true)) {
+		close(fd);
+		fd = -1;
+	}
+	return fd;
+}
+
+/*
+ * open_for_reading
+ *
+ * Description:
+ * 	Open a private cache file for reading.
+ */
+static int
+open_for_reading(const char *name) {
+	int directory = open_directory(false);
+	if (directory < 0) {
+		return -1;
+	}
+	int fd = openat(directory, name, O_RDONLY | O_NOFOLLOW);
+	close(directory);
+	if (fd >= 0 && !is_private(fd, false)) {
+		close(fd);
+		fd = -1;
+	}
+	return fd;
+}
+
+FILE *
+cache_file_open(const char *name) {
+	int fd = open_for_reading(name);
+	if (fd < 0) {
+		return NULL;
+	}
+	FILE *file = fdopen(fd, "rb");
+	if (file == NULL) {
+		close(fd);
+	}
+	return file;
+}
+
+const void *
+cache_file_map(const char *name, size_t *size) {
+	int fd = open_for_reading(name);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat st;
+	void *data = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		*size = st.st_size;
+		data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	return (data == MAP_FAILED ? NULL : data);
+}
+
+bool
+cache_file_create(struct cache_file *cf, const char *name) {
+	cf->file = NULL;
+	cf->directory = open_directory(true);
+	if (cf->directory < 0) {
+		return false;
+	}
+	snprintf(cf->name, sizeof(cf->name), "%s", name);
+	snprintf(cf->temporary, sizeof(cf->temporary), "%s.%d.%u", name, (int) getpid(),
+			atomic_fetch_add(&temporary_counter, 1));
+	int fd = openat(cf->directory, cf->temporary, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW,
+			0600);
+	if (fd >= 0) {
+		cf->file = fdopen(fd, "wb");
+		if (cf->file == NULL) {
+			close(fd);
+			unlinkat(cf->directory, cf->temporary, 0);
+		}
+	}
+	if (cf->file == NULL) {
+		close(cf->directory);
+		cf->directory = -1;
+		return false;
+	}
+	return true;
+}
+
+void
+cache_file_commit(struct cache_file *cf, bool written) {
+	if (cf->file == NULL) {
+		return;
+	}
+	written = (fclose(cf->file) == 0 && written);
+	if (!written || renameat(cf->directory, cf->temporary, cf->directory, cf->name) != 0) {
+		unlinkat(cf->directory, cf->temporary, 0);
+	}
+	close(cf->directory);
+	cf->file = NULL;
+	cf->directory = -1;
+}
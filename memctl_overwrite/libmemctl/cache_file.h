@@ -0,0 +1,131 @@
+#ifndef MEMCTL__CACHE_FILE_H_
+#define MEMCTL__CACHE_FILE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * CACHE_FILE_DIR
+ *
+ * Description:
+ * 	The directory in which analyses and decompressed kernel images are cached between runs. It
+ * 	is created with mode 0700, and it is not used unless it is a directory owned by this user
+ * 	that no one else can access.
+ */
+#ifndef CACHE_FILE_DIR
+# define CACHE_FILE_DIR		"/tmp/memctl"
+#endif
+
+/*
+ * CACHE_FILE_NAME_SIZE
+ *
+ * Description:
+ * 	The size of a buffer large enough to hold any name generated by cache_file_name.
+ */
+#define CACHE_FILE_NAME_SIZE	64
+
+/*
+ * struct cache_file
+ *
+ * Description:
+ * 	A cache file being written. The data is written to a new temporary file in the cache
+ * 	directory, which replaces the cache file only once it is complete.
+ */
+struct cache_file {
+	// The file to write the data to.
+	FILE *file;
+	// The cache directory.
+	int directory;
+	// The name of the cache file and of the temporary file.
+	char name[CACHE_FILE_NAME_SIZE];
+	char temporary[CACHE_FILE_NAME_SIZE + 32];
+};
+
+/*
+ * cache_file_hash
+ *
+ * Description:
+ * 	Hash some data, such as the contents of a kernel, to key or check a cache file. This is
+ * 	not a cryptographic hash, but it is cheap even for a large kernelcache.
+ */
+uint64_t cache_file_hash(const void *data, size_t size);
+
+/*
+ * cache_file_name
+ *
+ * Description:
+ * 	Generate the name of a cache file from a prefix and a key, such as a UUID, which is
+ * 	appended in hexadecimal.
+ *
+ * Parameters:
+ * 	out	name			A buffer of CACHE_FILE_NAME_SIZE bytes for the name.
+ * 		prefix			The prefix, naming the kind of data in the file.
+ * 		key			The key.
+ * 		key_size		The size of the key in bytes. The prefix and key must fit in
+ * 					CACHE_FILE_NAME_SIZE.
+ */
+void cache_file_name(char name[CACHE_FILE_NAME_SIZE], const char *prefix, const void *key,
+		size_t key_size);
+
+/*
+ * cache_file_open
+ *
+ * Description:
+ * 	Open a cache file for reading.
+ *
+ * Parameters:
+ * 		name			The name of the cache file.
+ *
+ * Returns:
+ * 	The open file, or NULL if there is no cache file or if it or the cache directory is not
+ * 	private. Failure is not an error.
+ */
+FILE *cache_file_open(const char *name);
+
+/*
+ * cache_file_map
+ *
+ * Description:
+ * 	Map a cache file read-only.
+ *
+ * Parameters:
+ * 		name			The name of the cache file.
+ * 	out	size			On return, the size of the mapping.
+ *
+ * Returns:
+ * 	The mapping, which must be unmapped with munmap, or NULL under the same conditions as
+ * 	cache_file_open or if the file is empty.
+ */
+const void *cache_file_map(const char *name, size_t *size);
+
+/*
+ * cache_file_create
+ *
+ * Description:
+ * 	Start writing a cache file, creating the cache directory if needed.
+ *
+ * Parameters:
+ * 	out	cf			On return, the cache file to write to cf->file.
+ * 		name			The name of the cache file.
+ *
+ * Returns:
+ * 	True if the file can be written. Failure is not an error.
+ */
+bool cache_file_create(struct cache_file *cf, const char *name);
+
+/*
+ * cache_file_commit
+ *
+ * Description:
+ * 	Finish writing a cache file. The temporary file replaces the cache file if it was written
+ * 	successfully and is removed otherwise, so a partially written cache file is never used.
+ *
+ * Parameters:
+ * 		cf			The cache file.
+ * 		written			Whether every write to the file succeeded.
+ */
+void cache_file_commit(struct cache_file *cf, bool written);
+
+#endif
@@ -1,20 +1,65 @@
 #include "kernel.h"
 
+#include "analysis_cache.h"
+#include "kernel_image.h"
 #include "kernel_slide.h"
 #include "memctl_error.h"
+#include "parallel.h"
 
 #include "algorithm.h"
 #include "memctl_common.h"
+#include "utility.h"
+
+#if __arm64__
+#include "arm64/functions.h"
+#endif
 
 #include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
 #include <string.h>
-#include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 
 const char KERNEL_ID[] = "__kernel__";
 
 struct kext kernel;
 
+/*
+ * struct kext_analysis
+ *
+ * Description:
+ * 	The symbol analysis of a kext: initializing its symbol table and running its symbol
+ * 	finders. Analyses run on the worker pool, and a thread that needs a kext's symbols waits
+ * 	only for that kext's analysis.
+ */
+struct kext_analysis {
+	// The job that runs the analysis on the worker pool.
+	struct parallel_job job;
+	// The kext being analyzed.
+	struct kext *kext;
+	// An analysis that must finish before this one starts, or NULL. Every kext depends on the
+	// kernel, since symbol finders may look up kernel symbols.
+	struct kext_analysis *dependency;
+	// The analysis that the thread running this one is waiting for, or NULL. Protected by
+	// analysis_lock.
+	struct kext_analysis *waiting_for;
+	// Whether the job is queued on the worker pool. Protected by analysis_lock.
+	bool queued;
+	// The analysis state. This is only changed with analysis_lock held, but it may be read
+	// without the lock: once it is KEXT_ANALYSIS_DONE, the symbol table and success are
+	// published and will not change.
+	_Atomic int state;
+	// Whether the analysis succeeded.
+	bool success;
+	// Whether the analysis ran on a worker thread, in which case its errors were discarded.
+	bool ran_on_worker;
+};
+
+// The analysis of the kernel.
+static struct kext_analysis kernel_analysis;
+
 /*
  * struct kext_info
  *
@@ -26,6 +71,8 @@ struct kext_info {
 	struct kext kext;
 	// The reference count.
 	unsigned refcount;
+	// The symbol analysis.
+	struct kext_analysis analysis;
 	// The following state is used to keep track of whether the kext is out-of-date.
 #if !KERNELCACHE
 	// Whether the current kext is outdated, and thus should be freed when its reference count
@@ -99,6 +146,10 @@ struct kext_analyzers {
 	size_t symbol_finders_count;
 };
 
+// The version of the symbol finders. Bump this whenever a symbol finder registered in
+// symbol_finders.c changes which symbols it finds, so that saved analyses are discarded.
+#define SYMBOL_FINDER_VERSION	1
+
 // The array of kext analyzers.
 struct kext_analyzers *all_analyzers;
 
@@ -191,6 +242,26 @@ clear_all_analyzers() {
 	all_analyzers_count = 0;
 }
 
+/*
+ * symbol_finder_version
+ *
+ * Description:
+ * 	Combine SYMBOL_FINDER_VERSION with the bundle IDs and number of the registered symbol
+ * 	finders, so that a saved analysis is only used with the same set of finders.
+ */
+static uint64_t
+symbol_finder_version() {
+	uint64_t version = SYMBOL_FINDER_VERSION;
+	for (size_t i = 0; i < all_analyzers_count; i++) {
+		const struct kext_analyzers *ka = &all_analyzers[i];
+		for (const char *c = ka->bundle_id; *c != 0; c++) {
+			version = (version ^ (uint8_t) *c) * 0x100000001b3;
+		}
+		version = (version ^ ka->symbol_finders_count) * 0x100000001b3;
+	}
+	return version;
+}
+
 /*
  * kext_analyzers_insert_symbol_finder
  *
@@ -214,6 +285,66 @@ kext_analyzers_insert_symbol_finder(struct kext_analyzers *ka,
 	return true;
 }
 
+// ---- Kext analysis pipeline -------------------------------------------------------------------
+
+enum {
+	// The analysis has not been started.
+	KEXT_ANALYSIS_IDLE,
+	// The analysis has been started but no thread is running it yet.
+	KEXT_ANALYSIS_PENDING,
+	// The analysis is running on some thread.
+	KEXT_ANALYSIS_RUNNING,
+	// The analysis has finished or was cancelled.
+	KEXT_ANALYSIS_DONE,
+};
+
+// Protects the analysis states.
+static pthread_mutex_t analysis_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Broadcast when an analysis finishes.
+static pthread_cond_t analysis_finished = PTHREAD_COND_INITIALIZER;
+
+// Whether the worker pool has been started for kext analyses.
+static bool analysis_workers_started;
+
+// Set while stopping the worker pool, so that queued analyses are cancelled instead of run.
+static bool analysis_workers_stopping;
+
+// The analysis being run by this thread, if any.
+_Thread_local static struct kext_analysis *current_analysis;
+
+// Whether to print the time taken by each kext and symbol finder. Set MEMCTL_ANALYSIS_TIMING
+// in the environment to enable.
+static bool analysis_timing;
+
+/*
+ * kext_analysis
+ *
+ * Description:
+ * 	Get the analysis struct for a kext returned by kernel_kext.
+ */
+static struct kext_analysis *
+kext_analysis(const struct kext *kext) {
+	if (kext == &kernel) {
+		return &kernel_analysis;
+	}
+	struct kext_info *ki = (struct kext_info *)(kext);
+	return &ki->analysis;
+}
+
+/*
+ * analysis_time
+ *
+ * Description:
+ * 	The current time in seconds, for analysis timing.
+ */
+static double
+analysis_time() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
 /*
  * run_symbol_finders
  *
@@ -222,29 +353,42 @@ kext_analyzers_insert_symbol_finder(struct kext_analyzers *ka,
  */
 static void
 run_symbol_finders(const struct kext_analyzers *ka, struct kext *kext) {
-	kext_symbol_finder_fn *symbol_finder = ka->symbol_finders;
-	kext_symbol_finder_fn *end = symbol_finder + ka->symbol_finders_count;
 	error_stop();
-	for (; symbol_finder < end; symbol_finder++) {
-		(*symbol_finder)(kext);
+	for (size_t i = 0; i < ka->symbol_finders_count; i++) {
+		double start = (analysis_timing ? analysis_time() : 0);
+		ka->symbol_finders[i](kext);
+		if (analysis_timing) {
+			fprintf(stderr, "analysis: %s: finder %s[%zu]: %.3f ms\n", kext->bundle_id,
+					(ka->bundle_id[0] == 0 ? "*" : ka->bundle_id), i,
+					(analysis_time() - start) * 1e3);
+		}
 	}
 	error_start();
 }
 
 /*
- * init_kext_symbols
+ * analyze_kext
  *
  * Description:
  * 	Initialize the symbols in a kext. This includes initializing the symtab and running any
  * 	matching symbol finders on the kext.
  */
 static bool
-init_kext_symbols(struct kext *kext) {
+analyze_kext(struct kext *kext) {
+	double start = (analysis_timing ? analysis_time() : 0);
+	assert(kext->bundle_id != NULL);
+	// Use the saved analysis from a previous run if there is one.
+	if (analysis_cache_find(kext->bundle_id, &kext->macho, &kext->symtab)) {
+		if (analysis_timing) {
+			fprintf(stderr, "analysis: %s: %.3f ms (saved)\n", kext->bundle_id,
+					(analysis_time() - start) * 1e3);
+		}
+		return true;
+	}
 	bool success = symbol_table_init_with_macho(&kext->symtab, &kext->macho);
 	if (!success) {
 		return false;
 	}
-	assert(kext->bundle_id != NULL);
 	const char *bundle_ids[2] = { kext->bundle_id, "" };
 	for (size_t i = 0; i < 2; i++) {
 		struct kext_analyzers *ka = find_kext_analyzers_for_id(bundle_ids[i], NULL);
@@ -252,9 +396,274 @@ init_kext_symbols(struct kext *kext) {
 			run_symbol_finders(ka, kext);
 		}
 	}
+	analysis_cache_add(kext->bundle_id, &kext->macho, &kext->symtab);
+	if (analysis_timing) {
+		fprintf(stderr, "analysis: %s: %.3f ms\n", kext->bundle_id,
+				(analysis_time() - start) * 1e3);
+	}
+	return true;
+}
+
+/*
+ * analysis_claim
+ *
+ * Description:
+ * 	Take a pending analysis off the worker pool's queue so that the calling thread can run it.
+ * 	analysis_lock must be held.
+ *
+ * Returns:
+ * 	True if the analysis is now running on this thread, or false if a worker has already
+ * 	taken it.
+ */
+static bool
+analysis_claim(struct kext_analysis *analysis) {
+	if (analysis->queued && !parallel_cancel(&analysis->job)) {
+		return false;
+	}
+	analysis->queued = false;
+	atomic_store_explicit(&analysis->state, KEXT_ANALYSIS_RUNNING, memory_order_relaxed);
 	return true;
 }
 
+/*
+ * analysis_publish
+ *
+ * Description:
+ * 	Mark an analysis as done and wake any threads waiting for it. analysis_lock must be held.
+ */
+static void
+analysis_publish(struct kext_analysis *analysis, bool success) {
+	analysis->success = success;
+	atomic_store_explicit(&analysis->state, KEXT_ANALYSIS_DONE, memory_order_release);
+	pthread_cond_broadcast(&analysis_finished);
+}
+
+static bool kext_analysis_wait(struct kext_analysis *analysis);
+
+/*
+ * kext_analysis_run
+ *
+ * Description:
+ * 	Run an analysis that has been claimed by the calling thread, then publish the result.
+ */
+static void
+kext_analysis_run(struct kext_analysis *analysis) {
+	struct kext_analysis *outer = current_analysis;
+	current_analysis = analysis;
+	bool success = true;
+	if (analysis->dependency != NULL) {
+		success = kext_analysis_wait(analysis->dependency);
+	}
+	if (success) {
+		success = analyze_kext(analysis->kext);
+	}
+	current_analysis = outer;
+	pthread_mutex_lock(&analysis_lock);
+	analysis_publish(analysis, success);
+	pthread_mutex_unlock(&analysis_lock);
+}
+
+/*
+ * analysis_waits_for
+ *
+ * Description:
+ * 	Check whether the thread running an analysis is, through a chain of waits, waiting for the
+ * 	given analysis. analysis_lock must be held.
+ */
+static bool
+analysis_waits_for(struct kext_analysis *analysis, struct kext_analysis *target) {
+	for (; analysis != NULL; analysis = analysis->waiting_for) {
+		if (analysis == target) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * kext_analysis_wait
+ *
+ * Description:
+ * 	Wait for an analysis to finish. If no thread has started it yet, run it on this thread
+ * 	rather than waiting for a worker.
+ *
+ * Returns:
+ * 	True if the analysis succeeded.
+ *
+ * Notes:
+ * 	A symbol finder may look up the symbols of another kext, but the kexts must not wait for
+ * 	each other. Such a cycle of waits would deadlock, so it is detected and fails instead.
+ */
+static bool
+kext_analysis_wait(struct kext_analysis *analysis) {
+	int state = atomic_load_explicit(&analysis->state, memory_order_acquire);
+	if (state == KEXT_ANALYSIS_IDLE || state == KEXT_ANALYSIS_DONE) {
+		goto done;
+	}
+	struct kext_analysis *waiter = current_analysis;
+	pthread_mutex_lock(&analysis_lock);
+	state = atomic_load_explicit(&analysis->state, memory_order_relaxed);
+	if (state != KEXT_ANALYSIS_DONE && waiter != NULL) {
+		if (analysis_waits_for(analysis, waiter)) {
+			pthread_mutex_unlock(&analysis_lock);
+			error_internal("analyses of %s and %s wait for each other",
+					waiter->kext->bundle_id, analysis->kext->bundle_id);
+			return false;
+		}
+		waiter->waiting_for = analysis;
+	}
+	if (state == KEXT_ANALYSIS_PENDING && analysis_claim(analysis)) {
+		pthread_mutex_unlock(&analysis_lock);
+		kext_analysis_run(analysis);
+		pthread_mutex_lock(&analysis_lock);
+		state = KEXT_ANALYSIS_DONE;
+	}
+	while (state != KEXT_ANALYSIS_DONE) {
+		pthread_cond_wait(&analysis_finished, &analysis_lock);
+		state = atomic_load_explicit(&analysis->state, memory_order_relaxed);
+	}
+	if (waiter != NULL) {
+		waiter->waiting_for = NULL;
+	}
+	pthread_mutex_unlock(&analysis_lock);
+done:
+	if (!analysis->success && analysis->ran_on_worker) {
+		error_internal("could not initialize symbols for %s", analysis->kext->bundle_id);
+	}
+	return (state == KEXT_ANALYSIS_IDLE || analysis->success);
+}
+
+/*
+ * analysis_job_run
+ *
+ * Description:
+ * 	Run an analysis on a worker thread, unless the pool is being stopped.
+ */
+static void
+analysis_job_run(struct parallel_job *job) {
+	struct kext_analysis *analysis = (struct kext_analysis *) job;
+	pthread_mutex_lock(&analysis_lock);
+	analysis->queued = false;
+	if (analysis_workers_stopping) {
+		analysis_publish(analysis, false);
+		pthread_mutex_unlock(&analysis_lock);
+		return;
+	}
+	atomic_store_explicit(&analysis->state, KEXT_ANALYSIS_RUNNING, memory_order_relaxed);
+	analysis->ran_on_worker = true;
+	pthread_mutex_unlock(&analysis_lock);
+	kext_analysis_run(analysis);
+}
+
+/*
+ * analysis_workers_start
+ *
+ * Description:
+ * 	Start the worker pool. analysis_lock must be held. If no threads can be created, analyses
+ * 	still run, on whichever thread first waits for them.
+ */
+static void
+analysis_workers_start() {
+	analysis_workers_started = true;
+	const char *env_timing = getenv("MEMCTL_ANALYSIS_TIMING");
+	analysis_timing = (env_timing != NULL && strtol(env_timing, NULL, 10) > 0);
+	parallel_pool_start();
+}
+
+/*
+ * analysis_workers_stop
+ *
+ * Description:
+ * 	Cancel all queued analyses and stop the worker pool, waiting for any running analyses to
+ * 	finish.
+ */
+static void
+analysis_workers_stop() {
+	pthread_mutex_lock(&analysis_lock);
+	bool started = analysis_workers_started;
+	analysis_workers_stopping = true;
+	pthread_mutex_unlock(&analysis_lock);
+	if (started) {
+		parallel_pool_stop();
+	}
+	pthread_mutex_lock(&analysis_lock);
+	analysis_workers_started  = false;
+	analysis_workers_stopping = false;
+	pthread_mutex_unlock(&analysis_lock);
+}
+
+/*
+ * kext_analysis_cancel
+ *
+ * Description:
+ * 	Make sure no thread is or will be analyzing the kext. A pending analysis is taken off the
+ * 	queue and one that a thread has taken is waited for.
+ */
+static void
+kext_analysis_cancel(struct kext_analysis *analysis) {
+	pthread_mutex_lock(&analysis_lock);
+	int state = atomic_load_explicit(&analysis->state, memory_order_relaxed);
+	if (state == KEXT_ANALYSIS_PENDING
+			&& (!analysis->queued || parallel_cancel(&analysis->job))) {
+		analysis->queued = false;
+		analysis_publish(analysis, false);
+		state = KEXT_ANALYSIS_DONE;
+	}
+	while (state == KEXT_ANALYSIS_PENDING || state == KEXT_ANALYSIS_RUNNING) {
+		pthread_cond_wait(&analysis_finished, &analysis_lock);
+		state = atomic_load_explicit(&analysis->state, memory_order_relaxed);
+	}
+	pthread_mutex_unlock(&analysis_lock);
+}
+
+/*
+ * init_kext_symbols
+ *
+ * Description:
+ * 	Start initializing the symbols in a kext. The kernel is analyzed immediately on this
+ * 	thread, since every other kext depends on it. Other kexts are queued on the worker pool,
+ * 	and lookups in the kext wait for the analysis to finish.
+ */
+static bool
+init_kext_symbols(struct kext *kext) {
+	struct kext_analysis *analysis = kext_analysis(kext);
+	// Clear the symtab so that it can be deinitialized even if the analysis is cancelled.
+	memset(&kext->symtab, 0, sizeof(kext->symtab));
+	analysis->job.run       = analysis_job_run;
+	analysis->kext          = kext;
+	analysis->waiting_for   = NULL;
+	analysis->queued        = false;
+	analysis->success       = false;
+	analysis->ran_on_worker = false;
+	if (kext == &kernel) {
+		analysis->dependency = NULL;
+		atomic_store_explicit(&analysis->state, KEXT_ANALYSIS_RUNNING,
+				memory_order_relaxed);
+		kext_analysis_run(analysis);
+		return analysis->success;
+	}
+	analysis->dependency = &kernel_analysis;
+	pthread_mutex_lock(&analysis_lock);
+	if (!analysis_workers_started) {
+		analysis_workers_start();
+	}
+	atomic_store_explicit(&analysis->state, KEXT_ANALYSIS_PENDING, memory_order_relaxed);
+	analysis->queued = parallel_submit(&analysis->job);
+	pthread_mutex_unlock(&analysis_lock);
+	return true;
+}
+
+/*
+ * kext_symbols_ready
+ *
+ * Description:
+ * 	Wait for the symbols of the kext to be initialized.
+ */
+static bool
+kext_symbols_ready(const struct kext *kext) {
+	return kext_analysis_wait(kext_analysis(kext));
+}
+
 /*
  * deinit_kext_symbols
  *
@@ -263,6 +672,9 @@ init_kext_symbols(struct kext *kext) {
  */
 static void
 deinit_kext_symbols(struct kext *kext) {
+	struct kext_analysis *analysis = kext_analysis(kext);
+	kext_analysis_cancel(analysis);
+	atomic_store_explicit(&analysis->state, KEXT_ANALYSIS_IDLE, memory_order_relaxed);
 	symbol_table_deinit(&kext->symtab);
 }
 
@@ -295,6 +707,9 @@ size_t kexts_count;
  */
 static void
 deinit_kext_macho(struct macho *macho) {
+	if (macho->mh != kernel.macho.mh) {
+		macho_symbol_index_deinit(macho);
+	}
 #if !KERNELCACHE
 	if (macho->mh != kernel.macho.mh) {
 		oskext_deinit_macho(macho);
@@ -381,6 +796,9 @@ clear_kexts() {
 // The path of the currently initialized kernel.
 static const char *initialized_kernel = NULL;
 
+// The mapping backing kernel.macho.
+static struct kernel_image kernel_image;
+
 /*
  * kernel_init_macos
  *
@@ -389,12 +807,14 @@ static const char *initialized_kernel = NULL;
  */
 static bool
 kernel_init_macos(const char *kernel_path) {
-	// mmap the kernel file.
-	if (!mmap_file(kernel_path, (const void **)&kernel.macho.mh, &kernel.macho.size)) {
+	// Map the kernel file, unwrapping and decompressing it if necessary.
+	if (!kernel_image_open(kernel_path, &kernel_image)) {
 		// kernel_deinit will be called.
 		assert(kernel.macho.mh == NULL);
 		return false;
 	}
+	kernel.macho.mh   = (void *)kernel_image.macho;
+	kernel.macho.size = kernel_image.macho_size;
 	macho_result mr = macho_validate(kernel.macho.mh, kernel.macho.size);
 	if (mr != MACHO_SUCCESS) {
 		error_internal("%s is not a valid Mach-O file", kernel_path);
@@ -434,6 +854,8 @@ kernel_init(const char *kernel_path) {
 
 	kernel.slide = kernel_slide;
 	kernel.bundle_id = KERNEL_ID;
+	// Map the saved analysis of this kernel, if there is one.
+	analysis_cache_open(&kernel.macho, symbol_finder_version());
 	// Initialize the symtab.
 	if (!init_kext_symbols(&kernel)) {
 		goto fail;
@@ -447,14 +869,22 @@ fail:
 
 void
 kernel_deinit() {
+	// Stop analyzing kexts before tearing down the kernel and analyzers they depend on.
+	analysis_workers_stop();
 	initialized_kernel = NULL;
 	if (kernel.macho.mh != NULL) {
-		munmap(kernel.macho.mh, kernel.macho.size);
+		macho_symbol_index_deinit(&kernel.macho);
+		kernel_image_close(&kernel_image);
 		kernel.macho.mh = NULL;
 	}
 	deinit_kext_symbols(&kernel);
 	clear_all_analyzers();
 	clear_kexts();
+	// Save the new analyses now that no symbol table refers to the saved ones.
+	analysis_cache_close();
+#if __arm64__
+	aarch64_function_index_cache_clear();
+#endif
 }
 
 void
@@ -480,13 +910,46 @@ kext_add_symbol_finder(const char *bundle_id, kext_symbol_finder_fn symbol_finde
 	return kext_analyzers_insert_symbol_finder(ka, symbol_finder);
 }
 
+/*
+ * limit_symbol_size
+ *
+ * Description:
+ * 	Limit the guessed size of the symbol at the given static address to the end of the
+ * 	function it starts, if it starts one and the kext's function index has been built. Symbol
+ * 	sizes are otherwise measured to the next symbol, which in a stripped kernelcache may be
+ * 	many functions away.
+ */
+static void
+limit_symbol_size(const struct kext *kext, kaddr_t static_address, size_t *size) {
+#if __arm64__
+	const struct aarch64_function_index *index = aarch64_function_index_find(&kext->macho);
+	if (index == NULL) {
+		return;
+	}
+	const struct aarch64_function *function = aarch64_function_containing(index,
+			static_address);
+	if (function != NULL && index->base + function->start == static_address) {
+		size_t function_size = function->end - function->start;
+		if (*size == 0 || function_size < *size) {
+			*size = function_size;
+		}
+	}
+#endif
+}
+
 kext_result
 kext_find_symbol(const struct kext *kext, const char *symbol, kaddr_t *address, size_t *size) {
+	if (!kext_symbols_ready(kext)) {
+		return KEXT_ERROR;
+	}
 	uint64_t static_address;
 	bool found = symbol_table_resolve_symbol(&kext->symtab, symbol, &static_address, size);
 	if (!found) {
 		return KEXT_NOT_FOUND;
 	}
+	if (size != NULL) {
+		limit_symbol_size(kext, static_address, size);
+	}
 	*address = static_address + kext->slide;
 	return KEXT_SUCCESS;
 }
@@ -494,9 +957,13 @@ kext_find_symbol(const struct kext *kext, const char *symbol, kaddr_t *address,
 kext_result
 kext_resolve_address(const struct kext *kext, kaddr_t address, const char **name, size_t *size,
 		size_t *offset) {
+	if (!kext_symbols_ready(kext)) {
+		return KEXT_ERROR;
+	}
 	uint64_t static_address = address - kext->slide;
+	size_t symbol_offset;
 	bool found = symbol_table_resolve_address(&kext->symtab, static_address, name, size,
-			offset);
+			&symbol_offset);
 	if (!found) {
 		if (name != NULL) {
 			*name = NULL;
@@ -509,6 +976,18 @@ kext_resolve_address(const struct kext *kext, kaddr_t address, const char **name
 		}
 		return KEXT_NOT_FOUND;
 	}
+	if (size != NULL) {
+		// Keep the guessed size if the address lies past the end of the function, so that
+		// the offset is never beyond the size.
+		size_t limited = *size;
+		limit_symbol_size(kext, static_address - symbol_offset, &limited);
+		if (symbol_offset < limited) {
+			*size = limited;
+		}
+	}
+	if (offset != NULL) {
+		*offset = symbol_offset;
+	}
 	return KEXT_SUCCESS;
 }
 
@@ -566,17 +1045,20 @@ kext_id_find_symbol(const char *bundle_id, const char *symbol, kaddr_t *addr, si
  * 	Callback context for kernel_and_kexts_find_symbol.
  */
 struct kernel_and_kexts_find_symbol_context {
-	const char *symbol;
-	kaddr_t addr;
-	size_t size;
+	// The kexts, in kext_for_each order.
+	const struct kext **kexts;
+	size_t count;
+	size_t capacity;
+	// Whether an allocation failed.
+	bool out_of_memory;
 };
 
 /*
  * kernel_and_kexts_find_symbol_callback
  *
  * Description:
- * 	A callback for kernel_and_kexts_find_symbol that tries to find a symbol in the given
- * 	kernel extension.
+ * 	A callback for kernel_and_kexts_find_symbol that loads the given kernel extension, which
+ * 	queues its analysis.
  */
 static bool
 kernel_and_kexts_find_symbol_callback(void *context, CFDictionaryRef info,
@@ -585,27 +1067,60 @@ kernel_and_kexts_find_symbol_callback(void *context, CFDictionaryRef info,
 		return false;
 	}
 	struct kernel_and_kexts_find_symbol_context *c = context;
+	if (c->count == c->capacity) {
+		size_t capacity = max(2 * c->capacity, (size_t) 64);
+		const struct kext **kexts = realloc(c->kexts, capacity * sizeof(*kexts));
+		if (kexts == NULL) {
+			c->out_of_memory = true;
+			return true;
+		}
+		c->kexts    = kexts;
+		c->capacity = capacity;
+	}
 	error_stop();
-	kext_result kr = kext_id_find_symbol(bundle_id, c->symbol, &c->addr, &c->size);
+	kext_result kr = kernel_kext(&c->kexts[c->count], bundle_id);
 	error_start();
-	return (kr == KEXT_SUCCESS);
+	if (kr == KEXT_SUCCESS) {
+		c->count++;
+	}
+	return false;
 }
 
 kext_result
 kernel_and_kexts_find_symbol(const char *symbol, kaddr_t *addr, size_t *size) {
-	struct kernel_and_kexts_find_symbol_context context = { symbol };
+	// Load every kext first so that their analyses run in parallel, then search them in
+	// order. Each search waits only for the analysis of the kext being searched.
+	struct kernel_and_kexts_find_symbol_context context = {};
+	kext_result kr = KEXT_NOT_FOUND;
 	bool success = kext_for_each(kernel_and_kexts_find_symbol_callback, &context);
 	if (!success) {
-		return KEXT_ERROR;
+		kr = KEXT_ERROR;
+		goto out;
 	}
-	if (context.addr == 0 && context.size == 0) {
-		return KEXT_NOT_FOUND;
+	if (context.out_of_memory) {
+		error_out_of_memory();
+		kr = KEXT_ERROR;
+		goto out;
 	}
-	*addr = context.addr;
-	if (size != NULL) {
-		*size = context.size;
+	for (size_t i = 0; i < context.count; i++) {
+		size_t found_size;
+		error_stop();
+		kr = kext_find_symbol(context.kexts[i], symbol, addr, &found_size);
+		error_start();
+		if (kr == KEXT_SUCCESS) {
+			if (size != NULL) {
+				*size = found_size;
+			}
+			break;
+		}
+		kr = KEXT_NOT_FOUND;
 	}
-	return KEXT_SUCCESS;
+out:
+	for (size_t i = 0; i < context.count; i++) {
+		kext_release(context.kexts[i]);
+	}
+	free(context.kexts);
+	return kr;
 }
 
 /*
@@ -172,6 +172,10 @@ void kext_release(const struct kext *kext);
  *
  * Notes:
  * 	Errors will be stopped while this function is running.
+ *
+ * 	Symbol finders for kernel extensions other than the kernel run on analysis worker threads,
+ * 	concurrently with each other. They may read the kernel's symbols, which are always
+ * 	initialized first, but must not call kernel_kext.
  */
 typedef void (*kext_symbol_finder_fn)(struct kext *kext);
 
@@ -215,6 +219,15 @@ bool kext_add_symbol_finder(const char *bundle_id, kext_symbol_finder_fn symbol_
  * 	KEXT_SUCCESS			Success.
  * 	KEXT_NOT_FOUND			The symbol was not found.
  * 	KEXT_ERROR			An error was encountered.
+ *
+ * Notes:
+ * 	A kext's symbols are analyzed in the background after kernel_kext returns. This function
+ * 	waits for that analysis to finish, running it on the calling thread if no worker has
+ * 	started it yet.
+ *
+ * 	On arm64, if size is requested and the symbol starts a function, the size is limited to
+ * 	the end of the function. This needs the kext's function index, which is not built here:
+ * 	the limit applies once something has built it with aarch64_function_index_get.
  */
 kext_result kext_find_symbol(const struct kext *kext, const char *symbol,
 		kaddr_t *address, size_t *size);
@@ -238,6 +251,11 @@ kext_result kext_find_symbol(const struct kext *kext, const char *symbol,
  * 	KEXT_SUCCESS			Success.
  * 	KEXT_NOT_FOUND			The symbol for the address could not be found.
  * 	KEXT_ERROR			An error was encountered.
+ *
+ * Notes:
+ * 	The size is limited to the end of a function as described for kext_find_symbol, unless the
+ * 	address lies past the end of the function: the limit never leaves the offset beyond the
+ * 	size.
  */
 kext_result kext_resolve_address(const struct kext *kext, kaddr_t address, const char **name,
 		size_t *size, size_t *offset);
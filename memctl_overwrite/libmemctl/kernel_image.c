@@ -0,0 +1,361 @@
+#include "kernel_image.h"
+
+#include "cache_file.h"
+#include "memctl/macho.h"
+#include "memctl/memctl_error.h"
+
+#include "external/lzss.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// DER tags used by IMG4 containers.
+#define DER_OCTET_STRING	0x04
+#define DER_IA5_STRING		0x16
+#define DER_SEQUENCE		0x30
+
+/*
+ * struct complzss_header
+ *
+ * Description:
+ * 	The header of an LZSS-compressed kernelcache. All fields are big-endian.
+ */
+struct complzss_header {
+	uint8_t  signature[8];
+	uint32_t checksum;
+	uint32_t uncompressed_size;
+	uint32_t compressed_size;
+	uint32_t prelink_version;
+	uint8_t  padding[0x168];
+};
+
+static const uint8_t complzss_signature[8] = "complzss";
+
+/*
+ * read_be32
+ *
+ * Description:
+ * 	Read a big-endian 32-bit value.
+ */
+static uint32_t
+read_be32(const void *data) {
+	const uint8_t *p = data;
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// ---- DER parsing -------------------------------------------------------------------------------
+
+/*
+ * struct der
+ *
+ * Description:
+ * 	A span of DER-encoded data. Parsing never copies: values point into the underlying file
+ * 	mapping.
+ */
+struct der {
+	const uint8_t *data;
+	const uint8_t *end;
+};
+
+/*
+ * der_next
+ *
+ * Description:
+ * 	Parse the next element from a span of DER-encoded data. Only single-byte tags and lengths
+ * 	of up to 4 bytes are supported, which covers IMG4.
+ */
+static bool
+der_next(struct der *der, uint8_t *tag, struct der *value) {
+	const uint8_t *p = der->data;
+	if (der->end - p < 2) {
+		return false;
+	}
+	*tag = *p++;
+	size_t length = *p++;
+	if (length & 0x80) {
+		size_t count = length & 0x7f;
+		if (count == 0 || count > 4 || (size_t)(der->end - p) < count) {
+			return false;
+		}
+		length = 0;
+		for (size_t i = 0; i < count; i++) {
+			length = (length << 8) | *p++;
+		}
+	}
+	if ((size_t)(der->end - p) < length) {
+		return false;
+	}
+	value->data = p;
+	value->end  = p + length;
+	der->data   = p + length;
+	return true;
+}
+
+/*
+ * der_next_string
+ *
+ * Description:
+ * 	Parse the next element, which must be an IA5String, and check whether it has the given
+ * 	value.
+ */
+static bool
+der_next_string(struct der *der, const char *string) {
+	uint8_t tag;
+	struct der value;
+	if (!der_next(der, &tag, &value) || tag != DER_IA5_STRING) {
+		return false;
+	}
+	size_t length = strlen(string);
+	return ((size_t)(value.end - value.data) == length
+			&& memcmp(value.data, string, length) == 0);
+}
+
+/*
+ * img4_payload
+ *
+ * Description:
+ * 	Find the payload of an IMG4 or IM4P container.
+ */
+static bool
+img4_payload(const void *data, size_t size, struct der *payload) {
+	struct der der = { data, (const uint8_t *)data + size };
+	uint8_t tag;
+	struct der im4p;
+	if (!der_next(&der, &tag, &im4p) || tag != DER_SEQUENCE) {
+		goto fail;
+	}
+	// An IMG4 wraps an IM4P.
+	struct der img4 = im4p;
+	if (der_next_string(&img4, "IMG4")) {
+		if (!der_next(&img4, &tag, &im4p) || tag != DER_SEQUENCE) {
+			goto fail;
+		}
+	}
+	// IM4P ::= SEQUENCE { "IM4P", type, description, OCTET STRING payload,
+	//                     OCTET STRING keybag OPTIONAL, SEQUENCE compression OPTIONAL }
+	struct der field;
+	if (!der_next_string(&im4p, "IM4P")
+			|| !der_next(&im4p, &tag, &field) || tag != DER_IA5_STRING
+			|| !der_next(&im4p, &tag, &field) || tag != DER_IA5_STRING
+			|| !der_next(&im4p, &tag, payload) || tag != DER_OCTET_STRING) {
+		goto fail;
+	}
+	if (der_next(&im4p, &tag, &field)) {
+		if (tag == DER_OCTET_STRING) {
+			error_kernelcache("IM4P payload is encrypted");
+		} else {
+			error_kernelcache("IM4P payload compression is not supported");
+		}
+		return false;
+	}
+	return true;
+fail:
+	error_kernelcache("malformed IMG4 container");
+	return false;
+}
+
+// ---- Decompression -----------------------------------------------------------------------------
+
+/*
+ * adler32
+ *
+ * Description:
+ * 	Compute the Adler-32 checksum used in the complzss header.
+ */
+static uint32_t
+adler32(const uint8_t *data, size_t size) {
+	const uint32_t mod = 65521;
+	uint32_t a = 1, b = 0;
+	while (size > 0) {
+		// 5552 is the largest block for which b cannot overflow.
+		size_t block = (size < 5552 ? size : 5552);
+		size -= block;
+		for (size_t i = 0; i < block; i++) {
+			a += *data++;
+			b += a;
+		}
+		a %= mod;
+		b %= mod;
+	}
+	return (b << 16) | a;
+}
+
+/*
+ * cache_name
+ *
+ * Description:
+ * 	Generate the name of the cache file for a compressed kernel image. The name is keyed by a
+ * 	hash of the whole compressed image, including its complzss header.
+ */
+static void
+cache_name(char name[CACHE_FILE_NAME_SIZE], const void *data, size_t size) {
+	uint64_t hash = cache_file_hash(data, size);
+	cache_file_name(name, "kernel-", &hash, sizeof(hash));
+}
+
+/*
+ * cache_open
+ *
+ * Description:
+ * 	Map a previously saved decompressed kernel image, if there is one. The saved image is only
+ * 	used if it has the size and Adler-32 checksum given in the complzss header.
+ */
+static bool
+cache_open(const char *name, const struct complzss_header *header,
+		struct kernel_image *image) {
+	size_t size = 0;
+	const void *data = cache_file_map(name, &size);
+	if (data == NULL) {
+		return false;
+	}
+	if (size != read_be32(&header->uncompressed_size)
+			|| adler32(data, size) != read_be32(&header->checksum)) {
+		munmap((void *) data, size);
+		return false;
+	}
+	image->mapping      = (void *) data;
+	image->mapping_size = size;
+	image->macho        = data;
+	image->macho_size   = size;
+	return true;
+}
+
+/*
+ * cache_save
+ *
+ * Description:
+ * 	Save a decompressed kernel image for later runs. Failure is not an error: the image will
+ * 	simply be decompressed again next time.
+ */
+static void
+cache_save(const char *name, const void *data, size_t size) {
+	struct cache_file cf;
+	if (cache_file_create(&cf, name)) {
+		cache_file_commit(&cf, fwrite(data, 1, size, cf.file) == size);
+	}
+}
+
+/*
+ * decompress_image
+ *
+ * Description:
+ * 	Decompress a complzss kernelcache into an anonymous mapping, or map the cached copy from a
+ * 	previous run.
+ */
+static bool
+decompress_image(const void *data, size_t size, struct kernel_image *image) {
+	const struct complzss_header *header = data;
+	if (size < sizeof(*header)) {
+		error_kernelcache("truncated complzss header");
+		return false;
+	}
+	size_t uncompressed_size = read_be32(&header->uncompressed_size);
+	size_t compressed_size   = read_be32(&header->compressed_size);
+	if (compressed_size > size - sizeof(*header) || uncompressed_size == 0) {
+		error_kernelcache("invalid complzss header");
+		return false;
+	}
+	char name[CACHE_FILE_NAME_SIZE];
+	cache_name(name, data, sizeof(*header) + compressed_size);
+	if (cache_open(name, header, image)) {
+		return true;
+	}
+	void *out = mmap(NULL, uncompressed_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (out == MAP_FAILED) {
+		error_out_of_memory();
+		return false;
+	}
+	int written = decompress_lzss(out, uncompressed_size, (const uint8_t *)(header + 1),
+			compressed_size);
+	if ((size_t)written != uncompressed_size
+			|| adler32(out, uncompressed_size) != read_be32(&header->checksum)) {
+		munmap(out, uncompressed_size);
+		error_kernelcache("complzss decompression failed");
+		return false;
+	}
+	mprotect(out, uncompressed_size, PROT_READ);
+	cache_save(name, out, uncompressed_size);
+	image->mapping      = out;
+	image->mapping_size = uncompressed_size;
+	image->macho        = out;
+	image->macho_size   = uncompressed_size;
+	return true;
+}
+
+// ---- Public API --------------------------------------------------------------------------------
+
+bool
+kernel_image_open(const char *path, struct kernel_image *image) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		error_open(path, errno);
+		return false;
+	}
+	struct stat st;
+	int err = fstat(fd, &st);
+	if (err) {
+		close(fd);
+		error_io(path);
+		return false;
+	}
+	size_t size = st.st_size;
+	void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		error_out_of_memory();
+		return false;
+	}
+	// Unwrap an IMG4 container.
+	const uint8_t *payload = data;
+	size_t payload_size = size;
+	if (size > 0 && payload[0] == DER_SEQUENCE) {
+		struct der der;
+		if (!img4_payload(data, size, &der)) {
+			goto fail;
+		}
+		payload      = der.data;
+		payload_size = der.end - der.data;
+	}
+	// An uncompressed Mach-O is used in place.
+	if (payload_size >= sizeof(uint32_t)) {
+		uint32_t magic;
+		memcpy(&magic, payload, sizeof(magic));
+		if (magic == MH_MAGIC_64 || magic == MH_MAGIC) {
+			image->mapping      = data;
+			image->mapping_size = size;
+			image->macho        = payload;
+			image->macho_size   = payload_size;
+			return true;
+		}
+	}
+	// Otherwise it must be a compressed kernelcache. The decompressed image does not refer to
+	// the file, so the file can be unmapped.
+	if (payload_size >= sizeof(complzss_signature)
+			&& memcmp(payload, complzss_signature, sizeof(complzss_signature)) == 0) {
+		bool success = decompress_image(payload, payload_size, image);
+		munmap(data, size);
+		return success;
+	}
+	error_kernelcache("%s: unrecognized kernel image format", path);
+fail:
+	munmap(data, size);
+	return false;
+}
+
+void
+kernel_image_close(struct kernel_image *image) {
+	if (image->mapping != NULL) {
+		munmap(image->mapping, image->mapping_size);
+	}
+	image->mapping      = NULL;
+	image->mapping_size = 0;
+	image->macho        = NULL;
+	image->macho_size   = 0;
+}
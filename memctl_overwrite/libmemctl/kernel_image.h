@@ -0,0 +1,55 @@
+#ifndef MEMCTL__KERNEL_IMAGE_H_
+#define MEMCTL__KERNEL_IMAGE_H_
+
+#include "memctl_types.h"
+
+/*
+ * struct kernel_image
+ *
+ * Description:
+ * 	A kernel Mach-O mapped from a file. The file may contain the raw Mach-O, a kernelcache
+ * 	with a complzss header, or an IMG4/IM4P container wrapping either.
+ */
+struct kernel_image {
+	// The mapping holding the Mach-O.
+	void *       mapping;
+	size_t       mapping_size;
+	// The Mach-O, which lies inside the mapping.
+	const void * macho;
+	size_t       macho_size;
+};
+
+/*
+ * kernel_image_open
+ *
+ * Description:
+ * 	Map the kernel Mach-O contained in the given file.
+ *
+ * Parameters:
+ * 		path			The path to the kernel file.
+ * 	out	image			On return, the mapped kernel image.
+ *
+ * Returns:
+ * 	True if the kernel image was mapped.
+ *
+ * Notes:
+ * 	Uncompressed images are mapped directly from the file. Compressed images are decompressed
+ * 	once and saved to a file in CACHE_FILE_DIR named after a hash of the compressed image;
+ * 	later calls map the saved file instead, after checking it against the size and checksum in
+ * 	the complzss header. Either way the Mach-O is mapped read-only and its pages are only
+ * 	brought in as they are accessed.
+ */
+bool kernel_image_open(const char *path, struct kernel_image *image);
+
+/*
+ * kernel_image_close
+ *
+ * Description:
+ * 	Unmap a kernel image mapped with kernel_image_open.
+ *
+ * Parameters:
+ * 		image			The kernel image.
+ */
+void kernel_image_close(struct kernel_image *image);
+
+#endif
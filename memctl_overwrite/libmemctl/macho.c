@@ -118,6 +118,311 @@ macho_symtab_string_index(const struct macho *macho, const struct symtab_command
 	}
 }
 
+/*
+ * struct macho_symbol_hash_slot
+ *
+ * Description:
+ * 	A slot in the symbol name hash table. An index of 0 marks an empty slot; otherwise the slot
+ * 	refers to nlist entry index - 1.
+ */
+struct macho_symbol_hash_slot {
+	uint32_t hash;
+	uint32_t index;
+};
+
+/*
+ * struct macho_symbol_index
+ *
+ * Description:
+ * 	The symbol lookup accelerator attached to a struct macho.
+ */
+struct macho_symbol_index {
+	// The symtab command this index was built from.
+	const struct symtab_command *symtab;
+	// The distinct n_value fields of all nlist entries in ascending order. Used to find the
+	// next symbol after an address.
+	uint64_t *values;
+	uint32_t values_count;
+	// The distinct n_value fields of the N_SECT nlist entries in ascending order, along with
+	// the index of the first nlist entry having that value. Used to resolve addresses.
+	uint64_t *sect_values;
+	uint32_t *sect_index;
+	uint32_t sect_count;
+	// An open-addressed hash table mapping symbol names to the first nlist entry with that
+	// name. The number of slots is names_mask + 1, which is a power of 2.
+	struct macho_symbol_hash_slot *names;
+	uint32_t names_mask;
+};
+
+/*
+ * symbol_name_hash
+ *
+ * Description:
+ * 	The FNV-1a hash of a symbol name.
+ */
+static uint32_t
+symbol_name_hash(const char *name) {
+	uint32_t hash = 2166136261u;
+	for (const uint8_t *p = (const uint8_t *)name; *p != 0; p++) {
+		hash = (hash ^ *p) * 16777619u;
+	}
+	return hash;
+}
+
+/*
+ * radix_sort_values
+ *
+ * Description:
+ * 	Stably sort the values array in ascending order with an LSD radix sort, applying the same
+ * 	permutation to the index array. Byte positions at which all values agree are skipped,
+ * 	which for kernel addresses eliminates most of the passes.
+ */
+static bool
+radix_sort_values(uint64_t *values, uint32_t *index, uint32_t count) {
+	uint32_t (*histogram)[256] = calloc(8, sizeof(*histogram));
+	uint64_t *values_tmp = malloc(count * sizeof(*values_tmp));
+	uint32_t *index_tmp  = malloc(count * sizeof(*index_tmp));
+	bool success = false;
+	if (histogram == NULL || values_tmp == NULL || index_tmp == NULL) {
+		goto fail;
+	}
+	// Build all the histograms in a single pass.
+	for (uint32_t i = 0; i < count; i++) {
+		uint64_t value = values[i];
+		for (unsigned byte = 0; byte < 8; byte++) {
+			histogram[byte][(value >> (8 * byte)) & 0xff]++;
+		}
+	}
+	for (unsigned byte = 0; byte < 8; byte++) {
+		uint32_t *h = histogram[byte];
+		// Skip this pass if every value has the same byte here.
+		if (count == 0 || h[(values[0] >> (8 * byte)) & 0xff] == count) {
+			continue;
+		}
+		// Convert the histogram into starting offsets.
+		uint32_t offset = 0;
+		for (unsigned d = 0; d < 256; d++) {
+			uint32_t n = h[d];
+			h[d] = offset;
+			offset += n;
+		}
+		// Scatter into the temporary arrays and swap.
+		for (uint32_t i = 0; i < count; i++) {
+			uint32_t to = h[(values[i] >> (8 * byte)) & 0xff]++;
+			values_tmp[to] = values[i];
+			index_tmp[to]  = index[i];
+		}
+		memcpy(values, values_tmp, count * sizeof(*values));
+		memcpy(index, index_tmp, count * sizeof(*index));
+	}
+	success = true;
+fail:
+	free(histogram);
+	free(values_tmp);
+	free(index_tmp);
+	return success;
+}
+
+/*
+ * symbol_index_free
+ *
+ * Description:
+ * 	Free a macho_symbol_index.
+ */
+static void
+symbol_index_free(struct macho_symbol_index *index) {
+	if (index != NULL) {
+		free(index->values);
+		free(index->sect_values);
+		free(index->sect_index);
+		free(index->names);
+		free(index);
+	}
+}
+
+/*
+ * symbol_index_insert_name
+ *
+ * Description:
+ * 	Insert nlist entry idx into the name hash table, unless an earlier entry already has the
+ * 	same name.
+ */
+static void
+symbol_index_insert_name(struct macho_symbol_index *index, const struct macho *macho,
+		const struct symtab_command *symtab, const char *name, uint32_t idx) {
+	uint32_t hash = symbol_name_hash(name);
+	for (uint32_t slot = hash;; slot++) {
+		struct macho_symbol_hash_slot *s = &index->names[slot & index->names_mask];
+		if (s->index == 0) {
+			s->hash  = hash;
+			s->index = idx + 1;
+			return;
+		}
+		if (s->hash == hash) {
+			const void *nl = macho_get_nlist(macho, symtab, s->index - 1);
+			uint32_t strx = MACHO_STRUCT_FIELD(macho, struct nlist, nl, n_un.n_strx);
+			if (strcmp(macho_symtab_string(macho, symtab, strx), name) == 0) {
+				return;
+			}
+		}
+	}
+}
+
+/*
+ * symbol_index_build
+ *
+ * Description:
+ * 	Build a macho_symbol_index for the symtab. Returns NULL if memory could not be allocated.
+ */
+static struct macho_symbol_index *
+symbol_index_build(const struct macho *macho, const struct symtab_command *symtab) {
+	uint32_t nsyms = symtab->nsyms;
+	struct macho_symbol_index *index = calloc(1, sizeof(*index));
+	if (index == NULL) {
+		return NULL;
+	}
+	index->symtab = symtab;
+	// Size the hash table to a power of 2 at least twice the number of symbols.
+	uint32_t slots = 16;
+	while (slots < 2 * (uint64_t)nsyms) {
+		slots <<= 1;
+	}
+	index->names_mask  = slots - 1;
+	index->names       = calloc(slots, sizeof(*index->names));
+	index->values      = malloc(nsyms * sizeof(*index->values) + 1);
+	index->sect_values = malloc(nsyms * sizeof(*index->sect_values) + 1);
+	index->sect_index  = malloc(nsyms * sizeof(*index->sect_index) + 1);
+	uint32_t *order    = malloc(nsyms * sizeof(*order) + 1);
+	if (index->names == NULL || index->values == NULL || index->sect_values == NULL
+			|| index->sect_index == NULL || order == NULL) {
+		goto fail;
+	}
+	// Collect the values and names in nlist order.
+	for (uint32_t i = 0; i < nsyms; i++) {
+		const void *nl_i = macho_get_nlist(macho, symtab, i);
+		index->values[i] = MACHO_STRUCT_FIELD(macho, struct nlist, nl_i, n_value);
+		order[i] = i;
+		uint32_t n_strx = MACHO_STRUCT_FIELD(macho, struct nlist, nl_i, n_un.n_strx);
+		const char *name = macho_symtab_string(macho, symtab, n_strx);
+		if (name != NULL) {
+			symbol_index_insert_name(index, macho, symtab, name, i);
+		}
+	}
+	// Sort by value. The sort is stable, so equal values stay in nlist order.
+	if (!radix_sort_values(index->values, order, nsyms)) {
+		goto fail;
+	}
+	// Extract the first N_SECT entry for each distinct value and deduplicate the values.
+	uint32_t values_count = 0;
+	uint32_t sect_count = 0;
+	for (uint32_t i = 0; i < nsyms; i++) {
+		uint64_t value = index->values[i];
+		if (values_count == 0 || index->values[values_count - 1] != value) {
+			index->values[values_count++] = value;
+		}
+		const void *nl_i = macho_get_nlist(macho, symtab, order[i]);
+		uint8_t n_type = MACHO_STRUCT_FIELD(macho, struct nlist, nl_i, n_type);
+		if ((n_type & N_TYPE) != N_SECT) {
+			continue;
+		}
+		if (sect_count == 0 || index->sect_values[sect_count - 1] != value) {
+			index->sect_values[sect_count] = value;
+			index->sect_index[sect_count]  = order[i];
+			sect_count++;
+		}
+	}
+	index->values_count = values_count;
+	index->sect_count   = sect_count;
+	free(order);
+	return index;
+fail:
+	free(order);
+	symbol_index_free(index);
+	return NULL;
+}
+
+/*
+ * get_symbol_index
+ *
+ * Description:
+ * 	Get the symbol index for the symtab. Returns NULL if no index has been built for it, in
+ * 	which case callers should fall back to scanning the symtab.
+ */
+static const struct macho_symbol_index *
+get_symbol_index(const struct macho *macho, const struct symtab_command *symtab) {
+	const struct macho_symbol_index *index = macho->symbol_index;
+	if (index == NULL || index->symtab != symtab) {
+		return NULL;
+	}
+	return index;
+}
+
+/*
+ * upper_bound
+ *
+ * Description:
+ * 	Return the index of the first element of the sorted array that is greater than value.
+ */
+static uint32_t
+upper_bound(const uint64_t *array, uint32_t count, uint64_t value) {
+	uint32_t left = 0;
+	uint32_t right = count;
+	while (left < right) {
+		uint32_t mid = left + (right - left) / 2;
+		if (array[mid] <= value) {
+			left = mid + 1;
+		} else {
+			right = mid;
+		}
+	}
+	return left;
+}
+
+/*
+ * symbol_index_find_name
+ *
+ * Description:
+ * 	Find the index of the first nlist entry with the given name, or -1.
+ */
+static uint32_t
+symbol_index_find_name(const struct macho_symbol_index *index, const struct macho *macho,
+		const char *name) {
+	uint32_t hash = symbol_name_hash(name);
+	for (uint32_t slot = hash;; slot++) {
+		const struct macho_symbol_hash_slot *s = &index->names[slot & index->names_mask];
+		if (s->index == 0) {
+			return -1;
+		}
+		if (s->hash == hash) {
+			const void *nl = macho_get_nlist(macho, index->symtab, s->index - 1);
+			uint32_t strx = MACHO_STRUCT_FIELD(macho, struct nlist, nl, n_un.n_strx);
+			if (strcmp(macho_symtab_string(macho, index->symtab, strx), name) == 0) {
+				return s->index - 1;
+			}
+		}
+	}
+}
+
+macho_result
+macho_symbol_index_init(struct macho *macho, const struct symtab_command *symtab) {
+	if (get_symbol_index(macho, symtab) != NULL) {
+		return MACHO_SUCCESS;
+	}
+	symbol_index_free(macho->symbol_index);
+	macho->symbol_index = symbol_index_build(macho, symtab);
+	if (macho->symbol_index == NULL) {
+		macho_error("could not allocate Mach-O symbol index");
+		return MACHO_ERROR;
+	}
+	return MACHO_SUCCESS;
+}
+
+void
+macho_symbol_index_deinit(struct macho *macho) {
+	symbol_index_free(macho->symbol_index);
+	macho->symbol_index = NULL;
+}
+
 macho_result
 macho_validate_32(const struct mach_header *mh, size_t size) {
 	if (mh->magic != MH_MAGIC) {
@@ -285,6 +590,31 @@ macho_find_base(const struct macho *macho, uint64_t *base) {
 	}
 }
 
+uint64_t
+macho_lowest_address(const struct macho *macho) {
+	uint64_t lowest = UINT64_MAX;
+	const struct load_command *lc = NULL;
+	while ((lc = macho_next_segment(macho, lc)) != NULL) {
+		uint64_t vmaddr = MACHO_STRUCT_FIELD(macho, struct segment_command, lc, vmaddr);
+		uint64_t vmsize = MACHO_STRUCT_FIELD(macho, struct segment_command, lc, vmsize);
+		if (vmsize > 0 && vmaddr < lowest) {
+			lowest = vmaddr;
+		}
+	}
+	return (lowest == UINT64_MAX ? 0 : lowest);
+}
+
+macho_result
+macho_find_uuid(const struct macho *macho, uint8_t uuid[16]) {
+	const struct uuid_command *uc = (const struct uuid_command *)
+		macho_find_load_command(macho, NULL, LC_UUID);
+	if (uc == NULL) {
+		return MACHO_NOT_FOUND;
+	}
+	memcpy(uuid, uc->uuid, sizeof(uc->uuid));
+	return MACHO_SUCCESS;
+}
+
 void
 macho_for_each_symbol(const struct macho *macho, const struct symtab_command *symtab,
 		macho_for_each_symbol_fn callback, void *context) {
@@ -314,6 +644,11 @@ macho_for_each_symbol(const struct macho *macho, const struct symtab_command *sy
  */
 static uint64_t
 macho_next_symbol(const struct macho *macho, const struct symtab_command *symtab, uint64_t addr) {
+	const struct macho_symbol_index *index = get_symbol_index(macho, symtab);
+	if (index != NULL) {
+		uint32_t next_idx = upper_bound(index->values, index->values_count, addr);
+		return (next_idx < index->values_count ? index->values[next_idx] : -1);
+	}
 	uint64_t next = -1;
 	for (uint32_t i = 0; i < symtab->nsyms; i++) {
 		const void *nl_i = macho_get_nlist(macho, symtab, i);
@@ -329,13 +664,25 @@ macho_next_symbol(const struct macho *macho, const struct symtab_command *symtab
 macho_result
 macho_resolve_symbol(const struct macho *macho, const struct symtab_command *symtab,
 		const char *symbol, uint64_t *addr, size_t *size) {
-	uint32_t strx = macho_symtab_string_index(macho, symtab, symbol);
-	if (strx == 0) {
-		return MACHO_NOT_FOUND;
+	const struct macho_symbol_index *index = get_symbol_index(macho, symtab);
+	uint32_t strx = 0;
+	uint32_t first = 0;
+	if (index != NULL) {
+		first = symbol_index_find_name(index, macho, symbol);
+		if (first == -1) {
+			return MACHO_NOT_FOUND;
+		}
+		const void *nl = macho_get_nlist(macho, symtab, first);
+		strx = MACHO_STRUCT_FIELD(macho, struct nlist, nl, n_un.n_strx);
+	} else {
+		strx = macho_symtab_string_index(macho, symtab, symbol);
+		if (strx == 0) {
+			return MACHO_NOT_FOUND;
+		}
 	}
 	uint64_t addr0 = 0;
 	uint32_t symidx = -1;
-	for (uint32_t i = 0; i < symtab->nsyms; i++) {
+	for (uint32_t i = first; i < symtab->nsyms; i++) {
 		const void *nl_i = macho_get_nlist(macho, symtab, i);
 		uint32_t n_strx = MACHO_STRUCT_FIELD(macho, struct nlist, nl_i, n_un.n_strx);
 		if (n_strx == strx) {
@@ -382,6 +729,16 @@ macho_resolve_address(const struct macho *macho, const struct symtab_command *sy
 	const void *sym = NULL;
 	uint32_t symidx;
 	uint64_t sym_addr;
+	const struct macho_symbol_index *index = get_symbol_index(macho, symtab);
+	if (index != NULL) {
+		uint32_t found = upper_bound(index->sect_values, index->sect_count, addr);
+		if (found > 0) {
+			symidx   = index->sect_index[found - 1];
+			sym      = macho_get_nlist(macho, symtab, symidx);
+			sym_addr = index->sect_values[found - 1];
+		}
+		goto found;
+	}
 	for (uint32_t i = 0; i < symtab->nsyms; i++) {
 		const void *nl_i = macho_get_nlist(macho, symtab, i);
 		uint8_t n_type = MACHO_STRUCT_FIELD(macho, struct nlist, nl_i, n_type);
@@ -395,6 +752,7 @@ macho_resolve_address(const struct macho *macho, const struct symtab_command *sy
 			sym_addr = n_value;
 		}
 	}
+found:
 	if (sym == NULL) {
 		return MACHO_NOT_FOUND;
 	}
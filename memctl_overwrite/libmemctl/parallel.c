@@ -0,0 +1,299 @@
+#include "parallel.h"
+
+#include "memctl/error.h"
+#include "memctl/utility.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// Protects the job queue and the pool state.
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Signalled when a job is queued or the workers should stop.
+static pthread_cond_t pool_queued = PTHREAD_COND_INITIALIZER;
+
+// Broadcast when a shard queued by parallel_run finishes.
+static pthread_cond_t pool_shard_done = PTHREAD_COND_INITIALIZER;
+
+// The queue of jobs that no worker has started.
+static struct parallel_job *pool_queue;
+static struct parallel_job **pool_queue_tail = &pool_queue;
+
+// The worker threads.
+static pthread_t pool_threads[PARALLEL_MAX_THREADS];
+static size_t pool_thread_count;
+static bool pool_stopping;
+
+/*
+ * struct shard_job
+ *
+ * Description:
+ * 	A shard of a parallel_run call, run either as a job on the worker pool or on a thread of
+ * 	its own.
+ */
+struct shard_job {
+	struct parallel_job job;
+	// The start routine and its shard.
+	void *(*routine)(void *);
+	void *shard;
+	// Whether errors were stopped on the thread that called parallel_run.
+	bool errors_stopped;
+	// Whether the shard has finished on the worker pool. Protected by pool_lock.
+	bool done;
+	// The thread running the shard, if it was started.
+	pthread_t thread;
+	bool started;
+};
+
+size_t
+parallel_thread_count(size_t work, size_t min_shard) {
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t threads = (cpus > 0 ? cpus : 1);
+	threads = min(threads, (size_t) PARALLEL_MAX_THREADS);
+	threads = min(threads, work / min_shard);
+	return max(threads, (size_t) 1);
+}
+
+/*
+ * pool_remove
+ *
+ * Description:
+ * 	Remove a job from the queue. pool_lock must be held.
+ *
+ * Returns:
+ * 	True if the job was in the queue.
+ */
+static bool
+pool_remove(struct parallel_job *job) {
+	struct parallel_job **link = &pool_queue;
+	while (*link != job) {
+		if (*link == NULL) {
+			return false;
+		}
+		link = &(*link)->next;
+	}
+	*link = job->next;
+	if (pool_queue_tail == &job->next) {
+		pool_queue_tail = link;
+	}
+	job->next = NULL;
+	return true;
+}
+
+/*
+ * pool_worker
+ *
+ * Description:
+ * 	The worker thread. Run jobs from the queue until it is empty and the pool is stopping.
+ */
+static void *
+pool_worker(void *context) {
+	error_init();
+	pthread_mutex_lock(&pool_lock);
+	for (;;) {
+		while (pool_queue == NULL && !pool_stopping) {
+			pthread_cond_wait(&pool_queued, &pool_lock);
+		}
+		struct parallel_job *job = pool_queue;
+		if (job == NULL) {
+			break;
+		}
+		pool_remove(job);
+		pthread_mutex_unlock(&pool_lock);
+		job->run(job);
+		// The errors of a job have no one to report them to.
+		error_clear();
+		pthread_mutex_lock(&pool_lock);
+	}
+	pthread_mutex_unlock(&pool_lock);
+	error_free();
+	return NULL;
+}
+
+bool
+parallel_pool_start() {
+	pthread_mutex_lock(&pool_lock);
+	if (pool_thread_count == 0) {
+		size_t count = parallel_thread_count(PARALLEL_MAX_THREADS, 1);
+		for (size_t i = 0; i < count; i++) {
+			pthread_t *thread = &pool_threads[pool_thread_count];
+			if (pthread_create(thread, NULL, pool_worker, NULL) != 0) {
+				break;
+			}
+			pool_thread_count++;
+		}
+	}
+	bool running = (pool_thread_count > 0);
+	pthread_mutex_unlock(&pool_lock);
+	return running;
+}
+
+void
+parallel_pool_stop() {
+	pthread_mutex_lock(&pool_lock);
+	pool_stopping = true;
+	pthread_cond_broadcast(&pool_queued);
+	size_t count = pool_thread_count;
+	pthread_mutex_unlock(&pool_lock);
+	for (size_t i = 0; i < count; i++) {
+		pthread_join(pool_threads[i], NULL);
+	}
+	pthread_mutex_lock(&pool_lock);
+	assert(pool_queue == NULL);
+	pool_thread_count = 0;
+	pool_stopping     = false;
+	pthread_mutex_unlock(&pool_lock);
+}
+
+bool
+parallel_submit(struct parallel_job *job) {
+	pthread_mutex_lock(&pool_lock);
+	bool running = (pool_thread_count > 0 && !pool_stopping);
+	if (running) {
+		job->next = NULL;
+		*pool_queue_tail = job;
+		pool_queue_tail  = &job->next;
+		pthread_cond_signal(&pool_queued);
+	}
+	pthread_mutex_unlock(&pool_lock);
+	return running;
+}
+
+bool
+parallel_cancel(struct parallel_job *job) {
+	pthread_mutex_lock(&pool_lock);
+	bool removed = pool_remove(job);
+	pthread_mutex_unlock(&pool_lock);
+	return removed;
+}
+
+/*
+ * shard_run
+ *
+ * Description:
+ * 	Run a shard on a thread other than the one that called parallel_run, which has its own
+ * 	error stack. Errors stay stopped if they were stopped on the calling thread.
+ */
+static void
+shard_run(struct shard_job *sj) {
+	if (sj->errors_stopped) {
+		error_stop();
+	}
+	sj->routine(sj->shard);
+	if (sj->errors_stopped) {
+		error_start();
+	}
+}
+
+/*
+ * shard_job_run
+ *
+ * Description:
+ * 	Run a shard queued by parallel_run and tell the waiting thread that it is done.
+ */
+static void
+shard_job_run(struct parallel_job *job) {
+	struct shard_job *sj = (struct shard_job *) job;
+	shard_run(sj);
+	pthread_mutex_lock(&pool_lock);
+	sj->done = true;
+	pthread_cond_broadcast(&pool_shard_done);
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/*
+ * shard_thread
+ *
+ * Description:
+ * 	The pthread start routine for a shard that runs on a thread of its own.
+ */
+static void *
+shard_thread(void *context) {
+	error_init();
+	shard_run(context);
+	error_free();
+	return NULL;
+}
+
+/*
+ * run_on_pool
+ *
+ * Description:
+ * 	Run the shards of parallel_run on the worker pool, if it is running.
+ *
+ * Returns:
+ * 	True if the shards ran.
+ */
+static bool
+run_on_pool(struct shard_job *jobs, size_t count) {
+	pthread_mutex_lock(&pool_lock);
+	bool running = (pool_thread_count > 0 && !pool_stopping);
+	if (!running) {
+		pthread_mutex_unlock(&pool_lock);
+		return false;
+	}
+	// Queue the shards at the front, so that they do not wait behind unrelated jobs while this
+	// thread holds on to the work that is waiting for them.
+	for (size_t t = count - 1; t >= 1; t--) {
+		jobs[t].job.run  = shard_job_run;
+		jobs[t].job.next = pool_queue;
+		if (pool_queue == NULL) {
+			pool_queue_tail = &jobs[t].job.next;
+		}
+		pool_queue = &jobs[t].job;
+	}
+	pthread_cond_broadcast(&pool_queued);
+	pthread_mutex_unlock(&pool_lock);
+	jobs[0].routine(jobs[0].shard);
+	// Run the shards that no worker has taken, then wait for the rest.
+	for (size_t t = 1; t < count; t++) {
+		pthread_mutex_lock(&pool_lock);
+		if (pool_remove(&jobs[t].job)) {
+			pthread_mutex_unlock(&pool_lock);
+			jobs[t].routine(jobs[t].shard);
+			continue;
+		}
+		while (!jobs[t].done) {
+			pthread_cond_wait(&pool_shard_done, &pool_lock);
+		}
+		pthread_mutex_unlock(&pool_lock);
+	}
+	return true;
+}
+
+void
+parallel_run(void *(*routine)(void *), void *shards, size_t width, size_t count) {
+	struct shard_job *jobs = calloc(count, sizeof(*jobs));
+	if (jobs == NULL) {
+		for (size_t t = 0; t < count; t++) {
+			routine((uint8_t *) shards + t * width);
+		}
+		return;
+	}
+	bool errors_stopped = error_stopped();
+	for (size_t t = 0; t < count; t++) {
+		jobs[t].routine        = routine;
+		jobs[t].shard          = (uint8_t *) shards + t * width;
+		jobs[t].errors_stopped = errors_stopped;
+	}
+	if (count > 1 && run_on_pool(jobs, count)) {
+		goto done;
+	}
+	for (size_t t = 1; t < count; t++) {
+		jobs[t].started = (pthread_create(&jobs[t].thread, NULL, shard_thread,
+					&jobs[t]) == 0);
+	}
+	for (size_t t = 0; t < count; t++) {
+		if (!jobs[t].started) {
+			routine(jobs[t].shard);
+		}
+	}
+	for (size_t t = 1; t < count; t++) {
+		if (jobs[t].started) {
+			pthread_join(jobs[t].thread, NULL);
+		}
+	}
+done:
+	free(jobs);
+}
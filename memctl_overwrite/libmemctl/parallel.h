@@ -0,0 +1,116 @@
+#ifndef MEMCTL__PARALLEL_H_
+#define MEMCTL__PARALLEL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * PARALLEL_MAX_THREADS
+ *
+ * Description:
+ * 	The maximum number of threads among which parallel_thread_count splits work.
+ */
+#define PARALLEL_MAX_THREADS	8
+
+/*
+ * parallel_thread_count
+ *
+ * Description:
+ * 	Choose how many threads to use for the given amount of work.
+ *
+ * Parameters:
+ * 		work			The number of units of work.
+ * 		min_shard		The least work worth giving to a thread of its own.
+ *
+ * Returns:
+ * 	A number of threads between 1 and PARALLEL_MAX_THREADS, and no more than the number of
+ * 	online CPUs.
+ */
+size_t parallel_thread_count(size_t work, size_t min_shard);
+
+/*
+ * struct parallel_job
+ *
+ * Description:
+ * 	A job for the worker pool, usually embedded in a larger struct describing the work.
+ */
+struct parallel_job {
+	// The next job in the queue.
+	struct parallel_job *next;
+	// The function that does the work. It is called on a worker thread with no lock held, and
+	// the job is not touched again once it returns.
+	void (*run)(struct parallel_job *job);
+};
+
+/*
+ * parallel_pool_start
+ *
+ * Description:
+ * 	Start the worker pool, if it is not already running. The pool has one worker per online
+ * 	CPU, up to PARALLEL_MAX_THREADS.
+ *
+ * Returns:
+ * 	True if the pool has at least one worker.
+ */
+bool parallel_pool_start(void);
+
+/*
+ * parallel_pool_stop
+ *
+ * Description:
+ * 	Stop the worker pool once every queued job has run, and wait for the workers to exit.
+ *
+ * Notes:
+ * 	Owners of queued jobs that should not run must make them return immediately.
+ */
+void parallel_pool_stop(void);
+
+/*
+ * parallel_submit
+ *
+ * Description:
+ * 	Queue a job to run on the worker pool.
+ *
+ * Returns:
+ * 	True if the job was queued, or false if the pool is not running, in which case the caller
+ * 	is responsible for the work.
+ */
+bool parallel_submit(struct parallel_job *job);
+
+/*
+ * parallel_cancel
+ *
+ * Description:
+ * 	Take a job off the queue if no worker has started it.
+ *
+ * Returns:
+ * 	True if the job was removed from the queue and will not run. Otherwise a worker has taken
+ * 	the job and will run it.
+ */
+bool parallel_cancel(struct parallel_job *job);
+
+/*
+ * parallel_run
+ *
+ * Description:
+ * 	Run a start routine on each element of an array of shards and wait for them all to finish.
+ *
+ * Parameters:
+ * 		routine			The routine, which is passed a pointer to its shard.
+ * 		shards			The array of shards.
+ * 		width			The size of each shard in bytes.
+ * 		count			The number of shards.
+ *
+ * Notes:
+ * 	Shard 0 runs on this thread. While the worker pool is running, the other shards are queued
+ * 	ahead of any other jobs and this thread runs those no worker has taken yet, so nested
+ * 	parallel work never has more threads than the pool. Otherwise each shard gets a thread of
+ * 	its own, and any shard for which a thread could not be created runs on this thread.
+ *
+ * 	A shard that runs on another thread has that thread's error stack, so errors it pushes are
+ * 	discarded. If errors are stopped on this thread, they are stopped for every shard.
+ */
+void parallel_run(void *(*routine)(void *), void *shards, size_t width, size_t count);
+
+#endif
@@ -10,6 +10,10 @@
 #include "arm64/finder/zone_element_size.h"
 #endif
 
+// Saved analyses include the symbols found by these finders. Adding or removing a finder
+// invalidates them automatically, but changing which symbols an existing finder, including one
+// in arm64/finder, adds does not: bump SYMBOL_FINDER_VERSION in kernel.c along with any such
+// change.
 void
 kernel_symbol_finders_init() {
 	error_stop();
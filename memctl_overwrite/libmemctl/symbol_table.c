@@ -7,23 +7,290 @@
 
 #include <assert.h>
 #include <string.h>
+#include <unistd.h> // for ssize_t
 
 /*
- * sort_order
+ * struct symbol_table_wide_address
  *
  * Description:
- * 	Get a newly allocated sorting permutation for an array.
+ * 	The full address of a symbol whose address cannot be stored as a 32-bit offset from the
+ * 	symbol table's base.
  */
-static size_t *
-sort_order(const void *array, size_t width, size_t count,
-		int (*compare)(const void *, const void *)) {
-	size_t *order = malloc(count * sizeof(*order));
-	if (order != NULL) {
-		sorting_permutation(array, width, count, compare, order);
+struct symbol_table_wide_address {
+	uint32_t index;
+	kaddr_t  address;
+};
+
+// The address offset marking a symbol whose address is stored in the wide array.
+#define WIDE_ADDRESS		UINT32_MAX
+
+// The minimum capacity of the symbol table arrays.
+#define MIN_CAPACITY		64
+
+// The minimum capacity of the string pool.
+#define MIN_STRINGS_CAPACITY	0x10000
+
+// A sentinel value indicating that the index was not found.
+#define NOT_FOUND ((size_t)(-1))
+
+// ---- String pool -------------------------------------------------------------------------------
+
+/*
+ * strings_add
+ *
+ * Description:
+ * 	Copy a string into the symbol table's string pool and return its offset.
+ */
+static bool
+strings_add(struct symbol_table *st, const char *string, uint32_t *offset) {
+	size_t length = strlen(string) + 1;
+	size_t size = st->strings_size + length;
+	if (size > UINT32_MAX) {
+		return false;
+	}
+	if (size > st->strings_capacity) {
+		size_t capacity = max(size, 2 * st->strings_capacity);
+		capacity = max(capacity, MIN_STRINGS_CAPACITY);
+		char *strings = realloc(st->strings, capacity);
+		if (strings == NULL) {
+			return false;
+		}
+		st->strings          = strings;
+		st->strings_capacity = capacity;
+	}
+	memcpy(st->strings + st->strings_size, string, length);
+	*offset = st->strings_size;
+	st->strings_size = size;
+	return true;
+}
+
+/*
+ * symbol_name
+ *
+ * Description:
+ * 	Get the name of the symbol at the given index.
+ */
+static inline const char *
+symbol_name(const struct symbol_table *st, size_t index) {
+	return st->strings + st->name[index];
+}
+
+// ---- Addresses ---------------------------------------------------------------------------------
+
+/*
+ * wide_address
+ *
+ * Description:
+ * 	Look up the full address of a symbol stored in the wide array.
+ */
+static kaddr_t
+wide_address(const struct symbol_table *st, size_t index) {
+	size_t left  = 0;
+	size_t right = st->wide_count;
+	while (left < right) {
+		size_t mid = left + (right - left) / 2;
+		if (st->wide[mid].index < index) {
+			left = mid + 1;
+		} else {
+			right = mid;
+		}
+	}
+	assert(left < st->wide_count && st->wide[left].index == index);
+	return st->wide[left].address;
+}
+
+/*
+ * symbol_address
+ *
+ * Description:
+ * 	Get the address of the symbol at the given index.
+ */
+static inline kaddr_t
+symbol_address(const struct symbol_table *st, size_t index) {
+	uint32_t offset = st->address[index];
+	if (offset != WIDE_ADDRESS) {
+		return st->base + offset;
+	}
+	return wide_address(st, index);
+}
+
+/*
+ * set_symbol_address
+ *
+ * Description:
+ * 	Store the address of the symbol at the given index. Symbols must be stored in increasing
+ * 	index order so that the wide array stays sorted.
+ */
+static bool
+set_symbol_address(struct symbol_table *st, size_t index, kaddr_t address) {
+	if (address >= st->base && address - st->base < WIDE_ADDRESS) {
+		st->address[index] = address - st->base;
+		return true;
+	}
+	assert(st->wide_count == 0 || st->wide[st->wide_count - 1].index < index);
+	struct symbol_table_wide_address *wide = realloc(st->wide,
+			(st->wide_count + 1) * sizeof(*wide));
+	if (wide == NULL) {
+		return false;
+	}
+	wide[st->wide_count].index   = index;
+	wide[st->wide_count].address = address;
+	st->wide = wide;
+	st->wide_count++;
+	st->address[index] = WIDE_ADDRESS;
+	return true;
+}
+
+/*
+ * truncate_wide_addresses
+ *
+ * Description:
+ * 	Drop the wide addresses of symbols at or beyond count, which have not been published.
+ */
+static void
+truncate_wide_addresses(struct symbol_table *st, size_t count) {
+	while (st->wide_count > 0 && st->wide[st->wide_count - 1].index >= count) {
+		st->wide_count--;
+	}
+}
+
+// ---- Sorting and searching ---------------------------------------------------------------------
+
+/*
+ * compare_symbols
+ *
+ * Description:
+ * 	Compare two elements of an array of symbol name pointers.
+ */
+static int
+compare_symbols(const void *a0, const void *b0) {
+	const char *const *a = a0;
+	const char *const *b = b0;
+	return strcmp(*a, *b);
+}
+
+/*
+ * sort_names
+ *
+ * Description:
+ * 	Compute the stable lexicographical sort order of the symbols with indices start through
+ * 	start + count - 1. On return, order contains the sorted indices relative to start.
+ */
+static bool
+sort_names(const struct symbol_table *st, size_t start, size_t count, uint32_t *order) {
+	const char **names = malloc((count + 1) * sizeof(*names));
+	size_t *permutation = malloc((count + 1) * sizeof(*permutation));
+	bool success = false;
+	if (names == NULL || permutation == NULL) {
+		goto fail;
+	}
+	for (size_t i = 0; i < count; i++) {
+		names[i] = symbol_name(st, start + i);
+		permutation[i] = i;
+	}
+	if (!stable_sorting_permutation(names, sizeof(*names), count, compare_symbols,
+				permutation)) {
+		goto fail;
+	}
+	for (size_t i = 0; i < count; i++) {
+		order[i] = permutation[i];
+	}
+	success = true;
+fail:
+	free(names);
+	free(permutation);
+	return success;
+}
+
+/*
+ * sort_addresses
+ *
+ * Description:
+ * 	Compute the stable numerical sort order of the addresses of the symbols with indices start
+ * 	through start + count - 1. On return, order contains the sorted indices relative to start.
+ */
+static bool
+sort_addresses(const struct symbol_table *st, size_t start, size_t count, uint32_t *order) {
+	kaddr_t *addresses = malloc((count + 1) * sizeof(*addresses));
+	size_t *permutation = malloc((count + 1) * sizeof(*permutation));
+	bool success = false;
+	if (addresses == NULL || permutation == NULL) {
+		goto fail;
+	}
+	for (size_t i = 0; i < count; i++) {
+		addresses[i] = symbol_address(st, start + i);
+	}
+	if (!radix_sorting_permutation(addresses, count, permutation)) {
+		goto fail;
+	}
+	for (size_t i = 0; i < count; i++) {
+		order[i] = permutation[i];
+	}
+	success = true;
+fail:
+	free(addresses);
+	free(permutation);
+	return success;
+}
+
+/*
+ * find_index_of_symbol
+ *
+ * Description:
+ * 	Find the index in the symbol/address tables corresponding to the given symbol. If
+ * 	sort_symbol_index is not NULL, then the index in the sort_symbol table (at which the symbol
+ * 	could be inserted) is also returned.
+ */
+static size_t
+find_index_of_symbol(const struct symbol_table *st, const char *symbol,
+		size_t *sort_symbol_index) {
+	size_t left  = 0;
+	size_t right = st->count;
+	while (left < right) {
+		size_t mid = left + (right - left) / 2;
+		int cmp = strcmp(symbol, symbol_name(st, st->sort_symbol[mid]));
+		if (cmp < 0) {
+			right = mid;
+		} else if (cmp > 0) {
+			left = mid + 1;
+		} else {
+			left = mid;
+			if (sort_symbol_index != NULL) {
+				*sort_symbol_index = mid;
+			}
+			return st->sort_symbol[mid];
+		}
+	}
+	if (sort_symbol_index != NULL) {
+		*sort_symbol_index = left;
+	}
+	return NOT_FOUND;
+}
+
+/*
+ * address_upper_bound
+ *
+ * Description:
+ * 	Find the first index in the sort_address table whose address is greater than the given
+ * 	address.
+ */
+static size_t
+address_upper_bound(const struct symbol_table *st, kaddr_t address) {
+	size_t left  = 0;
+	size_t right = st->count;
+	while (left < right) {
+		size_t mid = left + (right - left) / 2;
+		if (symbol_address(st, st->sort_address[mid]) <= address) {
+			left = mid + 1;
+		} else {
+			right = mid;
+		}
 	}
-	return order;
+	return left;
 }
 
+// ---- Initialization ----------------------------------------------------------------------------
+
 /*
  * count_symbol
  *
@@ -73,55 +340,22 @@ collect_symbol(void *context0, const char *symbol, uint64_t address) {
 	struct collect_symbol_context *context = context0;
 	struct symbol_table *st = context->st;
 	assert(st->count < context->capacity);
-	// Duplicate the symbol string.
-	char *new_symbol = strdup(symbol);
-	if (new_symbol == NULL) {
+	// Copy the symbol string into the string pool and store the address.
+	if (!strings_add(st, symbol, &st->name[st->count])
+			|| !set_symbol_address(st, st->count, address)) {
 		context->out_of_memory = true;
 		return true;
 	}
-	// Insert this new symbol into the arrays.
-	st->symbol[st->count]  = new_symbol;
-	st->address[st->count] = address;
 	st->count++;
 	return (st->count == context->capacity);
 }
 
-/*
- * compare_symbols
- *
- * Description:
- * 	Compare symbols in the symbol array for symbol_table_init_with_macho.
- */
-static int
-compare_symbols(const void *a0, const void *b0) {
-	const char *const *a = a0;
-	const char *const *b = b0;
-	return strcmp(*a, *b);
-}
-
-/*
- * compare_addresses
- *
- * Description:
- * 	Compare addresses in the address array for symbol_table_init_with_macho.
- */
-static int
-compare_addresses(const void *a0, const void *b0) {
-	kaddr_t a = *(const kaddr_t *)a0;
-	kaddr_t b = *(const kaddr_t *)b0;
-	if (a < b) {
-		return -1;
-	} else if (a > b) {
-		return 1;
-	}
-	return 0;
-}
-
 /*
  * collect_segments
  *
  * Description:
- * 	Collect segment information into the symbol table.
+ * 	Collect segment information into the symbol table. The lowest segment address becomes the
+ * 	base for symbol addresses.
  */
 static bool
 collect_segments(struct symbol_table *st, const struct macho *macho) {
@@ -135,7 +369,7 @@ collect_segments(struct symbol_table *st, const struct macho *macho) {
 		}
 	}
 	// Allocate the arrays.
-	st->segment = malloc(2 * count * sizeof(*st->segment));
+	st->segment = malloc(2 * count * sizeof(*st->segment) + 1);
 	if (st->segment == NULL) {
 		return false;
 	}
@@ -154,20 +388,72 @@ collect_segments(struct symbol_table *st, const struct macho *macho) {
 		macho_segment_data(macho, sc, NULL, &address, &size);
 		st->segment[2 * i]     = address;
 		st->segment[2 * i + 1] = address + size;
+		if (i == 0 || address < st->base) {
+			st->base = address;
+		}
 	}
 	return true;
 }
 
+/*
+ * grow_arrays
+ *
+ * Description:
+ * 	Grow all the arrays so that they can hold at least count elements.
+ */
+static bool
+grow_arrays(struct symbol_table *st, size_t count) {
+	if (count <= st->capacity) {
+		return true;
+	}
+	if (count > WIDE_ADDRESS) {
+		return false;
+	}
+	count = max(count, 2 * st->capacity);
+	count = max(count, MIN_CAPACITY);
+	count = min(count, WIDE_ADDRESS);
+	uint32_t *name = realloc(st->name, count * sizeof(*st->name));
+	if (name == NULL) {
+		return false;
+	}
+	st->name = name;
+	uint32_t *address = realloc(st->address, count * sizeof(*st->address));
+	if (address == NULL) {
+		return false;
+	}
+	st->address = address;
+	uint32_t *sort_symbol = realloc(st->sort_symbol, count * sizeof(*st->sort_symbol));
+	if (sort_symbol == NULL) {
+		return false;
+	}
+	st->sort_symbol = sort_symbol;
+	uint32_t *sort_address = realloc(st->sort_address, count * sizeof(*st->sort_address));
+	if (sort_address == NULL) {
+		return false;
+	}
+	st->sort_address = sort_address;
+	st->capacity = count;
+	return true;
+}
+
 bool
 symbol_table_init_with_macho(struct symbol_table *st, const struct macho *macho) {
 	// Default-initialize.
-	st->count         = 0;
-	st->symbol        = NULL;
-	st->address       = NULL;
-	st->sort_symbol   = NULL;
-	st->sort_address  = NULL;
-	st->segment       = NULL;
-	st->segment_count = 0;
+	st->count            = 0;
+	st->capacity         = 0;
+	st->name             = NULL;
+	st->address          = NULL;
+	st->sort_symbol      = NULL;
+	st->sort_address     = NULL;
+	st->base             = 0;
+	st->wide             = NULL;
+	st->wide_count       = 0;
+	st->strings          = NULL;
+	st->strings_size     = 0;
+	st->strings_capacity = 0;
+	st->segment          = NULL;
+	st->segment_count    = 0;
+	st->image            = NULL;
 	// Get the segments.
 	if (!collect_segments(st, macho)) {
 		goto out_of_memory;
@@ -178,13 +464,17 @@ symbol_table_init_with_macho(struct symbol_table *st, const struct macho *macho)
 	if (symtab == NULL) {
 		return true;
 	}
-	// Create arrays of the requisite capacity.
+	// Create arrays of the requisite capacity. Reserve the string pool up front, since the
+	// names in the Mach-O string table are a good upper bound.
 	size_t count = count_symbols(macho, symtab);
-	st->symbol  = malloc(count * sizeof(*st->symbol));
-	st->address = malloc(count * sizeof(*st->address));
-	if (st->symbol == NULL || st->address == NULL) {
+	if (!grow_arrays(st, count)) {
+		goto out_of_memory;
+	}
+	st->strings = malloc(symtab->strsize + 1);
+	if (st->strings == NULL) {
 		goto out_of_memory;
 	}
+	st->strings_capacity = symtab->strsize + 1;
 	// Collect the symbols and addresses.
 	struct collect_symbol_context context = { st, count, false };
 	macho_for_each_symbol(macho, symtab, collect_symbol, &context);
@@ -194,9 +484,8 @@ symbol_table_init_with_macho(struct symbol_table *st, const struct macho *macho)
 	assert(st->count == count);
 	// Get the lexicographical sort order of the symbols and the numerical sort order of the
 	// addresses.
-	st->sort_symbol  = sort_order(st->symbol,  sizeof(*st->symbol),  count, compare_symbols);
-	st->sort_address = sort_order(st->address, sizeof(*st->address), count, compare_addresses);
-	if (st->sort_symbol == NULL || st->sort_address == NULL) {
+	if (!sort_names(st, 0, count, st->sort_symbol)
+			|| !sort_addresses(st, 0, count, st->sort_address)) {
 		goto out_of_memory;
 	}
 	// All done.
@@ -209,150 +498,212 @@ out_of_memory:
 
 void
 symbol_table_deinit(struct symbol_table *st) {
-	if (st->symbol != NULL) {
-		for (size_t i = 0; i < st->count; i++) {
-			free(st->symbol[i]);
-		}
-		free(st->symbol);
-		st->symbol = NULL;
-	}
-	st->count = 0;
-	if (st->address != NULL) {
+	if (st->image == NULL) {
+		free(st->name);
 		free(st->address);
-		st->address = NULL;
-	}
-	if (st->sort_symbol != NULL) {
 		free(st->sort_symbol);
-		st->sort_symbol = NULL;
-	}
-	if (st->sort_address != NULL) {
 		free(st->sort_address);
-		st->sort_address = NULL;
-	}
-	if (st->segment != NULL) {
+		free(st->wide);
+		free(st->strings);
 		free(st->segment);
-		st->segment = NULL;
 	}
-	st->segment_count = 0;
+	st->image            = NULL;
+	st->name             = NULL;
+	st->address          = NULL;
+	st->sort_symbol      = NULL;
+	st->sort_address     = NULL;
+	st->wide             = NULL;
+	st->strings          = NULL;
+	st->segment          = NULL;
+	st->count            = 0;
+	st->capacity         = 0;
+	st->wide_count       = 0;
+	st->strings_size     = 0;
+	st->strings_capacity = 0;
+	st->segment_count    = 0;
 }
 
-// A sentinel value indicating that the index was not found.
-#define NOT_FOUND ((size_t)(-1))
+// ---- Images ------------------------------------------------------------------------------------
 
 /*
- * struct compare_sort_symbol_key
+ * struct symbol_table_image_header
  *
  * Description:
- * 	A key and context for compare_sort_symbol.
+ * 	The header of a symbol table image. It is followed by the name, address, sort_symbol, and
+ * 	sort_address arrays, padding to 8 bytes, the wide and segment arrays, and finally the
+ * 	string pool.
  */
-struct compare_sort_symbol_key {
-	const char *symbol;
-	char **symbols;
+struct symbol_table_image_header {
+	uint64_t base;
+	uint32_t count;
+	uint32_t wide_count;
+	uint32_t strings_size;
+	uint32_t segment_count;
 };
 
 /*
- * compare_sort_symbol
+ * image_layout
  *
  * Description:
- * 	Compare a key to an element in the sort_symbol array.
+ * 	Compute the offsets of the parts of a symbol table image from its header. Returns the total
+ * 	size of the image.
  */
-static int
-compare_sort_symbol(const void *key0, const void *element) {
-	const struct compare_sort_symbol_key *key = key0;
-	size_t symbol_index = *(const size_t *)element;
-	return compare_symbols(&key->symbol, &key->symbols[symbol_index]);
+static size_t
+image_layout(const struct symbol_table_image_header *header, size_t *wide, size_t *segment,
+		size_t *strings) {
+	size_t size = sizeof(*header) + 4 * (size_t) header->count * sizeof(uint32_t);
+	size = (size + 7) & ~(size_t) 7;
+	*wide = size;
+	size += header->wide_count * sizeof(struct symbol_table_wide_address);
+	*segment = size;
+	size += 2 * (size_t) header->segment_count * sizeof(kaddr_t);
+	*strings = size;
+	return size + header->strings_size;
 }
 
 /*
- * find_index_of_symbol
+ * image_indices_valid
  *
  * Description:
- * 	Find the index in the symbol/address tables corresponding to the given symbol. If index is
- * 	not NULL, then the index in the sort_symbol table (at which the symbol could be inserted)
- * 	is also returned.
+ * 	Check that every name offset in a symbol table image lies in the string pool, that every
+ * 	symbol index is less than the symbol count, and that the wide addresses are sorted and
+ * 	correspond exactly to the symbols marked WIDE_ADDRESS.
  */
-static size_t
-find_index_of_symbol(const struct symbol_table *st, const char *symbol,
-		size_t *sort_symbol_index) {
-	struct compare_sort_symbol_key key = { symbol, st->symbol };
-	const size_t *symbol_index = binary_search(st->sort_symbol, sizeof(*st->sort_symbol),
-			st->count, compare_sort_symbol, &key, sort_symbol_index);
-	return (symbol_index == NULL ? NOT_FOUND : *symbol_index);
+static bool
+image_indices_valid(const struct symbol_table *st) {
+	size_t wide_marked = 0;
+	for (size_t i = 0; i < st->count; i++) {
+		if (st->name[i] >= st->strings_size
+				|| st->sort_symbol[i] >= st->count
+				|| st->sort_address[i] >= st->count) {
+			return false;
+		}
+		wide_marked += (st->address[i] == WIDE_ADDRESS);
+	}
+	if (wide_marked != st->wide_count) {
+		return false;
+	}
+	for (size_t i = 0; i < st->wide_count; i++) {
+		uint32_t index = st->wide[i].index;
+		if (index >= st->count || st->address[index] != WIDE_ADDRESS
+				|| (i > 0 && index <= st->wide[i - 1].index)) {
+			return false;
+		}
+	}
+	return true;
 }
 
-/*
- * struct compare_sort_address_key
- *
- * Description:
- * 	A key and context for compare_sort_address.
- */
-struct compare_sort_address_key {
-	kaddr_t address;
-	const kaddr_t *addresses;
-};
+bool
+symbol_table_init_with_image(struct symbol_table *st, const void *image, size_t size) {
+	const struct symbol_table_image_header *header = image;
+	size_t wide, segment, strings;
+	if (size < sizeof(*header) || ((uintptr_t) image & 7) != 0
+			|| image_layout(header, &wide, &segment, &strings) != size
+			|| (header->strings_size > 0 && ((const char *) image)[size - 1] != 0)) {
+		return false;
+	}
+	const uint32_t *arrays = (const uint32_t *) (header + 1);
+	st->count            = header->count;
+	st->capacity         = 0;
+	st->name             = (uint32_t *) arrays;
+	st->address          = (uint32_t *) arrays + header->count;
+	st->sort_symbol      = (uint32_t *) arrays + 2 * header->count;
+	st->sort_address     = (uint32_t *) arrays + 3 * header->count;
+	st->base             = header->base;
+	st->wide             = (struct symbol_table_wide_address *) ((uintptr_t) image + wide);
+	st->wide_count       = header->wide_count;
+	st->strings          = (char *) image + strings;
+	st->strings_size     = header->strings_size;
+	st->strings_capacity = 0;
+	st->segment          = (kaddr_t *) ((uintptr_t) image + segment);
+	st->segment_count    = header->segment_count;
+	st->image            = image;
+	if (!image_indices_valid(st)) {
+		symbol_table_deinit(st);
+		return false;
+	}
+	return true;
+}
 
-/*
- * compare_sort_address
- *
- * Description:
- * 	Compare a key to an element in the sort_address array.
- */
-static int
-compare_sort_address(const void *key0, const void *element) {
-	const struct compare_sort_address_key *key = key0;
-	size_t address_index = *(const size_t *)element;
-	return compare_addresses(&key->address, &key->addresses[address_index]);
+size_t
+symbol_table_image_size(const struct symbol_table *st) {
+	struct symbol_table_image_header header = {
+		st->base, st->count, st->wide_count, st->strings_size, st->segment_count,
+	};
+	size_t wide, segment, strings;
+	return image_layout(&header, &wide, &segment, &strings);
 }
 
-/*
- * find_index_of_address
- *
- * Description:
- * 	Find the index in the symbol/address tables corresponding to the given address. If index is
- * 	not NULL, then the index in the sort_address table (at which the address could be inserted)
- * 	is also returned.
- */
-static size_t
-find_index_of_address(const struct symbol_table *st, kaddr_t address, size_t *sort_address_index) {
-	struct compare_sort_address_key key = { address, st->address };
-	const size_t *address_index = binary_search(st->sort_address, sizeof(*st->sort_address),
-			st->count, compare_sort_address, &key, sort_address_index);
-	return (address_index == NULL ? NOT_FOUND : *address_index);
+void
+symbol_table_write_image(const struct symbol_table *st, void *image) {
+	struct symbol_table_image_header *header = image;
+	header->base          = st->base;
+	header->count         = st->count;
+	header->wide_count    = st->wide_count;
+	header->strings_size  = st->strings_size;
+	header->segment_count = st->segment_count;
+	size_t wide, segment, strings;
+	size_t size = image_layout(header, &wide, &segment, &strings);
+	uint32_t *arrays = (uint32_t *) (header + 1);
+	size_t count = st->count;
+	memcpy(arrays,             st->name,         count * sizeof(*arrays));
+	memcpy(arrays + count,     st->address,      count * sizeof(*arrays));
+	memcpy(arrays + 2 * count, st->sort_symbol,  count * sizeof(*arrays));
+	memcpy(arrays + 3 * count, st->sort_address, count * sizeof(*arrays));
+	memset(arrays + 4 * count, 0, wide - sizeof(*header) - 4 * count * sizeof(*arrays));
+	memcpy((uint8_t *) image + wide, st->wide, st->wide_count * sizeof(*st->wide));
+	memcpy((uint8_t *) image + segment, st->segment,
+			2 * st->segment_count * sizeof(*st->segment));
+	memcpy((uint8_t *) image + strings, st->strings, size - strings);
 }
 
 /*
- * grow_arrays
+ * own_arrays
  *
  * Description:
- * 	Grow all the arrays.
+ * 	Copy the arrays of a symbol table initialized from an image into allocated memory, so that
+ * 	the symbol table can be modified.
  */
 static bool
-grow_arrays(struct symbol_table *st, size_t count) {
-	char **symbol = realloc(st->symbol, count * sizeof(*st->symbol));
-	if (symbol == NULL) {
-		return false;
-	}
-	st->symbol = symbol;
-	kaddr_t *address = realloc(st->address, count * sizeof(*st->address));
-	if (address == NULL) {
-		return false;
-	}
-	st->address = address;
-	size_t *sort_symbol = realloc(st->sort_symbol, count * sizeof(*st->sort_symbol));
-	if (sort_symbol == NULL) {
-		return false;
+own_arrays(struct symbol_table *st) {
+	if (st->image == NULL) {
+		return true;
 	}
-	st->sort_symbol = sort_symbol;
-	size_t *sort_address = realloc(st->sort_address, count * sizeof(*st->sort_address));
-	if (sort_address == NULL) {
+	struct symbol_table copy = *st;
+	copy.capacity         = 0;
+	copy.name             = NULL;
+	copy.address          = NULL;
+	copy.sort_symbol      = NULL;
+	copy.sort_address     = NULL;
+	copy.wide             = malloc(st->wide_count * sizeof(*st->wide) + 1);
+	copy.strings          = malloc(st->strings_size + 1);
+	copy.strings_capacity = st->strings_size;
+	copy.segment          = malloc(2 * st->segment_count * sizeof(*st->segment) + 1);
+	copy.image            = NULL;
+	if (copy.wide == NULL || copy.strings == NULL || copy.segment == NULL
+			|| !grow_arrays(&copy, st->count)) {
+		symbol_table_deinit(&copy);
 		return false;
 	}
-	st->sort_address = sort_address;
+	size_t count = st->count;
+	memcpy(copy.name,         st->name,         count * sizeof(*st->name));
+	memcpy(copy.address,      st->address,      count * sizeof(*st->address));
+	memcpy(copy.sort_symbol,  st->sort_symbol,  count * sizeof(*st->sort_symbol));
+	memcpy(copy.sort_address, st->sort_address, count * sizeof(*st->sort_address));
+	memcpy(copy.wide, st->wide, st->wide_count * sizeof(*st->wide));
+	memcpy(copy.strings, st->strings, st->strings_size);
+	memcpy(copy.segment, st->segment, 2 * st->segment_count * sizeof(*st->segment));
+	*st = copy;
 	return true;
 }
 
+// ---- Adding symbols ----------------------------------------------------------------------------
+
 bool
 symbol_table_add_symbol(struct symbol_table *st, const char *symbol, kaddr_t address) {
+	if (!own_arrays(st)) {
+		goto out_of_memory;
+	}
 	// Get the index of the symbol, in case it is already present.
 	size_t sort_symbol_index;
 	size_t symbol_index = find_index_of_symbol(st, symbol, &sort_symbol_index);
@@ -365,25 +716,24 @@ symbol_table_add_symbol(struct symbol_table *st, const char *symbol, kaddr_t add
 	if (!grow_arrays(st, count + 1)) {
 		goto out_of_memory;
 	}
-	// Duplicate the symbol string.
-	char *new_symbol = strdup(symbol);
-	if (new_symbol == NULL) {
+	// Append the symbol to the end of the name and address arrays.
+	if (!strings_add(st, symbol, &st->name[count])) {
+		goto out_of_memory;
+	}
+	if (!set_symbol_address(st, count, address)) {
 		goto out_of_memory;
 	}
-	// Append the symbol to the end of the symbol and address arrays.
-	st->symbol[count]  = new_symbol;
-	st->address[count] = address;
 	// Insert the new index in the proper sorted position in the sort_symbol array.
 	memmove(&st->sort_symbol[sort_symbol_index + 1], &st->sort_symbol[sort_symbol_index],
 			(count - sort_symbol_index) * sizeof(*st->sort_symbol));
 	st->sort_symbol[sort_symbol_index] = count;
-	// Insert the new index in the proper sorted position in the sort_address array.
-	size_t sort_address_index;
-	find_index_of_address(st, address, &sort_address_index);
+	// Insert the new index in the proper sorted position in the sort_address array, after
+	// any symbols with the same address.
+	size_t sort_address_index = address_upper_bound(st, address);
 	memmove(&st->sort_address[sort_address_index + 1], &st->sort_address[sort_address_index],
 			(count - sort_address_index) * sizeof(*st->sort_address));
 	st->sort_address[sort_address_index] = count;
-	// All done. Increment count (after all of the find_index_of_* calls, which use count).
+	// All done. Increment count (after all of the lookups, which use count).
 	st->count = count + 1;
 	return true;
 out_of_memory:
@@ -391,6 +741,159 @@ out_of_memory:
 	return false;
 }
 
+void
+symbol_table_builder_init(struct symbol_table_builder *builder, struct symbol_table *st) {
+	builder->st            = st;
+	builder->count         = 0;
+	builder->capacity      = 0;
+	builder->name          = NULL;
+	builder->address       = NULL;
+	builder->out_of_memory = false;
+}
+
+bool
+symbol_table_builder_add(struct symbol_table_builder *builder, const char *symbol,
+		kaddr_t address) {
+	if (builder->out_of_memory) {
+		return false;
+	}
+	if (!own_arrays(builder->st)) {
+		goto out_of_memory;
+	}
+	// Grow the staging arrays geometrically.
+	if (builder->count == builder->capacity) {
+		size_t capacity = max(2 * builder->capacity, MIN_CAPACITY);
+		uint32_t *new_name = realloc(builder->name, capacity * sizeof(*new_name));
+		if (new_name == NULL) {
+			goto out_of_memory;
+		}
+		builder->name = new_name;
+		kaddr_t *new_address = realloc(builder->address, capacity * sizeof(*new_address));
+		if (new_address == NULL) {
+			goto out_of_memory;
+		}
+		builder->address  = new_address;
+		builder->capacity = capacity;
+	}
+	if (!strings_add(builder->st, symbol, &builder->name[builder->count])) {
+		goto out_of_memory;
+	}
+	builder->address[builder->count] = address;
+	builder->count++;
+	return true;
+out_of_memory:
+	builder->out_of_memory = true;
+	return false;
+}
+
+/*
+ * builder_free
+ *
+ * Description:
+ * 	Free the staging arrays of a symbol_table_builder.
+ */
+static void
+builder_free(struct symbol_table_builder *builder) {
+	free(builder->name);
+	free(builder->address);
+	builder->name     = NULL;
+	builder->address  = NULL;
+	builder->count    = 0;
+	builder->capacity = 0;
+}
+
+bool
+symbol_table_builder_finish(struct symbol_table_builder *builder) {
+	struct symbol_table *st = builder->st;
+	size_t staged = builder->count;
+	size_t base   = st->count;
+	uint32_t *order = malloc((staged + 1) * sizeof(*order));
+	if (builder->out_of_memory || order == NULL || !own_arrays(st)) {
+		goto out_of_memory;
+	}
+	// Copy the staged symbols past the end of the published symbols. Nothing beyond count is
+	// visible to lookups, so the symbol table is unmodified until count is updated.
+	if (!grow_arrays(st, base + staged)) {
+		goto out_of_memory;
+	}
+	for (size_t i = 0; i < staged; i++) {
+		st->name[base + i] = builder->name[i];
+		if (!set_symbol_address(st, base + i, builder->address[i])) {
+			goto out_of_memory;
+		}
+	}
+	// Sort the staged symbols by name. The sort is stable, so among staged symbols with the
+	// same name, the one added first comes first.
+	if (!sort_names(st, base, staged, order)) {
+		goto out_of_memory;
+	}
+	// Drop staged symbols that repeat an earlier name, and compact the remaining symbols into
+	// sorted order.
+	size_t added = 0;
+	for (size_t i = 0; i < staged; i++) {
+		const char *symbol = builder->name[order[i]] + st->strings;
+		if (i > 0 && strcmp(symbol, builder->name[order[i - 1]] + st->strings) == 0) {
+			continue;
+		}
+		if (find_index_of_symbol(st, symbol, NULL) != NOT_FOUND) {
+			continue;
+		}
+		order[added++] = order[i];
+	}
+	truncate_wide_addresses(st, base);
+	for (size_t i = 0; i < added; i++) {
+		st->name[base + i] = builder->name[order[i]];
+		if (!set_symbol_address(st, base + i, builder->address[order[i]])) {
+			goto out_of_memory;
+		}
+	}
+	// Get the sort order of the new addresses.
+	if (!sort_addresses(st, base, added, order)) {
+		goto out_of_memory;
+	}
+	// Merge the new symbols into sort_symbol from the back. The new symbols are already in
+	// name order and the names are distinct, so there are no ties.
+	size_t count = base + added;
+	ssize_t old_i = base - 1;
+	ssize_t new_i = added - 1;
+	for (size_t out = count; new_i >= 0;) {
+		size_t new_index = base + new_i;
+		if (old_i >= 0 && strcmp(symbol_name(st, st->sort_symbol[old_i]),
+					symbol_name(st, new_index)) > 0) {
+			st->sort_symbol[--out] = st->sort_symbol[old_i--];
+		} else {
+			st->sort_symbol[--out] = new_index;
+			new_i--;
+		}
+	}
+	// Merge the new addresses into sort_address the same way. Existing symbols sort before new
+	// symbols with the same address.
+	old_i = base - 1;
+	new_i = added - 1;
+	for (size_t out = count; new_i >= 0;) {
+		size_t new_index = base + order[new_i];
+		if (old_i >= 0 && symbol_address(st, st->sort_address[old_i])
+				> symbol_address(st, new_index)) {
+			st->sort_address[--out] = st->sort_address[old_i--];
+		} else {
+			st->sort_address[--out] = new_index;
+			new_i--;
+		}
+	}
+	st->count = count;
+	free(order);
+	builder_free(builder);
+	return true;
+out_of_memory:
+	error_out_of_memory();
+	truncate_wide_addresses(st, base);
+	free(order);
+	builder_free(builder);
+	return false;
+}
+
+// ---- Lookups -----------------------------------------------------------------------------------
+
 /*
  * find_segment_containing_address
  *
@@ -417,19 +920,14 @@ find_segment_containing_address(const struct symbol_table *st, kaddr_t address,
  */
 static kaddr_t
 find_symbol_end_address(const struct symbol_table *st, kaddr_t address, kaddr_t segment_end) {
-	// Find the insertion index in the sort_address array of `address + 1`. This will skip over
-	// any symbols that share the same address, and either put sort_address_index right on a
-	// next symbol, or put us off the end of the array.
-	size_t sort_address_index;
-	find_index_of_address(st, address + 1, &sort_address_index);
+	size_t sort_address_index = address_upper_bound(st, address);
 	assert(sort_address_index <= st->count);
 	if (sort_address_index == st->count) {
 		// This is the last address. The end of the symbol is the end of the containing
 		// segment.
 		return segment_end;
 	}
-	assert(st->sort_address[sort_address_index] < st->count);
-	kaddr_t next = st->address[st->sort_address[sort_address_index]];
+	kaddr_t next = symbol_address(st, st->sort_address[sort_address_index]);
 	assert(next > address);
 	return min(next, segment_end);
 }
@@ -441,7 +939,7 @@ symbol_table_resolve_symbol(const struct symbol_table *st, const char *symbol,
 	if (index == NOT_FOUND) {
 		return false;
 	}
-	kaddr_t start = st->address[index];
+	kaddr_t start = symbol_address(st, index);
 	if (address != NULL) {
 		*address = start;
 	}
@@ -464,25 +962,19 @@ symbol_table_resolve_address(const struct symbol_table *st, kaddr_t address,
 		// The address is not contained in any segment.
 		return false;
 	}
-	// Get the index of the symbol containing the address.
-	size_t sort_address_index;
-	size_t index = find_index_of_address(st, address, &sort_address_index);
-	if (index == NOT_FOUND) {
-		// No symbol is at that exact address, but we have an insertion index, which means
-		// the address before it is the symbol containing this address.
-		if (sort_address_index == 0) {
-			// We'd have to insert at index 0, meaning this address comes before all
-			// symbols. No match.
-			return false;
-		}
-		index = st->sort_address[sort_address_index - 1];
+	// The symbol containing the address is the last one at or before the address.
+	size_t sort_address_index = address_upper_bound(st, address);
+	if (sort_address_index == 0) {
+		// This address comes before all symbols. No match.
+		return false;
 	}
+	size_t index = st->sort_address[sort_address_index - 1];
 	assert(index < st->count);
 	// Extract the symbol name, size, and the offset of the address from the start.
 	if (symbol != NULL) {
-		*symbol = st->symbol[index];
+		*symbol = symbol_name(st, index);
 	}
-	kaddr_t start = st->address[index];
+	kaddr_t start = symbol_address(st, index);
 	if (size != NULL) {
 		kaddr_t end = find_symbol_end_address(st, address, segment_end);
 		assert(start <= address && address < end && end <= segment_end);
@@ -493,3 +985,16 @@ symbol_table_resolve_address(const struct symbol_table *st, kaddr_t address,
 	}
 	return true;
 }
+
+void
+symbol_table_stats(const struct symbol_table *st, struct symbol_table_stats *stats) {
+	stats->count        = st->count;
+	stats->wide_count   = st->wide_count;
+	stats->strings_size = st->strings_size;
+	stats->memory       = sizeof(*st)
+		+ st->capacity * (sizeof(*st->name) + sizeof(*st->address)
+				+ sizeof(*st->sort_symbol) + sizeof(*st->sort_address))
+		+ st->wide_count * sizeof(*st->wide)
+		+ st->strings_capacity
+		+ 2 * st->segment_count * sizeof(*st->segment);
+}
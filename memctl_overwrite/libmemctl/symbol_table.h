@@ -4,28 +4,92 @@
 #include "macho.h"
 #include "memctl_types.h"
 
+struct symbol_table_wide_address;
+
 /*
  * struct symbol_table
  *
  * Description:
  * 	A symbol table mapping symbols to addresses.
+ *
+ * 	The table is stored compactly: symbols are referenced by 32-bit index, names are 32-bit
+ * 	offsets into a single string pool, and addresses are 32-bit offsets from the lowest segment
+ * 	address. The rare address that does not fit is stored in full in a side array.
  */
 struct symbol_table {
 	// The number of symbols.
 	size_t        count;
-	// The symbol names. These are in no particular order.
-	char **       symbol;
-	// The address of each symbol, in the same order as the symbol array.
-	kaddr_t *     address;
-	// The symbols above in lexicographical sorted order.
-	size_t *      sort_symbol;
-	// The addresses above in sorted order.
-	size_t *      sort_address;
+	// The number of elements allocated for the name, address, sort_symbol, and sort_address
+	// arrays. The arrays grow geometrically.
+	size_t        capacity;
+	// The offset of each symbol name in the string pool. These are in no particular order.
+	uint32_t *    name;
+	// The address of each symbol as an offset from base, in the same order as the name array.
+	// UINT32_MAX means the full address is stored in the wide array.
+	uint32_t *    address;
+	// The symbol indices in lexicographical sorted order of the names.
+	uint32_t *    sort_symbol;
+	// The symbol indices in sorted order of the addresses.
+	uint32_t *    sort_address;
+	// The base address from which symbol addresses are offset.
+	kaddr_t       base;
+	// The full addresses of symbols whose address is not representable as an offset from
+	// base, sorted by symbol index.
+	struct symbol_table_wide_address *wide;
+	size_t        wide_count;
+	// The string pool holding the symbol names, each terminated by a NUL byte.
+	char *        strings;
+	size_t        strings_size;
+	size_t        strings_capacity;
 	// The memory segments underlying the symbol table. The segment information is used to
 	// truncate symbols. Information about each segment is stored as a pair of addresses: the
 	// start address followed by the end address.
 	kaddr_t *     segment;
 	size_t        segment_count;
+	// If not NULL, the arrays point into this read-only image written by
+	// symbol_table_write_image rather than into allocated memory. The arrays are copied
+	// before the symbol table is modified.
+	const void *  image;
+};
+
+/*
+ * struct symbol_table_builder
+ *
+ * Description:
+ * 	State for adding many symbols to a symbol table at once. Symbols added through the builder
+ * 	are appended to a staging area and only sorted into the symbol table once, in
+ * 	symbol_table_builder_finish, rather than paying for a sorted insert on every addition.
+ */
+struct symbol_table_builder {
+	// The symbol table to which the symbols will be added.
+	struct symbol_table *st;
+	// The number of staged symbols.
+	size_t        count;
+	// The number of elements allocated for the staging arrays.
+	size_t        capacity;
+	// The staged symbol names, as offsets into the symbol table's string pool.
+	uint32_t *    name;
+	// The staged addresses.
+	kaddr_t *     address;
+	// Set if memory could not be allocated while staging.
+	bool          out_of_memory;
+};
+
+/*
+ * struct symbol_table_stats
+ *
+ * Description:
+ * 	Memory usage statistics for a symbol table.
+ */
+struct symbol_table_stats {
+	// The number of symbols.
+	size_t count;
+	// The number of symbols whose address is stored in full.
+	size_t wide_count;
+	// The number of bytes of symbol names in the string pool.
+	size_t strings_size;
+	// The total number of bytes allocated by the symbol table.
+	size_t memory;
 };
 
 /*
@@ -48,6 +112,46 @@ struct symbol_table {
  */
 bool symbol_table_init_with_macho(struct symbol_table *st, const struct macho *macho);
 
+/*
+ * symbol_table_init_with_image
+ *
+ * Description:
+ * 	Initialize a symbol table from an image written by symbol_table_write_image. The symbol
+ * 	table refers to the image directly rather than copying it.
+ *
+ * Parameters:
+ * 	out	st			The symbol table to initialize.
+ * 		image			The image. It must be 8-byte aligned and must remain valid
+ * 					until the symbol table is deinitialized.
+ * 		size			The size of the image.
+ *
+ * Returns:
+ * 	True if the image is well formed. No error is pushed if it is not.
+ */
+bool symbol_table_init_with_image(struct symbol_table *st, const void *image, size_t size);
+
+/*
+ * symbol_table_image_size
+ *
+ * Description:
+ * 	Get the size of the image symbol_table_write_image will write for a symbol table.
+ */
+size_t symbol_table_image_size(const struct symbol_table *st);
+
+/*
+ * symbol_table_write_image
+ *
+ * Description:
+ * 	Serialize a symbol table into a flat image that symbol_table_init_with_image can use in
+ * 	place, for example after mapping it from a file.
+ *
+ * Parameters:
+ * 		st			The symbol table.
+ * 	out	image			The buffer to fill. It must be 8-byte aligned and
+ * 					symbol_table_image_size(st) bytes long.
+ */
+void symbol_table_write_image(const struct symbol_table *st, void *image);
+
 /*
  * symbol_table_deinit
  *
@@ -76,6 +180,57 @@ void symbol_table_deinit(struct symbol_table *st);
  */
 bool symbol_table_add_symbol(struct symbol_table *st, const char *symbol, kaddr_t address);
 
+/*
+ * symbol_table_builder_init
+ *
+ * Description:
+ * 	Start adding symbols to a symbol table in bulk.
+ *
+ * Parameters:
+ * 	out	builder			The builder to initialize.
+ * 		st			The symbol table to which symbols will be added.
+ *
+ * Notes:
+ * 	Staged symbols are not visible to lookups on the symbol table until
+ * 	symbol_table_builder_finish is called. Single symbols may still be added with
+ * 	symbol_table_add_symbol while a builder is active.
+ */
+void symbol_table_builder_init(struct symbol_table_builder *builder, struct symbol_table *st);
+
+/*
+ * symbol_table_builder_add
+ *
+ * Description:
+ * 	Stage a symbol to be added to the symbol table.
+ *
+ * Parameters:
+ * 		builder			The builder.
+ * 		symbol			The symbol name to add. This string is copied internally,
+ * 					so it may be freed after this function returns.
+ * 		address			The address of the symbol.
+ *
+ * Returns:
+ * 	True if the symbol was staged. On failure, symbol_table_builder_finish will also fail.
+ */
+bool symbol_table_builder_add(struct symbol_table_builder *builder, const char *symbol,
+		kaddr_t address);
+
+/*
+ * symbol_table_builder_finish
+ *
+ * Description:
+ * 	Sort the staged symbols and merge them into the symbol table. Staged symbols whose name is
+ * 	already present in the symbol table, or which repeat the name of a symbol staged earlier,
+ * 	are skipped. The builder's resources are released whether or not this call succeeds.
+ *
+ * Parameters:
+ * 		builder			The builder.
+ *
+ * Returns:
+ * 	True if no errors were encountered. On failure, the symbol table is left unmodified.
+ */
+bool symbol_table_builder_finish(struct symbol_table_builder *builder);
+
 /*
  * symbol_table_resolve_symbol
  *
@@ -105,8 +260,8 @@ bool symbol_table_resolve_symbol(const struct symbol_table *st, const char *symb
  * 		address			The address to resolve.
  * 	out	symbol			On return, the symbol name. The returned string points to
  * 					memory allocated by the symbol table, and must not be
- * 					referenced after symbol_table_deinit is called. May be
- * 					NULL.
+ * 					referenced after the symbol table is modified or
+ * 					symbol_table_deinit is called. May be NULL.
  * 	out	size			On return, the size of the symbol, which is computed as the
  * 					number of bytes between the start of this symbol and the
  * 					start of the next one. May be NULL.
@@ -116,4 +271,16 @@ bool symbol_table_resolve_symbol(const struct symbol_table *st, const char *symb
 bool symbol_table_resolve_address(const struct symbol_table *st, kaddr_t address,
 		const char **symbol, size_t *size, size_t *offset);
 
+/*
+ * symbol_table_stats
+ *
+ * Description:
+ * 	Report the memory used by a symbol table.
+ *
+ * Parameters:
+ * 		st			The symbol table.
+ * 	out	stats			On return, the symbol table statistics.
+ */
+void symbol_table_stats(const struct symbol_table *st, struct symbol_table_stats *stats);
+
 #endif
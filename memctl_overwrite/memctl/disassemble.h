@@ -9,12 +9,11 @@
  * MEMCTL_DISASSEMBLY
  *
  * Description:
- * 	Whether disassembly is supported on this platform.
+ * 	Whether disassembly is supported. The disassembler and the arm64 analyses in libmemctl
+ * 	are not built yet, so disassembly is off unless enabled explicitly.
  */
 #ifndef MEMCTL_DISASSEMBLY
-# if __arm64__
-#  define MEMCTL_DISASSEMBLY 1
-# endif
+# define MEMCTL_DISASSEMBLY 0
 #endif
 
 #if MEMCTL_DISASSEMBLY
@@ -161,6 +161,11 @@ error_start() {
 	--errors.stop_count;
 }
 
+bool
+error_stopped() {
+	return (errors.stop_count > 0);
+}
+
 void *
 error_push(const struct error_type *type, size_t size) {
 	if (errors.stop_count > 0) {
@@ -82,6 +82,14 @@ void error_stop(void);
  */
 void error_start(void);
 
+/*
+ * error_stopped
+ *
+ * Description:
+ * 	Check whether errors have been stopped with error_stop on this thread.
+ */
+bool error_stopped(void);
+
 /*
  * error_push
  *
@@ -8,6 +8,8 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+struct macho_symbol_index;
+
 /*
  * struct macho
  *
@@ -21,6 +23,10 @@ struct macho {
 		struct mach_header_64 *mh64;
 	};
 	size_t size;
+	// The symbol lookup accelerator built by macho_symbol_index_init, or NULL. Initialize this
+	// to NULL and, if the index was built, release it with macho_symbol_index_deinit before
+	// unmapping the Mach-O.
+	struct macho_symbol_index *symbol_index;
 };
 
 /*
@@ -222,6 +228,35 @@ void macho_section_data(const struct macho *macho, const struct load_command *se
  */
 macho_result macho_find_base(const struct macho *macho, uint64_t *base);
 
+/*
+ * macho_lowest_address
+ *
+ * Description:
+ * 	Get the lowest address of any non-empty segment in the Mach-O file.
+ *
+ * Parameters:
+ * 		macho			The macho struct.
+ *
+ * Returns:
+ * 	The lowest segment address, or 0 if there are no segments.
+ */
+uint64_t macho_lowest_address(const struct macho *macho);
+
+/*
+ * macho_find_uuid
+ *
+ * Description:
+ * 	Get the UUID of the Mach-O file from its LC_UUID load command.
+ *
+ * Parameters:
+ * 		macho			The macho struct.
+ * 	out	uuid			The UUID.
+ *
+ * Returns:
+ * 	MACHO_SUCCESS if the Mach-O has a UUID, and MACHO_NOT_FOUND otherwise.
+ */
+macho_result macho_find_uuid(const struct macho *macho, uint8_t uuid[16]);
+
 /*
  * macho_for_each_symbol_fn
  *
@@ -258,6 +293,41 @@ typedef bool (*macho_for_each_symbol_fn)(void *context, const char *symbol, uint
 void macho_for_each_symbol(const struct macho *macho, const struct symtab_command *symtab,
 		macho_for_each_symbol_fn callback, void *context);
 
+/*
+ * macho_symbol_index_init
+ *
+ * Description:
+ * 	Build the symbol lookup accelerator for the given symtab. The accelerator consists of an
+ * 	address-sorted index of the nlist entries and a hash table over the symbol names, which
+ * 	make macho_resolve_symbol, macho_resolve_address, and macho_guess_symbol_size run in
+ * 	logarithmic or constant time rather than scanning the whole symbol table.
+ *
+ * Parameters:
+ * 		macho			The macho struct.
+ * 		symtab			The Mach-O symtab command.
+ *
+ * Returns:
+ * 	MACHO_SUCCESS if the index was built, MACHO_ERROR if memory could not be allocated.
+ *
+ * Notes:
+ * 	The lookup functions only use the index, never build it, so they may run concurrently on
+ * 	the same macho. They fall back to a linear scan if there is no index or if they are given
+ * 	a different symtab. This function replaces any index built for another symtab, and must
+ * 	not run concurrently with lookups on the same macho.
+ */
+macho_result macho_symbol_index_init(struct macho *macho, const struct symtab_command *symtab);
+
+/*
+ * macho_symbol_index_deinit
+ *
+ * Description:
+ * 	Free the symbol lookup accelerator, if any.
+ *
+ * Parameters:
+ * 		macho			The macho struct.
+ */
+void macho_symbol_index_deinit(struct macho *macho);
+
 /*
  * macho_resolve_symbol
  *
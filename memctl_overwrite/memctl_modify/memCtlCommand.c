@@ -11,18 +11,36 @@
 #include <unistd.h>
 
 #include "kernel_call.h"
+#include "log.h"
 #include "memCtlCommand.h"
+#include "memCtlPrefetch.h"
 #include "memCtlRead.h"
+#include "memCtlServer.h"
+#include "memCtlStartup.h"
 #include "../libmemctl/format.h"
 #include "../libmemctl/memory.h"
 #include "../libmemctl/error.h"
 #include "../libmemctl/vmmap.h"
 #include "../libmemctl/find.h"
+#include "../memctl/disassemble.h"
+#if MEMCTL_DISASSEMBLY
+#include "../libmemctl/kernel.h"
+#include "../libmemctl/kernel_image.h"
+#include "../libmemctl/macho.h"
+#include "../libmemctl/arm64/fingerprint.h"
+#include "../libmemctl/arm64/functions.h"
+#endif
 #include "../kernel/kernel_memory.h"
 #include "../ktrr/ktrr_bypass_parameters.h"
 #include "../kernel/kernel_slide.h"
+#include "../kernel/kernel_tasks.h"
+#include "../kext_load/resolve_symbol.h"
 #include "../system/platform.h"
 #include "memCtlZoneCommand.h"
+#include "memCtlPortCommand.h"
+#include "memCtlStructCommand.h"
+#include "memCtlTelCommand.h"
+#include "memCtlWalkCommand.h"
 
 
 static memflags
@@ -196,7 +214,6 @@ kvtophys(kaddr_t kvaddr) {
 		uint64_t physBase = 0x800000000;
 		paddr = physBase + ppnum;
 		if(ppnum == 0){
-			printf("[*] Non-existent Address\n");
 			return false;
 		}
 		// uint64_t checkPhyaddress = phys_read64(paddr);
@@ -215,13 +232,82 @@ kvtophys(kaddr_t kvaddr) {
 	}
 }
 
-bool safeacess(kaddr_t address){
+// Serializes the kernel calls made by safeacess(), which the prefetch and serve threads also use.
+static pthread_mutex_t safeacess_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * page_mapped
+ *
+ * Description:
+ * 	Whether the page holding a kernel address is mapped. Prints nothing, so background
+ * 	threads may call it.
+ */
+static bool
+page_mapped(kaddr_t address) {
+	// kvtophys() is called through kernel_call at an address from the KTRR parameters.
+	if (!startup_require(FEATURE_KTRR)) {
+		return false;
+	}
+	pthread_mutex_lock(&safeacess_lock);
 	uint64_t phyAddress = kvtophys(address);
-	//uint64_t result;
-	if(phyAddress){
+	pthread_mutex_unlock(&safeacess_lock);
+	return (phyAddress != 0);
+}
+
+bool safeacess(kaddr_t address){
+	// A page the prefetch thread has already checked and read is not checked again.
+	if (prefetch_checked(address)) {
 		return true;
 	}
-	return false;
+	if (!page_mapped(address)) {
+		printf("[*] Non-existent Address\n");
+		return false;
+	}
+	return true;
+}
+
+/*
+ * range_mapped
+ *
+ * Description:
+ * 	Check every page of a range with the given check, stopping at the first failure.
+ */
+static bool
+range_mapped(kaddr_t address, size_t length, bool (*check)(kaddr_t)) {
+	if (length == 0 || address + length < address) {
+		return (length == 0);
+	}
+	kaddr_t last = (address + length - 1) & ~(page_size - 1);
+	for (kaddr_t page = address & ~(page_size - 1);; page += page_size) {
+		if (!check(page < address ? address : page)) {
+			return false;
+		}
+		if (page == last) {
+			return true;
+		}
+	}
+}
+
+bool
+safeacess_range(kaddr_t address, size_t length) {
+	return range_mapped(address, length, safeacess);
+}
+
+bool
+safeacess_range_quiet(kaddr_t address, size_t length) {
+	return range_mapped(address, length, page_mapped);
+}
+
+/*
+ * is_kernel_pointer
+ *
+ * Description:
+ * 	Whether a value lies in the kernel's half of the address space, and so might be a kernel
+ * 	pointer worth checking with safeacess().
+ */
+bool
+is_kernel_pointer(uint64_t value) {
+	return (value >= 0xffffff8000000000 && value < 0xfffffffffffff000);
 }
 
 static bool
@@ -353,11 +439,393 @@ ws_command(kaddr_t address, const char *string, bool force, bool physical, size_
 	return wd_command(address, string, length, force, physical, access);
 }
 
+#if MEMCTL_DISASSEMBLY
+
+/*
+ * dis_function
+ *
+ * Description:
+ * 	Disassemble the function containing the given address one basic block at a time, using the
+ * 	function index of the kext containing it. Each block is preceded by its successors.
+ */
+static bool
+dis_function(kaddr_t address, memflags flags, size_t access) {
+	const struct kext *kext;
+	kext_result kr = kernel_kext_containing_address(&kext, address);
+	if (kr != KEXT_SUCCESS) {
+		if (kr == KEXT_NO_KEXT) {
+			ERROR("no kext contains address "KADDR_XFMT, address);
+		}
+		return false;
+	}
+	bool success = false;
+	const struct aarch64_function_index *index = aarch64_function_index_get(&kext->macho);
+	if (index == NULL) {
+		goto out;
+	}
+	const struct aarch64_function *function = aarch64_function_containing(index,
+			address - kext->slide);
+	if (function == NULL) {
+		ERROR("no function contains address "KADDR_XFMT, address);
+		goto out;
+	}
+	kaddr_t base = index->base + kext->slide;
+	for (uint32_t b = 0; b < function->block_count; b++) {
+		const struct aarch64_basic_block *block = &index->blocks[function->first_block + b];
+		printf("block %u:", b);
+		const uint32_t *edges = &index->edges[block->first_edge];
+		for (uint32_t e = 0; e < block->edge_count; e++) {
+			printf(" -> %u", edges[e] - function->first_block);
+		}
+		printf("\n");
+		if (!memctl_disassemble(base + block->start, block->end - block->start, flags,
+					access)) {
+			goto out;
+		}
+	}
+	success = true;
+out:
+	kext_release(kext);
+	return success;
+}
+
+bool
+dis_command(kaddr_t address, size_t length, bool force, bool physical, size_t access) {
+	if (length == 0 && physical) {
+		ERROR("a length is required to disassemble physical memory");
+		return false;
+	}
+	if (!force && !check_address(address, length, physical)) {
+		return false;
+	}
+	memflags flags = make_memflags(force, physical);
+	if (length == 0) {
+		return dis_function(address, flags, access);
+	}
+	return memctl_disassemble(address, length, flags, access);
+}
+
+// The maximum length of a symbol name in a symbol database.
+#define SYMBOL_NAME_MAX	256
+
+/*
+ * struct ported_symbol
+ *
+ * Description:
+ * 	A symbol read from a symbol database and its address in the kernelcache it is ported to.
+ */
+struct ported_symbol {
+	char name[SYMBOL_NAME_MAX];
+	kaddr_t address;
+	bool found;
+	// The key of the match the symbol was ported through.
+	enum aarch64_match_key key;
+};
+
+/*
+ * open_kernelcache
+ *
+ * Description:
+ * 	Map a kernelcache file and check that it is a 64-bit Mach-O.
+ */
+static bool
+open_kernelcache(const char *path, struct kernel_image *image, struct macho *macho) {
+	if (!kernel_image_open(path, image)) {
+		return false;
+	}
+	*macho = (struct macho) {};
+	macho->mh   = (void *)image->macho;
+	macho->size = image->macho_size;
+	if (macho_validate(macho->mh, macho->size) != MACHO_SUCCESS || !macho_is_64(macho)) {
+		ERROR("%s is not a valid 64-bit Mach-O file", path);
+		kernel_image_close(image);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * read_symbol_database
+ *
+ * Description:
+ * 	Read the symbols in a symbol database. Each line holds a symbol name and its address, in
+ * 	the format of the files in kernel_symbols/.
+ */
+static bool
+read_symbol_database(const char *path, struct ported_symbol **symbols, size_t *count) {
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		ERROR("could not open %s", path);
+		return false;
+	}
+	struct ported_symbol *array = NULL;
+	size_t capacity = 0;
+	bool success = false;
+	char line[SYMBOL_NAME_MAX + 64];
+	*count = 0;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		struct ported_symbol symbol = {};
+		unsigned long long address;
+		if (sscanf(line, "%255s %llx", symbol.name, &address) != 2) {
+			continue;
+		}
+		symbol.address = address;
+		if (*count == capacity) {
+			capacity = (capacity == 0 ? 16 : 2 * capacity);
+			struct ported_symbol *grown = realloc(array, capacity * sizeof(*grown));
+			if (grown == NULL) {
+				error_out_of_memory();
+				goto out;
+			}
+			array = grown;
+		}
+		array[(*count)++] = symbol;
+	}
+	*symbols = array;
+	array = NULL;
+	success = true;
+out:
+	free(array);
+	fclose(file);
+	return success;
+}
+
+/*
+ * print_parameter_table
+ *
+ * Description:
+ * 	Print the ported symbols as an addresses__ function for kernel_parameters.c. Symbols
+ * 	that could not be ported are left as comments, as are symbols ported through a match
+ * 	that was not made on the exact fingerprint, which should be checked by hand.
+ */
+static void
+print_parameter_table(const char *name, const struct ported_symbol *symbols, size_t count) {
+	int width = 0;
+	for (size_t i = 0; i < count; i++) {
+		const char *parameter = symbols[i].name + (symbols[i].name[0] == '_');
+		if ((int) strlen(parameter) > width) {
+			width = strlen(parameter);
+		}
+	}
+	printf("static void\naddresses__%s() {\n", name);
+	for (size_t i = 0; i < count; i++) {
+		const char *parameter = symbols[i].name + (symbols[i].name[0] == '_');
+		if (symbols[i].found && symbols[i].key == AARCH64_MATCH_EXACT) {
+			printf("\tSTATIC_ADDRESS(%s)%*s = 0x%016llX;\n", parameter,
+					width - (int) strlen(parameter), "",
+					(unsigned long long) symbols[i].address);
+		} else if (symbols[i].found) {
+			printf("\t// STATIC_ADDRESS(%s)%*s = 0x%016llX; // matched on %s\n",
+					parameter, width - (int) strlen(parameter), "",
+					(unsigned long long) symbols[i].address,
+					aarch64_match_key_name(symbols[i].key));
+		} else {
+			printf("\t// STATIC_ADDRESS(%s) not found\n", parameter);
+		}
+	}
+	printf("}\n");
+}
+
+bool
+port_command(const char *reference, const char *symbols_path, const char *kernelcache,
+		const char *output, const char *name) {
+	struct kernel_image images[2];
+	struct macho machos[2];
+	struct aarch64_fingerprints fp[2];
+	struct ported_symbol *symbols = NULL;
+	size_t count = 0;
+	uint32_t *match = NULL;
+	uint8_t *keys = NULL;
+	size_t matched;
+	bool success = false;
+	if (!read_symbol_database(symbols_path, &symbols, &count)) {
+		return false;
+	}
+	if (!open_kernelcache(reference, &images[0], &machos[0])) {
+		goto fail_0;
+	}
+	if (!open_kernelcache(kernelcache, &images[1], &machos[1])) {
+		goto fail_1;
+	}
+	// Fingerprint both kernelcaches at the same time, then match them.
+	if (!aarch64_fingerprints_init_pair(&fp[0], &machos[0], &fp[1], &machos[1])) {
+		goto fail_2;
+	}
+	if (!aarch64_fingerprints_match(&fp[0], &fp[1], &match, &keys, &matched)) {
+		goto fail_3;
+	}
+	FILE *file = fopen(output, "w");
+	if (file == NULL) {
+		ERROR("could not open %s", output);
+		goto fail_4;
+	}
+	// Only the symbols ported through exact matches go in the symbol database.
+	size_t ported = 0, weak = 0;
+	for (size_t i = 0; i < count; i++) {
+		struct ported_symbol *symbol = &symbols[i];
+		symbol->found = aarch64_fingerprints_port(&fp[0], &fp[1], match, keys,
+				symbol->address, &symbol->address, &symbol->key);
+		if (!symbol->found) {
+			continue;
+		}
+		ported++;
+		if (symbol->key != AARCH64_MATCH_EXACT) {
+			weak++;
+			continue;
+		}
+		fprintf(file, "%s\t0x%016llX\n", symbol->name,
+				(unsigned long long) symbol->address);
+	}
+	fclose(file);
+	printf("// Matched %zu of %zu functions. Ported %zu of %zu symbols, %zu of them through\n"
+			"// weak matches, which are commented out.\n", matched,
+			fp[0].functions.function_count, ported, count, weak);
+	print_parameter_table(name, symbols, count);
+	success = true;
+fail_4:
+	free(match);
+	free(keys);
+fail_3:
+	aarch64_fingerprints_deinit(&fp[0]);
+	aarch64_fingerprints_deinit(&fp[1]);
+fail_2:
+	kernel_image_close(&images[1]);
+fail_1:
+	kernel_image_close(&images[0]);
+fail_0:
+	free(symbols);
+	return success;
+}
+
+#endif // MEMCTL_DISASSEMBLY
+
+bool
+log_command() {
+	log_flush();
+	struct log_stats stats;
+	log_get_stats(&stats);
+	printf("messages:   %llu\n", (unsigned long long) stats.messages);
+	printf("bytes:      %llu\n", (unsigned long long) stats.bytes);
+	printf("dropped:    %llu\n", (unsigned long long) stats.dropped);
+	printf("suppressed: %llu\n", (unsigned long long) stats.suppressed);
+	return true;
+}
+
 bool
 zs_command(kaddr_t address) {
 	return zone_space(address);
 }
 
+static bool
+serve_kernel_read(void *context, uint64_t address, void *data, size_t size) {
+	return safeacess_range(address, size) && kernel_read(address, data, size);
+}
+
+static bool
+serve_kernel_write(void *context, uint64_t address, const void *data, size_t size) {
+	return safeacess_range(address, size) && kernel_write(address, data, size);
+}
+
+static bool
+serve_kernel_zone(void *context, uint64_t address, struct server_zone *zone) {
+	struct zone_info info;
+	if (!zone_lookup(address, &info)) {
+		return false;
+	}
+	zone->zone         = info.zone;
+	zone->metadata     = info.metadata;
+	zone->element_size = info.element_size;
+	snprintf(zone->name, sizeof(zone->name), "%s", info.name);
+	return true;
+}
+
+static bool
+serve_kernel_symbol(void *context, const char *name, uint64_t *address) {
+	uint64_t static_address = resolve_symbol(name);
+	if (static_address == 0) {
+		return false;
+	}
+	*address = static_address + kernel_slide;
+	return true;
+}
+
+bool
+serve_command(const char *endpoint, const char *image, kaddr_t base) {
+	struct server_backend backend = {
+		NULL,
+		serve_kernel_read,
+		serve_kernel_write,
+		serve_kernel_zone,
+		serve_kernel_symbol,
+	};
+	if (image != NULL) {
+		if (!server_image_backend_init(&backend, image, base)) {
+			return false;
+		}
+	} else {
+		if (!startup_require(FEATURE_KTRR)) {
+			return false;
+		}
+		// Symbol resolution is optional: the database may not exist for this platform.
+		if (!startup_require(FEATURE_SYMBOLS)) {
+			backend.symbol = NULL;
+		}
+	}
+	bool success = server_run(endpoint, &backend);
+	if (image != NULL) {
+		server_image_backend_deinit(&backend);
+	}
+	return success;
+}
+
+static void
+ps_print(const struct kernel_proc *entry) {
+	printf("%6d  0x%016llx  0x%016llx  0x%016llx\n", entry->pid,
+			(unsigned long long) entry->proc, (unsigned long long) entry->task,
+			(unsigned long long) entry->ipc_space);
+}
+
+bool
+ps_command(bool refresh, bool one, int pid) {
+	// The process table needs the kernel slide to find allproc.
+	if (!startup_require(FEATURE_KERNEL_CALL)) {
+		return false;
+	}
+	if (refresh) {
+		kernel_procs_invalidate();
+	}
+	size_t count;
+	const struct kernel_proc *procs = kernel_procs(&count);
+	if (procs == NULL) {
+		return false;
+	}
+	if (one) {
+		const struct kernel_proc *entry = kernel_proc_find(pid);
+		if (entry == NULL) {
+			ERROR("no process with PID %d", pid);
+			return false;
+		}
+		procs = entry;
+		count = 1;
+	}
+	printf("%6s  %-18s  %-18s  %-18s\n", "PID", "PROC", "TASK", "IPC_SPACE");
+	for (size_t i = 0; i < count; i++) {
+		ps_print(&procs[i]);
+	}
+	if (kernel_procs_partial()) {
+		printf("allproc could not be read to the end; run ps -r to walk it again\n");
+	}
+	return true;
+}
+
+bool
+fport_command(bool one, int pid, kaddr_t port) {
+	if (one) {
+		return port_space(pid);
+	}
+	return port_holders(port, port == 0);
+}
+
 // Command Code 
 
 // Handler Code
@@ -466,6 +934,104 @@ HANDLER(ws_handler) {
 	return false;
 }
 
+#if MEMCTL_DISASSEMBLY
+HANDLER(dis_handler) {
+	bool force      = OPT_PRESENT(0, "f");
+	bool physical   = OPT_PRESENT(1, "p");
+	size_t access   = OPT_GET_WIDTH_OR(2, "x", "access", 0);
+	kaddr_t address = ARG_GET_ADDRESS(3, "address");
+	size_t length   = ARG_GET_UINT_OR(4, "length", 0);
+
+	bool checkSafe = safeacess(address);
+	if(checkSafe){
+		return dis_command(address, length, force, physical, access);
+	}
+
+	return false;
+}
+
+HANDLER(port_handler) {
+	const char *name        = OPT_GET_STRING_OR(0, "n", "name", "ported");
+	const char *reference   = ARG_GET_STRING(1, "reference");
+	const char *symbols     = ARG_GET_STRING(2, "symbols");
+	const char *kernelcache = ARG_GET_STRING(3, "kernelcache");
+	const char *output      = ARG_GET_STRING(4, "output");
+	return port_command(reference, symbols, kernelcache, output, name);
+}
+#endif
+
+HANDLER(log_handler) {
+	return log_command();
+}
+
+HANDLER(serve_handler) {
+	const char *image    = OPT_GET_STRING_OR(0, "i", "image", NULL);
+	kaddr_t base         = OPT_GET_ADDRESS_OR(1, "b", "base", 0);
+	const char *endpoint = ARG_GET_STRING(2, "endpoint");
+	return serve_command(endpoint, image, base);
+}
+
+HANDLER(ps_handler) {
+	bool refresh = OPT_PRESENT(0, "r");
+	bool one     = ARG_PRESENT(1, "pid");
+	int pid      = ARG_GET_INT_OR(1, "pid", 0);
+	return ps_command(refresh, one, pid);
+}
+
+HANDLER(fport_handler) {
+	kaddr_t port = OPT_GET_ADDRESS_OR(0, "p", "port", 0);
+	bool one     = ARG_PRESENT(1, "pid");
+	int pid      = ARG_GET_INT_OR(1, "pid", 0);
+	return fport_command(one, pid, port);
+}
+
+HANDLER(tel_handler) {
+	kaddr_t address = ARG_GET_ADDRESS(0, "address");
+	size_t count    = ARG_GET_UINT_OR(1, "n", 8);
+	size_t depth    = ARG_GET_UINT_OR(2, "depth", 2);
+	if (count == 0 || count > TEL_MAX_WORDS || depth > TEL_MAX_DEPTH) {
+		ERROR("tel shows 1 to %d words and follows up to %d levels", TEL_MAX_WORDS,
+				TEL_MAX_DEPTH);
+		return false;
+	}
+	bool checkSafe = safeacess(address);
+	if(checkSafe){
+		return tel_command(address, count, depth);
+	}
+	return false;
+}
+
+HANDLER(pt_handler) {
+	size_t count     = OPT_GET_UINT_OR(0, "n", "count", 1);
+	size_t depth     = OPT_GET_UINT_OR(1, "d", "depth", 1);
+	const char *type = ARG_GET_STRING(2, "type");
+	kaddr_t address  = ARG_GET_ADDRESS(3, "address");
+	if (count == 0 || depth > PT_MAX_DEPTH) {
+		ERROR("pt prints at least 1 struct and follows up to %d levels", PT_MAX_DEPTH);
+		return false;
+	}
+	bool checkSafe = safeacess(address);
+	if(checkSafe){
+		return pt_command(type, address, count, depth);
+	}
+	return false;
+}
+
+HANDLER(walk_handler) {
+	size_t budget       = OPT_GET_UINT_OR(0, "n", "count", WALK_DEFAULT_BUDGET);
+	size_t link         = OPT_GET_UINT_OR(1, "l", "link", 0);
+	bool first          = OPT_PRESENT(2, "f");
+	const char *type    = OPT_GET_STRING_OR(3, "t", "type", NULL);
+	kaddr_t head        = ARG_GET_ADDRESS(4, "head");
+	const char *next    = ARG_GET_STRING(5, "next");
+	const char **fields = ARG_GET_ARGV_OR(6, "fields", NULL);
+	bool checkSafe = safeacess(head);
+	if(checkSafe){
+		return walk_command(head, next, link, first, type, fields, budget);
+	}
+	return false;
+}
+
 HANDLER(zs_handler) {	
 	kaddr_t address = ARG_GET_ADDRESS(0, "address");
 
@@ -563,6 +1129,119 @@ static struct command commands[] = {
 			{ ARGUMENT, "string",  ARG_STRING,  "The string to write"     },
 		},
 	}, {
+#if MEMCTL_DISASSEMBLY
+		"dis", NULL, dis_handler,
+		"Disassemble kernel memory",
+		"Disassemble instructions in kernel memory. If no length is given, the function "
+		"containing the address is disassembled one basic block at a time, with the "
+		"function's bounds and control flow graph found by analyzing its kext.",
+		ARGSPEC(5) {
+			{ "f",      NULL,      ARG_NONE,    "Force read (unsafe)"                },
+			{ "p",      NULL,      ARG_NONE,    "Read physical memory"               },
+			{ "x",      "access",  ARG_WIDTH,   "The memory access width"            },
+			{ ARGUMENT, "address", ARG_ADDRESS, "The address to disassemble"         },
+			{ OPTIONAL, "length",  ARG_UINT,    "The number of bytes to disassemble" },
+		},
+	}, {
+		"port", NULL, port_handler,
+		"Port a symbol database to a new kernelcache",
+		"Match the functions of a reference kernelcache with those of a new kernelcache "
+		"by their fingerprints, then port the addresses in a symbol database for the "
+		"reference to the new kernelcache. The ported database is written to the output "
+		"file and the addresses__ function for kernel_parameters.c is printed.",
+		ARGSPEC(5) {
+			{ "n",      "name",        ARG_STRING, "The addresses__ function suffix" },
+			{ ARGUMENT, "reference",   ARG_STRING, "The reference kernelcache"       },
+			{ ARGUMENT, "symbols",     ARG_STRING, "The reference symbol database"   },
+			{ ARGUMENT, "kernelcache", ARG_STRING, "The kernelcache to port to"      },
+			{ ARGUMENT, "output",      ARG_STRING, "The symbol database to write"    },
+		},
+	}, {
+#endif
+		"log", NULL, log_handler,
+		"Print logging statistics",
+		"Print the number of log messages and bytes logged, the number of messages dropped "
+		"because the log queue was full, and the number of repeated or rate-limited "
+		"messages that were not printed.",
+		0, NULL,
+	}, {
+		"serve", NULL, serve_handler,
+		"Serve memory to host tools over a socket",
+		"Listen on a UNIX socket that only the current user may connect to and answer "
+		"read, readv, write, find, zone, and symbol requests in the binary protocol "
+		"described in memCtlServer.h until interrupted. Kernel memory is only accessed on "
+		"mapped pages. With -i, a file is served as a memory image starting at the base "
+		"address instead of kernel memory.",
+		ARGSPEC(3) {
+			{ "i",      "image",    ARG_STRING,  "Serve a memory image file"     },
+			{ "b",      "base",     ARG_ADDRESS, "The base address of the image" },
+			{ ARGUMENT, "endpoint", ARG_STRING,  "The socket path"               },
+		},
+	}, {
+		"ps", NULL, ps_handler,
+		"List processes",
+		"Print the PID, proc, task, and ipc_space of each process on allproc, or of one "
+		"process. The process table is built by a single walk of allproc and reused by "
+		"later commands until it is refreshed with -r.",
+		ARGSPEC(2) {
+			{ "r",      NULL,  ARG_NONE, "Rebuild the process table" },
+			{ OPTIONAL, "pid", ARG_INT,  "The PID to print"          },
+		},
+	}, {
+		"fport", NULL, fport_handler,
+		"Find Mach ports",
+		"With a PID, print the name, port address, rights, and user references of every "
+		"entry in the process's ipc_space. Otherwise scan every process and print the "
+		"PID, name, and rights of each holder of every port, or only of the port given "
+		"with -p.",
+		ARGSPEC(2) {
+			{ "p",      "port", ARG_ADDRESS, "The port to find the holders of" },
+			{ OPTIONAL, "pid",  ARG_INT,     "The process to list the ports of" },
+		},
+	}, {
+		"tel", NULL, tel_handler,
+		"Print memory and follow pointers",
+		"Print n words of kernel memory and follow each kernel pointer up to depth "
+		"levels. Pointers are annotated with the symbol they point into, the zone they "
+		"belong to, or the string they point to. The pointers at each level are read "
+		"together, and each target is read only once.",
+		ARGSPEC(3) {
+			{ ARGUMENT, "address", ARG_ADDRESS, "The address to read"            },
+			{ OPTIONAL, "n",       ARG_UINT,    "The number of words to print"   },
+			{ OPTIONAL, "depth",   ARG_UINT,    "The number of levels to follow" },
+		},
+	}, {
+		"pt", NULL, pt_handler,
+		"Print a kernel struct",
+		"Print count structs of the given type at an address, decoded with the struct "
+		"layouts for this device and build. The structs are read in one transfer, and "
+		"struct pointers are followed up to depth levels.",
+		ARGSPEC(4) {
+			{ "n",      "count",   ARG_UINT,    "The number of structs to print"  },
+			{ "d",      "depth",   ARG_UINT,    "The number of levels to follow"  },
+			{ ARGUMENT, "type",    ARG_STRING,  "The struct type"                 },
+			{ ARGUMENT, "address", ARG_ADDRESS, "The address of the struct"       },
+		},
+	}, {
+		"walk", NULL, walk_handler,
+		"Walk a linked list",
+		"Follow the next pointer at the given offset from node to node and print the "
+		"given fields of each node. The head is the address of the list head, or of the "
+		"first node with -f. For lists whose next pointers point into the middle of a "
+		"node, such as queue_chain_t, give that offset with -l. Fields are offsets with "
+		"an optional :width, or field names of the struct given with -t. The walk stops "
+		"at a NULL pointer, when it returns to the head, or after count nodes. It fails "
+		"at a node it already visited or cannot read.",
+		ARGSPEC(7) {
+			{ "n",      "count",  ARG_UINT,    "The most nodes to visit"              },
+			{ "l",      "link",   ARG_UINT,    "The node offset next points to"       },
+			{ "f",      NULL,     ARG_NONE,    "The head is the first node"           },
+			{ "t",      "type",   ARG_STRING,  "The struct type of the nodes"         },
+			{ ARGUMENT, "head",   ARG_ADDRESS, "The address of the list head"         },
+			{ ARGUMENT, "next",   ARG_STRING,  "The offset or name of the next field" },
+			{ OPTIONAL, "fields", ARG_ARGV,    "The fields to print"                  },
+		},
+	}, {
 		"zs", NULL, zs_handler,
 		"zone Space Print",
 		"zone Print",
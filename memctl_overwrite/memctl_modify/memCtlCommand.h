@@ -12,11 +12,23 @@ bool wd_command(kaddr_t address, const void *data, size_t length, bool force, bo
 bool rb_command(kaddr_t address, size_t length, bool force, bool physical, size_t access);
 bool rs_command(kaddr_t address, size_t length, bool force, bool physical, size_t access);
 bool ws_command(kaddr_t address, const char *string, bool force, bool physical, size_t access);
+bool dis_command(kaddr_t address, size_t length, bool force, bool physical, size_t access);
+bool port_command(const char *reference, const char *symbols, const char *kernelcache,
+		const char *output, const char *name);
+bool log_command(void);
+bool serve_command(const char *endpoint, const char *image, kaddr_t base);
+bool ps_command(bool refresh, bool one, int pid);
+bool fport_command(bool one, int pid, kaddr_t port);
 bool f_command(kaddr_t start, kaddr_t end, kword_t value, size_t width, bool physical, bool heap,
 		size_t access, size_t alignment);
 
 bool default_action(void);
 bool safeacess(kaddr_t address);
+bool safeacess_range(kaddr_t address, size_t length);
+// Like safeacess_range(), but prints nothing and ignores prefetched data. For background
+// threads.
+bool safeacess_range_quiet(kaddr_t address, size_t length);
+bool is_kernel_pointer(uint64_t value);
 
 
 struct state {
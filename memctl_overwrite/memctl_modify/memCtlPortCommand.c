@@ -0,0 +1,398 @@
+#include "memCtlPortCommand.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "memCtlCommand.h"
+#include "memCtlStartup.h"
+#include "../memctl/memctl_signal.h"
+#include "../memctl/utility.h"
+#include "../kernel/kernel_memory.h"
+#include "../kernel/kernel_tasks.h"
+#include "log.h"
+
+// The maximum number of threads scanning ipc_spaces.
+#define MAX_PORT_SCAN_THREADS	8
+
+// The number of slots in the set of pages checked during one scan. At most half are used.
+#define PORT_SCAN_PAGE_SLOTS	0x20000
+
+/*
+ * struct page_set
+ *
+ * Description:
+ * 	An open-addressed hash set of the pages already checked during a scan. safeacess() makes
+ * 	a kernel call under a global lock, so the threads would otherwise take turns checking the
+ * 	same zone pages, which hold many ipc_spaces and small is_tables each.
+ */
+struct page_set {
+	pthread_mutex_t lock;
+	uint64_t *pages;
+	size_t slots;
+	size_t count;
+};
+
+// The pages checked by the scan in progress.
+static struct page_set scan_pages = { PTHREAD_MUTEX_INITIALIZER };
+
+/*
+ * scan_page_checked
+ *
+ * Description:
+ * 	Look up a page in scan_pages, adding it if add is set and there is room.
+ */
+static bool
+scan_page_checked(uint64_t page, bool add) {
+	bool found = false;
+	pthread_mutex_lock(&scan_pages.lock);
+	if (scan_pages.slots > 0) {
+		size_t mask = scan_pages.slots - 1;
+		size_t slot = (size_t) ((page / page_size) * 0x9e3779b97f4a7c15 >> 32) & mask;
+		while (scan_pages.pages[slot] != 0 && scan_pages.pages[slot] != page) {
+			slot = (slot + 1) & mask;
+		}
+		found = (scan_pages.pages[slot] == page);
+		if (!found && add && scan_pages.count < scan_pages.slots / 2) {
+			scan_pages.pages[slot] = page;
+			scan_pages.count++;
+		}
+	}
+	pthread_mutex_unlock(&scan_pages.lock);
+	return found;
+}
+
+/*
+ * port_scan_check
+ *
+ * Description:
+ * 	Check a range of an ipc_space or is_table before it is read, making a kernel call only for
+ * 	pages this scan has not checked yet. Prints nothing, since it runs on the scan threads.
+ */
+static bool
+port_scan_check(uint64_t address, size_t length) {
+	if (length == 0 || address + length < address) {
+		return (length == 0);
+	}
+	uint64_t last = (address + length - 1) & ~(page_size - 1);
+	for (uint64_t page = address & ~(page_size - 1);; page += page_size) {
+		if (!scan_page_checked(page, false)) {
+			if (!safeacess_range_quiet(max(page, address), 1)) {
+				return false;
+			}
+			scan_page_checked(page, true);
+		}
+		if (page == last) {
+			return true;
+		}
+	}
+}
+
+/*
+ * struct port_scan_shard
+ *
+ * Description:
+ * 	The state of one scanning thread. Threads take processes from a shared counter, since the
+ * 	size of an ipc_space varies a lot between processes.
+ */
+struct port_scan_shard {
+	const struct kernel_proc *procs;
+	size_t proc_count;
+	atomic_size_t *next;
+	struct port_holder *holders;
+	size_t count;
+	size_t capacity;
+	size_t unreadable;
+	bool failed;
+};
+
+/*
+ * port_scan_add
+ *
+ * Description:
+ * 	Add the entries of a process's ipc_space to a shard.
+ */
+static bool
+port_scan_add(struct port_scan_shard *shard, int pid, const struct kernel_ipc_entry *entries,
+		size_t count) {
+	if (shard->count + count > shard->capacity) {
+		size_t capacity = max(shard->capacity * 2, shard->count + count);
+		struct port_holder *holders = realloc(shard->holders,
+				capacity * sizeof(*holders));
+		if (holders == NULL) {
+			return false;
+		}
+		shard->holders = holders;
+		shard->capacity = capacity;
+	}
+	for (size_t i = 0; i < count; i++) {
+		// Dead names have no port, and a port set's object is an ipc_pset, not a port.
+		if (entries[i].object == 0 || (entries[i].type & MACH_PORT_TYPE_PORT_SET) != 0) {
+			continue;
+		}
+		struct port_holder *holder = &shard->holders[shard->count++];
+		holder->port = entries[i].object;
+		holder->pid  = pid;
+		holder->name = entries[i].name;
+		holder->type = entries[i].type;
+	}
+	return true;
+}
+
+static void *
+port_scan_worker(void *arg) {
+	struct port_scan_shard *shard = arg;
+	for (;;) {
+		size_t i = atomic_fetch_add(shard->next, 1);
+		if (i >= shard->proc_count || shard->failed || interrupted) {
+			break;
+		}
+		// A process that is exiting may have no ipc_space, and so holds no rights.
+		const struct kernel_proc *proc = &shard->procs[i];
+		if (proc->ipc_space == 0) {
+			continue;
+		}
+		struct kernel_ipc_entry *entries;
+		size_t count;
+		if (!kernel_ipc_space_entries(proc->ipc_space, port_scan_check, &entries,
+					&count)) {
+			shard->unreadable++;
+			continue;
+		}
+		shard->failed = !port_scan_add(shard, proc->pid, entries, count);
+		free(entries);
+	}
+	return NULL;
+}
+
+/*
+ * compare_port_holders
+ *
+ * Description:
+ * 	Compare two holders by port, then PID, then name, for qsort.
+ */
+static int
+compare_port_holders(const void *a, const void *b) {
+	const struct port_holder *x = a;
+	const struct port_holder *y = b;
+	if (x->port != y->port) {
+		return (x->port < y->port ? -1 : 1);
+	}
+	if (x->pid != y->pid) {
+		return (x->pid < y->pid ? -1 : 1);
+	}
+	return (x->name < y->name ? -1 : x->name > y->name);
+}
+
+bool
+port_index_build(struct port_index *index) {
+	// Processes come and go between scans, so allproc is walked again for each one.
+	kernel_procs_invalidate();
+	size_t proc_count;
+	const struct kernel_proc *procs = kernel_procs(&proc_count);
+	if (procs == NULL) {
+		return false;
+	}
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t thread_count = min((size_t) (cpus > 0 ? cpus : 1), (size_t) MAX_PORT_SCAN_THREADS);
+	thread_count = max(min(thread_count, proc_count), (size_t) 1);
+	atomic_size_t next = 0;
+	struct port_scan_shard shards[MAX_PORT_SCAN_THREADS] = {};
+	pthread_t threads[MAX_PORT_SCAN_THREADS];
+	bool started[MAX_PORT_SCAN_THREADS] = {};
+	for (size_t t = 0; t < thread_count; t++) {
+		shards[t].procs = procs;
+		shards[t].proc_count = proc_count;
+		shards[t].next = &next;
+	}
+	// Without the page set every page is checked each time it is read, which is slower but
+	// still correct.
+	pthread_mutex_lock(&scan_pages.lock);
+	scan_pages.pages = calloc(PORT_SCAN_PAGE_SLOTS, sizeof(*scan_pages.pages));
+	scan_pages.slots = (scan_pages.pages != NULL ? PORT_SCAN_PAGE_SLOTS : 0);
+	scan_pages.count = 0;
+	pthread_mutex_unlock(&scan_pages.lock);
+	// Shard 0 runs on this thread, and takes over the work of any thread that did not start.
+	for (size_t t = 1; t < thread_count; t++) {
+		started[t] = (pthread_create(&threads[t], NULL, port_scan_worker, &shards[t]) == 0);
+	}
+	port_scan_worker(&shards[0]);
+	size_t count = 0;
+	bool failed = false;
+	index->unreadable = 0;
+	for (size_t t = 0; t < thread_count; t++) {
+		if (started[t]) {
+			pthread_join(threads[t], NULL);
+		}
+		count += shards[t].count;
+		failed |= shards[t].failed;
+		index->unreadable += shards[t].unreadable;
+	}
+	pthread_mutex_lock(&scan_pages.lock);
+	free(scan_pages.pages);
+	scan_pages.pages = NULL;
+	scan_pages.slots = 0;
+	pthread_mutex_unlock(&scan_pages.lock);
+	// Merge the shards and sort the entries by port. An interrupted scan is incomplete and is
+	// discarded.
+	index->holders = NULL;
+	if (!failed && !interrupted) {
+		index->holders = malloc(max(count, (size_t) 1) * sizeof(*index->holders));
+	}
+	index->count = 0;
+	if (index->holders == NULL && !interrupted) {
+		ERROR("Could not allocate the port index");
+	}
+	for (size_t t = 0; t < thread_count; t++) {
+		if (index->holders != NULL) {
+			memcpy(index->holders + index->count, shards[t].holders,
+					shards[t].count * sizeof(*shards[t].holders));
+			index->count += shards[t].count;
+		}
+		free(shards[t].holders);
+	}
+	if (index->holders == NULL) {
+		return false;
+	}
+	qsort(index->holders, index->count, sizeof(*index->holders), compare_port_holders);
+	return true;
+}
+
+void
+port_index_deinit(struct port_index *index) {
+	free(index->holders);
+	index->holders = NULL;
+	index->count = 0;
+}
+
+const struct port_holder *
+port_index_find(const struct port_index *index, uint64_t port, size_t *count) {
+	// Find the first holder of the port.
+	size_t lo = 0;
+	size_t hi = index->count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (index->holders[mid].port < port) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	size_t end = lo;
+	while (end < index->count && index->holders[end].port == port) {
+		end++;
+	}
+	*count = end - lo;
+	return (end > lo ? &index->holders[lo] : NULL);
+}
+
+/*
+ * port_rights_string
+ *
+ * Description:
+ * 	Format the rights in a MACH_PORT_TYPE_* mask, such as "recv+send".
+ */
+static const char *
+port_rights_string(mach_port_type_t type, char *buffer, size_t size) {
+	static const struct {
+		mach_port_type_t type;
+		const char *name;
+	} rights[] = {
+		{ MACH_PORT_TYPE_RECEIVE,   "recv"      },
+		{ MACH_PORT_TYPE_SEND,      "send"      },
+		{ MACH_PORT_TYPE_SEND_ONCE, "send-once" },
+		{ MACH_PORT_TYPE_PORT_SET,  "port-set"  },
+		{ MACH_PORT_TYPE_DEAD_NAME, "dead-name" },
+	};
+	size_t length = 0;
+	buffer[0] = 0;
+	for (size_t i = 0; i < sizeof(rights) / sizeof(rights[0]); i++) {
+		if ((type & rights[i].type) != 0 && length < size) {
+			length += snprintf(buffer + length, size - length, "%s%s",
+					(length > 0 ? "+" : ""), rights[i].name);
+		}
+	}
+	return buffer;
+}
+
+bool
+port_space(int pid) {
+	if (!startup_require(FEATURE_KERNEL_CALL)) {
+		return false;
+	}
+	// The process may have exited since the table was built, so the table is built again.
+	kernel_procs_invalidate();
+	const struct kernel_proc *proc = kernel_proc_find(pid);
+	if (proc == NULL) {
+		ERROR("no process with PID %d", pid);
+		return false;
+	}
+	if (proc->ipc_space == 0) {
+		ERROR("process %d has no ipc_space", pid);
+		return false;
+	}
+	struct kernel_ipc_entry *entries;
+	size_t count;
+	if (!kernel_ipc_space_entries(proc->ipc_space, safeacess_range, &entries, &count)) {
+		return false;
+	}
+	printf("%-10s  %-18s  %-18s  %s\n", "NAME", "IPC_PORT", "RIGHTS", "UREFS");
+	for (size_t i = 0; i < count && !interrupted; i++) {
+		char rights[64];
+		printf("0x%08x  0x%016llx  %-18s  %u\n", entries[i].name,
+				(unsigned long long) entries[i].object,
+				port_rights_string(entries[i].type, rights, sizeof(rights)),
+				entries[i].urefs);
+	}
+	free(entries);
+	return true;
+}
+
+static void
+port_holder_print(const struct port_holder *holder) {
+	char rights[64];
+	printf("\t%6d  0x%08x  %s\n", holder->pid, holder->name,
+			port_rights_string(holder->type, rights, sizeof(rights)));
+}
+
+bool
+port_holders(uint64_t port, bool all) {
+	if (!startup_require(FEATURE_KERNEL_CALL)) {
+		return false;
+	}
+	struct port_index index;
+	if (!port_index_build(&index)) {
+		return false;
+	}
+	if (all) {
+		for (size_t i = 0; i < index.count && !interrupted;) {
+			printf("0x%016llx\n", (unsigned long long) index.holders[i].port);
+			uint64_t current = index.holders[i].port;
+			for (; i < index.count && index.holders[i].port == current; i++) {
+				port_holder_print(&index.holders[i]);
+			}
+		}
+	} else {
+		size_t count;
+		const struct port_holder *holders = port_index_find(&index, port, &count);
+		for (size_t i = 0; i < count; i++) {
+			port_holder_print(&holders[i]);
+		}
+		if (count == 0) {
+			printf("no process holds a right to 0x%016llx\n",
+					(unsigned long long) port);
+		}
+	}
+	if (index.unreadable > 0) {
+		printf("%zu processes could not be scanned\n", index.unreadable);
+	}
+	if (kernel_procs_partial()) {
+		printf("allproc could not be read to the end; some processes were not scanned\n");
+	}
+	port_index_deinit(&index);
+	return true;
+}
@@ -0,0 +1,98 @@
+#ifndef MEMCTL_PORT_COMMAND_H_
+#define MEMCTL_PORT_COMMAND_H_
+/*
+ * Mach port enumeration.
+ *
+ * A task's whole is_table is read in page-sized chunks and decoded at once, instead of looking
+ * up one name at a time. The system-wide scan reads the ipc_space of every process in the
+ * process table on several threads, then sorts the entries into a reverse index from port
+ * address to the (PID, name) pairs that hold a right to it.
+ */
+
+#include <mach/mach.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * struct port_holder
+ *
+ * Description:
+ * 	A right to a port held by a process.
+ */
+struct port_holder {
+	uint64_t port;
+	int pid;
+	mach_port_name_t name;
+	mach_port_type_t type;
+};
+
+/*
+ * struct port_index
+ *
+ * Description:
+ * 	The rights held by every process, sorted by port address, then PID, then name. Port sets
+ * 	are not ports and are left out.
+ */
+struct port_index {
+	struct port_holder *holders;
+	size_t count;
+	// The number of processes whose ipc_space could not be read.
+	size_t unreadable;
+};
+
+/*
+ * port_index_build
+ *
+ * Description:
+ * 	Scan the ipc_space of every process in the process table in parallel and build the reverse
+ * 	index.
+ *
+ * Returns:
+ * 	True if the index was built. Processes whose ipc_space could not be read are skipped.
+ */
+bool port_index_build(struct port_index *index);
+
+/*
+ * port_index_deinit
+ *
+ * Description:
+ * 	Free a reverse index.
+ */
+void port_index_deinit(struct port_index *index);
+
+/*
+ * port_index_find
+ *
+ * Description:
+ * 	Find the holders of a port.
+ *
+ * Parameters:
+ * 		index			The reverse index.
+ * 		port			The address of the port.
+ * 	out	count			On return, the number of holders.
+ *
+ * Returns:
+ * 	The first holder, or NULL if no process holds a right to the port.
+ */
+const struct port_holder *port_index_find(const struct port_index *index, uint64_t port,
+		size_t *count);
+
+/*
+ * port_space
+ *
+ * Description:
+ * 	Print the name, port, rights, and user references of every entry in a process's
+ * 	ipc_space.
+ */
+bool port_space(int pid);
+
+/*
+ * port_holders
+ *
+ * Description:
+ * 	Scan every process and print the holders of one port, or of every port if all is true.
+ */
+bool port_holders(uint64_t port, bool all);
+
+#endif
@@ -0,0 +1,255 @@
+#include "memCtlPrefetch.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memCtlCommand.h"
+#include "../kernel/kernel_memory.h"
+#include "mach_vm.h"
+
+// The number of ranges that can be queued or held at once.
+#define PREFETCH_SLOTS		32
+
+// The largest range held by one slot. Larger ranges are split across slots.
+#define PREFETCH_MAX_SIZE	0x10000
+
+/*
+ * enum slot_state
+ *
+ * Description:
+ * 	The state of a prefetch slot.
+ */
+enum slot_state {
+	SLOT_FREE,
+	SLOT_QUEUED,
+	SLOT_READING,
+	SLOT_READY,
+	SLOT_FAILED,
+};
+
+/*
+ * struct prefetch_slot
+ *
+ * Description:
+ * 	A range of kernel memory queued for or read by the prefetch thread.
+ */
+struct prefetch_slot {
+	enum slot_state state;
+	uint64_t address;
+	size_t size;
+	uint8_t *data;
+	// The order in which the slot was queued. Slots are read, and recycled, oldest first.
+	uint64_t sequence;
+};
+
+// Protects all of the prefetch state.
+static pthread_mutex_t prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Signaled whenever a slot changes state or the thread is asked to stop.
+static pthread_cond_t prefetch_cond = PTHREAD_COND_INITIALIZER;
+
+// The prefetch slots.
+static struct prefetch_slot prefetch_slots[PREFETCH_SLOTS];
+
+// The next slot sequence number.
+static uint64_t prefetch_sequence;
+
+// The prefetch thread, and whether it is running.
+static pthread_t prefetch_thread;
+static bool prefetch_running;
+
+/*
+ * oldest_slot
+ *
+ * Description:
+ * 	Find the oldest slot in one of two states.
+ */
+static struct prefetch_slot *
+oldest_slot(enum slot_state state1, enum slot_state state2) {
+	struct prefetch_slot *oldest = NULL;
+	for (size_t i = 0; i < PREFETCH_SLOTS; i++) {
+		struct prefetch_slot *slot = &prefetch_slots[i];
+		if ((slot->state == state1 || slot->state == state2)
+				&& (oldest == NULL || slot->sequence < oldest->sequence)) {
+			oldest = slot;
+		}
+	}
+	return oldest;
+}
+
+/*
+ * slot_covering
+ *
+ * Description:
+ * 	Find a queued, pending, or read slot holding the given range.
+ */
+static struct prefetch_slot *
+slot_covering(uint64_t address, size_t size) {
+	for (size_t i = 0; i < PREFETCH_SLOTS; i++) {
+		struct prefetch_slot *slot = &prefetch_slots[i];
+		if (slot->state != SLOT_FREE && slot->state != SLOT_FAILED
+				&& slot->address <= address
+				&& address - slot->address + size <= slot->size) {
+			return slot;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * prefetch_worker
+ *
+ * Description:
+ * 	Read the queued slots in order. This is a pthread start routine.
+ *
+ * Notes:
+ * 	Reads are made with mach_vm_read_overwrite rather than kernel_read so that a range that
+ * 	cannot be read is not reported as an error. The command that reads it will report the
+ * 	error when it reads the range itself. Every page of a range is checked with
+ * 	safeacess_range_quiet() first, so the worker never touches memory a command would refuse
+ * 	to read, and never prints from the background.
+ */
+static void *
+prefetch_worker(void *arg) {
+	pthread_mutex_lock(&prefetch_lock);
+	while (prefetch_running) {
+		struct prefetch_slot *slot = oldest_slot(SLOT_QUEUED, SLOT_QUEUED);
+		if (slot == NULL) {
+			pthread_cond_wait(&prefetch_cond, &prefetch_lock);
+			continue;
+		}
+		slot->state = SLOT_READING;
+		uint64_t address = slot->address;
+		size_t size = slot->size;
+		uint8_t *data = slot->data;
+		pthread_mutex_unlock(&prefetch_lock);
+		mach_vm_size_t size_out = 0;
+		kern_return_t kr = KERN_INVALID_ADDRESS;
+		if (safeacess_range_quiet(address, size)) {
+			kr = mach_vm_read_overwrite(kernel_task_port, address, size,
+					(mach_vm_address_t) data, &size_out);
+		}
+		pthread_mutex_lock(&prefetch_lock);
+		slot->state = (kr == KERN_SUCCESS && size_out == size ? SLOT_READY : SLOT_FAILED);
+		pthread_cond_broadcast(&prefetch_cond);
+	}
+	pthread_mutex_unlock(&prefetch_lock);
+	return NULL;
+}
+
+bool
+prefetch_start() {
+	pthread_mutex_lock(&prefetch_lock);
+	if (!prefetch_running) {
+		prefetch_running = true;
+		if (pthread_create(&prefetch_thread, NULL, prefetch_worker, NULL) != 0) {
+			prefetch_running = false;
+		}
+	}
+	bool running = prefetch_running;
+	pthread_mutex_unlock(&prefetch_lock);
+	return running;
+}
+
+void
+prefetch_stop() {
+	pthread_mutex_lock(&prefetch_lock);
+	bool running = prefetch_running;
+	prefetch_running = false;
+	pthread_cond_broadcast(&prefetch_cond);
+	pthread_mutex_unlock(&prefetch_lock);
+	if (running) {
+		pthread_join(prefetch_thread, NULL);
+	}
+	prefetch_clear();
+}
+
+void
+prefetch_range(uint64_t address, size_t size) {
+	pthread_mutex_lock(&prefetch_lock);
+	while (prefetch_running && size > 0) {
+		size_t chunk = (size < PREFETCH_MAX_SIZE ? size : PREFETCH_MAX_SIZE);
+		if (address + chunk < address) {
+			break;
+		}
+		if (slot_covering(address, chunk) == NULL) {
+			// Use a free slot, or else recycle the oldest slot that has been read.
+			struct prefetch_slot *slot = oldest_slot(SLOT_FREE, SLOT_FREE);
+			if (slot == NULL) {
+				slot = oldest_slot(SLOT_READY, SLOT_FAILED);
+			}
+			if (slot == NULL) {
+				break;
+			}
+			uint8_t *data = realloc(slot->data, chunk);
+			if (data == NULL) {
+				break;
+			}
+			slot->state    = SLOT_QUEUED;
+			slot->address  = address;
+			slot->size     = chunk;
+			slot->data     = data;
+			slot->sequence = prefetch_sequence++;
+		}
+		address += chunk;
+		size    -= chunk;
+	}
+	pthread_cond_broadcast(&prefetch_cond);
+	pthread_mutex_unlock(&prefetch_lock);
+}
+
+void
+prefetch_clear() {
+	pthread_mutex_lock(&prefetch_lock);
+	// A slot being read cannot be freed until the read finishes.
+	while (oldest_slot(SLOT_READING, SLOT_READING) != NULL) {
+		pthread_cond_wait(&prefetch_cond, &prefetch_lock);
+	}
+	for (size_t i = 0; i < PREFETCH_SLOTS; i++) {
+		struct prefetch_slot *slot = &prefetch_slots[i];
+		free(slot->data);
+		memset(slot, 0, sizeof(*slot));
+	}
+	pthread_mutex_unlock(&prefetch_lock);
+}
+
+/*
+ * ready_slot
+ *
+ * Description:
+ * 	Find the read slot holding the given range, waiting for it if it is still queued. The
+ * 	prefetch lock must be held.
+ */
+static struct prefetch_slot *
+ready_slot(uint64_t address, size_t size) {
+	struct prefetch_slot *slot = slot_covering(address, size);
+	while (slot != NULL && prefetch_running
+			&& (slot->state == SLOT_QUEUED || slot->state == SLOT_READING)) {
+		pthread_cond_wait(&prefetch_cond, &prefetch_lock);
+	}
+	if (slot != NULL && slot->state == SLOT_READY && slot->address <= address
+			&& address - slot->address + size <= slot->size) {
+		return slot;
+	}
+	return NULL;
+}
+
+bool
+prefetch_read(uint64_t address, void *data, size_t size) {
+	pthread_mutex_lock(&prefetch_lock);
+	struct prefetch_slot *slot = ready_slot(address, size);
+	if (slot != NULL) {
+		memcpy(data, slot->data + (address - slot->address), size);
+	}
+	pthread_mutex_unlock(&prefetch_lock);
+	return (slot != NULL);
+}
+
+bool
+prefetch_checked(uint64_t address) {
+	pthread_mutex_lock(&prefetch_lock);
+	bool checked = (ready_slot(address, 1) != NULL);
+	pthread_mutex_unlock(&prefetch_lock);
+	return checked;
+}
@@ -0,0 +1,74 @@
+#ifndef MEMCTL_PREFETCH_H_
+#define MEMCTL_PREFETCH_H_
+/*
+ * Kernel memory prefetching for batch mode.
+ *
+ * While one command runs and formats its output, the ranges that upcoming read commands will
+ * read are fetched by a background thread, each with a single kernel_read. The read routines
+ * check the prefetched ranges before reading kernel memory themselves. Prefetched data is
+ * dropped before any command that is not a plain read, so writes are never hidden.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * prefetch_start
+ *
+ * Description:
+ * 	Start the prefetch thread.
+ *
+ * Returns:
+ * 	True if the thread was started.
+ */
+bool prefetch_start(void);
+
+/*
+ * prefetch_stop
+ *
+ * Description:
+ * 	Stop the prefetch thread and drop all prefetched data.
+ */
+void prefetch_stop(void);
+
+/*
+ * prefetch_range
+ *
+ * Description:
+ * 	Queue a range of kernel virtual memory to be read in the background. If too many ranges
+ * 	are outstanding, the request is ignored.
+ */
+void prefetch_range(uint64_t address, size_t size);
+
+/*
+ * prefetch_clear
+ *
+ * Description:
+ * 	Drop all prefetched data, waiting for any read in progress to finish.
+ */
+void prefetch_clear(void);
+
+/*
+ * prefetch_read
+ *
+ * Description:
+ * 	Copy kernel memory from a prefetched range, waiting for the range to be read if it is
+ * 	still queued.
+ *
+ * Returns:
+ * 	True if the whole range was prefetched successfully.
+ */
+bool prefetch_read(uint64_t address, void *data, size_t size);
+
+/*
+ * prefetch_checked
+ *
+ * Description:
+ * 	Whether the page holding an address was checked with safeacess_range_quiet() and read by
+ * 	the prefetch thread, waiting for it if it is still queued. safeacess() uses this to skip
+ * 	a second check of the same page.
+ */
+bool prefetch_checked(uint64_t address);
+
+#endif
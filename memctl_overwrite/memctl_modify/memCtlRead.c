@@ -5,6 +5,7 @@
 #include <mach-o/loader.h>
 
 #include "memCtlRead.h"
+#include "memCtlPrefetch.h"
 #include "../libmemctl/format.h"
 #include "../memctl/memctl_signal.h"
 #include "../memctl/utility.h"
@@ -17,7 +18,9 @@ typedef void (*fn_t)(void);
 kaddr_t read_kernel(kaddr_t address, size_t *size, void *data, memflags flags,
                  size_t access) {
   uint64_t value;
-  bool ok = kernel_read(address, &value, sizeof(value));
+  // In batch mode the value may already have been read ahead of time.
+  bool ok = prefetch_read(address, &value, sizeof(value))
+      || kernel_read(address, &value, sizeof(value));
   if (!ok) {
     return -1;
   }
@@ -0,0 +1,603 @@
+#include "memCtlServer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "../memctl/memctl_signal.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL	0
+#endif
+
+// The size of a frame header.
+#define FRAME_HEADER_SIZE	12
+
+// The largest payload accepted or sent. Clients split larger reads.
+#define FRAME_MAX_PAYLOAD	(16 * 1024 * 1024)
+
+// The amount of data read from a connection at a time.
+#define RECEIVE_SIZE		0x10000
+
+// Pending responses are sent once they reach this size, even if more requests are buffered.
+#define SEND_THRESHOLD		0x100000
+
+// The size of the chunks read while searching memory.
+#define FIND_CHUNK_SIZE		0x4000
+
+// The longest symbol name accepted.
+#define SYMBOL_MAX		255
+
+/*
+ * struct buffer
+ *
+ * Description:
+ * 	A growable byte buffer.
+ */
+struct buffer {
+	uint8_t *data;
+	size_t size;
+	size_t capacity;
+};
+
+/*
+ * struct image
+ *
+ * Description:
+ * 	The context of an image backend.
+ */
+struct image {
+	int fd;
+	uint64_t base;
+	uint64_t size;
+};
+
+static uint32_t
+get_u32(const uint8_t *p) {
+	return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16
+		| (uint32_t) p[3] << 24;
+}
+
+static uint64_t
+get_u64(const uint8_t *p) {
+	return (uint64_t) get_u32(p) | (uint64_t) get_u32(p + 4) << 32;
+}
+
+static void
+put_u32(uint8_t *p, uint32_t value) {
+	for (size_t i = 0; i < sizeof(value); i++) {
+		p[i] = value >> (8 * i);
+	}
+}
+
+static void
+put_u64(uint8_t *p, uint64_t value) {
+	put_u32(p, value);
+	put_u32(p + 4, value >> 32);
+}
+
+/*
+ * buffer_reserve
+ *
+ * Description:
+ * 	Make room for at least size more bytes at the end of a buffer.
+ */
+static bool
+buffer_reserve(struct buffer *buffer, size_t size) {
+	if (buffer->capacity - buffer->size >= size) {
+		return true;
+	}
+	size_t capacity = (buffer->capacity == 0 ? RECEIVE_SIZE : buffer->capacity);
+	while (capacity - buffer->size < size) {
+		capacity *= 2;
+	}
+	uint8_t *data = realloc(buffer->data, capacity);
+	if (data == NULL) {
+		ERROR("server: could not allocate 0x%zx bytes", capacity);
+		return false;
+	}
+	buffer->data     = data;
+	buffer->capacity = capacity;
+	return true;
+}
+
+/*
+ * buffer_append_u64
+ *
+ * Description:
+ * 	Append a little-endian 64-bit integer to a buffer.
+ */
+static bool
+buffer_append_u64(struct buffer *buffer, uint64_t value) {
+	if (!buffer_reserve(buffer, sizeof(value))) {
+		return false;
+	}
+	put_u64(buffer->data + buffer->size, value);
+	buffer->size += sizeof(value);
+	return true;
+}
+
+/*
+ * buffer_append
+ *
+ * Description:
+ * 	Append raw bytes to a buffer.
+ */
+static bool
+buffer_append(struct buffer *buffer, const void *data, size_t size) {
+	if (!buffer_reserve(buffer, size)) {
+		return false;
+	}
+	memcpy(buffer->data + buffer->size, data, size);
+	buffer->size += size;
+	return true;
+}
+
+/*
+ * handle_read
+ *
+ * Description:
+ * 	Handle SERVER_OP_READ.
+ */
+static enum server_status
+handle_read(const struct server_backend *backend, const uint8_t *request, size_t length,
+		struct buffer *out) {
+	if (length != 12) {
+		return SERVER_BAD_REQUEST;
+	}
+	uint64_t address = get_u64(request);
+	uint32_t size    = get_u32(request + 8);
+	if (size > FRAME_MAX_PAYLOAD) {
+		return SERVER_BAD_REQUEST;
+	}
+	if (!buffer_reserve(out, size)) {
+		return SERVER_FAILED;
+	}
+	if (!backend->read(backend->context, address, out->data + out->size, size)) {
+		return SERVER_FAILED;
+	}
+	out->size += size;
+	return SERVER_OK;
+}
+
+/*
+ * handle_readv
+ *
+ * Description:
+ * 	Handle SERVER_OP_READV. Each range succeeds or fails on its own.
+ */
+static enum server_status
+handle_readv(const struct server_backend *backend, const uint8_t *request, size_t length,
+		struct buffer *out) {
+	if (length < 4) {
+		return SERVER_BAD_REQUEST;
+	}
+	uint32_t count = get_u32(request);
+	if ((length - 4) / 12 < count || length != 4 + 12 * (size_t) count) {
+		return SERVER_BAD_REQUEST;
+	}
+	// Check that the response will fit in a frame before reading anything.
+	uint64_t total = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		total += 8 + get_u32(request + 4 + 12 * i + 8);
+	}
+	if (total > FRAME_MAX_PAYLOAD) {
+		return SERVER_BAD_REQUEST;
+	}
+	if (!buffer_reserve(out, total)) {
+		return SERVER_FAILED;
+	}
+	for (uint32_t i = 0; i < count; i++) {
+		const uint8_t *range = request + 4 + 12 * i;
+		uint64_t address = get_u64(range);
+		uint32_t size    = get_u32(range + 8);
+		uint8_t *entry   = out->data + out->size;
+		bool ok = backend->read(backend->context, address, entry + 8, size);
+		put_u32(entry, (ok ? SERVER_OK : SERVER_FAILED));
+		put_u32(entry + 4, (ok ? size : 0));
+		out->size += 8 + (ok ? size : 0);
+	}
+	return SERVER_OK;
+}
+
+/*
+ * handle_write
+ *
+ * Description:
+ * 	Handle SERVER_OP_WRITE.
+ */
+static enum server_status
+handle_write(const struct server_backend *backend, const uint8_t *request, size_t length,
+		struct buffer *out) {
+	if (length < 8) {
+		return SERVER_BAD_REQUEST;
+	}
+	if (backend->write == NULL) {
+		return SERVER_UNSUPPORTED;
+	}
+	uint64_t address = get_u64(request);
+	bool ok = backend->write(backend->context, address, request + 8, length - 8);
+	return (ok ? SERVER_OK : SERVER_FAILED);
+}
+
+/*
+ * handle_find
+ *
+ * Description:
+ * 	Handle SERVER_OP_FIND. Memory is read in chunks through the backend, and chunks that
+ * 	cannot be read are skipped.
+ */
+static enum server_status
+handle_find(const struct server_backend *backend, const uint8_t *request, size_t length,
+		struct buffer *out) {
+	if (length != 32) {
+		return SERVER_BAD_REQUEST;
+	}
+	uint64_t start = get_u64(request);
+	uint64_t end   = get_u64(request + 8);
+	uint64_t value = get_u64(request + 16);
+	uint32_t width = get_u32(request + 24);
+	uint32_t limit = get_u32(request + 28);
+	if ((width != 1 && width != 2 && width != 4 && width != 8) || start % width != 0
+			|| end < start) {
+		return SERVER_BAD_REQUEST;
+	}
+	if (width < sizeof(value)) {
+		value &= ((uint64_t) 1 << (8 * width)) - 1;
+	}
+	if (limit == 0 || limit > FRAME_MAX_PAYLOAD / sizeof(uint64_t)) {
+		limit = FRAME_MAX_PAYLOAD / sizeof(uint64_t);
+	}
+	uint8_t chunk[FIND_CHUNK_SIZE];
+	uint32_t found = 0;
+	for (uint64_t address = start; end - address >= width && found < limit;) {
+		size_t size = (end - address < sizeof(chunk) ? end - address : sizeof(chunk));
+		size -= size % width;
+		if (interrupted) {
+			return SERVER_FAILED;
+		}
+		if (backend->read(backend->context, address, chunk, size)) {
+			for (size_t offset = 0; offset < size && found < limit; offset += width) {
+				uint64_t word = 0;
+				for (size_t i = 0; i < width; i++) {
+					word |= (uint64_t) chunk[offset + i] << (8 * i);
+				}
+				if (word == value) {
+					if (!buffer_append_u64(out, address + offset)) {
+						return SERVER_FAILED;
+					}
+					found++;
+				}
+			}
+		}
+		address += size;
+	}
+	return SERVER_OK;
+}
+
+/*
+ * handle_zone
+ *
+ * Description:
+ * 	Handle SERVER_OP_ZONE.
+ */
+static enum server_status
+handle_zone(const struct server_backend *backend, const uint8_t *request, size_t length,
+		struct buffer *out) {
+	if (length != 8) {
+		return SERVER_BAD_REQUEST;
+	}
+	if (backend->zone == NULL) {
+		return SERVER_UNSUPPORTED;
+	}
+	struct server_zone zone = {};
+	if (!backend->zone(backend->context, get_u64(request), &zone)) {
+		return SERVER_NOT_FOUND;
+	}
+	zone.name[sizeof(zone.name) - 1] = 0;
+	bool ok = buffer_append_u64(out, zone.zone)
+		&& buffer_append_u64(out, zone.metadata)
+		&& buffer_append_u64(out, zone.element_size)
+		&& buffer_append(out, zone.name, strlen(zone.name));
+	return (ok ? SERVER_OK : SERVER_FAILED);
+}
+
+/*
+ * handle_symbol
+ *
+ * Description:
+ * 	Handle SERVER_OP_SYMBOL.
+ */
+static enum server_status
+handle_symbol(const struct server_backend *backend, const uint8_t *request, size_t length,
+		struct buffer *out) {
+	if (length == 0 || length > SYMBOL_MAX || memchr(request, 0, length) != NULL) {
+		return SERVER_BAD_REQUEST;
+	}
+	if (backend->symbol == NULL) {
+		return SERVER_UNSUPPORTED;
+	}
+	char name[SYMBOL_MAX + 1];
+	memcpy(name, request, length);
+	name[length] = 0;
+	uint64_t address;
+	if (!backend->symbol(backend->context, name, &address)) {
+		return SERVER_NOT_FOUND;
+	}
+	return (buffer_append_u64(out, address) ? SERVER_OK : SERVER_FAILED);
+}
+
+/*
+ * handle_request
+ *
+ * Description:
+ * 	Handle one request frame and append the response frame to the output buffer.
+ */
+static bool
+handle_request(const struct server_backend *backend, const uint8_t *frame, struct buffer *out) {
+	uint32_t length = get_u32(frame);
+	uint32_t id     = get_u32(frame + 4);
+	uint8_t op      = frame[8];
+	const uint8_t *request = frame + FRAME_HEADER_SIZE;
+	// Write the header once the status and payload length are known.
+	if (!buffer_reserve(out, FRAME_HEADER_SIZE)) {
+		return false;
+	}
+	size_t header = out->size;
+	out->size += FRAME_HEADER_SIZE;
+	enum server_status status;
+	switch (op) {
+		case SERVER_OP_READ:
+			status = handle_read(backend, request, length, out);
+			break;
+		case SERVER_OP_READV:
+			status = handle_readv(backend, request, length, out);
+			break;
+		case SERVER_OP_WRITE:
+			status = handle_write(backend, request, length, out);
+			break;
+		case SERVER_OP_FIND:
+			status = handle_find(backend, request, length, out);
+			break;
+		case SERVER_OP_ZONE:
+			status = handle_zone(backend, request, length, out);
+			break;
+		case SERVER_OP_SYMBOL:
+			status = handle_symbol(backend, request, length, out);
+			break;
+		default:
+			status = SERVER_UNSUPPORTED;
+			break;
+	}
+	if (status != SERVER_OK) {
+		out->size = header + FRAME_HEADER_SIZE;
+	}
+	uint8_t *response = out->data + header;
+	put_u32(response, out->size - header - FRAME_HEADER_SIZE);
+	put_u32(response + 4, id);
+	response[8]  = op;
+	response[9]  = status;
+	response[10] = 0;
+	response[11] = 0;
+	return true;
+}
+
+/*
+ * send_all
+ *
+ * Description:
+ * 	Send the contents of a buffer and empty it.
+ */
+static bool
+send_all(int fd, struct buffer *buffer) {
+	size_t sent = 0;
+	while (sent < buffer->size) {
+		ssize_t n = send(fd, buffer->data + sent, buffer->size - sent, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR && !interrupted) {
+				continue;
+			}
+			return false;
+		}
+		sent += n;
+	}
+	buffer->size = 0;
+	return true;
+}
+
+/*
+ * serve_connection
+ *
+ * Description:
+ * 	Handle requests on a connection until it is closed. Every complete request that has been
+ * 	received is handled before the responses are sent, so pipelined requests are answered
+ * 	with few writes.
+ */
+static void
+serve_connection(int fd, const struct server_backend *backend) {
+	struct buffer in = {};
+	struct buffer out = {};
+	while (!interrupted) {
+		size_t offset = 0;
+		while (in.size - offset >= FRAME_HEADER_SIZE) {
+			uint32_t length = get_u32(in.data + offset);
+			if (length > FRAME_MAX_PAYLOAD) {
+				ERROR("server: request payload too large: %u bytes", length);
+				goto out;
+			}
+			if (in.size - offset - FRAME_HEADER_SIZE < length) {
+				break;
+			}
+			if (!handle_request(backend, in.data + offset, &out)) {
+				goto out;
+			}
+			offset += FRAME_HEADER_SIZE + length;
+			if (out.size >= SEND_THRESHOLD && !send_all(fd, &out)) {
+				goto out;
+			}
+		}
+		if (offset > 0) {
+			memmove(in.data, in.data + offset, in.size - offset);
+			in.size -= offset;
+		}
+		if (!send_all(fd, &out)) {
+			goto out;
+		}
+		if (!buffer_reserve(&in, RECEIVE_SIZE)) {
+			goto out;
+		}
+		ssize_t n = recv(fd, in.data + in.size, RECEIVE_SIZE, 0);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			break;
+		}
+		in.size += n;
+	}
+out:
+	free(in.data);
+	free(out.data);
+}
+
+/*
+ * listen_endpoint
+ *
+ * Description:
+ * 	Create a listening socket for an endpoint.
+ */
+static int
+listen_endpoint(const char *endpoint) {
+	int fd = -1;
+	struct sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (strlen(endpoint) >= sizeof(address.sun_path)) {
+		ERROR("server: socket path too long: %s", endpoint);
+		return -1;
+	}
+	strcpy(address.sun_path, endpoint);
+	// Replace a stale socket, but nothing else.
+	struct stat st;
+	if (lstat(endpoint, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		unlink(endpoint);
+	}
+	// Only the owner may connect. The umask covers the window between bind() and chmod().
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		goto fail;
+	}
+	mode_t mask = umask(0177);
+	int bound = bind(fd, (struct sockaddr *) &address, sizeof(address));
+	umask(mask);
+	if (bound != 0 || chmod(endpoint, 0600) != 0) {
+		goto fail;
+	}
+	if (listen(fd, 4) != 0) {
+		goto fail;
+	}
+	return fd;
+fail:
+	ERROR("server: could not listen on %s: %s", endpoint, strerror(errno));
+	if (fd >= 0) {
+		close(fd);
+	}
+	return -1;
+}
+
+bool
+server_run(const char *endpoint, const struct server_backend *backend) {
+	int fd = listen_endpoint(endpoint);
+	if (fd < 0) {
+		return false;
+	}
+	INFO("Serving on %s", endpoint);
+	interrupted = 0;
+	while (!interrupted) {
+		int connection = accept(fd, NULL, NULL);
+		if (connection < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			ERROR("server: accept failed: %s", strerror(errno));
+			break;
+		}
+#ifdef SO_NOSIGPIPE
+		int one = 1;
+		setsockopt(connection, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+		serve_connection(connection, backend);
+		close(connection);
+	}
+	close(fd);
+	unlink(endpoint);
+	return true;
+}
+
+static bool
+image_read(void *context, uint64_t address, void *data, size_t size) {
+	struct image *image = context;
+	if (address < image->base || address - image->base > image->size
+			|| size > image->size - (address - image->base)) {
+		return false;
+	}
+	return pread(image->fd, data, size, address - image->base) == (ssize_t) size;
+}
+
+static bool
+image_write(void *context, uint64_t address, const void *data, size_t size) {
+	struct image *image = context;
+	if (address < image->base || address - image->base > image->size
+			|| size > image->size - (address - image->base)) {
+		return false;
+	}
+	return pwrite(image->fd, data, size, address - image->base) == (ssize_t) size;
+}
+
+bool
+server_image_backend_init(struct server_backend *backend, const char *path, uint64_t base) {
+	bool writable = true;
+	int fd = open(path, O_RDWR);
+	if (fd < 0) {
+		writable = false;
+		fd = open(path, O_RDONLY);
+	}
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		ERROR("could not open %s: %s", path, strerror(errno));
+		goto fail;
+	}
+	struct image *image = malloc(sizeof(*image));
+	if (image == NULL) {
+		ERROR("could not allocate the image backend");
+		goto fail;
+	}
+	image->fd   = fd;
+	image->base = base;
+	image->size = st.st_size;
+	memset(backend, 0, sizeof(*backend));
+	backend->context = image;
+	backend->read    = image_read;
+	backend->write   = (writable ? image_write : NULL);
+	return true;
+fail:
+	if (fd >= 0) {
+		close(fd);
+	}
+	return false;
+}
+
+void
+server_image_backend_deinit(struct server_backend *backend) {
+	struct image *image = backend->context;
+	if (image != NULL) {
+		close(image->fd);
+		free(image);
+	}
+	memset(backend, 0, sizeof(*backend));
+}
@@ -0,0 +1,138 @@
+#ifndef MEMCTL_SERVER_H_
+#define MEMCTL_SERVER_H_
+/*
+ * A local RPC server for host-side tools.
+ *
+ * The server listens on a UNIX socket that only its owner may connect to, and speaks a compact
+ * binary protocol. Every message is a frame made of a 12-byte header and a
+ * payload. All integers are little-endian.
+ *
+ * 	uint32_t	length		The length of the payload.
+ * 	uint32_t	id		The request ID, echoed in the response.
+ * 	uint8_t		op		The operation, echoed in the response.
+ * 	uint8_t		status		0 in a request, the server_status in a response.
+ * 	uint16_t	reserved	0.
+ *
+ * Clients may send any number of requests without waiting for the responses. The requests
+ * on a connection are handled in order and answered in the same order.
+ *
+ * The payloads of each operation are:
+ *
+ * 	SERVER_OP_READ		request:  u64 address, u32 size
+ * 				response: the data, unencoded
+ * 	SERVER_OP_READV		request:  u32 count, then count times u64 address, u32 size
+ * 				response: count times u32 status, u32 size, the data
+ * 	SERVER_OP_WRITE		request:  u64 address, the data
+ * 				response: empty
+ * 	SERVER_OP_FIND		request:  u64 start, u64 end, u64 value, u32 width, u32 limit
+ * 				response: the u64 addresses of the width-aligned matches
+ * 	SERVER_OP_ZONE		request:  u64 address
+ * 				response: u64 zone, u64 metadata, u64 element size, the zone name
+ * 	SERVER_OP_SYMBOL	request:  the symbol name
+ * 				response: u64 address
+ *
+ * A response with a status other than SERVER_OK has an empty payload.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * enum server_op
+ *
+ * Description:
+ * 	The operations a request can ask for.
+ */
+enum server_op {
+	SERVER_OP_READ   = 1,
+	SERVER_OP_READV  = 2,
+	SERVER_OP_WRITE  = 3,
+	SERVER_OP_FIND   = 4,
+	SERVER_OP_ZONE   = 5,
+	SERVER_OP_SYMBOL = 6,
+};
+
+/*
+ * enum server_status
+ *
+ * Description:
+ * 	The status of a response.
+ */
+enum server_status {
+	SERVER_OK          = 0,
+	SERVER_BAD_REQUEST = 1,
+	SERVER_UNSUPPORTED = 2,
+	SERVER_FAILED      = 3,
+	SERVER_NOT_FOUND   = 4,
+};
+
+/*
+ * struct server_zone
+ *
+ * Description:
+ * 	The zone an address belongs to.
+ */
+struct server_zone {
+	uint64_t zone;
+	uint64_t metadata;
+	uint64_t element_size;
+	char name[64];
+};
+
+/*
+ * struct server_backend
+ *
+ * Description:
+ * 	The memory the server gives access to. Operations that the backend does not support are
+ * 	NULL.
+ */
+struct server_backend {
+	void *context;
+	bool (*read)(void *context, uint64_t address, void *data, size_t size);
+	bool (*write)(void *context, uint64_t address, const void *data, size_t size);
+	bool (*zone)(void *context, uint64_t address, struct server_zone *zone);
+	bool (*symbol)(void *context, const char *name, uint64_t *address);
+};
+
+/*
+ * server_image_backend_init
+ *
+ * Description:
+ * 	Create a backend that serves a file as a memory image, so that host tools can be
+ * 	developed and tested without a device. Zone and symbol queries are not supported.
+ *
+ * Parameters:
+ * 	out	backend			The backend to initialize.
+ * 		path			The image file. It is opened for writing if possible.
+ * 		base			The address at which the image starts.
+ *
+ * Returns:
+ * 	True if the image was opened.
+ */
+bool server_image_backend_init(struct server_backend *backend, const char *path, uint64_t base);
+
+/*
+ * server_image_backend_deinit
+ *
+ * Description:
+ * 	Close an image backend.
+ */
+void server_image_backend_deinit(struct server_backend *backend);
+
+/*
+ * server_run
+ *
+ * Description:
+ * 	Serve requests until interrupted. Connections are served one at a time.
+ *
+ * Parameters:
+ * 		endpoint		The path of the UNIX socket. It is created with mode 0600.
+ * 		backend			The memory to serve.
+ *
+ * Returns:
+ * 	True if the server was started.
+ */
+bool server_run(const char *endpoint, const struct server_backend *backend);
+
+#endif
@@ -0,0 +1,181 @@
+#include "memCtlStartup.h"
+
+#include <mach/mach.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "kernel_call.h"
+#include "kernel_memory.h"
+#include "kext_load.h"
+#include "ktrr_bypass.h"
+#include "log.h"
+#include "platform.h"
+
+/*
+ * struct startup_phase
+ *
+ * Description:
+ * 	An initialization step that provides one feature flag.
+ */
+struct startup_phase {
+	unsigned flag;
+	const char *name;
+	bool (*init)(void);
+};
+
+// Whether to print the duration of each phase.
+static bool startup_verbose;
+
+// The time at which startup began, in nanoseconds.
+static uint64_t startup_epoch;
+
+// The features that have been initialized. Phases run and update this with startup_lock held,
+// since the serve and prefetch threads reach startup_require() through safeacess().
+static unsigned loaded_features;
+static pthread_mutex_t startup_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// The thread loading the symbol database, and whether the database was loaded.
+static pthread_t symbols_thread;
+static bool symbols_thread_started;
+static bool symbols_loaded;
+
+static uint64_t
+now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * startup_trace
+ *
+ * Description:
+ * 	In verbose mode, print the time since startup and the duration of a phase that started
+ * 	at the given time.
+ */
+static void
+startup_trace(const char *phase, uint64_t start) {
+	if (!startup_verbose) {
+		return;
+	}
+	uint64_t end = now_ns();
+	fprintf(stderr, "[t] %10.3f ms  %-22s %10.3f ms\n", (end - startup_epoch) / 1e6, phase,
+			(end - start) / 1e6);
+}
+
+static void *
+load_symbols(void *arg) {
+	uint64_t start = now_ns();
+	symbols_loaded = kext_load_set_kernel_symbol_database("kernel_symbols");
+	startup_trace("symbol database load", start);
+	return NULL;
+}
+
+static bool
+init_symbols() {
+	// The first attempt waits for the background load. A retry loads the database again.
+	if (symbols_thread_started) {
+		pthread_join(symbols_thread, NULL);
+		symbols_thread_started = false;
+	} else if (!symbols_loaded) {
+		load_symbols(NULL);
+	}
+	if (!symbols_loaded) {
+		ERROR("Could not load kernel symbol database");
+	}
+	return symbols_loaded;
+}
+
+static bool
+init_kernel_task() {
+	kernel_task_port = MACH_PORT_NULL;
+	task_for_pid(mach_task_self(), 0, &kernel_task_port);
+	if (kernel_task_port == MACH_PORT_NULL) {
+		ERROR("Could not get kernel task port");
+		return false;
+	}
+	INFO("task_for_pid(0) = 0x%x", kernel_task_port);
+	return true;
+}
+
+static bool
+init_kernel_call() {
+	bool ok = kernel_call_init();
+	if (!ok) {
+		ERROR("Could not initialize kernel_call subsystem");
+	}
+	return ok;
+}
+
+static bool
+init_ktrr() {
+	bool ok = have_ktrr_bypass();
+	if (!ok) {
+		ERROR("No KTRR bypass is available for this platform");
+		return false;
+	}
+	ok = ktrr_bypass();
+	if (!ok) {
+		ERROR("NO KTRR bypass is available for this ktrr_bypass");
+	}
+	return ok;
+}
+
+// The phases initialized on demand, in dependency order. Each provides the flag of its feature
+// without the flags of the features it depends on.
+static const struct startup_phase phases[] = {
+	{
+		FEATURE_SYMBOLS & ~FEATURE_PLATFORM,
+		"symbol database", init_symbols,
+	}, {
+		FEATURE_KERNEL_TASK,
+		"kernel task port", init_kernel_task,
+	}, {
+		FEATURE_KERNEL_CALL & ~(FEATURE_KERNEL_TASK | FEATURE_PLATFORM),
+		"kernel call", init_kernel_call,
+	}, {
+		FEATURE_KTRR & ~FEATURE_KERNEL_CALL,
+		"KTRR parameters", init_ktrr,
+	},
+};
+
+void
+startup_begin(bool verbose) {
+	startup_verbose = verbose;
+	startup_epoch = now_ns();
+	platform_init();
+	loaded_features |= FEATURE_PLATFORM;
+	startup_trace("platform", startup_epoch);
+	// The symbol database only depends on the platform, so map and index it while the first
+	// command is read.
+	symbols_thread_started = (pthread_create(&symbols_thread, NULL, load_symbols, NULL) == 0);
+	if (!symbols_thread_started) {
+		load_symbols(NULL);
+	}
+}
+
+bool
+startup_require(startup_feature_t features) {
+	bool success = true;
+	pthread_mutex_lock(&startup_lock);
+	unsigned missing = features & ~loaded_features;
+	for (size_t i = 0; i < sizeof(phases) / sizeof(phases[0]) && missing != 0; i++) {
+		const struct startup_phase *phase = &phases[i];
+		if ((missing & phase->flag) == 0) {
+			continue;
+		}
+		// A phase that failed is tried again by the next command that needs it.
+		uint64_t start = now_ns();
+		bool ok = phase->init();
+		startup_trace(phase->name, start);
+		if (!ok) {
+			success = false;
+			break;
+		}
+		loaded_features |= phase->flag;
+		missing &= ~phase->flag;
+	}
+	pthread_mutex_unlock(&startup_lock);
+	return success;
+}
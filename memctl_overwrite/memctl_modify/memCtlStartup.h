@@ -0,0 +1,53 @@
+#ifndef MEMCTL_STARTUP_H_
+#define MEMCTL_STARTUP_H_
+/*
+ * Startup tracing and on-demand initialization.
+ *
+ * Only platform detection runs before the first prompt. At the same time, the kernel symbol
+ * database is mapped and indexed on a background thread. The kernel task port, the kernel call
+ * primitive and the KTRR bypass parameters are set up by the first command that needs them, so
+ * commands like "i" or "port" start immediately. In verbose mode each phase prints its
+ * duration as it completes.
+ */
+
+#include <stdbool.h>
+
+/*
+ * startup_feature_t
+ *
+ * Description:
+ * 	Flags for the parts of seokView that are initialized on demand. Each feature includes
+ * 	the features it depends on.
+ */
+typedef enum {
+	FEATURE_PLATFORM    = 0x01,
+	FEATURE_SYMBOLS     = 0x02 | FEATURE_PLATFORM,
+	FEATURE_KERNEL_TASK = 0x04,
+	FEATURE_KERNEL_CALL = 0x08 | FEATURE_KERNEL_TASK | FEATURE_PLATFORM,
+	FEATURE_KTRR        = 0x10 | FEATURE_KERNEL_CALL,
+} startup_feature_t;
+
+/*
+ * startup_begin
+ *
+ * Description:
+ * 	Detect the platform and start loading the symbol database in the background.
+ *
+ * Parameters:
+ * 		verbose			If true, print the time taken by each startup phase.
+ */
+void startup_begin(bool verbose);
+
+/*
+ * startup_require
+ *
+ * Description:
+ * 	Initialize the given features if they are not already initialized. A feature that failed
+ * 	to initialize is tried again. This function is thread-safe.
+ *
+ * Returns:
+ * 	True if all the features are available.
+ */
+bool startup_require(startup_feature_t features);
+
+#endif
@@ -0,0 +1,196 @@
+#include "memCtlStructCommand.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memCtlCommand.h"
+#include "memCtlStartup.h"
+#include "../memctl/memctl_signal.h"
+#include "../kernel/kernel_layouts.h"
+#include "../kernel/kernel_memory.h"
+#include "log.h"
+#include "platform.h"
+
+// The longest string read through a str field.
+#define PT_MAX_STRING	64
+
+static void
+pt_indent(unsigned indent) {
+	for (unsigned i = 0; i < indent; i++) {
+		printf("    ");
+	}
+}
+
+/*
+ * pt_print_chars
+ *
+ * Description:
+ * 	Print up to length characters as a quoted string, stopping at the first NUL.
+ */
+static void
+pt_print_chars(const uint8_t *chars, size_t length) {
+	printf("\"");
+	for (size_t i = 0; i < length && chars[i] != 0; i++) {
+		printf("%c", (isprint(chars[i]) ? chars[i] : '.'));
+	}
+	printf("\"");
+}
+
+/*
+ * pt_print_string
+ *
+ * Description:
+ * 	Print the string a str field points to. The read does not cross the end of the page.
+ */
+static void
+pt_print_string(uint64_t address) {
+	if (!is_kernel_pointer(address) || !safeacess(address)) {
+		return;
+	}
+	uint8_t string[PT_MAX_STRING];
+	size_t length = page_size - (address & (page_size - 1));
+	length = (length < sizeof(string) ? length : sizeof(string));
+	if (kernel_read(address, string, length)) {
+		printf(" ");
+		pt_print_chars(string, length);
+	}
+}
+
+/*
+ * pt_print_scalar
+ *
+ * Description:
+ * 	Print element index of an integer or pointer field.
+ */
+static void
+pt_print_scalar(const struct layout_field *field, const void *data, size_t index) {
+	uint64_t value = layout_field_value(field, data, index);
+	switch (field->kind) {
+		case LAYOUT_INT:
+			printf("%lld", (long long) value);
+			break;
+		case LAYOUT_UINT:
+			printf("0x%llx", (unsigned long long) value);
+			break;
+		default:
+			printf("0x%016llx", (unsigned long long) value);
+			break;
+	}
+}
+
+static void pt_print_struct(const struct kernel_layout *layout, const uint8_t *data,
+		unsigned indent, size_t depth);
+
+/*
+ * pt_follow
+ *
+ * Description:
+ * 	Read the struct a struct pointer points to in one transfer and print it.
+ */
+static void
+pt_follow(const struct kernel_layout *layout, uint64_t address, unsigned indent,
+		size_t depth) {
+	uint8_t *data = malloc(layout->size);
+	if (data == NULL) {
+		ERROR("Could not allocate struct %s", layout->name);
+		return;
+	}
+	if (safeacess_range(address, layout->size) && kernel_read(address, data, layout->size)) {
+		printf(" -> struct %s {\n", layout->name);
+		pt_print_struct(layout, data, indent + 1, depth);
+		pt_indent(indent);
+		printf("}");
+	}
+	free(data);
+}
+
+/*
+ * pt_print_struct
+ *
+ * Description:
+ * 	Print the fields of a struct that has already been read, following struct pointers up to
+ * 	depth levels.
+ */
+static void
+pt_print_struct(const struct kernel_layout *layout, const uint8_t *data, unsigned indent,
+		size_t depth) {
+	for (size_t i = 0; i < layout->field_count && !interrupted; i++) {
+		const struct layout_field *field = &layout->fields[i];
+		pt_indent(indent);
+		printf("+0x%03x %-20s ", field->offset, field->name);
+		if (field->kind == LAYOUT_CHARS) {
+			pt_print_chars(data + field->offset, field->count);
+		} else if (field->kind == LAYOUT_STRUCT) {
+			printf("struct %s%s {\n", field->type->name,
+					(field->count > 1 ? "[]" : ""));
+			for (size_t e = 0; e < field->count && !interrupted; e++) {
+				const uint8_t *element = data + field->offset + e * field->stride;
+				if (field->count > 1) {
+					pt_indent(indent + 1);
+					printf("[%zu] {\n", e);
+				}
+				pt_print_struct(field->type, element,
+						indent + 1 + (field->count > 1), depth);
+				if (field->count > 1) {
+					pt_indent(indent + 1);
+					printf("}\n");
+				}
+			}
+			pt_indent(indent);
+			printf("}");
+		} else if (field->count > 1) {
+			printf("{ ");
+			for (size_t e = 0; e < field->count; e++) {
+				printf("%s", (e > 0 ? ", " : ""));
+				pt_print_scalar(field, data, e);
+			}
+			printf(" }");
+		} else {
+			uint64_t value = layout_field_value(field, data, 0);
+			pt_print_scalar(field, data, 0);
+			if (field->kind == LAYOUT_STRING_PTR) {
+				pt_print_string(value);
+			} else if (field->kind == LAYOUT_STRUCT_PTR && depth > 0
+					&& is_kernel_pointer(value)) {
+				pt_follow(field->type, value, indent, depth - 1);
+			}
+		}
+		printf("\n");
+	}
+}
+
+bool
+pt_command(const char *type, uint64_t address, size_t count, size_t depth) {
+	if (!startup_require(FEATURE_KTRR)) {
+		return false;
+	}
+	const struct kernel_layout *layout = kernel_layout_find(type);
+	if (layout == NULL) {
+		ERROR("no layout for struct %s on %s %s", type, platform.machine,
+				platform.osversion);
+		return false;
+	}
+	if (layout->size == 0 || count > PT_MAX_BYTES / layout->size) {
+		ERROR("pt reads at most 0x%x bytes", PT_MAX_BYTES);
+		return false;
+	}
+	// The whole array is read in one transfer, once every page it covers has passed
+	// safeacess(), and decoded locally.
+	size_t size = count * layout->size;
+	uint8_t *data = malloc(size);
+	if (data == NULL) {
+		ERROR("Could not allocate 0x%zx bytes", size);
+		return false;
+	}
+	bool success = (safeacess_range(address, size) && kernel_read(address, data, size));
+	for (size_t i = 0; success && i < count && !interrupted; i++) {
+		printf("struct %s 0x%016llx {\n", layout->name,
+				(unsigned long long) (address + i * layout->size));
+		pt_print_struct(layout, data + i * layout->size, 1, depth);
+		printf("}\n");
+	}
+	free(data);
+	return success;
+}
@@ -0,0 +1,28 @@
+#ifndef MEMCTL_STRUCT_COMMAND_H_
+#define MEMCTL_STRUCT_COMMAND_H_
+/*
+ * Struct printing.
+ *
+ * Structs are decoded with the layouts in kernel_layouts.h. Each struct, or array of structs,
+ * is read in one transfer and its fields are decoded locally from the compiled field table.
+ * Struct pointers are followed to a given depth, one read per struct reached.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The largest number of bytes pt_command() reads at once, and the deepest it follows pointers.
+#define PT_MAX_BYTES	0x100000
+#define PT_MAX_DEPTH	4
+
+/*
+ * pt_command
+ *
+ * Description:
+ * 	Print count structs of the given type starting at address, following struct pointers up
+ * 	to depth levels.
+ */
+bool pt_command(const char *type, uint64_t address, size_t count, size_t depth);
+
+#endif
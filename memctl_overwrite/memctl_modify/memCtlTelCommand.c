@@ -0,0 +1,436 @@
+#include "memCtlTelCommand.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memCtlCommand.h"
+#include "memCtlStartup.h"
+#include "memCtlZoneCommand.h"
+#include "../memctl/memctl_signal.h"
+#include "../kernel/kernel_memory.h"
+#include "../kernel/kernel_slide.h"
+#include "../kext_load/resolve_symbol.h"
+#include "log.h"
+#include "platform.h"
+
+// The number of bytes read at each pointer: enough for the next pointer and a string preview.
+#define TEL_PREVIEW		32
+
+// Targets on the same page that are at most this far apart are read together.
+#define TEL_COALESCE_GAP	0x100
+
+// The largest offset from a symbol that is still shown as symbol+offset.
+#define TEL_SYMBOL_RANGE	0x1000
+
+// The shortest run of printable characters shown as a string.
+#define TEL_MIN_STRING		4
+
+/*
+ * struct tel_block
+ *
+ * Description:
+ * 	The data read at one address.
+ */
+struct tel_block {
+	kaddr_t address;
+	bool ok;
+	uint8_t size;
+	uint8_t data[TEL_PREVIEW];
+};
+
+/*
+ * struct tel_page
+ *
+ * Description:
+ * 	The result of the safety check of one page.
+ */
+struct tel_page {
+	kaddr_t page;
+	bool safe;
+};
+
+/*
+ * struct tel_zone
+ *
+ * Description:
+ * 	The name of a zone, by zone index.
+ */
+struct tel_zone {
+	uint16_t zindex;
+	char name[64];
+};
+
+/*
+ * struct tel_cache
+ *
+ * Description:
+ * 	Everything read by one tel command. Blocks and pages are kept sorted by address.
+ */
+struct tel_cache {
+	struct tel_block *blocks;
+	size_t block_count;
+	struct tel_page *pages;
+	size_t page_count;
+	struct tel_zone *zones;
+	size_t zone_count;
+	bool failed;
+};
+
+static int
+compare_kaddr(const void *a, const void *b) {
+	kaddr_t x = *(const kaddr_t *)a;
+	kaddr_t y = *(const kaddr_t *)b;
+	return (x < y ? -1 : x > y);
+}
+
+static int
+compare_blocks(const void *a, const void *b) {
+	const struct tel_block *x = a;
+	const struct tel_block *y = b;
+	return (x->address < y->address ? -1 : x->address > y->address);
+}
+
+/*
+ * tel_block_find
+ *
+ * Description:
+ * 	Find the block read at an address, or NULL if the address has not been read.
+ */
+static const struct tel_block *
+tel_block_find(const struct tel_cache *cache, kaddr_t address) {
+	size_t lo = 0;
+	size_t hi = cache->block_count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (cache->blocks[mid].address < address) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo < cache->block_count && cache->blocks[lo].address == address) {
+		return &cache->blocks[lo];
+	}
+	return NULL;
+}
+
+/*
+ * tel_page_safe
+ *
+ * Description:
+ * 	Check whether a page may be read, running safeacess() only the first time each page is
+ * 	seen by this command.
+ */
+static bool
+tel_page_safe(struct tel_cache *cache, kaddr_t page) {
+	size_t lo = 0;
+	size_t hi = cache->page_count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (cache->pages[mid].page < page) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo < cache->page_count && cache->pages[lo].page == page) {
+		return cache->pages[lo].safe;
+	}
+	struct tel_page *pages = realloc(cache->pages, (cache->page_count + 1) * sizeof(*pages));
+	if (pages == NULL) {
+		cache->failed = true;
+		return false;
+	}
+	cache->pages = pages;
+	memmove(&pages[lo + 1], &pages[lo], (cache->page_count - lo) * sizeof(*pages));
+	pages[lo].page = page;
+	pages[lo].safe = safeacess(page);
+	cache->page_count++;
+	return pages[lo].safe;
+}
+
+/*
+ * tel_fetch
+ *
+ * Description:
+ * 	Read TEL_PREVIEW bytes at each of the given addresses that is not already cached. The
+ * 	addresses are sorted, and those on the same page that are close together are read with a
+ * 	single kernel_read(). Reads never cross a page boundary.
+ */
+static bool
+tel_fetch(struct tel_cache *cache, kaddr_t *targets, size_t count) {
+	if (count == 0) {
+		return true;
+	}
+	qsort(targets, count, sizeof(*targets), compare_kaddr);
+	struct tel_block *blocks = realloc(cache->blocks,
+			(cache->block_count + count) * sizeof(*blocks));
+	if (blocks == NULL) {
+		cache->failed = true;
+		return false;
+	}
+	cache->blocks = blocks;
+	size_t old_count = cache->block_count;
+	size_t new_count = old_count;
+	uint8_t *buffer = malloc(page_size);
+	if (buffer == NULL) {
+		cache->failed = true;
+		return false;
+	}
+	for (size_t first = 0; first < count;) {
+		kaddr_t page = targets[first] & ~(page_size - 1);
+		kaddr_t page_end = page + page_size;
+		// Extend the run while the targets stay on this page and close together.
+		size_t last = first;
+		for (size_t next = first + 1; next < count; next++) {
+			if (targets[next] >= page_end
+					|| targets[next] > targets[last] + TEL_COALESCE_GAP) {
+				break;
+			}
+			last = next;
+		}
+		kaddr_t start = targets[first];
+		kaddr_t end = targets[last] + TEL_PREVIEW;
+		if (end > page_end) {
+			end = page_end;
+		}
+		bool safe = tel_page_safe(cache, page);
+		bool bulk = safe && kernel_read(start, buffer, end - start);
+		for (size_t i = first; i <= last; i++) {
+			kaddr_t address = targets[i];
+			if ((i > first && address == targets[i - 1])
+					|| tel_block_find(cache, address) != NULL) {
+				continue;
+			}
+			struct tel_block *block = &blocks[new_count++];
+			block->address = address;
+			block->size = (page_end - address < TEL_PREVIEW ? page_end - address
+					: TEL_PREVIEW);
+			if (bulk) {
+				memcpy(block->data, buffer + (address - start), block->size);
+				block->ok = true;
+			} else {
+				block->ok = safe && kernel_read(address, block->data, block->size);
+			}
+		}
+		first = last + 1;
+	}
+	free(buffer);
+	cache->block_count = new_count;
+	if (new_count != old_count) {
+		qsort(cache->blocks, new_count, sizeof(*cache->blocks), compare_blocks);
+	}
+	return true;
+}
+
+/*
+ * tel_zone_name
+ *
+ * Description:
+ * 	Get the name of the zone an address in the zone map belongs to. The page metadata must
+ * 	already have been fetched. Zones are read once per command.
+ */
+static const char *
+tel_zone_name(struct tel_cache *cache, kaddr_t address) {
+	kaddr_t metadata;
+	if (!zone_metadata_address(address, &metadata)) {
+		return NULL;
+	}
+	const struct tel_block *block = tel_block_find(cache, metadata);
+	if (block == NULL || !block->ok
+			|| block->size < ZONE_METADATA_ZINDEX + sizeof(uint16_t)) {
+		return NULL;
+	}
+	uint16_t zindex;
+	memcpy(&zindex, block->data + ZONE_METADATA_ZINDEX, sizeof(zindex));
+	for (size_t i = 0; i < cache->zone_count; i++) {
+		if (cache->zones[i].zindex == zindex) {
+			return (cache->zones[i].name[0] != 0 ? cache->zones[i].name : NULL);
+		}
+	}
+	struct tel_zone *zones = realloc(cache->zones, (cache->zone_count + 1) * sizeof(*zones));
+	if (zones == NULL) {
+		return NULL;
+	}
+	cache->zones = zones;
+	struct tel_zone *zone = &zones[cache->zone_count++];
+	struct zone_info info;
+	zone->zindex = zindex;
+	zone->name[0] = 0;
+	if (zone_lookup_index(zindex, &info)) {
+		snprintf(zone->name, sizeof(zone->name), "%s", info.name);
+	}
+	return (zone->name[0] != 0 ? zone->name : NULL);
+}
+
+/*
+ * tel_string
+ *
+ * Description:
+ * 	If the block holds a printable NUL-terminated string, or a printable run that fills the
+ * 	block, return its length.
+ */
+static size_t
+tel_string(const struct tel_block *block) {
+	size_t length = 0;
+	while (length < block->size && isprint(block->data[length])) {
+		length++;
+	}
+	if (length < TEL_MIN_STRING || (length < block->size && block->data[length] != 0)) {
+		return 0;
+	}
+	return length;
+}
+
+/*
+ * tel_print_pointer
+ *
+ * Description:
+ * 	Print a value and its symbol or zone annotation.
+ */
+static void
+tel_print_pointer(struct tel_cache *cache, uint64_t value) {
+	printf("0x%016llx", (unsigned long long) value);
+	if (!is_kernel_pointer(value)) {
+		return;
+	}
+	char name[128];
+	uint64_t offset;
+	if (value > kernel_slide && resolve_address(value - kernel_slide, name, sizeof(name),
+				&offset) && offset < TEL_SYMBOL_RANGE) {
+		printf(" <%s+0x%llx>", name, (unsigned long long) offset);
+		return;
+	}
+	const char *zone = tel_zone_name(cache, value);
+	if (zone != NULL) {
+		printf(" [%s]", zone);
+	}
+}
+
+bool
+tel_command(uint64_t address, size_t count, size_t depth) {
+	if (!startup_require(FEATURE_KTRR)) {
+		return false;
+	}
+	// Symbol annotations are optional, but the database must have finished loading.
+	startup_require(FEATURE_SYMBOLS);
+	struct tel_cache cache = {};
+	bool success = false;
+	// chains[i * (depth + 1) + level] is the value reached from word i after level
+	// dereferences.
+	uint64_t *chains = calloc(count * (depth + 1), sizeof(*chains));
+	bool *valid = calloc(count * (depth + 1), sizeof(*valid));
+	kaddr_t *targets = malloc(count * sizeof(*targets));
+	if (chains == NULL || valid == NULL || targets == NULL) {
+		ERROR("Could not allocate %zu chains", count);
+		goto fail;
+	}
+	// Only the words up to the first page that fails safeacess() are read. They are read in
+	// one piece, or one at a time up to the first that cannot be read.
+	uint64_t *words = targets;
+	size_t readable = 0;
+	for (; readable < count; readable++) {
+		kaddr_t word = address + readable * sizeof(*words);
+		if (!tel_page_safe(&cache, word & ~(page_size - 1))
+				|| !tel_page_safe(&cache,
+					(word + sizeof(*words) - 1) & ~(page_size - 1))) {
+			break;
+		}
+	}
+	if (cache.failed) {
+		goto fail;
+	}
+	bool bulk = (readable > 0 && kernel_read(address, words, readable * sizeof(*words)));
+	for (size_t i = 0; i < readable; i++) {
+		if (!bulk && !kernel_read(address + i * sizeof(*words), &words[i],
+					sizeof(*words))) {
+			break;
+		}
+		chains[i * (depth + 1)] = words[i];
+		valid[i * (depth + 1)] = true;
+	}
+	// Follow every chain one level at a time, fetching all the pointers of a level together.
+	for (size_t level = 1; level <= depth; level++) {
+		size_t target_count = 0;
+		for (size_t i = 0; i < count; i++) {
+			size_t from = i * (depth + 1) + level - 1;
+			if (valid[from] && is_kernel_pointer(chains[from])) {
+				targets[target_count++] = chains[from];
+			}
+		}
+		if (target_count == 0) {
+			break;
+		}
+		if (!tel_fetch(&cache, targets, target_count)) {
+			goto fail;
+		}
+		for (size_t i = 0; i < count; i++) {
+			size_t from = i * (depth + 1) + level - 1;
+			if (!valid[from] || !is_kernel_pointer(chains[from])) {
+				continue;
+			}
+			const struct tel_block *block = tel_block_find(&cache, chains[from]);
+			if (block != NULL && block->ok && block->size >= sizeof(uint64_t)
+					&& tel_string(block) == 0) {
+				memcpy(&chains[from + 1], block->data, sizeof(uint64_t));
+				valid[from + 1] = true;
+			}
+		}
+	}
+	// Fetch the page metadata of every pointer into the zone map, for the zone names.
+	size_t metadata_count = 0;
+	kaddr_t *metadata = malloc(count * (depth + 1) * sizeof(*metadata));
+	if (metadata == NULL) {
+		ERROR("Could not allocate %zu chains", count);
+		goto fail;
+	}
+	for (size_t i = 0; i < count * (depth + 1); i++) {
+		if (valid[i] && zone_metadata_address(chains[i], &metadata[metadata_count])) {
+			metadata_count++;
+		}
+	}
+	bool fetched = tel_fetch(&cache, metadata, metadata_count);
+	free(metadata);
+	if (!fetched) {
+		goto fail;
+	}
+	for (size_t i = 0; i < count && !interrupted; i++) {
+		const uint64_t *chain = &chains[i * (depth + 1)];
+		const bool *chain_valid = &valid[i * (depth + 1)];
+		size_t offset = i * sizeof(uint64_t);
+		if (!chain_valid[0]) {
+			ERROR("could not read address 0x%016llx",
+					(unsigned long long) (address + offset));
+			break;
+		}
+		printf("0x%016llx|+0x%04zx: ", (unsigned long long) (address + offset), offset);
+		for (size_t level = 0; level <= depth && chain_valid[level]; level++) {
+			if (level > 0) {
+				printf(" -> ");
+			}
+			tel_print_pointer(&cache, chain[level]);
+			// A pointer to a string ends the chain with the string.
+			const struct tel_block *block = NULL;
+			if (is_kernel_pointer(chain[level])) {
+				block = tel_block_find(&cache, chain[level]);
+			}
+			size_t length = (block != NULL && block->ok ? tel_string(block) : 0);
+			if (length > 0) {
+				printf(" -> \"%.*s\"", (int) length, (const char *) block->data);
+				break;
+			}
+		}
+		printf("\n");
+	}
+	success = !cache.failed;
+fail:
+	free(chains);
+	free(valid);
+	free(targets);
+	free(cache.blocks);
+	free(cache.pages);
+	free(cache.zones);
+	return success;
+}
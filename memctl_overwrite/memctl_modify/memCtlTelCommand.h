@@ -0,0 +1,30 @@
+#ifndef MEMCTL_TEL_COMMAND_H_
+#define MEMCTL_TEL_COMMAND_H_
+/*
+ * Pointer telescope.
+ *
+ * The words at an address are printed along with the chain of values reached by following
+ * each kernel pointer. The pointers at each level of the chains are fetched together: targets
+ * on the same page are coalesced into one read, and targets already read by this command are
+ * taken from a cache. Pages are checked with safeacess() once each, as the r command checks
+ * its address. Pointers are annotated with the symbol they point into, the zone they belong
+ * to, or the string they point to.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The largest number of words and levels tel_command() accepts.
+#define TEL_MAX_WORDS	0x1000
+#define TEL_MAX_DEPTH	8
+
+/*
+ * tel_command
+ *
+ * Description:
+ * 	Print count words starting at address and follow kernel pointers up to depth levels.
+ */
+bool tel_command(uint64_t address, size_t count, size_t depth);
+
+#endif
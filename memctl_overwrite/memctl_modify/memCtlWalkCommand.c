@@ -0,0 +1,272 @@
+#include "memCtlWalkCommand.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memCtlCommand.h"
+#include "memCtlStartup.h"
+#include "../memctl/memctl_signal.h"
+#include "../kernel/kernel_layouts.h"
+#include "../kernel/kernel_memory.h"
+#include "log.h"
+
+/*
+ * struct walk_visited
+ *
+ * Description:
+ * 	An open-addressing hash set of node addresses, where 0 is an empty bucket. The number of
+ * 	buckets is a power of 2 and is kept at least twice the number of nodes.
+ */
+struct walk_visited {
+	uint64_t *buckets;
+	size_t bucket_count;
+	size_t count;
+};
+
+static size_t
+walk_bucket(const struct walk_visited *visited, uint64_t node) {
+	return (((node >> 3) * 0x9e3779b97f4a7c15) >> 32) & (visited->bucket_count - 1);
+}
+
+/*
+ * walk_visit
+ *
+ * Description:
+ * 	Add a node to the visited set. There must be a free bucket.
+ *
+ * Returns:
+ * 	False if the node was already visited.
+ */
+static bool
+walk_visit(struct walk_visited *visited, uint64_t node) {
+	size_t mask = visited->bucket_count - 1;
+	for (size_t b = walk_bucket(visited, node);; b = (b + 1) & mask) {
+		if (visited->buckets[b] == node) {
+			return false;
+		}
+		if (visited->buckets[b] == 0) {
+			visited->buckets[b] = node;
+			visited->count++;
+			return true;
+		}
+	}
+}
+
+/*
+ * walk_visited_reserve
+ *
+ * Description:
+ * 	Grow the visited set if needed so that one more node can be added.
+ */
+static bool
+walk_visited_reserve(struct walk_visited *visited) {
+	if (2 * (visited->count + 1) <= visited->bucket_count) {
+		return true;
+	}
+	size_t bucket_count = (visited->bucket_count > 0 ? 2 * visited->bucket_count : 1024);
+	uint64_t *buckets = calloc(bucket_count, sizeof(*buckets));
+	if (buckets == NULL) {
+		ERROR("Could not allocate the visited set");
+		return false;
+	}
+	struct walk_visited grown = { buckets, bucket_count, 0 };
+	for (size_t i = 0; i < visited->bucket_count; i++) {
+		if (visited->buckets[i] != 0) {
+			walk_visit(&grown, visited->buckets[i]);
+		}
+	}
+	free(visited->buckets);
+	*visited = grown;
+	return true;
+}
+
+/*
+ * walk_parse_field
+ *
+ * Description:
+ * 	Parse a field as a field name of the layout or as an offset with an optional ":width".
+ * 	Offset fields of 8 bytes are shown as pointers.
+ */
+static bool
+walk_parse_field(const struct kernel_layout *layout, const char *name,
+		struct layout_field *field) {
+	const struct layout_field *named = NULL;
+	if (layout != NULL) {
+		named = kernel_layout_field(layout, name);
+	}
+	if (named != NULL) {
+		if (named->kind == LAYOUT_STRUCT) {
+			ERROR("walk cannot print inline struct field %s", name);
+			return false;
+		}
+		*field = *named;
+		return true;
+	}
+	char *end;
+	unsigned long long offset = strtoull(name, &end, 0);
+	unsigned long width = 8;
+	if (end != name && *end == ':') {
+		const char *width_start = end + 1;
+		width = strtoul(width_start, &end, 0);
+		end = (end == width_start ? (char *) name : end);
+	}
+	if (end == name || *end != 0 || offset > UINT32_MAX
+			|| (width != 1 && width != 2 && width != 4 && width != 8)) {
+		ERROR("unknown field %s", name);
+		return false;
+	}
+	memset(field, 0, sizeof(*field));
+	snprintf(field->name, sizeof(field->name), "%s", name);
+	field->offset = offset;
+	field->count  = 1;
+	field->stride = width;
+	field->width  = width;
+	field->kind   = (width == 8 ? LAYOUT_PTR : LAYOUT_UINT);
+	return true;
+}
+
+/*
+ * walk_print_field
+ *
+ * Description:
+ * 	Print one field of a node. Arrays are printed inline.
+ */
+static void
+walk_print_field(const struct layout_field *field, const uint8_t *data) {
+	printf("  %s=", field->name);
+	if (field->kind == LAYOUT_CHARS) {
+		printf("\"%.*s\"", (int) strnlen((const char *) data + field->offset, field->count),
+				(const char *) data + field->offset);
+		return;
+	}
+	for (size_t e = 0; e < field->count; e++) {
+		uint64_t value = layout_field_value(field, data, e);
+		printf("%s", (e == 0 ? (field->count > 1 ? "{" : "") : ","));
+		if (field->kind == LAYOUT_INT) {
+			printf("%lld", (long long) value);
+		} else if (field->kind == LAYOUT_UINT) {
+			printf("0x%llx", (unsigned long long) value);
+		} else {
+			printf("0x%016llx", (unsigned long long) value);
+		}
+	}
+	printf("%s", (field->count > 1 ? "}" : ""));
+}
+
+bool
+walk_command(uint64_t head, const char *next, size_t link, bool first, const char *type,
+		const char **fields, size_t budget) {
+	if (!startup_require(FEATURE_KTRR)) {
+		return false;
+	}
+	const struct kernel_layout *layout = NULL;
+	if (type != NULL) {
+		layout = kernel_layout_find(type);
+		if (layout == NULL) {
+			ERROR("no layout for struct %s", type);
+			return false;
+		}
+	}
+	// The next pointer is fields[0]; the fields to print follow it.
+	struct layout_field wanted[WALK_MAX_FIELDS + 1];
+	size_t wanted_count = 0;
+	if (!walk_parse_field(layout, next, &wanted[wanted_count++])) {
+		return false;
+	}
+	const struct layout_field *next_field = &wanted[0];
+	if (next_field->width != sizeof(uint64_t) || next_field->count != 1) {
+		ERROR("the next field %s is not a pointer", next);
+		return false;
+	}
+	for (; fields != NULL && *fields != NULL; fields++) {
+		if (wanted_count > WALK_MAX_FIELDS) {
+			ERROR("walk prints at most %d fields", WALK_MAX_FIELDS);
+			return false;
+		}
+		if (!walk_parse_field(layout, *fields, &wanted[wanted_count++])) {
+			return false;
+		}
+	}
+	// Each node is read in one transfer covering the next pointer and every wanted field.
+	size_t span_start = next_field->offset;
+	size_t span_end = next_field->offset + sizeof(uint64_t);
+	for (size_t i = 1; i < wanted_count; i++) {
+		size_t end = wanted[i].offset + (size_t) wanted[i].count * wanted[i].stride;
+		span_start = (wanted[i].offset < span_start ? wanted[i].offset : span_start);
+		span_end = (end > span_end ? end : span_end);
+	}
+	size_t span = span_end - span_start;
+	uint8_t *data = malloc(span_end);
+	if (data == NULL) {
+		ERROR("Could not allocate 0x%zx bytes", span_end);
+		return false;
+	}
+	// The walk ends when a next pointer leads back to the head, as in a circular queue.
+	uint64_t link_address = head + link;
+	uint64_t stop = link_address;
+	if (!first) {
+		stop = head;
+		if (!safeacess_range(head, sizeof(link_address))
+				|| !kernel_read(head, &link_address, sizeof(link_address))) {
+			ERROR("could not read the list head at 0x%016llx",
+					(unsigned long long) head);
+			free(data);
+			return false;
+		}
+	}
+	// The walk succeeds only if it reached the end of the list or the node budget.
+	struct walk_visited visited = {};
+	const char *reason = NULL;
+	bool success = false;
+	size_t count = 0;
+	for (bool at_head = first;; at_head = false) {
+		if (link_address == 0) {
+			reason = "end of list";
+			success = true;
+			break;
+		}
+		if (link_address == stop && !at_head) {
+			reason = "back at the head";
+			success = true;
+			break;
+		}
+		if (interrupted) {
+			reason = "interrupted";
+			break;
+		}
+		if (count >= budget) {
+			reason = "node budget reached";
+			success = true;
+			break;
+		}
+		if (!walk_visited_reserve(&visited)) {
+			reason = "out of memory";
+			break;
+		}
+		uint64_t node = link_address - link;
+		if (!walk_visit(&visited, node)) {
+			ERROR("%zu nodes, cycle back to 0x%016llx", count,
+					(unsigned long long) node);
+			goto out;
+		}
+		if (!safeacess_range(node + span_start, span)
+				|| !kernel_read(node + span_start, data + span_start, span)) {
+			ERROR("%zu nodes, node 0x%016llx is unreadable", count,
+					(unsigned long long) node);
+			goto out;
+		}
+		printf("%6zu  0x%016llx", count, (unsigned long long) node);
+		for (size_t i = 1; i < wanted_count; i++) {
+			walk_print_field(&wanted[i], data);
+		}
+		printf("\n");
+		count++;
+		link_address = layout_field_value(next_field, data, 0);
+	}
+	printf("%zu nodes, %s\n", count, reason);
+out:
+	free(visited.buckets);
+	free(data);
+	return success;
+}
@@ -0,0 +1,47 @@
+#ifndef MEMCTL_WALK_COMMAND_H_
+#define MEMCTL_WALK_COMMAND_H_
+/*
+ * Linked list walking.
+ *
+ * A list is walked by following the next pointer at a fixed offset in each node. The next
+ * pointer and the requested fields of a node are read together in one transfer covering all of
+ * them. Visited nodes are kept in a hash set, so a cycle that does not pass through the head
+ * ends the walk instead of looping until the node budget runs out.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The number of nodes walk_command() visits when no budget is given, and the most fields it
+// prints per node.
+#define WALK_DEFAULT_BUDGET	100000
+#define WALK_MAX_FIELDS		16
+
+/*
+ * walk_command
+ *
+ * Description:
+ * 	Walk a linked list and print the given fields of each node.
+ *
+ * Parameters:
+ * 		head			The address of the list head. If first is set, the
+ * 					address of the first node instead.
+ * 		next			The offset of the next pointer in a node, or a field
+ * 					name of type.
+ * 		link			The offset in a node that next pointers point to.
+ * 		first			Whether head is the first node.
+ * 		type			The struct layout of the nodes, or NULL.
+ * 		fields			A NULL-terminated list of fields to print. Each is a
+ * 					field name of type or an offset with an optional
+ * 					":width".
+ * 		budget			The most nodes to visit.
+ *
+ * Returns:
+ * 	True if the walk reached the end of the list, returned to the head, or visited budget
+ * 	nodes. False if it found a cycle, reached a node it could not read, or was interrupted.
+ */
+bool walk_command(uint64_t head, const char *next, size_t link, bool first, const char *type,
+		const char **fields, size_t budget);
+
+#endif
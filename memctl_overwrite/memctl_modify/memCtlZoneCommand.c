@@ -1,104 +1,89 @@
 #include "memCtlZoneCommand.h"
+
+#include <string.h>
+
 #include "memCtlCommand.h"
 #include "../ktrr/ktrr_bypass_parameters.h"
+#include "../kernel/kernel_layouts.h"
 #include "../kernel/kernel_memory.h"
 
-bool zone_space(kaddr_t address)
+bool
+zone_metadata_address(kaddr_t address, kaddr_t *metadata)
 {
-	// printf("zone_map_min_address => 0x%llx\n",zone_map_min_addr);
-	// printf("zone_map_max_address => 0x%llx\n",zone_map_max_addr);
-	// printf("zone_base => 0x%llx\n",ADDRESS(zone_base));
-	// printf("zone_metadata_region_min => 0x%llx\n",zone_metadata_region_min);
-	// printf("zone_metadata_region_max => 0x%llx\n",zone_metadata_region_max);
+	if (address < zone_map_min_addr || address >= zone_map_max_addr) {
+		return false;
+	}
+	uint64_t page_index = ((address & ~(page_size - 1)) - zone_map_min_addr) / page_size;
+	*metadata = zone_metadata_region_min + page_index * 24;
+	return true;
+}
 
-	if(address < zone_map_min_addr || address > zone_map_max_addr)
+bool
+zone_lookup_index(uint16_t zindex, struct zone_info *info)
+{
+	// The zone is read in one transfer and decoded with its layout.
+	const struct kernel_layout *layout = kernel_layout_find("zone");
+	const struct layout_field *elem_size = NULL, *zone_name = NULL;
+	if (layout != NULL) {
+		elem_size = kernel_layout_field(layout, "elem_size");
+		zone_name = kernel_layout_field(layout, "zone_name");
+	}
+	uint8_t zone[0x200];
+	if (elem_size == NULL || zone_name == NULL || layout->size > sizeof(zone)) {
+		return false;
+	}
+	info->zone = ADDRESS(zone_base) + zindex * layout->size;
+	if (!safeacess_range(info->zone, layout->size)
+			|| !kernel_read(info->zone, zone, layout->size)) {
+		return false;
+	}
+	info->element_size = layout_field_value(elem_size, zone, 0);
+	// The name is read in one transfer that does not cross the end of its page.
+	kaddr_t zonename = layout_field_value(zone_name, zone, 0);
+	size_t length = page_size - (zonename & (page_size - 1));
+	length = (length < sizeof(info->name) - 1 ? length : sizeof(info->name) - 1);
+	memset(info->name, 0, sizeof(info->name));
+	if (!safeacess(zonename) || !kernel_read(zonename, info->name, length)) {
+		memset(info->name, 0, sizeof(info->name));
+	}
+	return true;
+}
+
+/*
+ * zone_lookup
+ *
+ * Description:
+ * 	Find the zone an address in the zone map belongs to, through the page metadata.
+ */
+bool
+zone_lookup(kaddr_t address, struct zone_info *info)
+{
+	if (!zone_metadata_address(address, &info->metadata)) {
+		return false;
+	}
+	kaddr_t zindex = info->metadata + ZONE_METADATA_ZINDEX;
+	if (!safeacess(zindex)) {
+		return false;
+	}
+	return zone_lookup_index(kernel_read16(zindex), info);
+}
+
+bool zone_space(kaddr_t address)
+{
+	struct zone_info info;
+	if(address < zone_map_min_addr || address >= zone_map_max_addr)
 	{
 		printf("Not found address from zone\n");
 		return false;
 	}
-	if(address >= zone_map_min_addr && address < zone_map_max_addr)
+	if(!zone_lookup(address, &info))
 	{
-		uint64_t page_index = ((address & ~(page_size - 1)) - zone_map_min_addr) / page_size;
-		uint64_t page_meta = zone_metadata_region_min + page_index * 24;
-		//printf("[+] page_index => 0x%llx\n",page_index);
-		bool checkSafe = false;
-		if( page_meta != 0)
-		{
-			// zone index & findzone 
-			uint64_t value = 0;
-			uint64_t zindex = page_meta+0x14;
-			//printf("[-] zindex address => 0x%llx\n",zindex);
-			checkSafe = safeacess(zindex);
-			if(checkSafe){
-				zindex = kernel_read16(zindex);
-			}
-			else if(!checkSafe) {
-				printf("[+] zindex Error \n");
-			}
-			uint64_t findzone = ADDRESS(zone_base) + (zindex * 0x140);
-
-			// zone name
-			uint64_t zonename = findzone+0x120;
-			char zonenamearray[30];
-			char backupzone[2];
-			int cnt = 0;
-			checkSafe = safeacess(zonename);
-			//printf("[+] zonename address => 0x%llx\n",zonename);
-			
-			if(checkSafe){
-				bool ok = kernel_read(zonename, &value, sizeof(value));
-				if (!ok) {
-					return -1;
-				}
-			else if(!checkSafe) {
-				printf("[+] zonename Error \n");
-				}
-			}
-			zonename = value;
-			checkSafe = safeacess(zonename);
-			if(checkSafe){
-				while(true)
-				{
-					uint8_t printzonename = kernel_read8(zonename);
-					if(printzonename == 0x00)
-					{
-						goto jump;
-					}
-					if(printzonename != 0x00)
-					{
-						//printf("printzonename => %c\n",printzonename);
-						sprintf(backupzone,"%c",printzonename);
-						zonenamearray[cnt] = *backupzone;
-						zonename++;
-						cnt++;
-					}
-				}
-			}
-			else if(!checkSafe) {
-				printf("[+] zonename Error \n");
-			}
-
-			jump:
-			//printf("%s\n",zonenamearray);
-			printf("");
-			// zone element size
-			uint64_t elementsize = findzone+0xf0;
-			checkSafe = safeacess(elementsize);
-			if(checkSafe){
-				bool ok = kernel_read(elementsize, &value, sizeof(value));
-				if (!ok) {
-					return -1;
-				}
-			else if(!checkSafe) {
-				printf("[+] elementsize Error \n");
-				}
-			}
-			elementsize = value;
-			printf("[ zoneName ]=> %s\n", zonenamearray);
-			printf(" ->  Zone => 0x%llx\n", findzone);
-			printf(" ->  Zone_metaData => 0x%llx\n",page_meta);
-			printf(" ->  ElementSize => 0x%llx\n",elementsize);
-		}
+		printf("[+] zone Error \n");
+		return false;
 	}
+	printf("[ zoneName ]=> %s\n", info.name);
+	printf(" ->  Zone => 0x%llx\n", info.zone);
+	printf(" ->  Zone_metaData => 0x%llx\n", info.metadata);
+	printf(" ->  ElementSize => 0x%llx\n", info.element_size);
 	return true;
 }
@@ -3,5 +3,54 @@
 
 typedef uint64_t kaddr_t;
 
+/*
+ * struct zone_info
+ *
+ * Description:
+ * 	The zone an address belongs to.
+ */
+struct zone_info {
+	kaddr_t zone;
+	kaddr_t metadata;
+	uint64_t element_size;
+	char name[64];
+};
+
+// The offset of the zone index in the page metadata.
+#define ZONE_METADATA_ZINDEX	0x14
+
+/*
+ * zone_metadata_address
+ *
+ * Description:
+ * 	Get the address of the page metadata for an address in the zone map.
+ *
+ * Returns:
+ * 	False if the address is not in the zone map.
+ */
+bool zone_metadata_address(kaddr_t address, kaddr_t *metadata);
+
+/*
+ * zone_lookup_index
+ *
+ * Description:
+ * 	Read the zone with the given index. The metadata field of the zone_info is not set.
+ *
+ * Returns:
+ * 	True if the zone could be read.
+ */
+bool zone_lookup_index(uint16_t zindex, struct zone_info *info);
+
+/*
+ * zone_lookup
+ *
+ * Description:
+ * 	Find the zone an address belongs to without printing anything.
+ *
+ * Returns:
+ * 	True if the address is in the zone map and its zone could be read.
+ */
+bool zone_lookup(kaddr_t address, struct zone_info *info);
+
 bool zone_space(kaddr_t address);
 
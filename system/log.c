@@ -19,9 +19,98 @@
 
 #include "log.h"
 
-#include <assert.h>
-#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// The longest message kept, including the NUL terminator. Longer messages are truncated.
+#define LOG_MESSAGE_MAX		512
+
+// The number of messages the queue can hold. Must be a power of 2.
+#define LOG_QUEUE_SIZE		128
+
+// Consecutive messages with the same format beyond this many in one second are suppressed.
+#define LOG_BURST		8
+
+// How long the writer thread sleeps when the queue is empty, in milliseconds. Producers try to
+// wake it sooner.
+#define LOG_IDLE_MS		10
+
+/*
+ * struct log_record
+ *
+ * Description:
+ * 	A message in the log queue.
+ */
+struct log_record {
+	// The position of the record in the queue protocol: equal to the queue position when the
+	// slot is free, and one more than that when it holds a message.
+	_Atomic size_t sequence;
+	char type;
+	// The format string, used to recognize a run of similar messages.
+	const char *format;
+	char message[LOG_MESSAGE_MAX];
+};
+
+// The log queue. This is a bounded multi-producer queue: producers claim a position with a
+// compare-and-swap on log_head, and the single writer thread consumes from log_tail.
+static struct log_record log_queue[LOG_QUEUE_SIZE];
+static _Atomic size_t log_head;
+static size_t log_tail;
+
+// The number of messages the writer thread has finished with, for log_flush().
+static _Atomic size_t log_done;
+
+// The number of calls to log_flush(), and the number the writer thread has finished with.
+static _Atomic size_t log_flush_requested;
+static _Atomic size_t log_flush_served;
+
+// The counters reported by log_get_stats().
+static _Atomic uint64_t log_messages;
+static _Atomic uint64_t log_bytes;
+static _Atomic uint64_t log_dropped;
+static _Atomic uint64_t log_suppressed;
+
+// Starts the writer thread once.
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+
+// Whether the writer thread is running. If it could not be started, messages are written
+// directly.
+static bool log_async;
+
+// Wakes the writer thread, and wakes log_flush() when the writer thread is idle.
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_wakeup = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t log_idle = PTHREAD_COND_INITIALIZER;
+
+// Set while the writer thread is waiting for messages.
+static _Atomic bool log_sleeping;
+
+// The buffer each thread formats its messages into.
+static _Thread_local char log_buffer[LOG_MESSAGE_MAX];
+
+/*
+ * struct log_run
+ *
+ * Description:
+ * 	The writer thread's state for coalescing repeated messages and rate-limiting runs of
+ * 	messages with the same format.
+ */
+struct log_run {
+	char type;
+	const char *format;
+	char message[LOG_MESSAGE_MAX];
+	// When the run started, and how many of its messages were printed.
+	time_t start;
+	size_t printed;
+	// The number of exact repeats of the last printed message and of other messages
+	// suppressed since it was printed.
+	size_t repeated;
+	size_t suppressed;
+};
 
 void
 log_internal(char type, const char *format, ...) {
@@ -33,20 +122,270 @@ log_internal(char type, const char *format, ...) {
 	}
 }
 
-// The default logging implementation prints to stderr with a nice hacker prefix.
-static void
-log_stderr(char type, const char *format, va_list ap) {
-	char *message = NULL;
-	vasprintf(&message, format, ap);
-	assert(message != NULL);
+static char
+log_prefix(char type) {
 	switch (type) {
-		case 'D': type = 'D'; break;
-		case 'I': type = '+'; break;
-		case 'W': type = '!'; break;
-		case 'E': type = '-'; break;
+		case 'I': return '+';
+		case 'W': return '!';
+		case 'E': return '-';
+		default:  return type;
 	}
-	fprintf(stderr, "[%c] %s\n", type, message);
-	free(message);
 }
 
-void (*log_implementation)(char type, const char *format, va_list ap) = log_stderr;
+// Write a message to stderr with a nice hacker prefix.
+static void
+log_write(char type, const char *message) {
+	fprintf(stderr, "[%c] %s\n", log_prefix(type), message);
+}
+
+/*
+ * log_run_flush
+ *
+ * Description:
+ * 	Report the messages held back since the last message of a run was printed.
+ */
+static void
+log_run_flush(struct log_run *run) {
+	char summary[64];
+	if (run->repeated > 0) {
+		snprintf(summary, sizeof(summary), "last message repeated %zu times",
+				run->repeated);
+		log_write(run->type, summary);
+	}
+	if (run->suppressed > 0) {
+		snprintf(summary, sizeof(summary), "%zu similar messages suppressed",
+				run->suppressed);
+		log_write(run->type, summary);
+	}
+	run->repeated   = 0;
+	run->suppressed = 0;
+}
+
+/*
+ * log_report_dropped
+ *
+ * Description:
+ * 	Report the messages dropped because the queue was full since the last report.
+ */
+static void
+log_report_dropped() {
+	static uint64_t reported;
+	uint64_t dropped = atomic_load(&log_dropped);
+	if (dropped > reported) {
+		char summary[64];
+		snprintf(summary, sizeof(summary), "%llu log messages dropped",
+				(unsigned long long) (dropped - reported));
+		log_write('W', summary);
+		reported = dropped;
+	}
+}
+
+/*
+ * log_run_add
+ *
+ * Description:
+ * 	Print a message unless it repeats the previous message or its run has exceeded the rate
+ * 	limit.
+ */
+static void
+log_run_add(struct log_run *run, const struct log_record *record) {
+	time_t now = time(NULL);
+	if (record->format == run->format && record->type == run->type
+			&& now - run->start < 1) {
+		if (strcmp(record->message, run->message) == 0) {
+			run->repeated++;
+			atomic_fetch_add(&log_suppressed, 1);
+			return;
+		}
+		if (run->printed >= LOG_BURST) {
+			run->suppressed++;
+			atomic_fetch_add(&log_suppressed, 1);
+			return;
+		}
+	} else {
+		log_run_flush(run);
+		run->type    = record->type;
+		run->format  = record->format;
+		run->start   = now;
+		run->printed = 0;
+	}
+	// A different message in the same run: report the repeats of the previous one first.
+	log_run_flush(run);
+	log_write(record->type, record->message);
+	strcpy(run->message, record->message);
+	run->printed++;
+}
+
+/*
+ * log_writer
+ *
+ * Description:
+ * 	The writer thread. Messages are taken from the queue in order and printed to stderr.
+ */
+static void *
+log_writer(void *arg) {
+	static struct log_run run;
+	for (;;) {
+		struct log_record *record = &log_queue[log_tail % LOG_QUEUE_SIZE];
+		size_t sequence = atomic_load_explicit(&record->sequence, memory_order_acquire);
+		if (sequence == log_tail + 1) {
+			log_run_add(&run, record);
+			// Release the slot for the producer one lap ahead.
+			atomic_store_explicit(&record->sequence, log_tail + LOG_QUEUE_SIZE,
+					memory_order_release);
+			log_tail++;
+			continue;
+		}
+		// The queue is empty, or the next message is still being copied in. Report the
+		// messages held back from a run once the run is over or a flush is requested.
+		bool empty = (atomic_load(&log_head) == log_tail);
+		size_t requested = atomic_load(&log_flush_requested);
+		if (empty && (requested != atomic_load(&log_flush_served)
+					|| time(NULL) - run.start >= 1)) {
+			log_run_flush(&run);
+			log_report_dropped();
+		}
+		fflush(stderr);
+		pthread_mutex_lock(&log_lock);
+		atomic_store(&log_done, log_tail);
+		if (empty) {
+			atomic_store(&log_flush_served, requested);
+		}
+		pthread_cond_broadcast(&log_idle);
+		atomic_store(&log_sleeping, true);
+		if (atomic_load(&log_head) == log_tail) {
+			struct timespec deadline;
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_nsec += LOG_IDLE_MS * 1000000;
+			if (deadline.tv_nsec >= 1000000000) {
+				deadline.tv_sec  += 1;
+				deadline.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&log_wakeup, &log_lock, &deadline);
+		}
+		atomic_store(&log_sleeping, false);
+		pthread_mutex_unlock(&log_lock);
+	}
+	return NULL;
+}
+
+static void
+log_start() {
+	for (size_t i = 0; i < LOG_QUEUE_SIZE; i++) {
+		atomic_init(&log_queue[i].sequence, i);
+	}
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_t thread;
+	log_async = (pthread_create(&thread, &attr, log_writer, NULL) == 0);
+	pthread_attr_destroy(&attr);
+	if (log_async) {
+		atexit(log_flush);
+	}
+}
+
+/*
+ * log_enqueue
+ *
+ * Description:
+ * 	Copy a formatted message into the log queue without blocking.
+ *
+ * Returns:
+ * 	False if the queue is full.
+ */
+static bool
+log_enqueue(char type, const char *format, const char *message) {
+	size_t position = atomic_load_explicit(&log_head, memory_order_relaxed);
+	struct log_record *record;
+	for (;;) {
+		record = &log_queue[position % LOG_QUEUE_SIZE];
+		size_t sequence = atomic_load_explicit(&record->sequence, memory_order_acquire);
+		if (sequence == position) {
+			if (atomic_compare_exchange_weak_explicit(&log_head, &position,
+					position + 1, memory_order_relaxed,
+					memory_order_relaxed)) {
+				break;
+			}
+		} else if (sequence < position + 1) {
+			return false;
+		} else {
+			position = atomic_load_explicit(&log_head, memory_order_relaxed);
+		}
+	}
+	record->type   = type;
+	record->format = format;
+	strcpy(record->message, message);
+	atomic_store_explicit(&record->sequence, position + 1, memory_order_release);
+	if (atomic_load(&log_sleeping)) {
+		pthread_cond_signal(&log_wakeup);
+	}
+	return true;
+}
+
+/*
+ * log_wait_for_room
+ *
+ * Description:
+ * 	Wait until the writer thread has emptied the queue, or has gone idle. The writer wakes
+ * 	up at least every LOG_IDLE_MS, so the wait cannot be missed for long.
+ */
+static void
+log_wait_for_room() {
+	pthread_mutex_lock(&log_lock);
+	pthread_cond_signal(&log_wakeup);
+	pthread_cond_wait(&log_idle, &log_lock);
+	pthread_mutex_unlock(&log_lock);
+}
+
+// The default logging implementation formats the message into a per-thread buffer and queues
+// it for the writer thread, so logging never allocates or waits for stderr. The exception is an
+// error that finds the queue full: it waits for room rather than being dropped.
+static void
+log_queued(char type, const char *format, va_list ap) {
+	pthread_once(&log_once, log_start);
+	int length = vsnprintf(log_buffer, sizeof(log_buffer), format, ap);
+	if (length < 0) {
+		return;
+	}
+	if (length >= LOG_MESSAGE_MAX) {
+		strcpy(log_buffer + LOG_MESSAGE_MAX - 4, "...");
+		length = LOG_MESSAGE_MAX - 1;
+	}
+	atomic_fetch_add(&log_messages, 1);
+	atomic_fetch_add(&log_bytes, length);
+	if (!log_async) {
+		log_write(type, log_buffer);
+	} else if (type == 'E') {
+		while (!log_enqueue(type, format, log_buffer)) {
+			log_wait_for_room();
+		}
+	} else if (!log_enqueue(type, format, log_buffer)) {
+		atomic_fetch_add(&log_dropped, 1);
+	}
+}
+
+void
+log_flush() {
+	if (!log_async) {
+		return;
+	}
+	size_t target = atomic_load(&log_head);
+	size_t ticket = atomic_fetch_add(&log_flush_requested, 1) + 1;
+	pthread_mutex_lock(&log_lock);
+	while (atomic_load(&log_done) < target || atomic_load(&log_flush_served) < ticket) {
+		pthread_cond_signal(&log_wakeup);
+		pthread_cond_wait(&log_idle, &log_lock);
+	}
+	pthread_mutex_unlock(&log_lock);
+}
+
+void
+log_get_stats(struct log_stats *stats) {
+	stats->messages   = atomic_load(&log_messages);
+	stats->bytes      = atomic_load(&log_bytes);
+	stats->dropped    = atomic_load(&log_dropped);
+	stats->suppressed = atomic_load(&log_suppressed);
+}
+
+void (*log_implementation)(char type, const char *format, va_list ap) = log_queued;
@@ -21,6 +21,7 @@
 #define LOG__H_
 
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 
 /*
@@ -28,8 +29,9 @@
  *
  * Description:
  * 	This is the log handler that will be executed when code wants to log a message. The default
- * 	implementation logs the message to stderr. Setting this value to NULL will disable all
- * 	logging. Specify a custom log handler to process log messages in another way.
+ * 	implementation queues the message to be written to stderr by a background thread.
+ * 	Setting this value to NULL will disable all logging. Specify a custom log handler to
+ * 	process log messages in another way.
  *
  * Parameters:
  * 	type				A character representing the type of message that is being
@@ -50,9 +52,32 @@
  */
 extern void (*log_implementation)(char type, const char *format, va_list ap);
 
-#define DEBUG_LEVEL(level)	(DEBUG && level <= DEBUG)
+/*
+ * LOG_LEVEL
+ *
+ * Description:
+ * 	The lowest level of message that is compiled in. Messages below this level compile to
+ * 	nothing, although their arguments are still type-checked. Set the LOG_LEVEL build variable
+ * 	to override the default, which keeps every message but DEBUG ones, or every message when
+ * 	DEBUG is set. INFO must stay compiled in by default: commands such as "i" print their
+ * 	output with it.
+ */
+#define LOG_LEVEL_DEBUG		0
+#define LOG_LEVEL_INFO		1
+#define LOG_LEVEL_WARNING	2
+#define LOG_LEVEL_ERROR		3
 
+#ifndef LOG_LEVEL
 #if DEBUG
+#define LOG_LEVEL	LOG_LEVEL_DEBUG
+#else
+#define LOG_LEVEL	LOG_LEVEL_INFO
+#endif
+#endif
+
+#define DEBUG_LEVEL(level)	(DEBUG && level <= DEBUG)
+
+#if DEBUG && LOG_LEVEL <= LOG_LEVEL_DEBUG
 #define DEBUG_TRACE(level, fmt, ...)						\
 	do {									\
 		if (DEBUG_LEVEL(level)) {					\
@@ -62,11 +87,59 @@ extern void (*log_implementation)(char type, const char *format, va_list ap);
 #else
 #define DEBUG_TRACE(level, fmt, ...)	do {} while (0)
 #endif
-#define INFO(fmt, ...)		log_internal('I', fmt, ##__VA_ARGS__)
-#define WARNING(fmt, ...)	log_internal('W', fmt, ##__VA_ARGS__)
-#define ERROR(fmt, ...)		log_internal('E', fmt, ##__VA_ARGS__)
+
+#define LOG_AT_LEVEL_(level, type, fmt, ...)					\
+	do {									\
+		if (LOG_LEVEL <= (level)) {					\
+			log_internal(type, fmt, ##__VA_ARGS__);			\
+		}								\
+	} while (0)
+
+#define INFO(fmt, ...)		LOG_AT_LEVEL_(LOG_LEVEL_INFO, 'I', fmt, ##__VA_ARGS__)
+#define WARNING(fmt, ...)	LOG_AT_LEVEL_(LOG_LEVEL_WARNING, 'W', fmt, ##__VA_ARGS__)
+#define ERROR(fmt, ...)		LOG_AT_LEVEL_(LOG_LEVEL_ERROR, 'E', fmt, ##__VA_ARGS__)
 
 // A function to call the logging implementation.
 void log_internal(char type, const char *format, ...) __printflike(2, 3);
 
+/*
+ * struct log_stats
+ *
+ * Description:
+ * 	Counters kept by the default logging implementation.
+ */
+struct log_stats {
+	// The number of messages logged and the number of bytes of message text.
+	uint64_t messages;
+	uint64_t bytes;
+	// The number of messages dropped because the log queue was full. Errors are never
+	// dropped: they wait for room in the queue instead.
+	uint64_t dropped;
+	// The number of messages not printed because they repeated the previous message or
+	// exceeded the rate limit.
+	uint64_t suppressed;
+};
+
+/*
+ * log_get_stats
+ *
+ * Description:
+ * 	Get the counters of the default logging implementation.
+ */
+void log_get_stats(struct log_stats *stats);
+
+/*
+ * log_flush
+ *
+ * Description:
+ * 	Wait until every message logged so far has been written to stderr.
+ *
+ * Notes:
+ * 	The default logging implementation formats each message on the calling thread and hands
+ * 	it to a background thread through a lock-free queue, so messages can lag behind output
+ * 	written directly to stdout. Call log_flush() before writing output that must appear after
+ * 	the messages, for example before printing the next prompt.
+ */
+void log_flush(void);
+
 #endif
@@ -0,0 +1,232 @@
+/*
+ * bench_aarch64_decode
+ *
+ * Description:
+ * 	Count the instructions per second that the simulator can decode, through aarch64_decode()
+ * 	and through the chain of aarch64_decode_* calls that aarch64_sim_step() used to make:
+ *
+ * 		bench_aarch64_decode [code]
+ *
+ * 	code is a raw dump of little-endian instructions, such as the __TEXT_EXEC segment of a
+ * 	kernelcache. Without it, a synthetic stream with a kernel-like mix of instructions is
+ * 	used. Both decoders must agree on every instruction. Build it with "make -C tools bench".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "arm64/decode.h"
+
+// The number of instructions in the synthetic stream.
+#define SYNTHETIC_INSTRUCTIONS	(4 << 20)
+
+// The number of timed passes over the code.
+#define BENCH_RUNS		5
+
+// The address of the first instruction.
+#define CODE_ADDRESS		0xfffffff007004000
+
+static double
+now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * decode_chain
+ *
+ * Description:
+ * 	Decode an instruction the way aarch64_sim_step() did before aarch64_decode(): try each
+ * 	decoder in turn until one accepts it.
+ */
+static bool
+decode_chain(uint32_t ins, uint64_t pc, struct aarch64_decoded *d) {
+	enum aarch64_decoded_kind kind;
+	if (aarch64_decode_adc(ins, &d->adc)) {
+		kind = AARCH64_DECODED_ADC;
+	} else if (aarch64_decode_add_xr(ins, &d->add_xr)) {
+		kind = AARCH64_DECODED_ADD_XR;
+	} else if (aarch64_decode_add_im(ins, &d->add_im)) {
+		kind = AARCH64_DECODED_ADD_IM;
+	} else if (aarch64_decode_add_sr(ins, &d->add_sr)) {
+		kind = AARCH64_DECODED_ADD_SR;
+	} else if (aarch64_decode_adr(ins, pc, &d->adr)) {
+		kind = AARCH64_DECODED_ADR;
+	} else if (aarch64_decode_and_im(ins, &d->and_im)) {
+		kind = AARCH64_DECODED_AND_IM;
+	} else if (aarch64_decode_and_sr(ins, &d->and_sr)) {
+		kind = AARCH64_DECODED_AND_SR;
+	} else if (aarch64_decode_b(ins, pc, &d->b)) {
+		kind = AARCH64_DECODED_B;
+	} else if (aarch64_decode_br(ins, &d->br)) {
+		kind = AARCH64_DECODED_BR;
+	} else if (aarch64_decode_cbz(ins, pc, &d->cbz)) {
+		kind = AARCH64_DECODED_CBZ;
+	} else if (aarch64_decode_ldp(ins, &d->ldp)) {
+		kind = AARCH64_DECODED_LDP;
+	} else if (aarch64_decode_ldr_ix(ins, &d->ldr_im)) {
+		kind = AARCH64_DECODED_LDR_IX;
+	} else if (aarch64_decode_ldr_ui(ins, &d->ldr_im)) {
+		kind = AARCH64_DECODED_LDR_UI;
+	} else if (aarch64_decode_ldr_lit(ins, pc, &d->ldr_lit)) {
+		kind = AARCH64_DECODED_LDR_LIT;
+	} else if (aarch64_decode_ldr_r(ins, &d->ldr_r)) {
+		kind = AARCH64_DECODED_LDR_R;
+	} else if (aarch64_decode_mov(ins, &d->mov)) {
+		kind = AARCH64_DECODED_MOV;
+	} else if (aarch64_decode_nop(ins)) {
+		kind = AARCH64_DECODED_NOP;
+	} else {
+		kind = AARCH64_DECODED_UNKNOWN;
+	}
+	d->kind = kind;
+	return (kind != AARCH64_DECODED_UNKNOWN);
+}
+
+/*
+ * synthetic_instruction
+ *
+ * Description:
+ * 	A random instruction. About a third are instructions the simulator does not decode, such
+ * 	as conditional branches, bitfield moves and system register accesses, as in kernel code.
+ */
+static uint32_t
+synthetic_instruction() {
+	uint32_t rd = rand() % 31, rn = rand() % 31, rm = rand() % 31;
+	unsigned r = rand() % 100;
+	if (r < 10) {
+		return 0x91000000 | ((rand() % 4096) << 10) | (rn << 5) | rd;		// ADD
+	} else if (r < 15) {
+		return 0xd1000000 | ((rand() % 4096) << 10) | (rn << 5) | rd;		// SUB
+	} else if (r < 20) {
+		return 0xd2800000 | ((rand() % 4) << 21) | ((rand() & 0xffff) << 5) | rd; // MOVZ
+	} else if (r < 28) {
+		return 0xf9400000 | ((rand() % 512) << 10) | (rn << 5) | rd;		// LDR
+	} else if (r < 33) {
+		return 0xf9000000 | ((rand() % 512) << 10) | (rn << 5) | rd;		// STR
+	} else if (r < 37) {
+		return 0xa9400000 | ((rand() % 128) << 15) | (rm << 10) | (rn << 5) | rd; // LDP
+	} else if (r < 43) {
+		return 0xa9000000 | ((rand() % 128) << 15) | (rm << 10) | (rn << 5) | rd; // STP
+	} else if (r < 47) {
+		return 0x90000000 | ((rand() % 4) << 29) | ((rand() % 0x7ffff) << 5) | rd; // ADRP
+	} else if (r < 51) {
+		return 0xaa0003e0 | (rm << 16) | rd;					// MOV
+	} else if (r < 53) {
+		return 0x92400000 | ((rand() % 4096) << 10) | (rn << 5) | rd;		// AND
+	} else if (r < 57) {
+		return 0xb4000000 | ((rand() % 2) << 24) | ((rand() % 0x7ffff) << 5) | rd; // CBZ
+	} else if (r < 64) {
+		return 0x14000000 | ((rand() % 2) << 31) | (rand() % 0x3ffffff);	// B, BL
+	} else if (r < 66) {
+		return 0xd65f03c0;							// RET
+	} else if (r < 67) {
+		return 0xd503201f;							// NOP
+	} else if (r < 74) {
+		return 0x54000000 | ((rand() % 0x7ffff) << 5) | (rand() % 14);	// B.cond
+	} else if (r < 77) {
+		return 0x36000000 | ((rand() % 64) << 19) | ((rand() % 0x4000) << 5) | rd; // TBZ
+	} else if (r < 81) {
+		return 0x9a800000 | (rm << 16) | ((rand() % 14) << 12) | (rn << 5) | rd; // CSEL
+	} else if (r < 86) {
+		return 0xd3400000 | ((rand() % 4096) << 10) | (rn << 5) | rd;		// UBFM
+	} else if (r < 89) {
+		return 0x9b007c00 | (rm << 16) | (rn << 5) | rd;			// MUL
+	} else if (r < 92) {
+		return 0xd5380000 | ((rand() % 0x8000) << 5) | rd;			// MRS
+	}
+	return rand() ^ (rand() << 16);
+}
+
+/*
+ * load_code
+ *
+ * Description:
+ * 	Read the instructions in a file. Returns NULL if there are none.
+ */
+static uint32_t *
+load_code(const char *path, size_t *count) {
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		return NULL;
+	}
+	uint32_t *code = NULL;
+	if (fseek(file, 0, SEEK_END) == 0) {
+		long size = ftell(file);
+		rewind(file);
+		*count = (size > 0 ? size / sizeof(*code) : 0);
+		code = (*count > 0 ? malloc(*count * sizeof(*code)) : NULL);
+		if (code != NULL && fread(code, sizeof(*code), *count, file) != *count) {
+			free(code);
+			code = NULL;
+		}
+	}
+	fclose(file);
+	return code;
+}
+
+int
+main(int argc, const char *argv[]) {
+	size_t count = SYNTHETIC_INSTRUCTIONS;
+	uint32_t *code;
+	if (argc > 1) {
+		code = load_code(argv[1], &count);
+		if (code == NULL) {
+			fprintf(stderr, "could not read %s\n", argv[1]);
+			return 1;
+		}
+	} else {
+		srand(1);
+		code = malloc(count * sizeof(*code));
+		if (code == NULL) {
+			fprintf(stderr, "out of memory\n");
+			return 1;
+		}
+		for (size_t i = 0; i < count; i++) {
+			code[i] = synthetic_instruction();
+		}
+	}
+	// Both decoders must agree before they are timed.
+	size_t recognized = 0, mismatches = 0;
+	for (size_t i = 0; i < count; i++) {
+		struct aarch64_decoded table, chain;
+		memset(&table, 0, sizeof(table));
+		memset(&chain, 0, sizeof(chain));
+		uint64_t pc = CODE_ADDRESS + i * sizeof(*code);
+		bool found = aarch64_decode(code[i], pc, &table);
+		if (found != decode_chain(code[i], pc, &chain)
+				|| (found && memcmp(&table, &chain, sizeof(table)) != 0)) {
+			mismatches++;
+		}
+		recognized += found;
+	}
+	printf("%zu instructions, %zu recognized, %zu mismatches\n", count, recognized,
+			mismatches);
+	const char *names[] = { "decode chain", "aarch64_decode" };
+	for (int which = 0; which < 2; which++) {
+		double best = 1e9;
+		size_t checksum = 0;
+		for (int run = 0; run < BENCH_RUNS; run++) {
+			double start = now();
+			for (size_t i = 0; i < count; i++) {
+				struct aarch64_decoded decoded;
+				uint64_t pc = CODE_ADDRESS + i * sizeof(*code);
+				if (which == 0) {
+					decode_chain(code[i], pc, &decoded);
+				} else {
+					aarch64_decode(code[i], pc, &decoded);
+				}
+				checksum += decoded.kind;
+			}
+			double elapsed = now() - start;
+			best = (elapsed < best ? elapsed : best);
+		}
+		printf("%-16s %8.1f M instructions/s  (checksum %zx)\n", names[which],
+				count / best / 1e6, checksum);
+	}
+	free(code);
+	return (mismatches == 0 ? 0 : 1);
+}
@@ -0,0 +1,424 @@
+/*
+ * bench_fingerprint
+ *
+ * Description:
+ * 	Time the fingerprinting, matching and porting steps of the "port" command on two builds:
+ *
+ * 		bench_fingerprint [functions]
+ * 		bench_fingerprint <reference-kernelcache> <new-kernelcache>
+ *
+ * 	The kernelcaches must be decompressed 64-bit Mach-Os. The function and xref indexes of a
+ * 	kernelcache with an LC_UUID are saved to CACHE_FILE_DIR, so remove them there to time a
+ * 	cold run.
+ *
+ * 	Without kernelcaches, two synthetic builds are generated. The second one drops, adds and
+ * 	changes a few percent of the functions, and moves the rest and the strings they refer to,
+ * 	so each match and ported address can be checked against the true one. Build it with
+ * 	"make -C tools bench".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "arm64/fingerprint.h"
+#include "memctl/memctl_error.h"
+
+// The number of functions in the synthetic builds when no count is given. They take about 20 MB,
+// as much code as the __TEXT_EXEC segment of a recent iOS kernelcache holds.
+#define DEFAULT_FUNCTIONS	150000
+
+// The address of the synthetic builds and the size of their header.
+#define BASE_ADDRESS		0xfffffff007004000
+#define HEADER_SIZE		0x4000
+#define PAGE_SIZE_16K		0x4000
+
+// The percentage of the functions that are only in the new build, only in the reference
+// build, and changed in the new build.
+#define ADDED_PERCENT		2
+#define REMOVED_PERCENT		2
+#define CHANGED_PERCENT		5
+
+// Instructions used to build functions.
+#define INS_PROLOGUE		0xa9bf7bfd	// STP X29, X30, [SP, #-0x10]!
+#define INS_EPILOGUE		0xa8c17bfd	// LDP X29, X30, [SP], #0x10
+#define INS_RET			0xd65f03c0
+
+void
+macho_error(const char *format, ...) {
+}
+
+void
+error_out_of_memory() {
+	fprintf(stderr, "out of memory\n");
+}
+
+/*
+ * struct build
+ *
+ * Description:
+ * 	A Mach-O, and for a synthetic build, where each function and string was placed.
+ */
+struct build {
+	struct macho macho;
+	// The address of each synthetic function, or 0 if it is not in this build.
+	kaddr_t *function_address;
+	// The address of each synthetic string.
+	kaddr_t *string_address;
+};
+
+static double
+now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// A small generator, so that a function's body depends only on its seed.
+static uint32_t
+next_random(uint64_t *state) {
+	*state = *state * 6364136223846793005ull + 1442695040888963407ull;
+	return *state >> 33;
+}
+
+// What happens to a synthetic function in the new build.
+enum fate { SAME, ADDED, REMOVED, CHANGED };
+
+static enum fate
+function_fate(size_t id) {
+	uint64_t state = id;
+	unsigned r = next_random(&state) % 100;
+	if (r < ADDED_PERCENT) {
+		return ADDED;
+	} else if (r < ADDED_PERCENT + REMOVED_PERCENT) {
+		return REMOVED;
+	} else if (r < ADDED_PERCENT + REMOVED_PERCENT + CHANGED_PERCENT) {
+		return CHANGED;
+	}
+	return SAME;
+}
+
+// The seed of a function's body in a build.
+static uint64_t
+function_seed(size_t id, bool new_build) {
+	uint64_t seed = id * 2 + 1;
+	return (new_build && function_fate(id) == CHANGED ? ~seed : seed);
+}
+
+// The number of instructions in a function's body, not counting the prologue and epilogue.
+static size_t
+function_body_size(uint64_t seed) {
+	return 6 + next_random(&seed) % 48;
+}
+
+static uint32_t
+adrp(kaddr_t pc, kaddr_t target, unsigned rd) {
+	int64_t pages = (int64_t) ((target & ~0xfffull) - (pc & ~0xfffull)) >> 12;
+	return 0x90000000 | ((pages & 3) << 29) | (((pages >> 2) & 0x7ffff) << 5) | rd;
+}
+
+/*
+ * emit_function
+ *
+ * Description:
+ * 	Write the instructions of a function. Calls and string references are resolved with the
+ * 	addresses in the build; a call to a function that is not in the build calls the function
+ * 	itself.
+ */
+static void
+emit_function(uint32_t *code, kaddr_t pc, uint64_t seed, const struct build *build,
+		size_t function_count, size_t string_count) {
+	size_t size = function_body_size(seed);
+	next_random(&seed);
+	kaddr_t start = pc;
+	uint32_t *ins = code;
+	*ins++ = INS_PROLOGUE;
+	for (size_t i = 0; i < size; i++) {
+		unsigned r = next_random(&seed) % 100;
+		unsigned rd = next_random(&seed) % 19;
+		unsigned rn = next_random(&seed) % 19;
+		unsigned imm = next_random(&seed) % 4096;
+		kaddr_t here = pc + (ins - code) * sizeof(*ins);
+		if (r < 8) {
+			size_t callee = next_random(&seed) % function_count;
+			kaddr_t target = build->function_address[callee];
+			target = (target == 0 ? start : target);
+			*ins++ = 0x94000000 | (((target - here) >> 2) & 0x3ffffff);	// BL
+		} else if (r < 12 && i + 1 < size) {
+			size_t string = next_random(&seed) % string_count;
+			kaddr_t target = build->string_address[string];
+			*ins++ = adrp(here, target, rd);
+			*ins++ = 0x91000000 | ((target & 0xfff) << 10) | (rd << 5) | rd; // ADD
+			i++;
+		} else if (r < 18) {
+			// B.cond forward, at most to the epilogue.
+			uint32_t offset = 1 + imm % (size - i);
+			*ins++ = 0x54000000 | ((offset & 0x7ffff) << 5) | (rn % 14);
+		} else if (r < 40) {
+			*ins++ = 0xf9400000 | ((imm % 512) << 10) | (rn << 5) | rd;	// LDR
+		} else if (r < 52) {
+			*ins++ = 0xf9000000 | ((imm % 512) << 10) | (rn << 5) | rd;	// STR
+		} else if (r < 68) {
+			*ins++ = 0x91000000 | (imm << 10) | (rn << 5) | rd;		// ADD
+		} else if (r < 80) {
+			*ins++ = 0xaa0003e0 | (rn << 16) | rd;				// MOV
+		} else if (r < 88) {
+			*ins++ = 0xeb00001f | (rd << 16) | (rn << 5);			// CMP
+		} else {
+			*ins++ = 0xd3400000 | (imm << 10) | (rn << 5) | rd;		// UBFM
+		}
+	}
+	*ins++ = INS_EPILOGUE;
+	*ins++ = INS_RET;
+}
+
+/*
+ * build_synthetic
+ *
+ * Description:
+ * 	Generate a synthetic build: a __TEXT segment with the header and the strings, and a
+ * 	__TEXT_EXEC segment with the functions.
+ */
+static bool
+build_synthetic(struct build *build, size_t function_count, bool new_build) {
+	size_t string_count = function_count / 4 + 1;
+	build->function_address = calloc(function_count, sizeof(kaddr_t));
+	build->string_address = calloc(string_count, sizeof(kaddr_t));
+	if (build->function_address == NULL || build->string_address == NULL) {
+		return false;
+	}
+	// Lay out the strings. The new build has a string of its own before every 16th one.
+	size_t strings_size = 0;
+	for (size_t i = 0; i < string_count; i++) {
+		if (new_build && i % 16 == 0) {
+			strings_size += 24;
+		}
+		build->string_address[i] = BASE_ADDRESS + HEADER_SIZE + strings_size;
+		strings_size += 40;
+	}
+	size_t text_size = (HEADER_SIZE + strings_size + PAGE_SIZE_16K - 1) & -PAGE_SIZE_16K;
+	// Lay out the functions.
+	kaddr_t exec_address = BASE_ADDRESS + text_size;
+	size_t code_size = 0;
+	for (size_t id = 0; id < function_count; id++) {
+		enum fate fate = function_fate(id);
+		if (fate == (new_build ? REMOVED : ADDED)) {
+			continue;
+		}
+		build->function_address[id] = exec_address + code_size;
+		size_t size = function_body_size(function_seed(id, new_build)) + 3;
+		code_size += size * sizeof(uint32_t);
+	}
+	size_t exec_size = (code_size + PAGE_SIZE_16K - 1) & -PAGE_SIZE_16K;
+	uint8_t *data = calloc(1, text_size + exec_size);
+	if (data == NULL) {
+		return false;
+	}
+	struct mach_header_64 *mh = (void *) data;
+	struct segment_command_64 *text = (void *) (mh + 1);
+	struct segment_command_64 *exec = text + 1;
+	mh->magic = MH_MAGIC_64;
+	mh->ncmds = 2;
+	mh->sizeofcmds = 2 * sizeof(*text);
+	text->cmd = exec->cmd = LC_SEGMENT_64;
+	text->cmdsize = exec->cmdsize = sizeof(*text);
+	strcpy(text->segname, "__TEXT");
+	text->vmaddr = BASE_ADDRESS;
+	text->vmsize = text->filesize = text_size;
+	text->initprot = text->maxprot = VM_PROT_READ;
+	strcpy(exec->segname, "__TEXT_EXEC");
+	exec->vmaddr = exec_address;
+	exec->vmsize = exec->filesize = exec_size;
+	exec->fileoff = text_size;
+	exec->initprot = exec->maxprot = VM_PROT_READ | VM_PROT_EXECUTE;
+	for (size_t i = 0; i < string_count; i++) {
+		char *string = (char *) data + (build->string_address[i] - BASE_ADDRESS);
+		snprintf(string, 40, "synthetic string %u: %08x", (unsigned) i,
+				(uint32_t) (i * 2654435761u));
+		if (new_build && i % 16 == 0) {
+			snprintf(string - 24, 24, "new string %u", (unsigned) i);
+		}
+	}
+	for (size_t id = 0; id < function_count; id++) {
+		kaddr_t address = build->function_address[id];
+		if (address != 0) {
+			emit_function((uint32_t *) (data + text_size + (address - exec_address)),
+					address, function_seed(id, new_build), build,
+					function_count, string_count);
+		}
+	}
+	build->macho.mh = data;
+	build->macho.size = text_size + exec_size;
+	return true;
+}
+
+/*
+ * load_build
+ *
+ * Description:
+ * 	Read a decompressed kernelcache.
+ */
+static bool
+load_build(struct build *build, const char *path) {
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		fprintf(stderr, "could not open %s\n", path);
+		return false;
+	}
+	void *data = NULL;
+	long size = -1;
+	if (fseek(file, 0, SEEK_END) == 0 && (size = ftell(file)) > 0) {
+		rewind(file);
+		data = malloc(size);
+		if (data != NULL && fread(data, size, 1, file) != 1) {
+			free(data);
+			data = NULL;
+		}
+	}
+	fclose(file);
+	if (data == NULL || (size_t) size < sizeof(struct mach_header_64)
+			|| ((struct mach_header_64 *) data)->magic != MH_MAGIC_64) {
+		fprintf(stderr, "%s is not a decompressed 64-bit Mach-O\n", path);
+		free(data);
+		return false;
+	}
+	build->macho.mh = data;
+	build->macho.size = size;
+	return true;
+}
+
+static void
+build_deinit(struct build *build) {
+	free(build->macho.mh);
+	free(build->function_address);
+	free(build->string_address);
+}
+
+/*
+ * check_synthetic
+ *
+ * Description:
+ * 	Check the matches and the ported string addresses against where each synthetic function
+ * 	and string was placed. A changed function should match its new version, and a removed
+ * 	function nothing. The wrong matches and ports are also broken down by match key.
+ */
+static void
+check_synthetic(const struct build builds[2], size_t count,
+		const struct aarch64_fingerprints *from, const struct aarch64_fingerprints *to,
+		const uint32_t *match, const uint8_t *keys) {
+	size_t right = 0, missed = 0, wrong = 0;
+	size_t key_right[AARCH64_MATCH_KEY_COUNT][2] = {};
+	size_t key_wrong[AARCH64_MATCH_KEY_COUNT][2] = {};
+	for (size_t id = 0; id < count; id++) {
+		kaddr_t address = builds[0].function_address[id];
+		if (address == 0) {
+			continue;
+		}
+		const struct aarch64_function *function =
+			aarch64_function_containing(&from->functions, address);
+		uint32_t m = AARCH64_NO_MATCH;
+		if (function != NULL && function->start == address - from->functions.base) {
+			m = match[function - from->functions.functions];
+		}
+		kaddr_t actual = 0;
+		if (m != AARCH64_NO_MATCH) {
+			actual = to->functions.base + to->functions.functions[m].start;
+		}
+		if (actual == 0) {
+			missed += (builds[1].function_address[id] != 0);
+			right  += (builds[1].function_address[id] == 0);
+			continue;
+		}
+		uint8_t key = keys[function - from->functions.functions];
+		if (actual == builds[1].function_address[id]) {
+			right++;
+			key_right[key][0]++;
+		} else {
+			wrong++;
+			key_wrong[key][0]++;
+		}
+	}
+	printf("reference functions: %zu right, %zu unmatched, %zu matched wrongly\n", right,
+			missed, wrong);
+	size_t strings_right = 0, strings_wrong = 0;
+	for (size_t i = 0; i < count / 4 + 1; i++) {
+		kaddr_t address;
+		enum aarch64_match_key key;
+		if (aarch64_fingerprints_port(from, to, match, keys, builds[0].string_address[i],
+					&address, &key)) {
+			if (address == builds[1].string_address[i]) {
+				strings_right++;
+				key_right[key][1]++;
+			} else {
+				strings_wrong++;
+				key_wrong[key][1]++;
+			}
+		}
+	}
+	printf("strings: %zu ported, %zu ported wrongly\n", strings_right, strings_wrong);
+	for (unsigned key = 0; key < AARCH64_MATCH_KEY_COUNT; key++) {
+		printf("  %-14s functions %6zu right %4zu wrong, strings %6zu right %4zu wrong\n",
+				aarch64_match_key_name(key), key_right[key][0], key_wrong[key][0],
+				key_right[key][1], key_wrong[key][1]);
+	}
+}
+
+int
+main(int argc, const char *argv[]) {
+	struct build builds[2] = {};
+	size_t count = 0;
+	bool synthetic = (argc < 3);
+	if (synthetic) {
+		count = (argc > 1 ? strtoul(argv[1], NULL, 0) : DEFAULT_FUNCTIONS);
+		if (count == 0 || !build_synthetic(&builds[0], count, false)
+				|| !build_synthetic(&builds[1], count, true)) {
+			fprintf(stderr, "could not build %zu synthetic functions\n", count);
+			return 1;
+		}
+	} else if (!load_build(&builds[0], argv[1]) || !load_build(&builds[1], argv[2])) {
+		return 1;
+	}
+	printf("size: %.1f MB and %.1f MB\n", builds[0].macho.size / 1e6,
+			builds[1].macho.size / 1e6);
+	struct aarch64_fingerprints from, to;
+	double start = now();
+	if (!aarch64_fingerprints_init_pair(&from, &builds[0].macho, &to, &builds[1].macho)) {
+		fprintf(stderr, "fingerprinting failed\n");
+		return 1;
+	}
+	double fingerprint_end = now();
+	uint32_t *match;
+	uint8_t *keys;
+	size_t matched;
+	if (!aarch64_fingerprints_match(&from, &to, &match, &keys, &matched)) {
+		fprintf(stderr, "matching failed\n");
+		return 1;
+	}
+	double match_end = now();
+	size_t ported = 0;
+	for (size_t i = 0; i < from.functions.function_count; i++) {
+		kaddr_t address;
+		ported += aarch64_fingerprints_port(&from, &to, match, keys,
+				from.functions.base + from.functions.functions[i].start, &address,
+				NULL);
+	}
+	double port_end = now();
+	printf("functions: %zu and %zu\n", from.functions.function_count,
+			to.functions.function_count);
+	printf("%-16s %8.3f s\n", "fingerprint", fingerprint_end - start);
+	printf("%-16s %8.3f s  (%zu matched)\n", "match", match_end - fingerprint_end, matched);
+	printf("%-16s %8.3f s  (%zu function starts ported)\n", "port",
+			port_end - match_end, ported);
+	printf("%-16s %8.3f s\n", "total", port_end - start);
+	if (synthetic) {
+		check_synthetic(builds, count, &from, &to, match, keys);
+	}
+	free(match);
+	free(keys);
+	aarch64_fingerprints_deinit(&from);
+	aarch64_fingerprints_deinit(&to);
+	build_deinit(&builds[0]);
+	build_deinit(&builds[1]);
+	return 0;
+}
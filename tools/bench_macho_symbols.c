@@ -0,0 +1,145 @@
+/*
+ * bench_macho_symbols
+ *
+ * Description:
+ * 	Time macho_resolve_symbol(), macho_resolve_address() and macho_guess_symbol_size() on a
+ * 	synthetic kernel-sized symbol table:
+ *
+ * 		bench_macho_symbols [symbols]
+ *
+ * 	Each lookup is repeated for at least BENCH_SECONDS and the mean time per call is printed,
+ * 	so the linear scans of older macho.c builds can be timed with the same program. Build it
+ * 	with "make -C tools bench"; it needs the mach-o headers of the macOS SDK.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "memctl/macho.h"
+
+// The number of symbols when no count is given, about as many as an iOS kernelcache has.
+#define DEFAULT_SYMBOLS		60000
+
+// How long each lookup is repeated.
+#define BENCH_SECONDS		0.5
+
+// The address of the one section, and its size.
+#define TEXT_ADDRESS		0xfffffff007004000
+#define TEXT_SIZE		0x2000000
+
+void
+macho_error(const char *format, ...) {
+}
+
+static double
+now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * build_symtab
+ *
+ * Description:
+ * 	Build a Mach-O with one __TEXT section and a symtab of count symbols. Names repeat, as
+ * 	they do across kexts, and a tenth of the symbols are undefined or absolute.
+ */
+static const struct symtab_command *
+build_symtab(struct macho *macho, size_t count) {
+	size_t size = 4096 + count * (sizeof(struct nlist_64) + 16);
+	uint8_t *data = calloc(1, size);
+	if (data == NULL) {
+		return NULL;
+	}
+	struct mach_header_64 *mh = (void *) data;
+	struct segment_command_64 *segment = (void *) (mh + 1);
+	struct section_64 *section = (void *) (segment + 1);
+	struct symtab_command *symtab = (void *) (section + 1);
+	mh->magic = MH_MAGIC_64;
+	mh->ncmds = 2;
+	segment->cmd = LC_SEGMENT_64;
+	segment->cmdsize = sizeof(*segment) + sizeof(*section);
+	strcpy(segment->segname, "__TEXT");
+	segment->vmaddr = TEXT_ADDRESS;
+	segment->vmsize = TEXT_SIZE;
+	segment->nsects = 1;
+	section->addr = TEXT_ADDRESS;
+	section->size = TEXT_SIZE;
+	symtab->cmd = LC_SYMTAB;
+	symtab->cmdsize = sizeof(*symtab);
+	mh->sizeofcmds = segment->cmdsize + symtab->cmdsize;
+	symtab->symoff = 4096;
+	symtab->nsyms = count;
+	symtab->stroff = 4096 + count * sizeof(struct nlist_64);
+	struct nlist_64 *nlist = (void *) (data + symtab->symoff);
+	char *strings = (char *) data + symtab->stroff;
+	uint32_t strx = 4;
+	for (size_t i = 0; i < count; i++) {
+		nlist[i].n_un.n_strx = strx;
+		strx += sprintf(strings + strx, "_sym%zu", (size_t) rand() % (count / 2 + 1)) + 1;
+		unsigned kind = rand() % 10;
+		nlist[i].n_type = (kind == 0 ? N_UNDF : kind == 1 ? N_ABS : N_SECT);
+		nlist[i].n_sect = 1;
+		nlist[i].n_value = (kind == 0 ? 0 : TEXT_ADDRESS + (rand() % (TEXT_SIZE / 4)) * 4);
+	}
+	symtab->strsize = strx;
+	macho->mh = (void *) data;
+	macho->size = size;
+	return symtab;
+}
+
+int
+main(int argc, const char *argv[]) {
+	size_t count = (argc > 1 ? strtoul(argv[1], NULL, 0) : DEFAULT_SYMBOLS);
+	srand(1);
+	struct macho macho = {};
+	const struct symtab_command *symtab = build_symtab(&macho, count);
+	if (symtab == NULL || count < 2) {
+		fprintf(stderr, "could not build a symtab of %zu symbols\n", count);
+		return 1;
+	}
+	printf("%zu symbols\n", count);
+	// Build the index, if there is one.
+	double start = now();
+	macho_symbol_index_init(&macho, symtab);
+	printf("%-24s %12.1f us\n", "index build", (now() - start) * 1e6);
+	uint64_t address;
+	size_t size;
+	const char *names[] = { "macho_resolve_symbol", "macho_resolve_address",
+		"macho_guess_symbol_size" };
+	for (int which = 0; which < 3; which++) {
+		size_t calls = 0;
+		uint64_t checksum = 0;
+		start = now();
+		double elapsed;
+		do {
+			for (int batch = 0; batch < 64; batch++, calls++) {
+				char name[32];
+				snprintf(name, sizeof(name), "_sym%zu", calls % (count / 2 + 8));
+				uint64_t query = TEXT_ADDRESS + (calls * 2654435761u) % TEXT_SIZE;
+				const char *found;
+				size_t offset;
+				if (which == 0) {
+					macho_resolve_symbol(&macho, symtab, name, &address, &size);
+					checksum += address + size;
+				} else if (which == 1) {
+					macho_resolve_address(&macho, symtab, query, &found, &size,
+							&offset);
+					checksum += size + offset;
+				} else {
+					checksum += macho_guess_symbol_size(&macho, symtab, query);
+				}
+			}
+			elapsed = now() - start;
+		} while (elapsed < BENCH_SECONDS);
+		printf("%-24s %12.1f ns/call  (%zu calls, checksum %llx)\n", names[which],
+				elapsed * 1e9 / calls, calls, (unsigned long long) checksum);
+	}
+	macho_symbol_index_deinit(&macho);
+	free((void *) macho.mh);
+	return 0;
+}
@@ -0,0 +1,309 @@
+/*
+ * lzss_test
+ *
+ * Description:
+ * 	Check decompress_lzss() and the lzss_stream reader against the original ring buffer
+ * 	decompressor on random inputs, or time the three:
+ *
+ * 		lzss_test [iterations] [seed]
+ * 		lzss_test -b [lzss-file]
+ *
+ * 	Every input is decompressed in one piece, into a buffer that is too short, and through a
+ * 	stream read in chunks of random sizes, and each output must match the reference byte for
+ * 	byte. "make -C tools test" runs the check.
+ *
+ * 	With -b, the decompressors are timed on a raw LZSS stream, such as the payload of a
+ * 	compressed kernelcache, or on synthetic streams when no file is given. The synthetic
+ * 	streams are random token streams and say nothing about the speed on real kernelcaches.
+ * 	"make -C tools bench" runs the synthetic timings.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lzss.h"
+
+// The number of random inputs checked when no count is given.
+#define DEFAULT_ITERATIONS	200000
+
+// The largest random input checked.
+#define CHECK_INPUT_SIZE	65536
+
+// The size of the input used for timing, and the number of timed runs.
+#define BENCH_INPUT_SIZE	(8 << 20)
+#define BENCH_RUNS		5
+
+/*
+ * reference_decompress_lzss
+ *
+ * Description:
+ * 	The decompressor that external/lzss.c used before it copied matches out of the output.
+ * 	The only change is that the whole initial window is filled with spaces: the original left
+ * 	the last 18 bytes uninitialized, and the new decompressors treat them as spaces.
+ */
+static int
+reference_decompress_lzss(uint8_t *dst, const uint8_t *src, uint32_t srclen) {
+	enum { N = 4096, F = 18, THRESHOLD = 2 };
+	uint8_t text_buf[N + F - 1];
+	uint8_t *dststart = dst;
+	const uint8_t *srcend = src + srclen;
+	int i, j, k, r, c;
+	unsigned int flags;
+	memset(text_buf, ' ', N);
+	r = N - F;
+	flags = 0;
+	for (;;) {
+		if (((flags >>= 1) & 0x100) == 0) {
+			if (src < srcend) c = *src++; else break;
+			flags = c | 0xFF00;
+		}
+		if (flags & 1) {
+			if (src < srcend) c = *src++; else break;
+			*dst++ = c;
+			text_buf[r++] = c;
+			r &= (N - 1);
+		} else {
+			if (src < srcend) i = *src++; else break;
+			if (src < srcend) j = *src++; else break;
+			i |= ((j & 0xF0) << 4);
+			j  =  (j & 0x0F) + THRESHOLD;
+			for (k = 0; k <= j; k++) {
+				c = text_buf[(i + k) & (N - 1)];
+				*dst++ = c;
+				text_buf[r++] = c;
+				r &= (N - 1);
+			}
+		}
+	}
+	return dst - dststart;
+}
+
+// The largest output srclen bytes of input can produce: every 17 bytes hold 8 matches of 18.
+static size_t
+max_output_size(uint32_t srclen) {
+	return (size_t) srclen * 9 + 64;
+}
+
+/*
+ * random_input
+ *
+ * Description:
+ * 	Fill src with a random token stream. match_percent of the flag bits select matches, and
+ * 	near_percent of the matches refer to the last 64 bytes of output, where overlapping
+ * 	copies happen.
+ */
+static void
+random_input(uint8_t *src, uint32_t srclen, unsigned match_percent, unsigned near_percent) {
+	uint32_t position = 0;
+	// The ring position of the next output byte, to aim matches near it.
+	uint32_t r = 4096 - 18;
+	while (position < srclen) {
+		uint8_t flags = 0;
+		for (unsigned bit = 0; bit < 8; bit++) {
+			if ((unsigned) rand() % 100 >= match_percent) {
+				flags |= 1 << bit;
+			}
+		}
+		src[position++] = flags;
+		for (unsigned bit = 0; bit < 8 && position < srclen; bit++) {
+			if (flags & (1 << bit)) {
+				src[position++] = rand();
+				r++;
+				continue;
+			}
+			unsigned length = rand() % 16;
+			unsigned index = rand() % 4096;
+			if ((unsigned) rand() % 100 < near_percent) {
+				index = (r - 1 - rand() % 64) % 4096;
+			}
+			src[position++] = index;
+			if (position < srclen) {
+				src[position++] = ((index >> 4) & 0xf0) | length;
+			}
+			r += length + 3;
+		}
+	}
+}
+
+static double
+now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * check_input
+ *
+ * Description:
+ * 	Decompress one input every way and compare each output with the reference.
+ */
+static bool
+check_input(const uint8_t *src, uint32_t srclen, uint8_t *expected, uint8_t *actual) {
+	uint32_t length = reference_decompress_lzss(expected, src, srclen);
+	// In one piece.
+	if ((uint32_t) decompress_lzss(actual, max_output_size(srclen), src, srclen) != length
+			|| memcmp(expected, actual, length) != 0) {
+		fprintf(stderr, "decompress_lzss differs on a %u byte input\n", srclen);
+		return false;
+	}
+	// Into a short buffer, which must not be overrun.
+	uint32_t limit = (length > 0 ? rand() % length : 0);
+	memset(actual, 0xa5, limit + 64);
+	if ((uint32_t) decompress_lzss(actual, limit, src, srclen) != limit
+			|| memcmp(expected, actual, limit) != 0 || actual[limit] != 0xa5) {
+		fprintf(stderr, "decompress_lzss differs with a %u byte limit\n", limit);
+		return false;
+	}
+	// In chunks: small ones to cross many chunk boundaries within matches, and large ones.
+	struct lzss_stream stream;
+	lzss_stream_init(&stream, src, srclen);
+	uint32_t total = 0;
+	for (;;) {
+		uint32_t chunk = 1 + rand() % (rand() % 2 ? 20 : 9000);
+		uint32_t read = lzss_stream_read(&stream, actual + total, chunk);
+		total += read;
+		if (read < chunk) {
+			break;
+		}
+	}
+	if (total != length || memcmp(expected, actual, length) != 0) {
+		fprintf(stderr, "lzss_stream_read differs on a %u byte input\n", srclen);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * bench
+ *
+ * Description:
+ * 	Print the best throughput of each decompressor on one input.
+ */
+static void
+bench(const char *name, const uint8_t *src, uint32_t srclen, uint8_t *dst) {
+	double best[3] = { 1e9, 1e9, 1e9 };
+	uint32_t length = 0;
+	for (int run = 0; run < BENCH_RUNS; run++) {
+		double start = now();
+		length = reference_decompress_lzss(dst, src, srclen);
+		double reference = now();
+		decompress_lzss(dst, max_output_size(srclen), src, srclen);
+		double oneshot = now();
+		struct lzss_stream stream;
+		lzss_stream_init(&stream, src, srclen);
+		for (uint32_t total = 0; total < length;) {
+			total += lzss_stream_read(&stream, dst + total, 0x10000);
+		}
+		double streamed = now();
+		double times[3] = { reference - start, oneshot - reference, streamed - oneshot };
+		for (int i = 0; i < 3; i++) {
+			best[i] = (times[i] < best[i] ? times[i] : best[i]);
+		}
+	}
+	printf("%-24s %6.1f MB out  reference %7.1f MB/s  decompress_lzss %7.1f MB/s  "
+			"stream %7.1f MB/s\n", name, length / 1e6, length / 1e6 / best[0],
+			length / 1e6 / best[1], length / 1e6 / best[2]);
+}
+
+/*
+ * load_input
+ *
+ * Description:
+ * 	Read a whole file. Returns NULL if it cannot be read or is empty.
+ */
+static uint8_t *
+load_input(const char *path, uint32_t *size) {
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		return NULL;
+	}
+	uint8_t *data = NULL;
+	if (fseek(file, 0, SEEK_END) == 0) {
+		long length = ftell(file);
+		rewind(file);
+		*size = (length > 0 && length <= UINT32_MAX / 9 ? length : 0);
+		data = (*size > 0 ? malloc(*size) : NULL);
+		if (data != NULL && fread(data, 1, *size, file) != *size) {
+			free(data);
+			data = NULL;
+		}
+	}
+	fclose(file);
+	return data;
+}
+
+/*
+ * bench_main
+ *
+ * Description:
+ * 	Time the decompressors on the given file, or on synthetic inputs.
+ */
+static int
+bench_main(const char *path) {
+	if (path != NULL) {
+		uint32_t srclen;
+		uint8_t *src = load_input(path, &srclen);
+		uint8_t *dst = (src != NULL ? malloc(max_output_size(srclen)) : NULL);
+		if (dst == NULL) {
+			fprintf(stderr, "could not read %s\n", path);
+			free(src);
+			return 1;
+		}
+		bench(path, src, srclen, dst);
+		free(src);
+		free(dst);
+		return 0;
+	}
+	srand(1);
+	uint8_t *src = malloc(BENCH_INPUT_SIZE);
+	uint8_t *dst = malloc(max_output_size(BENCH_INPUT_SIZE));
+	if (src == NULL || dst == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	random_input(src, BENCH_INPUT_SIZE, 0, 0);
+	bench("synthetic literals", src, BENCH_INPUT_SIZE, dst);
+	random_input(src, BENCH_INPUT_SIZE, 50, 20);
+	bench("synthetic mixed", src, BENCH_INPUT_SIZE, dst);
+	random_input(src, BENCH_INPUT_SIZE, 90, 10);
+	bench("synthetic matches", src, BENCH_INPUT_SIZE, dst);
+	free(src);
+	free(dst);
+	return 0;
+}
+
+int
+main(int argc, const char *argv[]) {
+	if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+		return bench_main(argc > 2 ? argv[2] : NULL);
+	}
+	unsigned long iterations = (argc > 1 ? strtoul(argv[1], NULL, 0) : DEFAULT_ITERATIONS);
+	unsigned seed = (argc > 2 ? strtoul(argv[2], NULL, 0) : 1);
+	srand(seed);
+	uint8_t *src = malloc(CHECK_INPUT_SIZE);
+	uint8_t *expected = malloc(max_output_size(CHECK_INPUT_SIZE));
+	uint8_t *actual = malloc(max_output_size(CHECK_INPUT_SIZE));
+	if (src == NULL || expected == NULL || actual == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	unsigned long failures = 0;
+	for (unsigned long i = 0; i < iterations; i++) {
+		// Mostly short inputs, so that many of them start inside the initial window.
+		uint32_t srclen = rand() % (i % 16 == 0 ? CHECK_INPUT_SIZE : 4096);
+		random_input(src, srclen, rand() % 101, rand() % 101);
+		if (!check_input(src, srclen, expected, actual)) {
+			failures++;
+		}
+	}
+	printf("%lu random inputs, %lu mismatches (seed %u)\n", iterations, failures, seed);
+	free(src);
+	free(expected);
+	free(actual);
+	return (failures == 0 ? 0 : 1);
+}
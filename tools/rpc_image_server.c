@@ -0,0 +1,57 @@
+/*
+ * rpc_image_server
+ *
+ * Description:
+ * 	A host build of the RPC server that serves a memory image file. It lets the protocol and
+ * 	the client be tested without a device:
+ *
+ * 		rpc_image_server <socket> <image> <base>
+ *
+ * 	test_seokview_rpc.py builds and runs it.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memCtlServer.h"
+#include "log.h"
+#include "../memctl/memctl_signal.h"
+
+volatile sig_atomic_t interrupted;
+
+static void
+interrupt(int signal) {
+	interrupted = 1;
+}
+
+int
+main(int argc, const char *argv[]) {
+	if (argc != 4) {
+		fprintf(stderr, "usage: %s <socket> <image> <base>\n", argv[0]);
+		return 2;
+	}
+	char *end;
+	uint64_t base = strtoull(argv[3], &end, 16);
+	if (argv[3][0] == 0 || *end != 0) {
+		fprintf(stderr, "invalid base address %s\n", argv[3]);
+		return 2;
+	}
+	// Without SA_RESTART, a signal makes accept() fail with EINTR so the server can stop.
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = interrupt;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	struct server_backend backend;
+	if (!server_image_backend_init(&backend, argv[2], base)) {
+		log_flush();
+		return 1;
+	}
+	bool success = server_run(argv[1], &backend);
+	server_image_backend_deinit(&backend);
+	log_flush();
+	return (success ? 0 : 1);
+}
@@ -0,0 +1,211 @@
+#!/usr/bin/env python3
+"""Client for the seokView RPC server.
+
+Start the server on the device with `serve /tmp/seokview.sock`, forward the socket to the host
+with `ssh -L /tmp/seokview.sock:/tmp/seokview.sock`, then use the Client class from host scripts
+or run this file:
+
+    seokview_rpc.py /tmp/seokview.sock read 0xfffffff007004000 0x4000 > header.bin
+    seokview_rpc.py /tmp/seokview.sock symbol _kernproc
+
+The protocol is described in memctl_overwrite/memctl_modify/memCtlServer.h. Requests are
+pipelined: read() and readv() send every request before waiting for the responses.
+"""
+
+import argparse
+import socket
+import struct
+import sys
+
+OP_READ = 1
+OP_READV = 2
+OP_WRITE = 3
+OP_FIND = 4
+OP_ZONE = 5
+OP_SYMBOL = 6
+
+STATUS_NAMES = {
+    0: "ok",
+    1: "bad request",
+    2: "unsupported",
+    3: "failed",
+    4: "not found",
+}
+
+HEADER = struct.Struct("<IIBBH")
+
+# The largest payload the server accepts or sends.
+MAX_PAYLOAD = 16 * 1024 * 1024
+
+
+class RPCError(Exception):
+    """A request that the server answered with an error status."""
+
+    def __init__(self, op, status):
+        super().__init__("op %d: %s" % (op, STATUS_NAMES.get(status, "status %d" % status)))
+        self.op = op
+        self.status = status
+
+
+class Client:
+    """A connection to the server.
+
+    endpoint is the path of the server's UNIX socket.
+    """
+
+    def __init__(self, endpoint):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.connect(endpoint)
+        self.file = self.sock.makefile("rb")
+        self.next_id = 1
+
+    def close(self):
+        self.file.close()
+        self.sock.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def _frame(self, op, payload):
+        request_id = self.next_id
+        self.next_id = (self.next_id + 1) & 0xFFFFFFFF
+        return request_id, HEADER.pack(len(payload), request_id, op, 0, 0) + payload
+
+    def _receive(self):
+        header = self.file.read(HEADER.size)
+        if len(header) != HEADER.size:
+            raise EOFError("connection closed")
+        length, request_id, op, status, _ = HEADER.unpack(header)
+        payload = self.file.read(length)
+        if len(payload) != length:
+            raise EOFError("connection closed")
+        return request_id, op, status, payload
+
+    def pipeline(self, requests):
+        """Send (op, payload) requests together and return their responses in order.
+
+        Each response is the payload, or an RPCError if the request failed.
+        """
+        ids = []
+        frames = []
+        for op, payload in requests:
+            request_id, frame = self._frame(op, payload)
+            ids.append(request_id)
+            frames.append(frame)
+        self.sock.sendall(b"".join(frames))
+        results = []
+        for request_id in ids:
+            response_id, op, status, payload = self._receive()
+            if response_id != request_id:
+                raise EOFError("response %d out of order" % response_id)
+            results.append(payload if status == 0 else RPCError(op, status))
+        return results
+
+    def call(self, op, payload):
+        result = self.pipeline([(op, payload)])[0]
+        if isinstance(result, RPCError):
+            raise result
+        return result
+
+    def read(self, address, size):
+        """Read memory. Reads larger than one frame are split and pipelined."""
+        requests = []
+        for offset in range(0, size, MAX_PAYLOAD):
+            chunk = min(size - offset, MAX_PAYLOAD)
+            requests.append((OP_READ, struct.pack("<QI", address + offset, chunk)))
+        data = []
+        for result in self.pipeline(requests):
+            if isinstance(result, RPCError):
+                raise result
+            data.append(result)
+        return b"".join(data)
+
+    def readv(self, ranges):
+        """Read (address, size) ranges in one request.
+
+        Returns a list with the data of each range, or None for ranges that could not be read.
+        """
+        payload = struct.pack("<I", len(ranges))
+        payload += b"".join(struct.pack("<QI", address, size) for address, size in ranges)
+        response = self.call(OP_READV, payload)
+        results = []
+        offset = 0
+        for _ in ranges:
+            status, size = struct.unpack_from("<II", response, offset)
+            offset += 8
+            results.append(response[offset:offset + size] if status == 0 else None)
+            offset += size
+        return results
+
+    def write(self, address, data):
+        self.call(OP_WRITE, struct.pack("<Q", address) + bytes(data))
+
+    def find(self, start, end, value, width=8, limit=0):
+        """Return the width-aligned addresses in [start, end) holding value."""
+        payload = struct.pack("<QQQII", start, end, value, width, limit)
+        response = self.call(OP_FIND, payload)
+        return list(struct.unpack("<%dQ" % (len(response) // 8), response))
+
+    def zone(self, address):
+        response = self.call(OP_ZONE, struct.pack("<Q", address))
+        zone, metadata, element_size = struct.unpack_from("<QQQ", response)
+        return {
+            "zone": zone,
+            "metadata": metadata,
+            "element_size": element_size,
+            "name": response[24:].decode("ascii", "replace"),
+        }
+
+    def symbol(self, name):
+        return struct.unpack("<Q", self.call(OP_SYMBOL, name.encode()))[0]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("endpoint", help="the path of the server socket")
+    commands = parser.add_subparsers(dest="command", required=True)
+    read = commands.add_parser("read", help="write raw memory to stdout")
+    read.add_argument("address", type=lambda s: int(s, 16))
+    read.add_argument("size", type=lambda s: int(s, 0))
+    write = commands.add_parser("write", help="write hex data to memory")
+    write.add_argument("address", type=lambda s: int(s, 16))
+    write.add_argument("data", type=bytes.fromhex)
+    find = commands.add_parser("find", help="search memory for a value")
+    find.add_argument("start", type=lambda s: int(s, 16))
+    find.add_argument("end", type=lambda s: int(s, 16))
+    find.add_argument("value", type=lambda s: int(s, 0))
+    find.add_argument("-w", "--width", type=int, default=8)
+    find.add_argument("-n", "--limit", type=int, default=0)
+    zone = commands.add_parser("zone", help="print the zone of an address")
+    zone.add_argument("address", type=lambda s: int(s, 16))
+    symbol = commands.add_parser("symbol", help="resolve a kernel symbol")
+    symbol.add_argument("name")
+    args = parser.parse_args()
+
+    try:
+        with Client(args.endpoint) as client:
+            if args.command == "read":
+                sys.stdout.buffer.write(client.read(args.address, args.size))
+            elif args.command == "write":
+                client.write(args.address, args.data)
+            elif args.command == "find":
+                for address in client.find(args.start, args.end, args.value, args.width,
+                                           args.limit):
+                    print("0x%016x" % address)
+            elif args.command == "zone":
+                info = client.zone(args.address)
+                print("%s: zone 0x%016x, metadata 0x%016x, element size 0x%x"
+                      % (info["name"], info["zone"], info["metadata"], info["element_size"]))
+            elif args.command == "symbol":
+                print("0x%016x" % client.symbol(args.name))
+    except (RPCError, OSError, EOFError) as error:
+        print("error: %s" % error, file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+"""Loopback test of the RPC server and seokview_rpc.py.
+
+The server is built for the host with rpc_image_server.c and serves a random memory image over
+a UNIX socket, so the test runs on Linux or macOS without a device:
+
+    tools/test_seokview_rpc.py
+
+Set CC to choose the compiler.
+"""
+
+import os
+import random
+import shlex
+import socket
+import stat
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+import unittest
+
+TOOLS = os.path.dirname(os.path.abspath(__file__))
+ROOT = os.path.dirname(TOOLS)
+sys.path.insert(0, TOOLS)
+
+from seokview_rpc import Client, RPCError, MAX_PAYLOAD, OP_READ  # noqa: E402
+
+BASE = 0xFFFFFFF007000000
+IMAGE_SIZE = 0x40000
+
+# The value planted in the image for the find tests, and where.
+NEEDLE = 0xDEADBEEFCAFEF00D
+NEEDLE_OFFSETS = [0x10008, 0x10010, 0x23ff8, 0x3fff8]
+
+SOURCES = [
+    os.path.join(TOOLS, "rpc_image_server.c"),
+    os.path.join(ROOT, "memctl_overwrite", "memctl_modify", "memCtlServer.c"),
+    os.path.join(ROOT, "system", "log.c"),
+]
+
+
+def build_server(directory):
+    server = os.path.join(directory, "rpc_image_server")
+    command = shlex.split(os.environ.get("CC", "cc")) + [
+        "-std=gnu11", "-O1", "-Wall", "-Werror",
+        "-D__printflike(a,b)=__attribute__((format(printf, a, b)))",
+        "-I" + os.path.join(ROOT, "memctl_overwrite", "memctl_modify"),
+        "-I" + os.path.join(ROOT, "system"),
+        "-o", server,
+    ] + SOURCES + ["-lpthread"]
+    subprocess.run(command, check=True)
+    return server
+
+
+class LoopbackTest(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.directory = tempfile.mkdtemp(prefix="seokview_rpc_")
+        server = build_server(cls.directory)
+        generator = random.Random(1)
+        image = bytearray(generator.getrandbits(8) for _ in range(IMAGE_SIZE))
+        for offset in NEEDLE_OFFSETS:
+            image[offset:offset + 8] = struct.pack("<Q", NEEDLE)
+        cls.image = bytes(image)
+        cls.image_path = os.path.join(cls.directory, "image.bin")
+        with open(cls.image_path, "wb") as f:
+            f.write(cls.image)
+        cls.socket_path = os.path.join(cls.directory, "server.sock")
+        cls.server = subprocess.Popen([server, cls.socket_path, cls.image_path,
+                                       "%x" % BASE])
+        for _ in range(100):
+            if os.path.exists(cls.socket_path):
+                break
+            time.sleep(0.05)
+        else:
+            cls.server.kill()
+            raise RuntimeError("the server did not start")
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.server.terminate()
+        # A blocked accept() only notices the signal once it returns.
+        try:
+            with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as s:
+                s.connect(cls.socket_path)
+        except OSError:
+            pass
+        cls.server.wait(timeout=10)
+        for name in os.listdir(cls.directory):
+            os.unlink(os.path.join(cls.directory, name))
+        os.rmdir(cls.directory)
+
+    def setUp(self):
+        self.client = Client(self.socket_path)
+
+    def tearDown(self):
+        self.client.close()
+
+    def test_socket_mode(self):
+        mode = os.lstat(self.socket_path).st_mode
+        self.assertTrue(stat.S_ISSOCK(mode))
+        self.assertEqual(stat.S_IMODE(mode), 0o600)
+
+    def test_read(self):
+        self.assertEqual(self.client.read(BASE + 5, 100), self.image[5:105])
+        self.assertEqual(self.client.read(BASE, IMAGE_SIZE), self.image)
+
+    def test_read_outside_image(self):
+        for address, size in [(BASE - 8, 8), (BASE + IMAGE_SIZE - 4, 8),
+                              (BASE + IMAGE_SIZE, 1)]:
+            with self.assertRaises(RPCError) as context:
+                self.client.read(address, size)
+            self.assertEqual(context.exception.status, 3)
+
+    def test_readv(self):
+        ranges = [(BASE, 16), (BASE - 8, 8), (BASE + 0x100, 4)]
+        self.assertEqual(self.client.readv(ranges),
+                         [self.image[:16], None, self.image[0x100:0x104]])
+
+    def test_write(self):
+        address = BASE + 0x20000
+        self.client.write(address, b"AB")
+        self.assertEqual(self.client.read(address, 2), b"AB")
+        self.client.write(address, self.image[0x20000:0x20002])
+        self.assertEqual(self.client.read(address, 2), self.image[0x20000:0x20002])
+
+    def test_find(self):
+        hits = self.client.find(BASE, BASE + IMAGE_SIZE, NEEDLE)
+        self.assertEqual(hits, [BASE + offset for offset in NEEDLE_OFFSETS])
+        self.assertEqual(self.client.find(BASE, BASE + IMAGE_SIZE, NEEDLE, limit=2),
+                         [BASE + offset for offset in NEEDLE_OFFSETS[:2]])
+
+    def test_unsupported(self):
+        for call in (lambda: self.client.zone(BASE), lambda: self.client.symbol("_kernproc")):
+            with self.assertRaises(RPCError) as context:
+                call()
+            self.assertEqual(context.exception.status, 2)
+
+    def test_pipeline(self):
+        requests = [(OP_READ, struct.pack("<QI", BASE + i, 8)) for i in range(5000)]
+        results = self.client.pipeline(requests)
+        self.assertEqual(results, [self.image[i:i + 8] for i in range(5000)])
+
+    def test_bad_requests(self):
+        results = self.client.pipeline([
+            (OP_READ, b"xx"),
+            (99, b""),
+            (OP_READ, struct.pack("<QI", BASE, MAX_PAYLOAD + 1)),
+            (OP_READ, struct.pack("<QI", BASE, 1)),
+        ])
+        self.assertEqual([r.status for r in results[:3]], [1, 2, 1])
+        self.assertEqual(results[3], self.image[:1])
+
+
+if __name__ == "__main__":
+    unittest.main()